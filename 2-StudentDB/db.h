@@ -29,6 +29,54 @@ static const int STUDENT_RECORD_SIZE  = sizeof(struct student);
 static const int DELETED_STUDENT_ID = 0;
 
 
+//The first slot of the database file belongs to id 0 which is never a valid
+//student id, so it is used to hold a superblock describing the file instead
+//of a student.  It is engineered to be exactly one record (64 bytes) long so
+//the layout of the student slots does not change.  Notes:
+//  1. magic identifies the file as a student database, a file whose first
+//     slot is all zeros was created before superblocks existed and is
+//     upgraded the first time it is opened
+//  2. version is the format version, files newer than SDB_VERSION are
+//     refused rather than risk damaging them
+//  3. state is SDB_STATE_DIRTY while a mutation is in progress, a dirty
+//     superblock on open means a writer died part way through and the
+//     counters below are rebuilt by scanning the file
+//  4. record_count and max_id are the number of live students and the
+//     highest id in use (0 when the database is empty)
+//  5. generation is bumped by every mutation and uuid is picked at random
+//     when the superblock is created.  Together they tie sidecar files
+//     (like the occupancy bitmap) to one exact version of this file
+//  6. layout says where students live.  SDB_LAYOUT_SPARSE is the original
+//     layout, student id N in slot N.  SDB_LAYOUT_DENSE is written by
+//     compress_db(): nslots students sorted by id in slots 1..nslots with
+//     no gaps, followed by a sorted array of their ids (one unsigned int
+//     each) that maps an id to its slot.  Version 2 added the layout
+//  7. SDB_LAYOUT_HASH files are created with sdbsc --hash and take any id up
+//     to INT_MAX.  Students live in nslots fixed size buckets found through
+//     an extendible hash directory of 2^hash_depth entries, see sdb_hash.c
+typedef struct superblock{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int state;
+    int record_count;
+    int max_id;
+    unsigned int generation;
+    unsigned long long uuid;
+    int layout;
+    int nslots;
+    int hash_depth;
+    char reserved[20];
+} superblock_t;
+
+#define SDB_MAGIC       0x42445353      //"SSDB" in a little endian file
+#define SDB_VERSION     2
+#define SDB_LAYOUT_SPARSE 0
+#define SDB_LAYOUT_DENSE  1
+#define SDB_LAYOUT_HASH   2
+#define SDB_STATE_CLEAN 0
+#define SDB_STATE_DIRTY 1
+#define SDB_HEADER_SIZE STUDENT_RECORD_SIZE  //bytes before the first student
+
 #define DB_FILE     "student.db"            //name of database file
 #define TMP_DB_FILE ".tmp_student.db"       //for extra credit
 
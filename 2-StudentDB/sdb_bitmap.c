@@ -0,0 +1,361 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+#define BM_BYTES (SDB_BITMAP_WORDS * sizeof(unsigned long long))
+
+/*
+ *  bm_attach
+ *      h:  handle of a database file opened with a path
+ *
+ *  Opens (creating if needed) the bitmap sidecar of the database and
+ *  allocates the in memory copy of the bitmap, all clear.  Does nothing if
+ *  that already happened.
+ *
+ *  returns:  NO_ERROR     h->bm_fd and h->bm are ready
+ *            ERR_DB_FILE  the sidecar could not be opened or out of memory
+ */
+static int bm_attach(sdb_handle_t *h) {
+  char bm_path[PATH_MAX];
+  mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+
+  if (h->bm != NULL)
+    return NO_ERROR;
+
+  if (snprintf(bm_path, sizeof(bm_path), "%s%s", h->path,
+               SDB_BITMAP_SUFFIX) >= (int)sizeof(bm_path))
+    return ERR_DB_FILE;
+
+  h->bm_fd = open(bm_path, O_RDWR | O_CREAT, mode);
+  if (h->bm_fd == -1)
+    return ERR_DB_FILE;
+
+  h->bm = calloc(SDB_BITMAP_WORDS, sizeof(unsigned long long));
+  if (h->bm == NULL) {
+    close(h->bm_fd);
+    h->bm_fd = -1;
+    return ERR_DB_FILE;
+  }
+
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_bm_open
+ *      fd:   file descriptor of a database file opened with a path
+ *      *sb:  the (clean) superblock of the database
+ *
+ *  Loads the occupancy bitmap sidecar into memory.  The bitmap is only
+ *  accepted if it was written for this exact version of the database: the
+ *  uuid and generation in its header must match the superblock and the
+ *  number of bits set must match the record count.  Databases attached
+ *  without a path do not use a bitmap, nor do hashed ones since their ids
+ *  go past MAX_STD_ID.
+ *
+ *  returns:  NO_ERROR        the bitmap is loaded, or not used for this fd
+ *            SRCH_NOT_FOUND  the sidecar is missing or stale, the bitmap
+ *                            has to be rebuilt, see sdb_sb_rebuild()
+ *            ERR_DB_FILE     database file I/O issue
+ */
+int sdb_bm_open(int fd, const superblock_t *sb) {
+  sdb_handle_t *h = sdb_handle(fd);
+  sdb_sidecar_t hdr;
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  if (h->path == NULL || h->layout == SDB_LAYOUT_HASH)
+    return NO_ERROR;
+
+  if (bm_attach(h) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  if (pread(h->bm_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+      hdr.magic != SDB_BITMAP_MAGIC || hdr.uuid != sb->uuid ||
+      hdr.generation != sb->generation ||
+      pread(h->bm_fd, h->bm, BM_BYTES, sizeof(hdr)) != BM_BYTES ||
+      sdb_bm_count(fd) != sb->record_count) {
+    memset(h->bm, 0, BM_BYTES);
+    return SRCH_NOT_FOUND;
+  }
+
+  h->bm_gen = sb->generation;
+  h->bm_uuid = sb->uuid;
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_bm_reset
+ *      fd:  file descriptor of an open database file
+ *
+ *  Clears the in memory bitmap ahead of a rebuild, opening the sidecar
+ *  first if it is not open yet.  The caller sets the bits of every live
+ *  student with sdb_bm_update() and writes the result with sdb_bm_save().
+ *
+ *  returns:  NO_ERROR     the bitmap is clear, or not used for this fd
+ *            ERR_DB_FILE  the sidecar could not be opened
+ */
+int sdb_bm_reset(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  if (h->path == NULL || h->layout == SDB_LAYOUT_HASH)
+    return NO_ERROR;
+
+  if (bm_attach(h) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  // a half built bitmap must never look fresh, see sdb_bm_fresh()
+  memset(h->bm, 0, BM_BYTES);
+  h->bm_uuid = 0;
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_bm_save
+ *      fd:   file descriptor of an open database file
+ *      *sb:  superblock the bitmap now matches
+ *
+ *  Writes the whole in memory bitmap to the sidecar, stamped with the
+ *  uuid and generation of *sb.
+ *
+ *  returns:  NO_ERROR     the sidecar was written, or there is no bitmap
+ *            ERR_DB_FILE  the sidecar could not be written
+ */
+int sdb_bm_save(int fd, const superblock_t *sb) {
+  sdb_handle_t *h = sdb_handle(fd);
+  sdb_sidecar_t hdr = {0};
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  if (h->bm == NULL)
+    return NO_ERROR;
+
+  hdr.magic = SDB_BITMAP_MAGIC;
+  hdr.version = SDB_VERSION;
+  hdr.generation = sb->generation;
+  hdr.uuid = sb->uuid;
+
+  if (pwrite(h->bm_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+      pwrite(h->bm_fd, h->bm, BM_BYTES, sizeof(hdr)) != BM_BYTES ||
+      ftruncate(h->bm_fd, sizeof(hdr) + BM_BYTES) == -1)
+    return ERR_DB_FILE;
+
+  h->bm_gen = sb->generation;
+  h->bm_uuid = sb->uuid;
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_bm_update
+ *      fd:    file descriptor of an open database file
+ *      id:    student id whose bit changes
+ *      live:  true if id now holds a student, false if it was deleted
+ *      *sb:   superblock of the mutation in progress (see sdb_sb_begin()),
+ *             or NULL to only change the in memory copy while rebuilding
+ *
+ *  Flips one bit and writes just the 8 byte word holding it plus the
+ *  sidecar header with the new generation.
+ *
+ *  returns:  NO_ERROR     the bit was updated, or there is no bitmap
+ *            ERR_DB_FILE  the sidecar could not be written
+ */
+int sdb_bm_update(int fd, int id, bool live, const superblock_t *sb) {
+  sdb_handle_t *h = sdb_handle(fd);
+  sdb_sidecar_t hdr = {0};
+  int word = id / 64;
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  if (h->bm == NULL || id < MIN_STD_ID || id > MAX_STD_ID)
+    return NO_ERROR;
+
+  if (live)
+    h->bm[word] |= 1ULL << (id % 64);
+  else
+    h->bm[word] &= ~(1ULL << (id % 64));
+
+  if (sb == NULL)
+    return NO_ERROR;
+
+  hdr.magic = SDB_BITMAP_MAGIC;
+  hdr.version = SDB_VERSION;
+  hdr.generation = sb->generation;
+  hdr.uuid = sb->uuid;
+
+  if (pwrite(h->bm_fd, &h->bm[word], sizeof(h->bm[word]),
+             sizeof(hdr) + word * sizeof(h->bm[word])) !=
+          sizeof(h->bm[word]) ||
+      pwrite(h->bm_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+    return ERR_DB_FILE;
+
+  h->bm_gen = sb->generation;
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_bm_fresh
+ *      fd:  file descriptor of an open database file
+ *
+ *  Checks that the in memory bitmap still describes the database.  Another
+ *  sdbsc process may have changed the file since we loaded it, in which
+ *  case the superblock generation moved on and the bitmap is reloaded.
+ *
+ *  returns:  true   h->bm can be trusted
+ *            false  there is no usable bitmap, fall back to the records
+ */
+bool sdb_bm_fresh(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+  superblock_t sb;
+
+  if (h == NULL || h->bm == NULL || sdb_sb_read(fd, &sb) != NO_ERROR ||
+      sb.uuid == 0)
+    return false;
+
+  if (sb.generation == h->bm_gen && sb.uuid == h->bm_uuid)
+    return true;
+
+  // a dirty superblock means a mutation (or a rebuild) is in progress, the
+  // sidecar on disk may be half updated so it is never reloaded then
+  if (sb.state != SDB_STATE_CLEAN)
+    return false;
+
+  return sdb_bm_open(fd, &sb) == NO_ERROR;
+}
+
+/*
+ *  sdb_bm_test
+ *      fd:  file descriptor of an open database file
+ *      id:  student id to check
+ *
+ *  Answers "is there a student with this id" without touching the record.
+ *
+ *  returns:  1   id holds a student
+ *            0   id is empty
+ *            -1  there is no usable bitmap, read the record instead
+ */
+int sdb_bm_test(int fd, int id) {
+  if (!sdb_bm_fresh(fd))
+    return -1;
+
+  if (id < MIN_STD_ID || id > MAX_STD_ID)
+    return 0;
+
+  return (sdb_handle(fd)->bm[id / 64] >> (id % 64)) & 1;
+}
+
+/*
+ *  sdb_bm_next
+ *      fd:  file descriptor of an open database file, sdb_bm_fresh() must
+ *           have returned true for it
+ *      id:  where to start looking
+ *
+ *  Finds the first live student id at or after id, skipping 64 empty ids
+ *  at a time.
+ *
+ *  returns:  <id>  the next live id
+ *            0     there are no students at or after id
+ */
+int sdb_bm_next(int fd, int id) {
+  const unsigned long long *bm = sdb_handle(fd)->bm;
+  int word;
+  unsigned long long bits;
+
+  if (id < MIN_STD_ID)
+    id = MIN_STD_ID;
+  if (id > MAX_STD_ID)
+    return 0;
+
+  word = id / 64;
+  bits = bm[word] & (~0ULL << (id % 64));
+  for (;;) {
+    if (bits != 0)
+      return word * 64 + __builtin_ctzll(bits);
+    if (++word == SDB_BITMAP_WORDS)
+      return 0;
+    bits = bm[word];
+  }
+}
+
+/*
+ *  sdb_bm_prev
+ *      fd:  file descriptor of an open database file, sdb_bm_fresh() must
+ *           have returned true for it
+ *      id:  search for live students below this id
+ *
+ *  returns:  <id>  the highest live id below id
+ *            0     there are no students below id
+ */
+int sdb_bm_prev(int fd, int id) {
+  const unsigned long long *bm = sdb_handle(fd)->bm;
+  int word;
+  unsigned long long bits;
+
+  if (id <= MIN_STD_ID)
+    return 0;
+  if (id > MAX_STD_ID + 1)
+    id = MAX_STD_ID + 1;
+
+  id--;
+  word = id / 64;
+  bits = bm[word] & (~0ULL >> (63 - id % 64));
+  for (;;) {
+    if (bits != 0)
+      return word * 64 + 63 - __builtin_clzll(bits);
+    if (word-- == 0)
+      return 0;
+    bits = bm[word];
+  }
+}
+
+/*
+ *  sdb_bm_count
+ *      fd:  file descriptor of an open database file
+ *
+ *  returns:  number of bits set in the in memory bitmap, 0 if there is none
+ */
+int sdb_bm_count(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+  int count = 0;
+
+  if (h == NULL || h->bm == NULL)
+    return 0;
+
+  for (int i = 0; i < SDB_BITMAP_WORDS; i++)
+    count += __builtin_popcountll(h->bm[i]);
+
+  return count;
+}
+
+/*
+ *  sdb_bm_close
+ *      fd:  file descriptor of an open database file
+ *
+ *  Frees the in memory bitmap and closes the sidecar.  Every change was
+ *  already written by sdb_bm_update() so there is nothing to flush.
+ */
+void sdb_bm_close(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || h->bm == NULL)
+    return;
+
+  free(h->bm);
+  h->bm = NULL;
+  close(h->bm_fd);
+  h->bm_fd = -1;
+}
@@ -0,0 +1,1024 @@
+#define _GNU_SOURCE // getline
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+// a parsed student plus the input line it came from, so duplicate ids in
+// the input can be reported and the first one kept
+typedef struct bulk_rec {
+  student_t s;
+  int line;
+} bulk_rec_t;
+
+// an input being read a student at a time, see next_rec()
+//  in:       the stream
+//  format:   SDB_FORMAT_CSV, SDB_FORMAT_JSONL or SDB_FORMAT_RAW
+//  line:     getline() buffer of cap bytes
+//  started:  the header of a raw input was read
+//  line_no:  lines (or raw slots) read so far
+//  lines:    student lines read, the invalid ones included
+//  invalid:  student lines that were skipped
+typedef struct bulk_src {
+  FILE *in;
+  int format;
+  char *line;
+  size_t cap;
+  bool started;
+  int line_no;
+  int lines;
+  int invalid;
+} bulk_src_t;
+
+/*
+ *  parse_int
+ *      field:  text of one CSV field, surrounding blanks are allowed
+ *      *val:   where the number is stored
+ *
+ *  returns:  true if the field is a whole decimal number, false otherwise
+ */
+static bool parse_int(const char *field, int *val) {
+  char *end;
+  long v;
+
+  errno = 0;
+  v = strtol(field, &end, 10);
+  if (end == field || errno != 0 || v < -2147483647L || v > 2147483647L)
+    return false;
+
+  while (isspace((unsigned char)*end))
+    end++;
+
+  *val = (int)v;
+  return *end == '\0';
+}
+
+/*
+ *  trim
+ *      field:  text of one CSV field, modified in place
+ *
+ *  returns:  field without leading or trailing blanks
+ */
+static char *trim(char *field) {
+  char *end;
+
+  while (isspace((unsigned char)*field))
+    field++;
+
+  end = field + strlen(field);
+  while (end > field && isspace((unsigned char)end[-1]))
+    *--end = '\0';
+
+  return field;
+}
+
+/*
+ *  split_line
+ *      line:    one line of input, modified in place
+ *      fields:  receives up to max comma separated fields
+ *      max:     number of entries in fields
+ *
+ *  A field may be in double quotes, with "" standing for a quote inside
+ *  it, so it can hold commas.  The quotes are taken off in place.
+ *
+ *  returns:  the number of fields on the line, 0 if there are more than max
+ *            or a quoted field is not closed
+ */
+static int split_line(char *line, char *fields[], int max) {
+  int n = 0;
+  char *p = line;
+
+  for (;;) {
+    char *comma;
+
+    if (n == max)
+      return 0;
+
+    while (*p == ' ' || *p == '\t')
+      p++;
+    fields[n++] = p;
+
+    if (*p == '"') {
+      char *w = p;
+
+      // the field is copied over its opening quote
+      for (p++;; p++) {
+        if (*p == '\0')
+          return 0;
+        if (*p == '"' && *++p != '"')
+          break;
+        *w++ = *p;
+      }
+      *w = '\0';
+
+      while (*p == ' ' || *p == '\t')
+        p++;
+      if (*p == '\0')
+        break;
+      if (*p++ != ',')
+        return 0;
+      continue;
+    }
+
+    comma = strchr(p, ',');
+    if (comma == NULL)
+      break;
+    *comma = '\0';
+    p = comma + 1;
+  }
+
+  return n;
+}
+
+/*
+ *  parse_csv
+ *      text:  one line of input, modified in place
+ *      *s:    receives the student, zeroed by the caller
+ *
+ *  returns:  1   the line is an id,first_name,last_name,gpa student
+ *            0   the line does not parse
+ *            -1  the line does not parse and its first field is not a
+ *                number, a column header if it is the first line
+ */
+static int parse_csv(char *text, student_t *s) {
+  char *fields[4];
+  int id, gpa;
+
+  if (split_line(text, fields, 4) != 4 || !parse_int(fields[0], &id) ||
+      !parse_int(fields[3], &gpa))
+    return parse_int(fields[0], &id) ? 0 : -1;
+
+  s->id = id;
+  strncpy(s->fname, trim(fields[1]), sizeof(s->fname) - 1);
+  strncpy(s->lname, trim(fields[2]), sizeof(s->lname) - 1);
+  s->gpa = gpa;
+  return 1;
+}
+
+/*
+ *  skip_blanks
+ *      p:  somewhere in a JSON line
+ *
+ *  returns:  p moved past any white space
+ */
+static const char *skip_blanks(const char *p) {
+  while (isspace((unsigned char)*p))
+    p++;
+
+  return p;
+}
+
+/*
+ *  json_string
+ *      *p:    points at the opening quote of a JSON string, moved past the
+ *             closing one
+ *      out:   receives the string, cut at size - 1 bytes and NUL terminated
+ *      size:  size of out
+ *
+ *  Escapes are decoded and \u escapes stored as UTF-8.
+ *
+ *  returns:  true if a well formed string was read
+ */
+static bool json_string(const char **p, char *out, size_t size) {
+  const char *s = *p;
+  size_t len = 0;
+
+  if (*s++ != '"')
+    return false;
+
+  while (*s != '"') {
+    unsigned char bytes[3];
+    unsigned int cp;
+    char hex[5] = {0};
+    int n = 1;
+
+    if (*s == '\0')
+      return false;
+
+    bytes[0] = (unsigned char)*s++;
+    if (bytes[0] == '\\') {
+      switch (*s++) {
+      case '"':
+      case '\\':
+      case '/':
+        bytes[0] = (unsigned char)s[-1];
+        break;
+      case 'b':
+        bytes[0] = '\b';
+        break;
+      case 'f':
+        bytes[0] = '\f';
+        break;
+      case 'n':
+        bytes[0] = '\n';
+        break;
+      case 'r':
+        bytes[0] = '\r';
+        break;
+      case 't':
+        bytes[0] = '\t';
+        break;
+      case 'u':
+        for (int i = 0; i < 4; i++) {
+          if (!isxdigit((unsigned char)s[i]))
+            return false;
+          hex[i] = s[i];
+        }
+        s += 4;
+        cp = (unsigned int)strtoul(hex, NULL, 16);
+        if (cp < 0x80) {
+          bytes[0] = (unsigned char)cp;
+        } else if (cp < 0x800) {
+          bytes[0] = (unsigned char)(0xc0 | cp >> 6);
+          bytes[1] = (unsigned char)(0x80 | (cp & 0x3f));
+          n = 2;
+        } else {
+          bytes[0] = (unsigned char)(0xe0 | cp >> 12);
+          bytes[1] = (unsigned char)(0x80 | (cp >> 6 & 0x3f));
+          bytes[2] = (unsigned char)(0x80 | (cp & 0x3f));
+          n = 3;
+        }
+        break;
+      default:
+        return false;
+      }
+    }
+
+    for (int i = 0; i < n && len < size - 1; i++)
+      out[len++] = (char)bytes[i];
+  }
+
+  out[len] = '\0';
+  *p = s + 1;
+  return true;
+}
+
+/*
+ *  json_int
+ *      *p:    points at a JSON number, moved past it
+ *      *val:  receives the number
+ *
+ *  returns:  true if the number is a whole number that fits in an int
+ */
+static bool json_int(const char **p, int *val) {
+  char *end;
+  long v;
+
+  errno = 0;
+  v = strtol(*p, &end, 10);
+  if (end == *p || errno != 0 || v < -2147483647L || v > 2147483647L)
+    return false;
+
+  *p = end;
+  *val = (int)v;
+  return true;
+}
+
+/*
+ *  parse_jsonl
+ *      text:  one line of input
+ *      *s:    receives the student, zeroed by the caller
+ *
+ *  Reads the {"id":..,"fname":..,"lname":..,"gpa":..} objects that
+ *  sdb_fmt_jsonl() writes, with the keys in any order and blanks wherever
+ *  JSON allows them.  Every key has to be there and no other key may be.
+ *
+ *  returns:  1  the line is a student
+ *            0  the line does not parse
+ */
+static int parse_jsonl(const char *text, student_t *s) {
+  const char *p = skip_blanks(text);
+  unsigned int seen = 0;
+
+  if (*p++ != '{')
+    return 0;
+
+  for (;;) {
+    char key[8];
+
+    p = skip_blanks(p);
+    if (!json_string(&p, key, sizeof(key)))
+      return 0;
+    p = skip_blanks(p);
+    if (*p++ != ':')
+      return 0;
+    p = skip_blanks(p);
+
+    if (strcmp(key, "id") == 0 && json_int(&p, &s->id))
+      seen |= 1;
+    else if (strcmp(key, "fname") == 0 &&
+             json_string(&p, s->fname, sizeof(s->fname)))
+      seen |= 2;
+    else if (strcmp(key, "lname") == 0 &&
+             json_string(&p, s->lname, sizeof(s->lname)))
+      seen |= 4;
+    else if (strcmp(key, "gpa") == 0 && json_int(&p, &s->gpa))
+      seen |= 8;
+    else
+      return 0;
+
+    p = skip_blanks(p);
+    if (*p == '}')
+      break;
+    if (*p++ != ',')
+      return 0;
+  }
+
+  return seen == 15 && *skip_blanks(p + 1) == '\0';
+}
+
+/*
+ *  next_raw
+ *      src:  a SDB_FORMAT_RAW input
+ *      *s:   receives the next slot
+ *
+ *  The first call checks the sdb_raw_hdr_t of the input.
+ *
+ *  returns:  1            *s is the next slot of the input
+ *            0            end of input
+ *            ERR_DB_FILE  the input could not be read or ends part way
+ *                         through a slot
+ *            ERR_DB_OP    the input is not a raw export
+ */
+static int next_raw(bulk_src_t *src, student_t *s) {
+  size_t n;
+
+  if (!src->started) {
+    sdb_raw_hdr_t hdr;
+
+    src->started = true;
+    if (fread(&hdr, sizeof(hdr), 1, src->in) != 1)
+      return ferror(src->in) ? ERR_DB_FILE : ERR_DB_OP;
+    if (hdr.magic != SDB_RAW_MAGIC || hdr.version != SDB_RAW_VERSION ||
+        hdr.rec_size != sizeof(student_t))
+      return ERR_DB_OP;
+  }
+
+  n = fread(s, 1, sizeof(*s), src->in);
+  if (n == 0 && !ferror(src->in))
+    return 0;
+  if (n != sizeof(*s))
+    return ERR_DB_FILE;
+
+  src->line_no++;
+  return 1;
+}
+
+/*
+ *  next_rec
+ *      fd:    the database the students are for
+ *      src:   the input
+ *      *rec:  receives the next valid student and its line
+ *
+ *  Reads lines (or raw slots) until one holds a valid student.  Blank
+ *  lines and lines starting with # are ignored, and so is a CSV header
+ *  line: a first student line whose id field is not a number.  Lines that
+ *  do not parse or fail validate_range() are reported, counted in
+ *  src->invalid and skipped.
+ *
+ *  returns:  1            *rec holds the next student
+ *            0            end of input
+ *            ERR_DB_FILE  the input could not be read
+ *            ERR_DB_OP    the input is not a raw export
+ *
+ *  console:  M_BULK_BAD_LINE, M_IMPORT_BAD_JSON or M_BULK_BAD_RANGE for
+ *            each skipped line
+ */
+static int next_rec(int fd, bulk_src_t *src, bulk_rec_t *rec) {
+  for (;;) {
+    int rc;
+
+    memset(rec, 0, sizeof(*rec));
+    if (src->format == SDB_FORMAT_RAW) {
+      rc = next_raw(src, &rec->s);
+      if (rc != 1)
+        return rc;
+      // names are cut at their field size like the daemon does
+      rec->s.fname[sizeof(rec->s.fname) - 1] = '\0';
+      rec->s.lname[sizeof(rec->s.lname) - 1] = '\0';
+    } else {
+      char *text;
+
+      if (getline(&src->line, &src->cap, src->in) == -1)
+        return ferror(src->in) ? ERR_DB_FILE : 0;
+      src->line_no++;
+      text = trim(src->line);
+      if (*text == '\0' || *text == '#')
+        continue;
+
+      rc = src->format == SDB_FORMAT_CSV ? parse_csv(text, &rec->s)
+                                         : parse_jsonl(text, &rec->s);
+      if (rc != 1) {
+        // first line with a non numeric id is a column header
+        if (rc == -1 && src->lines == 0)
+          continue;
+        src->lines++;
+        src->invalid++;
+        printf(src->format == SDB_FORMAT_CSV ? M_BULK_BAD_LINE
+                                             : M_IMPORT_BAD_JSON,
+               src->line_no);
+        continue;
+      }
+    }
+
+    src->lines++;
+    rec->line = src->line_no;
+    if (validate_range(fd, rec->s.id, rec->s.gpa) != NO_ERROR) {
+      src->invalid++;
+      printf(M_BULK_BAD_RANGE, src->line_no);
+      continue;
+    }
+    return 1;
+  }
+}
+
+/*
+ *  cmp_rec
+ *
+ *  qsort() comparator, orders by id and then by input line so the first
+ *  occurrence of a duplicated id sorts first.
+ */
+static int cmp_rec(const void *a, const void *b) {
+  const bulk_rec_t *ra = a, *rb = b;
+
+  if (ra->s.id != rb->s.id)
+    return ra->s.id < rb->s.id ? -1 : 1;
+
+  return (ra->line > rb->line) - (ra->line < rb->line);
+}
+
+/*
+ *  read_input
+ *      fd:     the database the students are for
+ *      src:    the input, see next_rec()
+ *      *out:   receives a malloc()'d array of the valid students
+ *      *nout:  receives the number of students in *out
+ *      max:    most students to read
+ *
+ *  returns:  NO_ERROR     *out holds the next students in input order,
+ *                         none if the input is used up
+ *            ERR_DB_FILE  the input could not be read or out of memory
+ *            ERR_DB_OP    the input is not a raw export
+ *
+ *  console:  see next_rec()
+ */
+static int read_input(int fd, bulk_src_t *src, bulk_rec_t **out, int *nout,
+                      int max) {
+  bulk_rec_t *recs = NULL, rec;
+  int nrecs = 0, cap = 0, rc = 0;
+
+  while (nrecs < max && (rc = next_rec(fd, src, &rec)) == 1) {
+    if (nrecs == cap) {
+      bulk_rec_t *grown;
+
+      cap = cap == 0 ? 1024 : cap * 2;
+      grown = realloc(recs, cap * sizeof(*recs));
+      if (grown == NULL) {
+        free(recs);
+        return ERR_DB_FILE;
+      }
+      recs = grown;
+    }
+    recs[nrecs++] = rec;
+  }
+
+  if (rc < 0) {
+    free(recs);
+    return rc;
+  }
+
+  *out = recs;
+  *nout = nrecs;
+  return NO_ERROR;
+}
+
+/*
+ *  add_batch
+ *      fd:          an open file descriptor to the database file
+ *      recs:        students to add sorted by id, overwritten
+ *      nrecs:       number of students in recs
+ *      *added:      receives the number of students added
+ *      *duplicate:  receives the number of students skipped as duplicates
+ *
+ *  Does the database side of bulk_load() once the ids of recs are locked.
+ *
+ *  returns:  NO_ERROR     the students that were not duplicates were added
+ *            ERR_DB_FILE  database file I/O issue, nothing was added
+ *
+ *  console:  M_BULK_DUP_INPUT or M_ERR_DB_ADD_DUP for each skipped line
+ *            M_ERR_DB_READ or M_ERR_DB_WRITE on database errors
+ */
+static int add_batch(int fd, bulk_rec_t *recs, int nrecs, int *added,
+                     int *duplicate) {
+  student_t *batch;
+  student_t existing;
+  superblock_t sb;
+  int n = 0, prev_id = 0;
+  bool use_bm, gaps_empty;
+
+  // pack the students to add into a contiguous array, in place, so
+  // consecutive ids are also consecutive in memory for pwritev()
+  batch = (student_t *)recs;
+  use_bm = sdb_bm_fresh(fd);
+  gaps_empty = use_bm;
+  for (int i = 0; i < nrecs; i++) {
+    int id = recs[i].s.id;
+    int exists;
+
+    // batch overwrites recs from the front, so remember the previous id
+    if (i > 0 && prev_id == id) {
+      (*duplicate)++;
+      printf(M_BULK_DUP_INPUT, recs[i].line, id);
+      continue;
+    }
+    prev_id = id;
+
+    if (use_bm) {
+      exists = sdb_bm_next(fd, id) == id;
+    } else {
+      ssize_t bytes_read = sdb_read_slot(fd, id, &existing);
+
+      if (bytes_read == -1) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+      }
+      exists = bytes_read == STUDENT_RECORD_SIZE &&
+               memcmp(&existing, &EMPTY_STUDENT_RECORD,
+                      STUDENT_RECORD_SIZE) != 0;
+    }
+
+    if (exists) {
+      (*duplicate)++;
+      printf(M_ERR_DB_ADD_DUP, id);
+      continue;
+    }
+
+    // zero filling a gap is only safe if the bitmap says it is empty
+    if (gaps_empty && n > 0) {
+      int next = sdb_bm_next(fd, batch[n - 1].id + 1);
+
+      if (next != 0 && next < id)
+        gaps_empty = false;
+    }
+
+    memmove(&batch[n++], &recs[i].s, sizeof(student_t));
+  }
+
+  *added = n;
+  if (n == 0)
+    return NO_ERROR;
+
+  if (sdb_sb_begin(fd, &sb) != NO_ERROR ||
+      sdb_write_sorted(fd, batch, n, gaps_empty) != NO_ERROR) {
+    sdb_sb_abort(fd);
+    printf(M_ERR_DB_WRITE);
+    return ERR_DB_FILE;
+  }
+
+  for (int i = 0; i < n; i++) {
+    sdb_bm_update(fd, batch[i].id, true, NULL);
+    sdb_name_update(fd, &batch[i], true);
+    sdb_col_update(fd, &batch[i], true);
+  }
+
+  sb.record_count += n;
+  if (batch[n - 1].id > sb.max_id)
+    sb.max_id = batch[n - 1].id;
+
+  if (sdb_bm_save(fd, &sb) != NO_ERROR) {
+    sdb_sb_abort(fd);
+    printf(M_ERR_DB_WRITE);
+    return ERR_DB_FILE;
+  }
+
+  if (sdb_sb_commit(fd, &sb) != NO_ERROR ||
+      (sdb_opts.sync && sdb_sync(fd) != NO_ERROR)) {
+    printf(M_ERR_DB_WRITE);
+    return ERR_DB_FILE;
+  }
+
+  return NO_ERROR;
+}
+
+/*
+ *  bulk_load
+ *      fd:  an open file descriptor to the database file
+ *      in:  stream of id,first_name,last_name,gpa lines, a file or stdin
+ *
+ *  Adds many students in one pass instead of one sdbsc -a process per
+ *  student.  The whole input is parsed and validated first, then sorted
+ *  by id.  Ids that appear more than once in the input keep their first
+ *  line, ids that already exist in the database are skipped just like
+ *  add_student() would.  The survivors are written in id order with
+ *  sdb_write_sorted(), which coalesces neighbouring students into a few
+ *  large pwritev() calls, all under a single superblock mutation and one
+ *  occupancy bitmap save.  The ids from the lowest to the highest one in
+ *  the input are locked exclusively while that happens.
+ *
+ *  returns:  NO_ERROR     every student in the input was added
+ *            ERR_DB_OP    some lines were skipped, the rest were added
+ *            ERR_DB_FILE  database file I/O issue, or reading the input
+ *                         failed, nothing was added
+ *
+ *  console:  M_BULK_SUMMARY once the load is done
+ *            M_BULK_BAD_LINE, M_BULK_BAD_RANGE, M_BULK_DUP_INPUT or
+ *              M_ERR_DB_ADD_DUP for each skipped line
+ *            M_ERR_DB_READ or M_ERR_DB_WRITE on database errors
+ *            M_ERR_BULK_READ if the input could not be read
+ */
+int bulk_load(int fd, FILE *in) {
+  bulk_src_t src = {0};
+  bulk_rec_t *recs = NULL;
+  int nrecs, lines, invalid, duplicate = 0, added = 0, first, count, rc;
+
+  src.in = in;
+  src.format = SDB_FORMAT_CSV;
+  rc = read_input(fd, &src, &recs, &nrecs, INT_MAX);
+  free(src.line);
+  if (rc != NO_ERROR) {
+    printf(M_ERR_BULK_READ);
+    return ERR_DB_FILE;
+  }
+  lines = src.lines;
+  invalid = src.invalid;
+
+  qsort(recs, nrecs, sizeof(*recs), cmp_rec);
+
+  if (nrecs > 0) {
+    first = recs[0].s.id;
+    count = recs[nrecs - 1].s.id - first + 1;
+
+    // a compressed (dense) database is expanded first, see sdb_lock_add()
+    if (sdb_lock_add(fd, first, count) != NO_ERROR) {
+      printf(M_ERR_DB_WRITE);
+      free(recs);
+      return ERR_DB_FILE;
+    }
+
+    rc = add_batch(fd, recs, nrecs, &added, &duplicate);
+    sdb_lock(fd, F_UNLCK, first, count);
+    if (rc != NO_ERROR) {
+      free(recs);
+      return ERR_DB_FILE;
+    }
+  }
+
+  free(recs);
+  printf(M_BULK_SUMMARY, lines, added, duplicate, invalid);
+  return (duplicate > 0 || invalid > 0) ? ERR_DB_OP : NO_ERROR;
+}
+
+/*
+ *  import_db
+ *      fd:      an open file descriptor to the database file
+ *      in:      the students, a file or stdin, usually written by
+ *               sdbsc --export=FMT
+ *      format:  SDB_FORMAT_CSV, SDB_FORMAT_JSONL or SDB_FORMAT_RAW
+ *
+ *  sdbsc --import=FMT, the other half of export_db().  Students are added
+ *  the way bulk_load() adds them, but the input is streamed instead of
+ *  read whole: SDB_IMPORT_BATCH students at a time are sorted, locked and
+ *  added in a superblock mutation of their own before the next ones are
+ *  read.  Memory and the write-ahead log stay bounded however big the
+ *  input is, and an import that fails part way keeps the batches that
+ *  were already added.  An id repeated in a later batch is skipped as
+ *  already in the database.
+ *
+ *  returns:  NO_ERROR     every student in the input was added
+ *            ERR_DB_OP    some records were skipped, the rest were added
+ *            ERR_DB_FILE  database file I/O issue, or reading the input
+ *                         failed, the batches before it were added
+ *
+ *  console:  M_IMPORT_SUMMARY once the import is done
+ *            the messages of bulk_load() for each skipped record,
+ *              M_IMPORT_BAD_JSON for JSONL lines that do not parse
+ *            M_ERR_IMPORT_RAW if a raw input has no raw export header
+ *            M_ERR_IMPORT_READ if the input could not be read
+ */
+int import_db(int fd, FILE *in, int format) {
+  bulk_src_t src = {0};
+  bulk_rec_t *recs;
+  int nrecs, added = 0, duplicate = 0, rc;
+
+  src.in = in;
+  src.format = format;
+  // the input may be a snapshot of a whole database, read it in big blocks
+  setvbuf(in, NULL, _IOFBF, SDB_EXPORT_BUF);
+
+  for (;;) {
+    int batch_added, first, count;
+
+    rc = read_input(fd, &src, &recs, &nrecs, SDB_IMPORT_BATCH);
+    if (rc != NO_ERROR) {
+      printf(rc == ERR_DB_OP ? M_ERR_IMPORT_RAW : M_ERR_IMPORT_READ);
+      break;
+    }
+    if (nrecs == 0) {
+      free(recs);
+      break;
+    }
+
+    qsort(recs, nrecs, sizeof(*recs), cmp_rec);
+    first = recs[0].s.id;
+    count = recs[nrecs - 1].s.id - first + 1;
+
+    if (sdb_lock_add(fd, first, count) != NO_ERROR) {
+      printf(M_ERR_DB_WRITE);
+      free(recs);
+      rc = ERR_DB_FILE;
+      break;
+    }
+
+    rc = add_batch(fd, recs, nrecs, &batch_added, &duplicate);
+    sdb_lock(fd, F_UNLCK, first, count);
+    free(recs);
+    if (rc != NO_ERROR)
+      break;
+    added += batch_added;
+  }
+
+  free(src.line);
+  if (rc != NO_ERROR)
+    return ERR_DB_FILE;
+
+  printf(M_IMPORT_SUMMARY, src.lines, added, duplicate, src.invalid);
+  return (duplicate > 0 || src.invalid > 0) ? ERR_DB_OP : NO_ERROR;
+}
+
+/*
+ *  read_updates
+ *      fd:        the database the updates are for
+ *      in:        stream to read updates from
+ *      *out:      receives a malloc()'d array of the valid updates, s.gpa
+ *                 is -1 and s.lname is empty for a field that is kept
+ *      *nout:     receives the number of updates in *out
+ *      *lines:    receives the number of update lines read
+ *      *invalid:  receives the number of lines that were skipped
+ *
+ *  Reads id,gpa or id,gpa,last_name lines, the gpa may be left blank to
+ *  change only the last name.  Blank lines, # comments and a header line
+ *  are ignored like in read_input().
+ *
+ *  returns:  NO_ERROR     *out holds the updates in input order
+ *            ERR_DB_FILE  the input could not be read or out of memory
+ *
+ *  console:  M_UPDATE_BAD_LINE or M_BULK_BAD_RANGE for each skipped line
+ */
+static int read_updates(int fd, FILE *in, bulk_rec_t **out, int *nout,
+                        int *lines, int *invalid) {
+  bulk_rec_t *recs = NULL;
+  int nrecs = 0, cap = 0, line_no = 0;
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+
+  *lines = 0;
+  *invalid = 0;
+
+  while ((len = getline(&line, &line_cap, in)) != -1) {
+    char *fields[3], *text, *lname = "";
+    bulk_rec_t rec = {0};
+    int nfields, id, gpa = -1;
+
+    line_no++;
+    text = trim(line);
+    if (*text == '\0' || *text == '#')
+      continue;
+
+    nfields = split_line(text, fields, 3);
+    if (nfields == 3)
+      lname = trim(fields[2]);
+    if (nfields < 2 || !parse_int(fields[0], &id) ||
+        (*trim(fields[1]) != '\0' && !parse_int(fields[1], &gpa)) ||
+        (gpa == -1 && *lname == '\0')) {
+      // first line with a non numeric id is a column header
+      if (*lines == 0 && !parse_int(fields[0], &id))
+        continue;
+      (*lines)++;
+      (*invalid)++;
+      printf(M_UPDATE_BAD_LINE, line_no);
+      continue;
+    }
+
+    (*lines)++;
+    if (validate_range(fd, id, gpa == -1 ? MIN_STD_GPA : gpa) != NO_ERROR) {
+      (*invalid)++;
+      printf(M_BULK_BAD_RANGE, line_no);
+      continue;
+    }
+
+    if (nrecs == cap) {
+      bulk_rec_t *grown;
+
+      cap = cap == 0 ? 1024 : cap * 2;
+      grown = realloc(recs, cap * sizeof(*recs));
+      if (grown == NULL) {
+        free(recs);
+        free(line);
+        return ERR_DB_FILE;
+      }
+      recs = grown;
+    }
+
+    rec.s.id = id;
+    strncpy(rec.s.lname, lname, sizeof(rec.s.lname) - 1);
+    rec.s.gpa = gpa;
+    rec.line = line_no;
+    recs[nrecs++] = rec;
+  }
+
+  free(line);
+  if (ferror(in)) {
+    free(recs);
+    return ERR_DB_FILE;
+  }
+
+  *out = recs;
+  *nout = nrecs;
+  return NO_ERROR;
+}
+
+/*
+ *  update_batch
+ *      fd:          an open file descriptor to the database file
+ *      recs:        updates sorted by id, see read_updates(), overwritten
+ *      nrecs:       number of updates in recs
+ *      *updated:    receives the number of students updated
+ *      *missing:    receives the number of updates for unknown students
+ *      *duplicate:  receives the number of updates skipped as duplicates
+ *
+ *  Does the database side of bulk_update() once the ids of recs are
+ *  locked.
+ *
+ *  returns:  NO_ERROR     the students that exist were updated
+ *            ERR_DB_FILE  database file I/O issue, nothing was updated
+ *
+ *  console:  M_BULK_DUP_INPUT or M_STD_NOT_FND_MSG for each skipped line
+ *            M_ERR_DB_READ or M_ERR_DB_WRITE on database errors
+ */
+static int update_batch(int fd, bulk_rec_t *recs, int nrecs, int *updated,
+                        int *missing, int *duplicate) {
+  sdb_handle_t *h = sdb_handle(fd);
+  student_t *batch, *cur;
+  superblock_t sb;
+  int *ids;
+  int n = 0, m = 0, rc = NO_ERROR;
+
+  ids = malloc((size_t)nrecs * sizeof(*ids));
+  cur = malloc((size_t)nrecs * sizeof(*cur));
+  if (ids == NULL || cur == NULL) {
+    free(ids);
+    free(cur);
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
+
+  // drop repeated ids first, sdb_read_sorted() wants each id once
+  for (int i = 0; i < nrecs; i++) {
+    if (n > 0 && recs[n - 1].s.id == recs[i].s.id) {
+      (*duplicate)++;
+      printf(M_BULK_DUP_INPUT, recs[i].line, recs[i].s.id);
+      continue;
+    }
+    recs[n] = recs[i];
+    ids[n++] = recs[i].s.id;
+  }
+
+  if (sdb_read_sorted(fd, ids, n, cur) != NO_ERROR) {
+    printf(M_ERR_DB_READ);
+    rc = ERR_DB_FILE;
+    goto done;
+  }
+
+  if (sdb_sb_begin(fd, &sb) != NO_ERROR) {
+    printf(M_ERR_DB_WRITE);
+    rc = ERR_DB_FILE;
+    goto done;
+  }
+
+  // pack the changed students into a contiguous array, in place, like
+  // add_batch() does
+  batch = (student_t *)recs;
+  for (int i = 0; i < n; i++) {
+    student_t s;
+
+    if (cur[i].id != ids[i]) {
+      (*missing)++;
+      printf(M_STD_NOT_FND_MSG, ids[i]);
+      continue;
+    }
+
+    (*updated)++;
+    s = cur[i];
+    if (recs[i].s.gpa >= 0)
+      s.gpa = recs[i].s.gpa;
+    if (recs[i].s.lname[0] != '\0')
+      memcpy(s.lname, recs[i].s.lname, sizeof(s.lname));
+    if (memcmp(&s, &cur[i], sizeof(s)) == 0)
+      continue;
+
+    if (strcmp(s.lname, cur[i].lname) != 0) {
+      sdb_name_update(fd, &cur[i], false);
+      sdb_name_update(fd, &s, true);
+    }
+    if (s.gpa != cur[i].gpa)
+      sdb_col_update(fd, &s, true);
+    batch[m++] = s;
+  }
+
+  // a dense database has no gaps to write around, see sdb_write_sorted()
+  if (h->layout == SDB_LAYOUT_DENSE) {
+    for (int i = 0; rc == NO_ERROR && i < m; i++)
+      rc = sdb_write_slot(fd, batch[i].id, &batch[i]);
+  } else {
+    rc = sdb_write_sorted(fd, batch, m, false);
+  }
+  if (rc != NO_ERROR) {
+    sdb_sb_abort(fd);
+    printf(M_ERR_DB_WRITE);
+    rc = ERR_DB_FILE;
+    goto done;
+  }
+
+  if (sdb_sb_commit(fd, &sb) != NO_ERROR ||
+      (sdb_opts.sync && sdb_sync(fd) != NO_ERROR)) {
+    printf(M_ERR_DB_WRITE);
+    rc = ERR_DB_FILE;
+  }
+
+done:
+  free(ids);
+  free(cur);
+  return rc;
+}
+
+/*
+ *  bulk_update
+ *      fd:  an open file descriptor to the database file
+ *      in:  stream of id,gpa or id,gpa,last_name lines, a file or stdin
+ *
+ *  Posts many grade (or last name) changes in one pass instead of one
+ *  sdbsc -u process per student.  The input is parsed, validated and
+ *  sorted by id like bulk_load() does, then the current students are read
+ *  with sdb_read_sorted() and the changed ones written back together with
+ *  sdb_write_sorted(), all under a single superblock mutation.  Ids that
+ *  are not in the database are reported and skipped, an id that appears
+ *  more than once keeps its first line.  The ids from the lowest to the
+ *  highest one in the input are locked exclusively while that happens.
+ *
+ *  returns:  NO_ERROR     every update in the input was applied
+ *            ERR_DB_OP    some lines were skipped, the rest were applied
+ *            ERR_DB_FILE  database file I/O issue, or reading the input
+ *                         failed, nothing was updated
+ *
+ *  console:  M_UPDATE_SUMMARY once the updates are done
+ *            M_UPDATE_BAD_LINE, M_BULK_BAD_RANGE, M_BULK_DUP_INPUT or
+ *              M_STD_NOT_FND_MSG for each skipped line
+ *            M_ERR_DB_READ or M_ERR_DB_WRITE on database errors
+ *            M_ERR_UPDATE_READ if the input could not be read
+ */
+int bulk_update(int fd, FILE *in) {
+  bulk_rec_t *recs = NULL;
+  int nrecs, lines, invalid, duplicate = 0, missing = 0, updated = 0;
+  int first, count, rc;
+
+  if (read_updates(fd, in, &recs, &nrecs, &lines, &invalid) != NO_ERROR) {
+    printf(M_ERR_UPDATE_READ);
+    return ERR_DB_FILE;
+  }
+
+  qsort(recs, nrecs, sizeof(*recs), cmp_rec);
+
+  if (nrecs > 0) {
+    first = recs[0].s.id;
+    count = recs[nrecs - 1].s.id - first + 1;
+
+    if (sdb_lock_ids(fd, F_WRLCK, first, count) != NO_ERROR) {
+      printf(M_ERR_DB_WRITE);
+      free(recs);
+      return ERR_DB_FILE;
+    }
+
+    rc = update_batch(fd, recs, nrecs, &updated, &missing, &duplicate);
+    sdb_lock(fd, F_UNLCK, first, count);
+    if (rc != NO_ERROR) {
+      free(recs);
+      return ERR_DB_FILE;
+    }
+  }
+
+  free(recs);
+  printf(M_UPDATE_SUMMARY, lines, updated, missing, duplicate, invalid);
+  return (missing > 0 || duplicate > 0 || invalid > 0) ? ERR_DB_OP
+                                                       : NO_ERROR;
+}
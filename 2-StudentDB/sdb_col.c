@@ -0,0 +1,401 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+// pending changes are written with one read-modify-write of the ids they
+// span as long as that is at most this many column entries
+#define COL_SPAN (SDB_SCAN_BLOCK / (int)sizeof(int))
+
+/*
+ *  col_off
+ *      id:  student id
+ *
+ *  returns:  offset of the column entry of id in the sidecar
+ */
+static off_t col_off(int id) {
+  return (off_t)sizeof(sdb_sidecar_t) + (off_t)id * sizeof(int);
+}
+
+/*
+ *  col_attach
+ *      h:       handle of a database file opened with a path
+ *      create:  create the sidecar if it does not exist yet
+ *
+ *  Opens the GPA column sidecar of the database.  Does nothing if that
+ *  already happened.  Only sdb_col_load() creates the sidecar, right
+ *  before it builds the column, so opening the database does not.
+ *
+ *  returns:  NO_ERROR        h->col is ready
+ *            SRCH_NOT_FOUND  there is no sidecar and create is false
+ *            ERR_DB_FILE     no path, the sidecar could not be opened or
+ *                            out of memory
+ */
+static int col_attach(sdb_handle_t *h, bool create) {
+  char path[PATH_MAX];
+  mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+  sdb_col_t *col;
+
+  if (h->col != NULL)
+    return NO_ERROR;
+
+  if (h->path == NULL ||
+      snprintf(path, sizeof(path), "%s%s", h->path, SDB_COL_SUFFIX) >=
+          (int)sizeof(path))
+    return ERR_DB_FILE;
+
+  col = calloc(1, sizeof(*col));
+  if (col == NULL)
+    return ERR_DB_FILE;
+
+  col->fd = open(path, O_RDWR | (create ? O_CREAT : 0), mode);
+  if (col->fd == -1) {
+    free(col);
+    return !create && errno == ENOENT ? SRCH_NOT_FOUND : ERR_DB_FILE;
+  }
+
+  h->col = col;
+  return NO_ERROR;
+}
+
+/*
+ *  col_fresh
+ *      col:  an attached GPA column
+ *      *sb:  the superblock the column has to match
+ *
+ *  returns:  true if the column was written for this exact version of the
+ *            database, false if it is missing, stale or half written
+ */
+static bool col_fresh(sdb_col_t *col, const superblock_t *sb) {
+  sdb_sidecar_t hdr;
+
+  return pread(col->fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+         hdr.magic == SDB_COL_MAGIC && hdr.uuid == sb->uuid &&
+         hdr.generation == sb->generation;
+}
+
+/*
+ *  col_stamp
+ *      col:  an attached GPA column
+ *      *sb:  the superblock the column now matches, NULL to mark it stale
+ *
+ *  returns:  NO_ERROR     the header was written
+ *            ERR_DB_FILE  the sidecar could not be written
+ */
+static int col_stamp(sdb_col_t *col, const superblock_t *sb) {
+  sdb_sidecar_t hdr = {0};
+
+  if (sb != NULL) {
+    hdr.magic = SDB_COL_MAGIC;
+    hdr.version = SDB_VERSION;
+    hdr.generation = sb->generation;
+    hdr.uuid = sb->uuid;
+  }
+
+  return pwrite(col->fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) ? NO_ERROR
+                                                             : ERR_DB_FILE;
+}
+
+/*
+ *  col_read
+ *      col:  an attached GPA column
+ *      buf:  receives the entries of ids 0 to n - 1
+ *      n:    number of entries
+ *
+ *  The file ends after the highest id ever written, entries past its end
+ *  are empty.
+ *
+ *  returns:  NO_ERROR     buf holds the entries
+ *            ERR_DB_FILE  the sidecar could not be read
+ */
+static int col_read(sdb_col_t *col, int *buf, int n) {
+  size_t want = (size_t)n * sizeof(int);
+  ssize_t got = pread(col->fd, buf, want, col_off(0));
+
+  if (got == -1)
+    return ERR_DB_FILE;
+
+  memset((char *)buf + got, 0, want - (size_t)got);
+  return NO_ERROR;
+}
+
+/*
+ *  rebuild
+ *      fd:   file descriptor of an open database file
+ *      col:  its attached GPA column
+ *      *sb:  the current superblock
+ *
+ *  Builds the column from scratch with a full table scan, the first time
+ *  it is used and whenever it went stale.  The caller holds the superblock
+ *  lock so no student changes underneath the scan.
+ *
+ *  returns:  NO_ERROR     the column matches *sb
+ *            ERR_DB_FILE  database file I/O issue or out of memory
+ */
+static int rebuild(int fd, sdb_col_t *col, const superblock_t *sb) {
+  int n = sb->max_id + 1;
+  int *buf = calloc(n, sizeof(*buf));
+  sdb_scan_t scan;
+  const student_t *rec;
+  int rc;
+
+  if (buf == NULL)
+    return ERR_DB_FILE;
+
+  rc = sdb_scan_open(&scan, fd);
+  while (rc == NO_ERROR && (rc = sdb_scan_next(&scan, &rec)) == 1) {
+    rc = NO_ERROR;
+    if (rec->id > 0 && rec->id < n)
+      buf[rec->id] = rec->gpa + 1;
+  }
+  sdb_scan_close(&scan);
+
+  if (rc == NO_ERROR &&
+      (col_stamp(col, NULL) != NO_ERROR ||
+       ftruncate(col->fd, col_off(0)) == -1 ||
+       pwrite(col->fd, buf, (size_t)n * sizeof(*buf), col_off(0)) !=
+           (ssize_t)((size_t)n * sizeof(*buf)) ||
+       col_stamp(col, sb) != NO_ERROR))
+    rc = ERR_DB_FILE;
+
+  free(buf);
+  return rc < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  sdb_col_begin
+ *      fd:   file descriptor of an open database file
+ *      *sb:  the superblock as it was before the mutation began
+ *
+ *  Called by sdb_sb_begin() with the superblock lock held.  If the column
+ *  matches the database the mutation records its GPA changes with
+ *  sdb_col_update() and sdb_sb_commit() applies them, otherwise the column
+ *  is left alone and stays stale until the next query rebuilds it.  A
+ *  missing column is not created, there is nothing to keep up to date.
+ */
+void sdb_col_begin(int fd, const superblock_t *sb) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || h->path == NULL || col_attach(h, false) != NO_ERROR)
+    return;
+
+  // one entry per id is no use for the ids of a hashed database
+  h->col->npending = 0;
+  h->col->fresh = h->layout != SDB_LAYOUT_HASH && col_fresh(h->col, sb);
+}
+
+/*
+ *  sdb_col_update
+ *      fd:    file descriptor of an open database file
+ *      *s:    student that was added or deleted by the running mutation
+ *      live:  true if s was added, false if it was deleted
+ *
+ *  Remembers a GPA change until sdb_col_commit().  If we run out of memory
+ *  the column is simply left to go stale.
+ */
+void sdb_col_update(int fd, const student_t *s, bool live) {
+  sdb_handle_t *h = sdb_handle(fd);
+  sdb_col_t *col;
+
+  if (h == NULL || (col = h->col) == NULL || !col->fresh)
+    return;
+
+  if (col->npending == col->cap) {
+    int cap = col->cap == 0 ? 256 : col->cap * 2;
+    sdb_col_ent_t *grown = realloc(col->pending, (size_t)cap *
+                                                     sizeof(*grown));
+
+    if (grown == NULL) {
+      col->fresh = false;
+      return;
+    }
+    col->pending = grown;
+    col->cap = cap;
+  }
+
+  col->pending[col->npending].id = s->id;
+  col->pending[col->npending].value = live ? s->gpa + 1 : 0;
+  col->npending++;
+}
+
+/*
+ *  sdb_col_commit
+ *      fd:   file descriptor of an open database file
+ *      *sb:  superblock of the mutation being committed
+ *
+ *  Called by sdb_sb_commit().  Writes the GPA changes of the mutation to
+ *  the column and stamps it with the new generation.  The header is
+ *  cleared while the entries are written so a crash part way leaves a
+ *  stale column rather than a wrong one.  Changes that sit close together,
+ *  such as the ids of a bulk load, go out with a single read-modify-write
+ *  of the ids they span.  The column is only a shortcut, so failing to
+ *  write it does not fail the mutation, it just goes stale.
+ */
+void sdb_col_commit(int fd, const superblock_t *sb) {
+  sdb_handle_t *h = sdb_handle(fd);
+  sdb_col_t *col;
+  int lo = INT_MAX, hi = 0, rc = NO_ERROR;
+
+  if (h == NULL || (col = h->col) == NULL || !col->fresh)
+    return;
+
+  col->fresh = false;
+  for (int i = 0; i < col->npending; i++) {
+    lo = col->pending[i].id < lo ? col->pending[i].id : lo;
+    hi = col->pending[i].id > hi ? col->pending[i].id : hi;
+  }
+
+  if (col->npending > 0)
+    rc = col_stamp(col, NULL);
+
+  if (rc == NO_ERROR && col->npending > 0 && hi - lo < COL_SPAN) {
+    int n = hi - lo + 1;
+    int *span = malloc((size_t)n * sizeof(*span));
+    ssize_t got;
+
+    rc = ERR_DB_FILE;
+    if (span != NULL &&
+        (got = pread(col->fd, span, (size_t)n * sizeof(*span),
+                     col_off(lo))) != -1) {
+      memset((char *)span + got, 0, (size_t)n * sizeof(*span) - got);
+      for (int i = 0; i < col->npending; i++)
+        span[col->pending[i].id - lo] = col->pending[i].value;
+      if (pwrite(col->fd, span, (size_t)n * sizeof(*span), col_off(lo)) ==
+          (ssize_t)((size_t)n * sizeof(*span)))
+        rc = NO_ERROR;
+    }
+    free(span);
+  } else {
+    for (int i = 0; rc == NO_ERROR && i < col->npending; i++) {
+      if (pwrite(col->fd, &col->pending[i].value, sizeof(int),
+                 col_off(col->pending[i].id)) != sizeof(int))
+        rc = ERR_DB_FILE;
+    }
+  }
+
+  if (rc == NO_ERROR)
+    col_stamp(col, sb);
+
+  col->npending = 0;
+}
+
+/*
+ *  sdb_col_abort
+ *      fd:     file descriptor of an open database file
+ *      stale:  clear the header so the column gets rebuilt
+ *
+ *  Forgets the GPA changes of a mutation that was given up, see
+ *  sdb_sb_abort() and sdb_sb_commit().
+ */
+void sdb_col_abort(int fd, bool stale) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || h->col == NULL)
+    return;
+
+  h->col->npending = 0;
+  h->col->fresh = false;
+  if (stale)
+    col_stamp(h->col, NULL);
+}
+
+/*
+ *  sdb_col_close
+ *      fd:  file descriptor of an open database file
+ *
+ *  Closes the GPA column sidecar, if it was opened.
+ */
+void sdb_col_close(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || h->col == NULL)
+    return;
+
+  close(h->col->fd);
+  free(h->col->pending);
+  free(h->col);
+  h->col = NULL;
+}
+
+/*
+ *  sdb_col_load
+ *      fd:     file descriptor of a database file opened with a path
+ *      **col:  receives a malloc()'d copy of the column, entry i holds the
+ *              GPA of id i plus one, or 0 if there is no such student
+ *      *n:     receives the number of entries, the highest id plus one
+ *
+ *  Reads the GPA column, 4 bytes per id instead of the 64 byte record,
+ *  for the analytic queries (see gpa_stats()).  Like get_student() no lock
+ *  is taken if the superblock is clean and at the same generation before
+ *  and after the read (and the column was written for that generation).
+ *  Otherwise the read is repeated holding the superblock lock, rebuilding
+ *  a stale or missing column first.  Hashed databases have no column, it
+ *  would need an entry for every id up to INT_MAX.
+ *
+ *  returns:  NO_ERROR     *col holds the column
+ *            ERR_DB_FILE  the column could not be used, database file I/O
+ *                         issue or out of memory
+ */
+int sdb_col_load(int fd, int **col, int *n) {
+  sdb_handle_t *h = sdb_handle(fd);
+  superblock_t before, after;
+  int *buf = NULL;
+  int rc;
+
+  *col = NULL;
+  *n = 0;
+  if (h == NULL || h->layout == SDB_LAYOUT_HASH ||
+      (rc = col_attach(h, false)) == ERR_DB_FILE)
+    return ERR_DB_FILE;
+
+  if (rc == NO_ERROR && sdb_sb_read(fd, &before) == NO_ERROR &&
+      before.state == SDB_STATE_CLEAN && col_fresh(h->col, &before)) {
+    buf = malloc(((size_t)before.max_id + 1) * sizeof(*buf));
+    if (buf == NULL)
+      return ERR_DB_FILE;
+
+    if (col_read(h->col, buf, before.max_id + 1) == NO_ERROR &&
+        sdb_sb_read(fd, &after) == NO_ERROR &&
+        after.state == SDB_STATE_CLEAN &&
+        after.generation == before.generation) {
+      *col = buf;
+      *n = before.max_id + 1;
+      return NO_ERROR;
+    }
+    free(buf);
+  }
+
+  if (sdb_lock(fd, F_WRLCK, SDB_LOCK_SB, 1) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  rc = col_attach(h, true);
+  if (rc == NO_ERROR)
+    rc = sdb_sb_read(fd, &before);
+  if (rc == NO_ERROR && !col_fresh(h->col, &before))
+    rc = rebuild(fd, h->col, &before);
+  if (rc == NO_ERROR) {
+    buf = malloc(((size_t)before.max_id + 1) * sizeof(*buf));
+    if (buf == NULL || col_read(h->col, buf, before.max_id + 1) != NO_ERROR)
+      rc = ERR_DB_FILE;
+  }
+
+  sdb_lock(fd, F_UNLCK, SDB_LOCK_SB, 1);
+  if (rc != NO_ERROR) {
+    free(buf);
+    return ERR_DB_FILE;
+  }
+
+  *col = buf;
+  *n = before.max_id + 1;
+  return NO_ERROR;
+}
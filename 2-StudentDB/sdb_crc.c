@@ -0,0 +1,101 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SDB_X86_64 1
+#endif
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+// CRC32C (Castagnoli) polynomial, reversed bit order
+#define CRC32C_POLY 0x82f63b78
+
+/*
+ *  crc32c_sw
+ *      crc:  running crc, already inverted
+ *      buf:  bytes to add
+ *      len:  number of bytes
+ *
+ *  Portable version of sdb_crc32c(), one table lookup per byte.
+ */
+static unsigned int crc32c_sw(unsigned int crc, const unsigned char *buf,
+                              size_t len) {
+  static unsigned int table[256];
+  static bool table_ready = false;
+
+  if (!table_ready) {
+    for (unsigned int i = 0; i < 256; i++) {
+      unsigned int c = i;
+
+      for (int k = 0; k < 8; k++)
+        c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+      table[i] = c;
+    }
+    table_ready = true;
+  }
+
+  while (len-- > 0)
+    crc = table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+  return crc;
+}
+
+#ifdef SDB_X86_64
+/*
+ *  crc32c_sse42
+ *
+ *  SSE4.2 version of sdb_crc32c(), the crc32 instruction computes CRC32C
+ *  eight bytes at a time.
+ */
+__attribute__((target("sse4.2"))) static unsigned int
+crc32c_sse42(unsigned int crc, const unsigned char *buf, size_t len) {
+  unsigned long long c = crc;
+
+  for (; len >= 8; buf += 8, len -= 8) {
+    unsigned long long v;
+
+    memcpy(&v, buf, sizeof(v));
+    c = _mm_crc32_u64(c, v);
+  }
+
+  crc = (unsigned int)c;
+  for (; len > 0; buf++, len--)
+    crc = _mm_crc32_u8(crc, *buf);
+
+  return crc;
+}
+#endif
+
+/*
+ *  sdb_crc32c
+ *      crc:  crc of the bytes before buf, 0 to start a new one
+ *      buf:  bytes to checksum
+ *      len:  number of bytes
+ *
+ *  Computes the CRC32C of a buffer, used to detect torn or corrupted writes.
+ *  The crc32 instruction of SSE4.2 is used when the cpu has it, otherwise a
+ *  table driven loop.  Chaining calls gives the same result as one call
+ *  over the concatenated buffers.
+ *
+ *  returns:  the CRC32C of everything checksummed so far
+ */
+unsigned int sdb_crc32c(unsigned int crc, const void *buf, size_t len) {
+  static unsigned int (*kernel)(unsigned int, const unsigned char *,
+                                size_t) = NULL;
+
+  if (kernel == NULL) {
+    kernel = crc32c_sw;
+#ifdef SDB_X86_64
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+      kernel = crc32c_sse42;
+#endif
+  }
+
+  return ~kernel(~crc, buf, len);
+}
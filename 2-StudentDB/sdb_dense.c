@@ -0,0 +1,336 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+// SDB_SCAN_BLOCK buffers sdb_dense_write() fills while earlier ones are
+// still being written through an io_uring
+#define DENSE_BLOCKS 4
+
+// ids in one page of the dense index, the binary search switches to a
+// single read of the remaining range once it fits in a page
+#define INDEX_PAGE_IDS (int)(SDB_SCAN_ALIGN / sizeof(unsigned int))
+
+/*
+ *  index_find
+ *      fd:    file descriptor of a dense database file
+ *      id:    student id to look up
+ *      *pos:  receives the index position of the first id >= id
+ *
+ *  Binary searches the sorted id array at the end of a dense file.  The
+ *  first few probes are single id reads, once the range left fits in one
+ *  page it is read in one go and searched in memory.  With the read/write
+ *  engine that is about seven pread() calls for a full database.
+ *
+ *  returns:  1            id is in the index at *pos
+ *            0            id is not in the index
+ *            ERR_DB_FILE  database file I/O issue
+ */
+static int index_find(int fd, int id, int *pos) {
+  sdb_handle_t *h = sdb_handle(fd);
+  unsigned int page[INDEX_PAGE_IDS];
+  off_t base;
+  int lo = 0, hi, n, first = 0, last;
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  base = (off_t)(h->nslots + 1) * STUDENT_RECORD_SIZE;
+  hi = h->nslots;
+
+  // the answer is always in lo..hi, hi included
+  while (hi - lo >= INDEX_PAGE_IDS) {
+    int mid = lo + (hi - lo) / 2;
+    unsigned int v;
+
+    if (sdb_read_at(fd, &v, sizeof(v), base + (off_t)mid * sizeof(v)) !=
+        sizeof(v))
+      return ERR_DB_FILE;
+
+    if (v < (unsigned int)id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  // hi is only a position to read if it is not past the last id
+  n = hi < h->nslots ? hi - lo + 1 : hi - lo;
+  if (n > 0 && sdb_read_at(fd, page, n * sizeof(page[0]),
+                           base + (off_t)lo * sizeof(page[0])) !=
+                   (ssize_t)(n * sizeof(page[0])))
+    return ERR_DB_FILE;
+
+  last = n;
+  while (first < last) {
+    int mid = first + (last - first) / 2;
+
+    if (page[mid] < (unsigned int)id)
+      first = mid + 1;
+    else
+      last = mid;
+  }
+
+  *pos = lo + first;
+  return first < n && page[first] == (unsigned int)id ? 1 : 0;
+}
+
+/*
+ *  sdb_dense_slot
+ *      fd:  file descriptor of a dense database file
+ *      id:  student id to look up
+ *
+ *  returns:  <slot>       the slot that holds id, 1 or more
+ *            0            id is not in the file
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_dense_slot(int fd, int id) {
+  int pos, rc;
+
+  if (id < MIN_STD_ID || id > MAX_STD_ID)
+    return 0;
+
+  rc = index_find(fd, id, &pos);
+  if (rc <= 0)
+    return rc;
+
+  return pos + 1;
+}
+
+/*
+ *  sdb_dense_prev
+ *      fd:  file descriptor of a dense database file
+ *      id:  search for live students below this id
+ *
+ *  Dense version of the backwards search in sdb_scan_prev(), walks the
+ *  slots below id until one that was not deleted.
+ *
+ *  returns:  <id>         the highest live id below id
+ *            0            there are no students below id
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_dense_prev(int fd, int id) {
+  student_t rec;
+  int pos;
+
+  if (index_find(fd, id, &pos) < 0)
+    return ERR_DB_FILE;
+
+  // slot pos holds the student at index position pos - 1
+  for (; pos > 0; pos--) {
+    if (sdb_read_at(fd, &rec, sizeof(rec),
+                    (off_t)pos * STUDENT_RECORD_SIZE) != sizeof(rec))
+      return ERR_DB_FILE;
+    if (memcmp(&rec, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0)
+      return rec.id;
+  }
+
+  return 0;
+}
+
+/*
+ *  sdb_dense_write
+ *      src_fd:  file descriptor of the database to copy
+ *      dst_fd:  file descriptor of a new, empty file
+ *
+ *  Writes every live student of src_fd into dst_fd using the dense layout
+ *  (see the superblock notes in db.h): the students back to back from slot
+ *  1, written SDB_SCAN_BLOCK bytes at a time, then the sorted id index and
+ *  finally the superblock.  If dst_fd has an io_uring the blocks are
+ *  written behind the scan, up to DENSE_BLOCKS of them in flight.  The
+ *  superblock keeps the uuid and generation of src_fd, the set of live ids
+ *  does not change so the sidecars of src_fd are still valid for the copy.
+ *
+ *  returns:  NO_ERROR     dst_fd holds the dense copy
+ *            ERR_DB_FILE  database file I/O issue or out of memory
+ */
+int sdb_dense_write(int src_fd, int dst_fd) {
+  const int per_block = SDB_SCAN_BLOCK / STUDENT_RECORD_SIZE;
+  sdb_scan_t scan;
+  const student_t *rec;
+  superblock_t sb;
+  student_t *blocks, *block;
+  unsigned int *ids = NULL;
+  off_t offset = SDB_HEADER_SIZE;
+  int n = 0, cap = 0, fill = 0, nblocks, cur = 0, rc;
+
+  nblocks = sdb_uring_ready(dst_fd) ? DENSE_BLOCKS : 1;
+  blocks = malloc((size_t)nblocks * SDB_SCAN_BLOCK);
+  if (blocks == NULL)
+    return ERR_DB_FILE;
+  block = blocks;
+
+  rc = sdb_scan_open(&scan, src_fd);
+  while (rc == NO_ERROR && (rc = sdb_scan_next(&scan, &rec)) == 1) {
+    rc = NO_ERROR;
+
+    // the index has to be sorted, scans hand out students by id
+    if (n > 0 && (unsigned int)rec->id <= ids[n - 1]) {
+      rc = ERR_DB_FILE;
+      break;
+    }
+
+    if (n == cap) {
+      unsigned int *grown;
+
+      cap = cap == 0 ? INDEX_PAGE_IDS : cap * 2;
+      grown = realloc(ids, cap * sizeof(*ids));
+      if (grown == NULL) {
+        rc = ERR_DB_FILE;
+        break;
+      }
+      ids = grown;
+    }
+
+    if (fill == per_block) {
+      struct iovec iov = {block, (size_t)fill * STUDENT_RECORD_SIZE};
+
+      if (nblocks > 1)
+        rc = sdb_uring_queue(dst_fd, true, &iov, 1, offset);
+      else
+        rc = sdb_write_at(dst_fd, block, iov.iov_len, offset);
+      if (rc != NO_ERROR)
+        break;
+      offset += (off_t)fill * STUDENT_RECORD_SIZE;
+      fill = 0;
+
+      // about to refill the oldest block, its write has to be done
+      cur = (cur + 1) % nblocks;
+      block = blocks + (size_t)cur * per_block;
+      if (cur == 0 && (rc = sdb_uring_wait(dst_fd)) != NO_ERROR)
+        break;
+    }
+
+    block[fill++] = *rec;
+    ids[n++] = rec->id;
+  }
+  sdb_scan_close(&scan);
+
+  if (sdb_uring_wait(dst_fd) != NO_ERROR)
+    rc = ERR_DB_FILE;
+
+  if (rc == NO_ERROR && fill > 0) {
+    rc = sdb_write_at(dst_fd, block, (size_t)fill * STUDENT_RECORD_SIZE,
+                      offset);
+    offset += (off_t)fill * STUDENT_RECORD_SIZE;
+  }
+
+  if (rc == NO_ERROR && n > 0)
+    rc = sdb_write_at(dst_fd, ids, n * sizeof(*ids), offset);
+
+  if (rc == NO_ERROR)
+    rc = sdb_sb_read(src_fd, &sb);
+
+  if (rc == NO_ERROR) {
+    sb.version = SDB_VERSION;
+    sb.layout = SDB_LAYOUT_DENSE;
+    sb.nslots = n;
+    sb.record_count = n;
+    sb.max_id = n > 0 ? (int)ids[n - 1] : 0;
+    rc = sdb_sb_write(dst_fd, &sb);
+  }
+
+  free(blocks);
+  free(ids);
+  return rc < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  sdb_dense_expand
+ *      fd:  file descriptor of a database file opened with open_db()
+ *
+ *  A dense file has no room for new students, so before one is added the
+ *  database is turned back into the sparse layout.  The sparse copy is
+ *  written next to the database, synced and renamed over it, so a crash
+ *  leaves either the old or the new file and never a mix of both.  The
+ *  copy is then moved onto fd with sdb_reopen() so the caller can keep
+ *  using the same file descriptor.  Does nothing for a sparse database.
+ *  The caller must hold the whole database lock, see sdb_lock_add().
+ *
+ *  returns:  NO_ERROR     fd refers to a sparse database
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_dense_expand(int fd) {
+  const int per_batch = SDB_SCAN_BLOCK / STUDENT_RECORD_SIZE;
+  sdb_handle_t *h = sdb_handle(fd);
+  char tmp_path[PATH_MAX];
+  sdb_scan_t scan;
+  const student_t *rec;
+  superblock_t sb;
+  student_t *batch;
+  int tmp_fd, fill = 0, rc;
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  if (h->layout != SDB_LAYOUT_DENSE)
+    return NO_ERROR;
+
+  // the sparse copy keeps the uuid, the log must not hold dense mutations
+  if (sdb_wal_checkpoint(fd) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  if (h->path == NULL ||
+      snprintf(tmp_path, sizeof(tmp_path), "%s%s", h->path,
+               SDB_EXPAND_SUFFIX) >= (int)sizeof(tmp_path))
+    return ERR_DB_FILE;
+
+  batch = malloc(SDB_SCAN_BLOCK);
+  if (batch == NULL)
+    return ERR_DB_FILE;
+
+  tmp_fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+  if (tmp_fd == -1 ||
+      sdb_attach(tmp_fd, NULL,
+                 h->ring != NULL ? SDB_ENGINE_URING : h->engine) != NO_ERROR) {
+    if (tmp_fd != -1)
+      close(tmp_fd);
+    free(batch);
+    return ERR_DB_FILE;
+  }
+
+  // slots between students of a new file are holes, so gaps can be zeros
+  rc = sdb_scan_open(&scan, fd);
+  while (rc == NO_ERROR && (rc = sdb_scan_next(&scan, &rec)) == 1) {
+    batch[fill++] = *rec;
+    rc = NO_ERROR;
+    if (fill == per_batch) {
+      rc = sdb_write_sorted(tmp_fd, batch, fill, true);
+      fill = 0;
+    }
+  }
+  sdb_scan_close(&scan);
+
+  if (rc == NO_ERROR)
+    rc = sdb_write_sorted(tmp_fd, batch, fill, true);
+  free(batch);
+
+  if (rc == NO_ERROR && (rc = sdb_sb_read(fd, &sb)) == NO_ERROR) {
+    sb.layout = SDB_LAYOUT_SPARSE;
+    sb.nslots = 0;
+    rc = sdb_sb_write(tmp_fd, &sb);
+  }
+
+  if (rc == NO_ERROR)
+    rc = sdb_sync(tmp_fd);
+
+  sdb_detach(tmp_fd);
+  if (rc != NO_ERROR || rename(tmp_path, h->path) == -1) {
+    close(tmp_fd);
+    unlink(tmp_path);
+    return ERR_DB_FILE;
+  }
+
+  // the handle keeps the old mapping and sidecars, attach the new file
+  close(tmp_fd);
+  return sdb_reopen(fd);
+}
@@ -0,0 +1,252 @@
+#define _GNU_SOURCE // IOV_MAX
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+// where an export is going
+//  fd:      the output file
+//  format:  SDB_FORMAT_CSV, SDB_FORMAT_JSONL or SDB_FORMAT_RAW
+//  buf:     formatted (or copied) students waiting to be written, len bytes
+//  iov:     raw students still in the database mapping waiting to be
+//           written, iovcnt of them, see put_slots()
+typedef struct export_out {
+  int fd;
+  int format;
+  char *buf;
+  size_t len;
+  struct iovec iov[IOV_MAX];
+  int iovcnt;
+} export_out_t;
+
+/*
+ *  writev_all
+ *      fd:      file descriptor to write to
+ *      iov:     buffers to write, changed as they go out
+ *      iovcnt:  number of buffers
+ *
+ *  writev() that keeps going after short writes and interrupts, the
+ *  sdb_write_all() of a list of buffers.
+ *
+ *  returns:  NO_ERROR     everything was written
+ *            ERR_DB_FILE  write error
+ */
+static int writev_all(int fd, struct iovec *iov, int iovcnt) {
+  while (iovcnt > 0) {
+    ssize_t n = writev(fd, iov, iovcnt);
+
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return ERR_DB_FILE;
+    }
+
+    while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= (ssize_t)iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= (size_t)n;
+    }
+  }
+
+  return NO_ERROR;
+}
+
+/*
+ *  flush_out
+ *      out:  the export
+ *
+ *  returns:  NO_ERROR     everything waiting was written
+ *            ERR_DB_FILE  write error
+ */
+static int flush_out(export_out_t *out) {
+  int rc = NO_ERROR;
+
+  if (out->iovcnt > 0)
+    rc = writev_all(out->fd, out->iov, out->iovcnt);
+  else if (out->len > 0)
+    rc = sdb_write_all(out->fd, out->buf, out->len);
+
+  out->iovcnt = 0;
+  out->len = 0;
+  return rc;
+}
+
+/*
+ *  put_slots
+ *      out:     the export
+ *      recs:    n students in a row
+ *      n:       number of students
+ *      mapped:  recs points into the database mapping, which stays put
+ *               until the scan is over
+ *
+ *  Adds students to a raw export.  Students in the mapping are not copied
+ *  at all, they go out with writev() straight from the page cache, and a
+ *  run that carries on where the last one stopped just makes that buffer
+ *  longer.  Scans of the read/write engine reuse their block, so those
+ *  students are copied to out->buf instead.
+ *
+ *  returns:  NO_ERROR     the students were added
+ *            ERR_DB_FILE  write error
+ */
+static int put_slots(export_out_t *out, const student_t *recs, int n,
+                     bool mapped) {
+  size_t len = (size_t)n * sizeof(student_t);
+
+  if (mapped) {
+    struct iovec *last = out->iovcnt > 0 ? &out->iov[out->iovcnt - 1] : NULL;
+
+    if (last != NULL &&
+        (const char *)last->iov_base + last->iov_len == (const char *)recs) {
+      last->iov_len += len;
+      return NO_ERROR;
+    }
+    if (out->iovcnt == IOV_MAX && flush_out(out) != NO_ERROR)
+      return ERR_DB_FILE;
+    out->iov[out->iovcnt].iov_base = (void *)recs;
+    out->iov[out->iovcnt++].iov_len = len;
+    return NO_ERROR;
+  }
+
+  if (SDB_EXPORT_BUF - out->len < len && flush_out(out) != NO_ERROR)
+    return ERR_DB_FILE;
+  memcpy(out->buf + out->len, recs, len);
+  out->len += len;
+  return NO_ERROR;
+}
+
+/*
+ *  put_group
+ *      out:     the export
+ *      recs:    a group of slots, see sdb_scan_group()
+ *      live:    the slots of the group that hold a student
+ *      mapped:  see put_slots()
+ *
+ *  returns:  NO_ERROR     the students of the group were added
+ *            ERR_DB_FILE  write error
+ */
+static int put_group(export_out_t *out, const student_t *recs,
+                     unsigned long long live, bool mapped) {
+  while (live != 0) {
+    int first = __builtin_ctzll(live), n;
+
+    if (out->format == SDB_FORMAT_RAW) {
+      // students next to each other go as one run
+      n = (~live >> first) == 0 ? 64 - first : __builtin_ctzll(~live >> first);
+      if (put_slots(out, &recs[first], n, mapped) != NO_ERROR)
+        return ERR_DB_FILE;
+      live &= n + first == 64 ? 0 : ~0ULL << (first + n);
+      continue;
+    }
+
+    if (SDB_EXPORT_BUF - out->len < SDB_FMT_REC_MAX &&
+        flush_out(out) != NO_ERROR)
+      return ERR_DB_FILE;
+    if (out->format == SDB_FORMAT_CSV)
+      out->len += sdb_fmt_csv(out->buf + out->len, &recs[first]);
+    else
+      out->len += sdb_fmt_jsonl(out->buf + out->len, &recs[first]);
+    live &= live - 1;
+  }
+
+  return NO_ERROR;
+}
+
+/*
+ *  export_db
+ *      fd:      an open file descriptor to the database file
+ *      out_fd:  where the students go, a file or STDOUT_FILENO
+ *      format:  SDB_FORMAT_CSV, SDB_FORMAT_JSONL or SDB_FORMAT_RAW
+ *
+ *  sdbsc --export=FMT, streams every student out in a format other
+ *  programs can read without parsing the print_db() table, see
+ *  SDB_FORMAT_CSV.  The table is walked with a full table scan a group of
+ *  slots at a time and nothing but the output buffer is held in memory,
+ *  so the size of the database does not matter.  CSV and JSONL lines are
+ *  formatted by hand (see sdb_fmt_csv()) into a SDB_EXPORT_BUF buffer
+ *  that goes out with one write() when it fills up.  A raw export is a
+ *  sdb_raw_hdr_t and then the 64 byte slots of the students, with the
+ *  mmap engine written straight from the mapping (see put_slots()).
+ *  Students come out in the order the scan finds them, by id unless the
+ *  database is hashed.  Like print_db() the table is read under a shared
+ *  lock on every id.
+ *
+ *  returns:  NO_ERROR     every student was written
+ *            ERR_DB_FILE  database file I/O issue, write error or out of
+ *                         memory, part of the export may have been written
+ *
+ *  console:  M_ERR_DB_READ on database errors and M_ERR_DB_WRITE on output
+ *            errors, nothing else
+ */
+int export_db(int fd, int out_fd, int format) {
+  export_out_t out = {0};
+  sdb_scan_t scan;
+  const student_t *recs;
+  unsigned long long live;
+  int rc, wrc = NO_ERROR;
+
+  out.fd = out_fd;
+  out.format = format;
+  out.buf = malloc(SDB_EXPORT_BUF);
+  if (out.buf == NULL) {
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
+
+  if (format == SDB_FORMAT_RAW) {
+    sdb_raw_hdr_t hdr = {SDB_RAW_MAGIC, SDB_RAW_VERSION, STUDENT_RECORD_SIZE,
+                         0};
+
+    memcpy(out.buf, &hdr, sizeof(hdr));
+    out.len = sizeof(hdr);
+  }
+
+  if (sdb_lock_ids(fd, F_RDLCK, MIN_STD_ID, 0) != NO_ERROR) {
+    free(out.buf);
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
+
+  // the header has to go before any student that is written from the
+  // mapping
+  rc = sdb_scan_open(&scan, fd);
+  if (rc == NO_ERROR && scan.mapped)
+    wrc = flush_out(&out);
+  while (rc == NO_ERROR && wrc == NO_ERROR &&
+         (rc = sdb_scan_group(&scan, &recs, &live)) > 0) {
+    wrc = put_group(&out, recs, live, scan.mapped);
+    rc = NO_ERROR;
+  }
+
+  // mapped students have to be written before the lock is dropped
+  if (rc == NO_ERROR && wrc == NO_ERROR)
+    wrc = flush_out(&out);
+  sdb_scan_close(&scan);
+  sdb_lock(fd, F_UNLCK, MIN_STD_ID, 0);
+  free(out.buf);
+
+  if (rc < 0) {
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
+  if (wrc != NO_ERROR) {
+    printf(M_ERR_DB_WRITE);
+    return ERR_DB_FILE;
+  }
+
+  return NO_ERROR;
+}
@@ -0,0 +1,434 @@
+#define _GNU_SOURCE // getline
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+/*
+ *  cmp_id
+ *
+ *  qsort() and bsearch() comparator for student ids.
+ */
+static int cmp_id(const void *a, const void *b) {
+  int ia = *(const int *)a, ib = *(const int *)b;
+
+  return (ia > ib) - (ia < ib);
+}
+
+/*
+ *  read_sorted
+ *      fd:    an open file descriptor to the database file
+ *      ids:   student ids, sorted with no duplicates
+ *      n:     number of ids, at least 1
+ *      recs:  receives the slot of each id, see sdb_read_sorted()
+ *
+ *  Reads the slots with the same lock free check get_student() uses, a
+ *  clean superblock at the same generation before and after the reads
+ *  means no student changed underneath them.  Otherwise the ids from the
+ *  lowest to the highest one are read again under a shared lock.
+ *
+ *  returns:  NO_ERROR     every slot was read
+ *            ERR_DB_FILE  database file I/O issue
+ */
+static int read_sorted(int fd, const int *ids, int n, student_t *recs) {
+  superblock_t before, after;
+  int count = ids[n - 1] - ids[0] + 1;
+  int rc;
+
+  if (sdb_sb_read(fd, &before) == NO_ERROR &&
+      before.state == SDB_STATE_CLEAN) {
+    rc = sdb_read_sorted(fd, ids, n, recs);
+    if (sdb_sb_read(fd, &after) == NO_ERROR &&
+        after.state == SDB_STATE_CLEAN &&
+        after.generation == before.generation)
+      return rc;
+  }
+
+  if (sdb_lock_ids(fd, F_RDLCK, ids[0], count) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  rc = sdb_read_sorted(fd, ids, n, recs);
+  sdb_lock(fd, F_UNLCK, ids[0], count);
+  return rc;
+}
+
+/*
+ *  find_students
+ *      fd:   an open file descriptor to the database file
+ *      ids:  student ids to look up, in the order they should be printed
+ *      n:    number of ids
+ *
+ *  The many id version of sdbsc -f.  Instead of one random read per id
+ *  the ids are deduplicated and sorted, which is also file order, and read
+ *  with sdb_read_sorted() so ids that live close together come back in a
+ *  few large reads.  The results are then printed in the order they were
+ *  asked for, one table with a row per id that was found.  With --client
+ *  each id is looked up by the daemon with get_student().
+ *
+ *  returns:  NO_ERROR        every student was found
+ *            SRCH_NOT_FOUND  some students were not found, the rest were
+ *                            printed
+ *            ERR_DB_FILE     database file I/O issue or out of memory
+ *
+ *  console:  the header and a row per student found, like print_db()
+ *            M_STD_NOT_FND_MSG for each id that was not found
+ *            M_ERR_DB_READ on database errors
+ */
+int find_students(int fd, const int *ids, int n) {
+  student_t *recs = NULL;
+  int *sorted = NULL;
+  int nsorted = 0, missing = 0;
+  bool header_printed = false;
+
+  if (n < 1)
+    return NO_ERROR;
+
+  sorted = malloc((size_t)n * sizeof(*sorted));
+  recs = malloc((size_t)n * sizeof(*recs));
+  if (sorted == NULL || recs == NULL) {
+    free(sorted);
+    free(recs);
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
+
+  // ids that can not be students never make it to the read
+  for (int i = 0; i < n; i++) {
+    if (ids[i] >= MIN_STD_ID && ids[i] <= sdb_id_max(fd))
+      sorted[nsorted++] = ids[i];
+  }
+
+  qsort(sorted, nsorted, sizeof(*sorted), cmp_id);
+  if (nsorted > 0) {
+    int kept = 1;
+
+    for (int i = 1; i < nsorted; i++) {
+      if (sorted[i] != sorted[kept - 1])
+        sorted[kept++] = sorted[i];
+    }
+    nsorted = kept;
+  }
+
+  if (sdb_remote(fd)) {
+    for (int i = 0; i < nsorted; i++) {
+      int rc = get_student(fd, sorted[i], &recs[i]);
+
+      if (rc == SRCH_NOT_FOUND) {
+        memset(&recs[i], 0, sizeof(recs[i]));
+      } else if (rc != NO_ERROR) {
+        free(sorted);
+        free(recs);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+      }
+    }
+  } else if (nsorted > 0 &&
+             read_sorted(fd, sorted, nsorted, recs) != NO_ERROR) {
+    free(sorted);
+    free(recs);
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
+
+  for (int i = 0; i < n; i++) {
+    int *pos = bsearch(&ids[i], sorted, nsorted, sizeof(*sorted), cmp_id);
+    student_t *s = pos == NULL ? NULL : &recs[pos - sorted];
+
+    // an empty slot or one that holds somebody else is not a match
+    if (s == NULL || s->id != ids[i]) {
+      printf(M_STD_NOT_FND_MSG, ids[i]);
+      missing++;
+      continue;
+    }
+
+    if (!header_printed) {
+      printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+      header_printed = true;
+    }
+
+    float calculated_gpa = s->gpa / 100.0;
+
+    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname,
+           calculated_gpa);
+  }
+
+  free(sorted);
+  free(recs);
+  return missing > 0 ? SRCH_NOT_FOUND : NO_ERROR;
+}
+
+/*
+ *  find_file
+ *      fd:  an open file descriptor to the database file
+ *      in:  stream with one student id per line, a file or stdin
+ *
+ *  sdbsc -F, reads a list of ids (a class list, for example) and looks
+ *  them all up with find_students().  Blank lines and lines starting with
+ *  # are ignored, other lines that are not a number are reported and
+ *  skipped.
+ *
+ *  returns:  see find_students()
+ *            ERR_DB_FILE  the input could not be read
+ *
+ *  console:  see find_students()
+ *            M_FIND_BAD_LINE for each skipped line
+ *            M_ERR_FIND_READ if the input could not be read
+ */
+int find_file(int fd, FILE *in) {
+  char *line = NULL, *end;
+  size_t cap = 0;
+  int *ids = NULL;
+  int n = 0, max = 0, lineno = 0, rc;
+  bool oom = false;
+
+  while (getline(&line, &cap, in) != -1) {
+    char *p = line;
+    long id;
+
+    lineno++;
+    while (isspace((unsigned char)*p))
+      p++;
+    if (*p == '\0' || *p == '#')
+      continue;
+
+    errno = 0;
+    id = strtol(p, &end, 10);
+    while (isspace((unsigned char)*end))
+      end++;
+    if (end == p || *end != '\0' || errno != 0 || id < -2147483647L ||
+        id > 2147483647L) {
+      printf(M_FIND_BAD_LINE, lineno);
+      continue;
+    }
+
+    if (n == max) {
+      int *grown = realloc(ids, (size_t)(max == 0 ? 256 : max * 2) *
+                                    sizeof(*ids));
+
+      if (grown == NULL) {
+        oom = true;
+        break;
+      }
+      ids = grown;
+      max = max == 0 ? 256 : max * 2;
+    }
+    ids[n++] = (int)id;
+  }
+  free(line);
+
+  if (ferror(in) || oom) {
+    free(ids);
+    printf(M_ERR_FIND_READ);
+    return ERR_DB_FILE;
+  }
+
+  rc = find_students(fd, ids, n);
+  free(ids);
+  return rc;
+}
+
+/*
+ *  cmp_name
+ *
+ *  qsort() comparator, orders students by last name and then id.
+ */
+static int cmp_name(const void *a, const void *b) {
+  const student_t *sa = a, *sb = b;
+  int c = strncmp(sa->lname, sb->lname, sizeof(sa->lname));
+
+  if (c != 0)
+    return c;
+
+  return (sa->id > sb->id) - (sa->id < sb->id);
+}
+
+/*
+ *  name_matches
+ *      s:       a student
+ *      key:     last name cut to fit student_t
+ *      prefix:  match last names starting with key
+ *
+ *  returns:  true if s is one of the students find_name() looks for
+ */
+static bool name_matches(const student_t *s, const char *key, bool prefix) {
+  return strncmp(s->lname, key, prefix ? strlen(key) : sizeof(s->lname)) ==
+         0;
+}
+
+/*
+ *  scan_name
+ *      fd:      an open file descriptor to the database file
+ *      key:     last name cut to fit student_t
+ *      prefix:  match last names starting with key
+ *      **out:   receives a malloc()'d array of the matching students
+ *      *nout:   receives the number of matches
+ *
+ *  Finds the students with a full table scan, for when the last name index
+ *  can not be used.
+ *
+ *  returns:  NO_ERROR     *out holds the matches
+ *            ERR_DB_FILE  database file I/O issue or out of memory
+ */
+static int scan_name(int fd, const char *key, bool prefix, student_t **out,
+                     int *nout) {
+  sdb_scan_t scan;
+  const student_t *rec;
+  int cap = 0, rc;
+
+  *out = NULL;
+  *nout = 0;
+
+  rc = sdb_scan_open(&scan, fd);
+  while (rc == NO_ERROR && (rc = sdb_scan_next(&scan, &rec)) == 1) {
+    rc = NO_ERROR;
+    if (!name_matches(rec, key, prefix))
+      continue;
+
+    if (*nout == cap) {
+      student_t *grown;
+
+      cap = cap == 0 ? 256 : cap * 2;
+      grown = realloc(*out, (size_t)cap * sizeof(*grown));
+      if (grown == NULL) {
+        rc = ERR_DB_FILE;
+        break;
+      }
+      *out = grown;
+    }
+    (*out)[(*nout)++] = *rec;
+  }
+  sdb_scan_close(&scan);
+
+  if (rc < 0) {
+    free(*out);
+    *out = NULL;
+    *nout = 0;
+    return ERR_DB_FILE;
+  }
+
+  return NO_ERROR;
+}
+
+/*
+ *  index_name
+ *      fd:      an open file descriptor to the database file
+ *      key:     last name cut to fit student_t
+ *      prefix:  match last names starting with key
+ *      **out:   receives a malloc()'d array of the matching students
+ *      *nout:   receives the number of matches
+ *
+ *  Finds the students through the last name index, see sdb_name_find().
+ *  The index only hands out ids, their slots are then read in file order
+ *  with read_sorted() and every student is checked against key again, so
+ *  a student that changed since the index was searched is left out
+ *  rather than printed wrong.
+ *
+ *  returns:  NO_ERROR     *out holds the matches
+ *            ERR_DB_FILE  the index could not be used, database file I/O
+ *                         issue or out of memory
+ */
+static int index_name(int fd, const char *key, bool prefix, student_t **out,
+                      int *nout) {
+  sdb_name_ent_t *ents;
+  student_t *recs;
+  int *ids;
+  int n;
+
+  *out = NULL;
+  *nout = 0;
+  if (sdb_name_find(fd, key, prefix, &ents, &n) != NO_ERROR)
+    return ERR_DB_FILE;
+  if (n == 0)
+    return NO_ERROR;
+
+  ids = malloc((size_t)n * sizeof(*ids));
+  recs = malloc((size_t)n * sizeof(*recs));
+  if (ids == NULL || recs == NULL) {
+    free(ents);
+    free(ids);
+    free(recs);
+    return ERR_DB_FILE;
+  }
+
+  for (int i = 0; i < n; i++)
+    ids[i] = ents[i].id;
+  free(ents);
+  qsort(ids, n, sizeof(*ids), cmp_id);
+
+  if (read_sorted(fd, ids, n, recs) != NO_ERROR) {
+    free(ids);
+    free(recs);
+    return ERR_DB_FILE;
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (recs[i].id == ids[i] && name_matches(&recs[i], key, prefix))
+      recs[(*nout)++] = recs[i];
+  }
+
+  free(ids);
+  *out = recs;
+  return NO_ERROR;
+}
+
+/*
+ *  find_name
+ *      fd:      an open file descriptor to the database file
+ *      name:    last name to look for
+ *      prefix:  find every last name that starts with name instead
+ *
+ *  sdbsc -n, prints every student with the given last name (or, with
+ *  --prefix, every last name starting with it) sorted by last name and id.
+ *  The students are found with the last name index instead of a full
+ *  table scan, which is only used if the index is not available.
+ *
+ *  returns:  NO_ERROR        at least one student was found
+ *            SRCH_NOT_FOUND  no student has that last name
+ *            ERR_DB_FILE     database file I/O issue or out of memory
+ *
+ *  console:  the header and a row per student found, like print_db()
+ *            M_NAME_NOT_FND if there are none
+ *            M_ERR_DB_READ on database errors
+ */
+int find_name(int fd, const char *name, bool prefix) {
+  char key[sizeof(((student_t *)0)->lname)] = {0};
+  student_t *recs;
+  int n;
+
+  // last names are stored cut to fit student_t, so is the one we look for
+  strncpy(key, name, sizeof(key) - 1);
+
+  if (index_name(fd, key, prefix, &recs, &n) != NO_ERROR &&
+      scan_name(fd, key, prefix, &recs, &n) != NO_ERROR) {
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
+
+  if (n == 0) {
+    free(recs);
+    printf(M_NAME_NOT_FND, name);
+    return SRCH_NOT_FOUND;
+  }
+
+  qsort(recs, n, sizeof(*recs), cmp_name);
+
+  printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+  for (int i = 0; i < n; i++) {
+    float calculated_gpa = recs[i].gpa / 100.0;
+
+    printf(STUDENT_PRINT_FMT_STRING, recs[i].id, recs[i].fname,
+           recs[i].lname, calculated_gpa);
+  }
+
+  free(recs);
+  return NO_ERROR;
+}
@@ -0,0 +1,287 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+// gpa values whose fixed point formatting is checked to match "%.2f" of the
+// float print_student() computes.  Anything outside goes through snprintf()
+#define FMT_GPA_LIMIT 1000000
+
+/*
+ *  put_field
+ *      out:    where the field is written
+ *      s:      string field of a student, not necessarily NUL terminated
+ *      width:  size of the field, and the %-<width>.<width>s width
+ *
+ *  returns:  out just past the field, which is always width bytes
+ */
+static char *put_field(char *out, const char *s, size_t width) {
+  size_t len = strnlen(s, width);
+
+  memcpy(out, s, len);
+  memset(out + len, ' ', width - len);
+  return out + width;
+}
+
+/*
+ *  put_uint
+ *      out:  where the digits are written
+ *      v:    number to write
+ *
+ *  returns:  out just past the last digit
+ */
+static char *put_uint(char *out, unsigned int v) {
+  char digits[10];
+  int n = 0;
+
+  do {
+    digits[n++] = (char)('0' + v % 10);
+    v /= 10;
+  } while (v != 0);
+
+  while (n > 0)
+    *out++ = digits[--n];
+
+  return out;
+}
+
+/*
+ *  sdb_fmt_row
+ *      out:  buffer of at least SDB_FMT_ROW_MAX bytes
+ *      s:    the student to format
+ *
+ *  Formats a student the way printf(STUDENT_PRINT_FMT_STRING, ...) does in
+ *  print_db(), byte for byte, without going through stdio.  The id is
+ *  converted by hand, the names are copied and padded, and the gpa is
+ *  written as fixed point: gpa / 100, a dot and gpa % 100 as two digits,
+ *  which is exactly what "%-3.2f" prints for gpa / 100.0 rounded to a float
+ *  as long as the gpa is not huge.  The rare gpa that is falls back to
+ *  snprintf().  The result is not NUL terminated.
+ *
+ *  returns:  number of bytes written to out
+ */
+size_t sdb_fmt_row(char *out, const student_t *s) {
+  char *p = out, *start;
+  unsigned int gpa;
+  size_t len;
+
+  if (s->gpa <= -FMT_GPA_LIMIT || s->gpa >= FMT_GPA_LIMIT) {
+    float calculated_gpa = s->gpa / 100.0;
+    int n = snprintf(out, SDB_FMT_ROW_MAX, STUDENT_PRINT_FMT_STRING, s->id,
+                     s->fname, s->lname, calculated_gpa);
+
+    return n < 0 ? 0 : (size_t)n < SDB_FMT_ROW_MAX ? (size_t)n
+                                                    : SDB_FMT_ROW_MAX - 1;
+  }
+
+  // %-6d
+  start = p;
+  if (s->id < 0) {
+    *p++ = '-';
+    p = put_uint(p, 0U - (unsigned int)s->id);
+  } else {
+    p = put_uint(p, (unsigned int)s->id);
+  }
+  len = (size_t)(p - start);
+  if (len < 6) {
+    memset(p, ' ', 6 - len);
+    p += 6 - len;
+  }
+  *p++ = ' ';
+
+  // %-24.24s %-32.32s
+  p = put_field(p, s->fname, sizeof(s->fname));
+  *p++ = ' ';
+  p = put_field(p, s->lname, sizeof(s->lname));
+  *p++ = ' ';
+
+  // %-3.2f, always at least 4 characters so the width never pads
+  if (s->gpa < 0) {
+    *p++ = '-';
+    gpa = 0U - (unsigned int)s->gpa;
+  } else {
+    gpa = (unsigned int)s->gpa;
+  }
+  p = put_uint(p, gpa / 100);
+  *p++ = '.';
+  *p++ = (char)('0' + gpa % 100 / 10);
+  *p++ = (char)('0' + gpa % 10);
+  *p++ = '\n';
+
+  return (size_t)(p - out);
+}
+
+/*
+ *  put_int
+ *      out:  where the number is written
+ *      v:    number to write, may be negative
+ *
+ *  returns:  out just past the last digit
+ */
+static char *put_int(char *out, int v) {
+  if (v < 0) {
+    *out++ = '-';
+    return put_uint(out, 0U - (unsigned int)v);
+  }
+
+  return put_uint(out, (unsigned int)v);
+}
+
+/*
+ *  put_csv
+ *      out:    where the field is written
+ *      s:      string field of a student, not necessarily NUL terminated
+ *      width:  size of the field
+ *
+ *  Writes s as a CSV field, in double quotes with every quote doubled if
+ *  it holds a comma, a quote or a line break, as is otherwise.
+ *
+ *  returns:  out just past the field
+ */
+static char *put_csv(char *out, const char *s, size_t width) {
+  size_t len = strnlen(s, width);
+
+  if (strcspn(s, ",\"\r\n") >= len) {
+    memcpy(out, s, len);
+    return out + len;
+  }
+
+  *out++ = '"';
+  for (size_t i = 0; i < len; i++) {
+    if (s[i] == '"')
+      *out++ = '"';
+    *out++ = s[i];
+  }
+  *out++ = '"';
+  return out;
+}
+
+/*
+ *  put_json
+ *      out:    where the string is written
+ *      s:      string field of a student, not necessarily NUL terminated
+ *      width:  size of the field
+ *
+ *  Writes s as a JSON string, quotes, backslashes and control characters
+ *  are escaped.  Other bytes are copied as they are, names are expected to
+ *  be UTF-8 already.
+ *
+ *  returns:  out just past the closing quote
+ */
+static char *put_json(char *out, const char *s, size_t width) {
+  static const char hex[] = "0123456789abcdef";
+  size_t len = strnlen(s, width);
+
+  *out++ = '"';
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)s[i];
+
+    if (c == '"' || c == '\\') {
+      *out++ = '\\';
+      *out++ = (char)c;
+    } else if (c == '\n') {
+      *out++ = '\\';
+      *out++ = 'n';
+    } else if (c == '\t') {
+      *out++ = '\\';
+      *out++ = 't';
+    } else if (c < 0x20) {
+      memcpy(out, "\\u00", 4);
+      out[4] = hex[c >> 4];
+      out[5] = hex[c & 0xf];
+      out += 6;
+    } else {
+      *out++ = (char)c;
+    }
+  }
+  *out++ = '"';
+  return out;
+}
+
+/*
+ *  sdb_fmt_csv
+ *      out:  buffer of at least SDB_FMT_REC_MAX bytes
+ *      s:    the student to format
+ *
+ *  Formats a student as an id,first_name,last_name,gpa line for
+ *  sdbsc --export=csv, the gpa as the integer that is stored so the line
+ *  can be loaded again with sdbsc -B.  The result is not NUL terminated.
+ *
+ *  returns:  number of bytes written to out
+ */
+size_t sdb_fmt_csv(char *out, const student_t *s) {
+  char *p = out;
+
+  p = put_int(p, s->id);
+  *p++ = ',';
+  p = put_csv(p, s->fname, sizeof(s->fname));
+  *p++ = ',';
+  p = put_csv(p, s->lname, sizeof(s->lname));
+  *p++ = ',';
+  p = put_int(p, s->gpa);
+  *p++ = '\n';
+
+  return (size_t)(p - out);
+}
+
+/*
+ *  sdb_fmt_jsonl
+ *      out:  buffer of at least SDB_FMT_REC_MAX bytes
+ *      s:    the student to format
+ *
+ *  Formats a student as one JSON object on a line of its own for
+ *  sdbsc --export=jsonl, {"id":1,"fname":"..","lname":"..","gpa":341}.
+ *  The result is not NUL terminated.
+ *
+ *  returns:  number of bytes written to out
+ */
+size_t sdb_fmt_jsonl(char *out, const student_t *s) {
+  char *p = out;
+
+  memcpy(p, "{\"id\":", 6);
+  p = put_int(p + 6, s->id);
+  memcpy(p, ",\"fname\":", 9);
+  p = put_json(p + 9, s->fname, sizeof(s->fname));
+  memcpy(p, ",\"lname\":", 9);
+  p = put_json(p + 9, s->lname, sizeof(s->lname));
+  memcpy(p, ",\"gpa\":", 7);
+  p = put_int(p + 7, s->gpa);
+  *p++ = '}';
+  *p++ = '\n';
+
+  return (size_t)(p - out);
+}
+
+/*
+ *  sdb_write_all
+ *      fd:   file descriptor to write to, for example STDOUT_FILENO
+ *      buf:  bytes to write
+ *      len:  number of bytes
+ *
+ *  write() that keeps going after short writes and interrupts.  Anything
+ *  already printed with stdio has to be flushed first.
+ *
+ *  returns:  NO_ERROR     everything was written
+ *            ERR_DB_FILE  write error
+ */
+int sdb_write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return ERR_DB_FILE;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+
+  return NO_ERROR;
+}
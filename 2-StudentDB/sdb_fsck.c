@@ -0,0 +1,274 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+// one part of sdbsc --fsck, handed to the thread that checks it
+//  fd:     the database
+//  first:  first page of the part
+//  end:    page after the last one
+//  bad:    pages of the part that do not match their checksum, nbad of
+//          them in order
+//  cap:    entries allocated for bad
+//  rc:     NO_ERROR or ERR_DB_FILE
+typedef struct fsck_part {
+  int fd;
+  off_t first;
+  off_t end;
+  off_t *bad;
+  int nbad;
+  int cap;
+  int rc;
+} fsck_part_t;
+
+/*
+ *  check_part
+ *      p:  the fsck_part_t to check
+ *
+ *  Thread body, collects the pages of one part that do not match their
+ *  checksum, see sdb_sum_verify().
+ */
+static void *check_part(void *p) {
+  fsck_part_t *part = p;
+  off_t page = part->first;
+
+  while ((page = sdb_sum_verify(part->fd, page, part->end)) < part->end) {
+    if (page < 0) {
+      part->rc = ERR_DB_FILE;
+      break;
+    }
+
+    if (part->nbad == part->cap) {
+      int cap = part->cap == 0 ? 64 : part->cap * 2;
+      off_t *grown = realloc(part->bad, (size_t)cap * sizeof(*grown));
+
+      if (grown == NULL) {
+        part->rc = ERR_DB_FILE;
+        break;
+      }
+      part->bad = grown;
+      part->cap = cap;
+    }
+    part->bad[part->nbad++] = page++;
+  }
+
+  return NULL;
+}
+
+/*
+ *  report_meta
+ *      lo, hi:       a run of corrupt pages
+ *      first, last:  pages of a region of the file that is not students
+ *      what:         name of the region
+ *
+ *  console:  M_FSCK_BAD_META if the run overlaps the region
+ */
+static void report_meta(off_t lo, off_t hi, off_t first, off_t last,
+                        const char *what) {
+  if (lo > last || hi < first)
+    return;
+
+  printf(M_FSCK_BAD_META, (long long)(lo > first ? lo : first),
+         (long long)(hi < last ? hi : last), what);
+}
+
+/*
+ *  report_slots
+ *      h:       an attached handle of a sparse or dense database
+ *      lo, hi:  a run of corrupt pages
+ *
+ *  Turns the slots of the pages into student ids, a sparse file uses the
+ *  slot numbers and a dense one the id index at the end of the file.  The
+ *  index is read straight from the file, it may be corrupt too.
+ *
+ *  console:  M_FSCK_BAD_IDS with the first and last id of the run
+ */
+static void report_slots(sdb_handle_t *h, off_t lo, off_t hi) {
+  const off_t per_page = SDB_SUM_PAGE / STUDENT_RECORD_SIZE;
+  off_t first = lo * per_page, last = (hi + 1) * per_page - 1;
+  unsigned int ids[2];
+
+  // slot 0 is the superblock
+  if (first < MIN_STD_ID)
+    first = MIN_STD_ID;
+  ids[0] = (unsigned int)first;
+  ids[1] = (unsigned int)last;
+
+  if (h->layout == SDB_LAYOUT_DENSE) {
+    off_t index = (off_t)(h->nslots + 1) * STUDENT_RECORD_SIZE;
+
+    if (first > h->nslots)
+      return;
+    if (last > h->nslots)
+      last = h->nslots;
+    if (pread(h->fd, &ids[0], sizeof(ids[0]),
+              index + (first - 1) * (off_t)sizeof(ids[0])) != sizeof(ids[0]) ||
+        pread(h->fd, &ids[1], sizeof(ids[1]),
+              index + (last - 1) * (off_t)sizeof(ids[1])) != sizeof(ids[1]))
+      ids[0] = ids[1] = 0;
+  }
+
+  printf(M_FSCK_BAD_IDS, (long long)lo, (long long)hi, (int)ids[0],
+         (int)ids[1]);
+}
+
+/*
+ *  report_run
+ *      h:       an attached handle
+ *      lo, hi:  a run of corrupt pages
+ *
+ *  Says what the corrupt pages hold: the superblock, students (by id),
+ *  the id index of a dense file or the directory and buckets of a hashed
+ *  one.
+ *
+ *  console:  M_FSCK_BAD_META, M_FSCK_BAD_IDS or M_FSCK_BAD_BUCKETS, one or
+ *            more of them
+ */
+static void report_run(sdb_handle_t *h, off_t lo, off_t hi) {
+  report_meta(lo, hi, 0, 0, "superblock");
+
+  if (h->layout == SDB_LAYOUT_HASH) {
+    off_t data = SDB_HASH_DATA_OFF / SDB_SUM_PAGE;
+
+    report_meta(lo, hi, SDB_HASH_DIR_OFF / SDB_SUM_PAGE, data - 1,
+                "hash directory");
+    if (hi >= data)
+      printf(M_FSCK_BAD_BUCKETS, (long long)(lo > data ? lo : data),
+             (long long)hi,
+             (int)(((lo > data ? lo : data) - data) * SDB_SUM_PAGE /
+                   SDB_HASH_BUCKET),
+             (int)((hi - data + 1) * SDB_SUM_PAGE / SDB_HASH_BUCKET - 1));
+    return;
+  }
+
+  report_slots(h, lo, hi);
+
+  if (h->layout == SDB_LAYOUT_DENSE) {
+    off_t index = (off_t)(h->nslots + 1) * STUDENT_RECORD_SIZE;
+    off_t index_end = index + (off_t)h->nslots * sizeof(unsigned int);
+
+    if (h->nslots > 0)
+      report_meta(lo, hi, index / SDB_SUM_PAGE,
+                  (index_end - 1) / SDB_SUM_PAGE, "dense id index");
+  }
+}
+
+/*
+ *  fsck_db
+ *      fd:  an open file descriptor to the database file
+ *
+ *  sdbsc --fsck, checks every page of the database file against the page
+ *  checksums kept in its .sum sidecar (see sdb_sum.c) and reports the
+ *  ones that were damaged behind the database's back.  The pages are cut
+ *  into sdb_opts.jobs ranges that are checked by their own threads, part 0
+ *  on the calling thread, and each thread reads SDB_SUM_CHUNK pages at a
+ *  time, see sdb_sum_verify().  Runs of corrupt pages are reported with
+ *  the students (or the metadata) they hold, so the students can be
+ *  restored from a backup or an export.  The whole table is read under a
+ *  shared lock on every id, like print_db().
+ *
+ *  returns:  NO_ERROR     every page matches its checksum
+ *            ERR_DB_OP    some pages are corrupt
+ *            ERR_DB_FILE  database file I/O issue, out of memory or the
+ *                         database has no current checksums
+ *
+ *  console:  M_FSCK_BAD_META, M_FSCK_BAD_IDS or M_FSCK_BAD_BUCKETS for
+ *            each run of corrupt pages, then M_FSCK_SUMMARY
+ *            M_ERR_FSCK_NO_SUMS or M_ERR_DB_READ on errors
+ */
+int fsck_db(int fd) {
+  fsck_part_t parts[SDB_MAX_JOBS];
+  pthread_t threads[SDB_MAX_JOBS];
+  bool started[SDB_MAX_JOBS] = {false};
+  sdb_handle_t *h = sdb_handle(fd);
+  off_t size, pages, per, lo = -1, hi = -1;
+  long long corrupt = 0;
+  int n, rc = NO_ERROR;
+
+  if (h == NULL || sdb_lock_ids(fd, F_RDLCK, MIN_STD_ID, 0) != NO_ERROR) {
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
+
+  if (!sdb_sum_ready(fd)) {
+    sdb_lock(fd, F_UNLCK, MIN_STD_ID, 0);
+    printf(M_ERR_FSCK_NO_SUMS);
+    return ERR_DB_FILE;
+  }
+
+  size = lseek(fd, 0, SEEK_END);
+  if (size == -1 || sdb_refresh(fd) != NO_ERROR) {
+    sdb_lock(fd, F_UNLCK, MIN_STD_ID, 0);
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
+
+  pages = (size + SDB_SUM_PAGE - 1) / SDB_SUM_PAGE;
+  n = sdb_opts.jobs < 1 ? 1 : sdb_opts.jobs;
+  if (n > SDB_MAX_JOBS)
+    n = SDB_MAX_JOBS;
+  if (pages < n)
+    n = pages < 1 ? 1 : (int)pages;
+  per = (pages + n - 1) / n;
+
+  for (int i = 0; i < n; i++) {
+    memset(&parts[i], 0, sizeof(parts[i]));
+    parts[i].fd = fd;
+    parts[i].first = (off_t)i * per < pages ? (off_t)i * per : pages;
+    parts[i].end = (off_t)(i + 1) * per < pages ? (off_t)(i + 1) * per : pages;
+    parts[i].rc = NO_ERROR;
+  }
+
+  // if a thread cannot be started its part runs here instead
+  for (int i = 1; i < n; i++)
+    started[i] =
+        pthread_create(&threads[i], NULL, check_part, &parts[i]) == 0;
+
+  check_part(&parts[0]);
+  for (int i = 1; i < n; i++) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    else
+      check_part(&parts[i]);
+  }
+
+  // parts are in page order, so are their pages
+  for (int i = 0; i < n; i++) {
+    if (parts[i].rc != NO_ERROR)
+      rc = ERR_DB_FILE;
+
+    for (int k = 0; rc == NO_ERROR && k < parts[i].nbad; k++) {
+      off_t page = parts[i].bad[k];
+
+      if (lo != -1 && page != hi + 1) {
+        report_run(h, lo, hi);
+        lo = -1;
+      }
+      if (lo == -1)
+        lo = page;
+      hi = page;
+      corrupt++;
+    }
+    free(parts[i].bad);
+  }
+  if (rc == NO_ERROR && lo != -1)
+    report_run(h, lo, hi);
+
+  sdb_lock(fd, F_UNLCK, MIN_STD_ID, 0);
+
+  if (rc != NO_ERROR) {
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
+
+  printf(M_FSCK_SUMMARY, (long long)pages, n, corrupt);
+  return corrupt > 0 ? ERR_DB_OP : NO_ERROR;
+}
@@ -0,0 +1,504 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+// student slots in one bucket
+#define BUCKET_SLOTS (int)(SDB_HASH_BUCKET / sizeof(student_t))
+
+// directory entries copied at a time when the directory doubles
+#define DIR_CHUNK (int)(SDB_SCAN_ALIGN / sizeof(unsigned int))
+
+/*
+ *  hash_id
+ *      id:  student id
+ *
+ *  Ids tend to be handed out in runs, so they are mixed (this is the
+ *  splitmix64 finalizer) before the low bits pick a directory entry.  The
+ *  mix is reversible, two ids never share all 64 bits.
+ *
+ *  returns:  the hash of id
+ */
+static unsigned long long hash_id(int id) {
+  unsigned long long x = (unsigned int)id;
+
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+/*
+ *  bucket_off
+ *      b:  bucket number
+ *
+ *  returns:  file offset of the first slot of bucket b
+ */
+static off_t bucket_off(unsigned int b) {
+  return SDB_HASH_DATA_OFF + (off_t)b * SDB_HASH_BUCKET;
+}
+
+/*
+ *  read_zero
+ *      fd:      file descriptor of a hashed database file
+ *      buf:     where the bytes are copied
+ *      len:     number of bytes to read
+ *      offset:  file offset to read from
+ *
+ *  Like sdb_read_at(), but whatever lies past the end of the file reads
+ *  back as zeros, the same as the holes a hashed file is full of.  Buckets
+ *  made by the running mutation are only in the write-ahead log so far,
+ *  the log is patched over the zeros as well.
+ *
+ *  returns:  NO_ERROR     buf holds len bytes
+ *            ERR_DB_FILE  database file I/O issue
+ */
+static int read_zero(int fd, void *buf, size_t len, off_t offset) {
+  ssize_t bytes_read = sdb_read_at(fd, buf, len, offset);
+
+  if (bytes_read == -1)
+    return ERR_DB_FILE;
+
+  if ((size_t)bytes_read < len) {
+    memset((char *)buf + bytes_read, 0, len - (size_t)bytes_read);
+    if (sdb_wal_active(fd))
+      sdb_wal_overlay(fd, buf, len, offset);
+  }
+  return NO_ERROR;
+}
+
+/*
+ *  locate
+ *      fd:      file descriptor of a hashed database file
+ *      id:      student id to look up
+ *      *sb:     receives the superblock, it has the directory depth
+ *      *entry:  receives the directory entry of id
+ *      *b:      receives the bucket the entry points to
+ *      bucket:  receives the BUCKET_SLOTS slots of that bucket
+ *
+ *  Finds the bucket id hashes to, a directory entry read and a bucket
+ *  read.  Inside a mutation both include the writes logged so far, so
+ *  splits of the running mutation are seen.
+ *
+ *  returns:  <slot>        the slot of bucket that holds id
+ *            BUCKET_SLOTS  id is not in the database
+ *            ERR_DB_FILE   database file I/O issue or a damaged directory
+ */
+static int locate(int fd, int id, superblock_t *sb, unsigned int *entry,
+                  unsigned int *b, student_t *bucket) {
+  int slot;
+
+  if (sdb_sb_read(fd, sb) != NO_ERROR || sb->hash_depth < 0 ||
+      sb->hash_depth > SDB_HASH_MAX_DEPTH)
+    return ERR_DB_FILE;
+
+  *entry = (unsigned int)(hash_id(id) & ((1ULL << sb->hash_depth) - 1));
+  if (read_zero(fd, b, sizeof(*b),
+                SDB_HASH_DIR_OFF + (off_t)*entry * sizeof(*b)) != NO_ERROR ||
+      *b >= (unsigned int)sb->nslots ||
+      read_zero(fd, bucket, SDB_HASH_BUCKET, bucket_off(*b)) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  for (slot = 0; slot < BUCKET_SLOTS; slot++) {
+    if (bucket[slot].id == id)
+      break;
+  }
+
+  return slot;
+}
+
+/*
+ *  grow_dir
+ *      fd:   file descriptor of a hashed database file
+ *      *sb:  the superblock, its hash_depth goes up by one
+ *
+ *  Doubles the directory by copying it after itself, every bucket is then
+ *  pointed to by twice as many entries.  The caller writes *sb.
+ *
+ *  returns:  NO_ERROR     the directory was doubled
+ *            ERR_DB_FILE  database file I/O issue
+ */
+static int grow_dir(int fd, superblock_t *sb) {
+  unsigned int chunk[DIR_CHUNK];
+  off_t half = (off_t)sizeof(unsigned int) << sb->hash_depth;
+
+  for (off_t off = 0; off < half; off += sizeof(chunk)) {
+    size_t len = half - off < (off_t)sizeof(chunk) ? (size_t)(half - off)
+                                                    : sizeof(chunk);
+
+    if (read_zero(fd, chunk, len, SDB_HASH_DIR_OFF + off) != NO_ERROR ||
+        sdb_write_at(fd, chunk, len, SDB_HASH_DIR_OFF + half + off) !=
+            NO_ERROR)
+      return ERR_DB_FILE;
+  }
+
+  sb->hash_depth++;
+  return NO_ERROR;
+}
+
+/*
+ *  split
+ *      fd:      file descriptor of a hashed database file
+ *      *sb:     the superblock from locate()
+ *      entry:   a directory entry pointing to the full bucket
+ *      b:       the full bucket
+ *      bucket:  its slots
+ *
+ *  Splits a full bucket in two.  The students whose hash has the next bit
+ *  (the local depth of the bucket) set move to a new bucket at the end of
+ *  the file and the directory entries that pick that bit are pointed at
+ *  it.  When the bucket was already as deep as the directory the directory
+ *  doubles first.  Only this bucket is touched, nothing else moves.
+ *
+ *  returns:  NO_ERROR     the bucket was split
+ *            ERR_DB_FILE  database file I/O issue, or the bucket is as deep
+ *                         as SDB_HASH_MAX_DEPTH allows
+ */
+static int split(int fd, superblock_t *sb, unsigned int entry, unsigned int b,
+                 const student_t *bucket) {
+  student_t keep[BUCKET_SLOTS], move[BUCKET_SLOTS];
+  unsigned int nb = (unsigned int)sb->nslots, step;
+  unsigned char depth;
+  int nkeep = 0, nmove = 0;
+
+  if (read_zero(fd, &depth, sizeof(depth), SDB_HASH_DEPTH_OFF + b) !=
+          NO_ERROR ||
+      depth >= SDB_HASH_MAX_DEPTH || nb >= 1U << SDB_HASH_MAX_DEPTH)
+    return ERR_DB_FILE;
+
+  if (depth == sb->hash_depth && grow_dir(fd, sb) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  memset(keep, 0, sizeof(keep));
+  memset(move, 0, sizeof(move));
+  for (int i = 0; i < BUCKET_SLOTS; i++) {
+    if (bucket[i].id == DELETED_STUDENT_ID)
+      continue;
+    if ((hash_id(bucket[i].id) >> depth) & 1)
+      move[nmove++] = bucket[i];
+    else
+      keep[nkeep++] = bucket[i];
+  }
+
+  depth++;
+  if (sdb_write_at(fd, move, sizeof(move), bucket_off(nb)) != NO_ERROR ||
+      sdb_write_at(fd, keep, sizeof(keep), bucket_off(b)) != NO_ERROR ||
+      sdb_write_at(fd, &depth, sizeof(depth), SDB_HASH_DEPTH_OFF + b) !=
+          NO_ERROR ||
+      sdb_write_at(fd, &depth, sizeof(depth), SDB_HASH_DEPTH_OFF + nb) !=
+          NO_ERROR)
+    return ERR_DB_FILE;
+
+  // the entries of b that have the new bit set, every step-th one from the
+  // first of them, now belong to the new bucket
+  step = 1U << depth;
+  for (unsigned int e = (entry & ((step >> 1) - 1)) | step >> 1;
+       e < 1U << sb->hash_depth; e += step) {
+    if (sdb_write_at(fd, &nb, sizeof(nb),
+                     SDB_HASH_DIR_OFF + (off_t)e * sizeof(nb)) != NO_ERROR)
+      return ERR_DB_FILE;
+  }
+
+  sb->nslots++;
+  return sdb_sb_write(fd, sb);
+}
+
+/*
+ *  sdb_hash_read
+ *      fd:  file descriptor of a hashed database file
+ *      id:  student id to look up
+ *      *s:  where the slot holding id is copied
+ *
+ *  The SDB_LAYOUT_HASH version of sdb_read_slot(), one directory entry and
+ *  one bucket are read no matter how many students there are.
+ *
+ *  returns:  STUDENT_RECORD_SIZE  the student was copied into *s
+ *            0                    id is not in the database
+ *            -1                   database file I/O issue
+ */
+ssize_t sdb_hash_read(int fd, int id, student_t *s) {
+  student_t bucket[BUCKET_SLOTS];
+  superblock_t sb;
+  unsigned int entry, b;
+  int slot;
+
+  if (id < MIN_STD_ID)
+    return 0;
+
+  slot = locate(fd, id, &sb, &entry, &b, bucket);
+  if (slot < 0)
+    return -1;
+  if (slot == BUCKET_SLOTS)
+    return 0;
+
+  *s = bucket[slot];
+  return STUDENT_RECORD_SIZE;
+}
+
+/*
+ *  sdb_hash_offset
+ *      fd:  file descriptor of a hashed database file
+ *      id:  student id to look up
+ *
+ *  Finds where the slot of id is in the file so a single field of it can
+ *  be written, see sdb_write_field().  The slot stays put until the bucket
+ *  splits, which only happens when a student is added.
+ *
+ *  returns:  <offset>     file offset of the slot holding id
+ *            0            id is not in the database
+ *            ERR_DB_FILE  database file I/O issue
+ */
+off_t sdb_hash_offset(int fd, int id) {
+  student_t bucket[BUCKET_SLOTS];
+  superblock_t sb;
+  unsigned int entry, b;
+  int slot;
+
+  if (id < MIN_STD_ID)
+    return 0;
+
+  slot = locate(fd, id, &sb, &entry, &b, bucket);
+  if (slot < 0)
+    return ERR_DB_FILE;
+  if (slot == BUCKET_SLOTS)
+    return 0;
+
+  return bucket_off(b) + (off_t)slot * STUDENT_RECORD_SIZE;
+}
+
+/*
+ *  sdb_hash_write
+ *      fd:  file descriptor of a hashed database file
+ *      id:  student id whose slot is written
+ *      *s:  the student to store, EMPTY_STUDENT_RECORD to delete id
+ *
+ *  The SDB_LAYOUT_HASH version of sdb_write_slot().  A student already in
+ *  the database is overwritten in its slot, a new one takes the first free
+ *  slot of its bucket, splitting the bucket (see split()) for as long as
+ *  it is full.  A split moves students of other ids, the caller must hold
+ *  the lock of every id, which sdb_lock() hands out for any id of a hashed
+ *  file.  Deleting an id that is not there does nothing.
+ *
+ *  returns:  NO_ERROR     the slot was written
+ *            ERR_DB_FILE  database file I/O issue or the bucket can not be
+ *                         split any more
+ */
+int sdb_hash_write(int fd, int id, const student_t *s) {
+  student_t bucket[BUCKET_SLOTS];
+  superblock_t sb;
+  unsigned int entry, b;
+  bool live = memcmp(s, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0;
+
+  for (;;) {
+    int slot = locate(fd, id, &sb, &entry, &b, bucket);
+
+    if (slot < 0)
+      return ERR_DB_FILE;
+    if (slot == BUCKET_SLOTS && !live)
+      return NO_ERROR;
+
+    for (int i = 0; slot == BUCKET_SLOTS && i < BUCKET_SLOTS; i++) {
+      if (bucket[i].id == DELETED_STUDENT_ID)
+        slot = i;
+    }
+
+    if (slot < BUCKET_SLOTS)
+      return sdb_write_at(fd, s, STUDENT_RECORD_SIZE,
+                          bucket_off(b) + (off_t)slot * STUDENT_RECORD_SIZE);
+
+    if (split(fd, &sb, entry, b, bucket) != NO_ERROR)
+      return ERR_DB_FILE;
+  }
+}
+
+// a student of a batch and where it goes, see sdb_hash_write_batch()
+//  key:  hash of the id with its bits reversed
+//  rec:  the student
+typedef struct batch_ent {
+  unsigned long long key;
+  const student_t *rec;
+} batch_ent_t;
+
+/*
+ *  cmp_batch
+ *
+ *  qsort() comparator for batch_ent_t by key.
+ */
+static int cmp_batch(const void *a, const void *b) {
+  unsigned long long ka = ((const batch_ent_t *)a)->key;
+  unsigned long long kb = ((const batch_ent_t *)b)->key;
+
+  return (ka > kb) - (ka < kb);
+}
+
+/*
+ *  reverse_bits
+ *      x:  a 64 bit value
+ *
+ *  returns:  x with bit 0 and bit 63 swapped, bit 1 and bit 62 and so on
+ */
+static unsigned long long reverse_bits(unsigned long long x) {
+  x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+  x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+  x = ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((x & 0x0f0f0f0f0f0f0f0fULL) << 4);
+  return __builtin_bswap64(x);
+}
+
+/*
+ *  sdb_hash_write_batch
+ *      fd:    file descriptor of a hashed database file
+ *      recs:  students to store
+ *      n:     number of students in recs
+ *
+ *  The SDB_LAYOUT_HASH version of sdb_write_sorted().  Every bucket holds
+ *  the hashes that share their low bits, so with the students ordered by
+ *  their hash read backwards the students of one bucket come one after
+ *  the other, whatever the depths.  Each bucket is then read and written
+ *  once for all of its students rather than once per student, which also
+ *  keeps the write-ahead log of a bulk load (and so the cost of reading
+ *  through it, see sdb_wal_overlay()) small.  Full buckets are split like
+ *  in sdb_hash_write().
+ *
+ *  returns:  NO_ERROR     every student was written
+ *            ERR_DB_FILE  database file I/O issue, out of memory or a
+ *                         bucket can not be split any more
+ */
+int sdb_hash_write_batch(int fd, const student_t *recs, int n) {
+  student_t bucket[BUCKET_SLOTS];
+  superblock_t sb;
+  batch_ent_t *ents;
+  unsigned long long mask = 0, pattern = 0;
+  unsigned int entry = 0, b = 0;
+  bool held = false, dirty = false;
+  int rc = NO_ERROR;
+
+  ents = malloc((size_t)n * sizeof(*ents));
+  if (ents == NULL)
+    return ERR_DB_FILE;
+
+  for (int i = 0; i < n; i++) {
+    ents[i].key = reverse_bits(hash_id(recs[i].id));
+    ents[i].rec = &recs[i];
+  }
+  qsort(ents, n, sizeof(*ents), cmp_batch);
+
+  for (int i = 0; rc == NO_ERROR && i < n; i++) {
+    const student_t *s = ents[i].rec;
+    unsigned long long h = hash_id(s->id);
+
+    for (;;) {
+      unsigned char depth;
+      int slot;
+
+      // the bucket in memory is the one of s as long as nothing split
+      if (held && (h & mask) == pattern) {
+        for (slot = 0; slot < BUCKET_SLOTS; slot++) {
+          if (bucket[slot].id == s->id)
+            break;
+        }
+      } else {
+        if (dirty && sdb_write_at(fd, bucket, sizeof(bucket),
+                                  bucket_off(b)) != NO_ERROR) {
+          rc = ERR_DB_FILE;
+          break;
+        }
+        dirty = false;
+
+        slot = locate(fd, s->id, &sb, &entry, &b, bucket);
+        if (slot < 0 || read_zero(fd, &depth, sizeof(depth),
+                                  SDB_HASH_DEPTH_OFF + b) != NO_ERROR) {
+          rc = ERR_DB_FILE;
+          break;
+        }
+        mask = (1ULL << depth) - 1;
+        pattern = h & mask;
+        held = true;
+      }
+
+      for (int k = 0; slot == BUCKET_SLOTS && k < BUCKET_SLOTS; k++) {
+        if (bucket[k].id == DELETED_STUDENT_ID)
+          slot = k;
+      }
+
+      if (slot < BUCKET_SLOTS) {
+        bucket[slot] = *s;
+        dirty = true;
+        break;
+      }
+
+      // split() reads the bucket from the file, so it goes out first
+      held = false;
+      if ((dirty && sdb_write_at(fd, bucket, sizeof(bucket),
+                                 bucket_off(b)) != NO_ERROR) ||
+          split(fd, &sb, entry, b, bucket) != NO_ERROR) {
+        rc = ERR_DB_FILE;
+        break;
+      }
+      dirty = false;
+    }
+  }
+
+  if (rc == NO_ERROR && dirty &&
+      sdb_write_at(fd, bucket, sizeof(bucket), bucket_off(b)) != NO_ERROR)
+    rc = ERR_DB_FILE;
+
+  free(ents);
+  return rc;
+}
+
+/*
+ *  sdb_hash_prev
+ *      fd:  file descriptor of a hashed database file
+ *      id:  search for live students below this id
+ *
+ *  Hashing scatters ids over the buckets, so unlike sdb_scan_prev() this
+ *  is a full table scan.  It only runs when the student with the highest
+ *  id is deleted.
+ *
+ *  returns:  <id>         the highest live id below id
+ *            0            there are no students below id
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_hash_prev(int fd, int id) {
+  sdb_scan_t scan;
+  const student_t *rec;
+  int best = 0, rc;
+
+  rc = sdb_scan_open(&scan, fd);
+  while (rc == NO_ERROR && (rc = sdb_scan_next(&scan, &rec)) == 1) {
+    rc = NO_ERROR;
+    if (rec->id < id && rec->id > best)
+      best = rec->id;
+  }
+  sdb_scan_close(&scan);
+
+  return rc < 0 ? ERR_DB_FILE : best;
+}
+
+/*
+ *  sdb_id_max
+ *      fd:  file descriptor of an open database file
+ *
+ *  returns:  the highest student id the database can hold, MAX_STD_ID
+ *            unless it is hashed.  With --client the daemon checks ids
+ *            against its own database
+ */
+int sdb_id_max(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h != NULL &&
+      (h->layout == SDB_LAYOUT_HASH || h->engine == SDB_ENGINE_REMOTE))
+    return INT_MAX;
+
+  return MAX_STD_ID;
+}
@@ -0,0 +1,900 @@
+#define _GNU_SOURCE // mremap() and fallocate()
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+// engine state for every attached database file.  A slot is free when its
+// fd is -1, see sdb_attach()
+static sdb_handle_t handles[SDB_MAX_HANDLES];
+static bool handles_ready = false;
+
+/*
+ *  page_round
+ *      len:  a length in bytes
+ *
+ *  returns:  len rounded up to the next multiple of the system page size
+ */
+static size_t page_round(size_t len) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+  return (len + page - 1) / page * page;
+}
+
+/*
+ *  map_file
+ *      h:     an attached handle using the mmap engine
+ *      size:  the size the database file has (or is about to have)
+ *
+ *  Makes sure the shared mapping of the database file covers at least size
+ *  bytes.  The first call creates the mapping, later calls grow it with
+ *  mremap() which is allowed to move it, so callers must never hold on to a
+ *  pointer into the mapping across a call that might grow the file.
+ *
+ *  returns:  NO_ERROR     the mapping covers size bytes
+ *            ERR_DB_FILE  the mapping could not be created or grown
+ */
+static int map_file(sdb_handle_t *h, off_t size) {
+  size_t want = page_round((size_t)size);
+  char *map;
+
+  h->file_size = size;
+  if (want <= h->map_len)
+    return NO_ERROR;
+
+  if (h->map == NULL)
+    map = mmap(NULL, want, PROT_READ | PROT_WRITE, MAP_SHARED, h->fd, 0);
+  else
+    map = mremap(h->map, h->map_len, want, MREMAP_MAYMOVE);
+
+  if (map == MAP_FAILED)
+    return ERR_DB_FILE;
+
+  h->map = map;
+  h->map_len = want;
+  return NO_ERROR;
+}
+
+/*
+ *  refresh_size
+ *      h:  an attached handle using the mmap engine
+ *
+ *  Another sdbsc process may have grown the database since we mapped it, so
+ *  before reporting EOF re-check the real file size and extend the mapping
+ *  to match.  It may also have cut the end off (see sdb_reclaim_all()),
+ *  touching a mapped page past the end of the file is a SIGBUS rather than
+ *  a short read, so a smaller size is taken over too.  The mapping keeps
+ *  its length, only the part of it up to file_size is ever used.
+ *
+ *  returns:  NO_ERROR     the handle reflects the current file size
+ *            ERR_DB_FILE  the file could not be examined or remapped
+ */
+static int refresh_size(sdb_handle_t *h) {
+  struct stat st;
+
+  if (fstat(h->fd, &st) == -1)
+    return ERR_DB_FILE;
+
+  if (st.st_size <= h->file_size) {
+    h->file_size = st.st_size;
+    return NO_ERROR;
+  }
+
+  return map_file(h, st.st_size);
+}
+
+/*
+ *  sdb_refresh
+ *      fd:  file descriptor of an open database file
+ *
+ *  Public wrapper around refresh_size() for code that walks the mapping
+ *  directly, like full table scans.  A no-op for the read/write engine.
+ *
+ *  returns:  NO_ERROR     the handle reflects the current file size
+ *            ERR_DB_FILE  the file could not be examined or remapped
+ */
+int sdb_refresh(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  if (h->engine == SDB_ENGINE_RW)
+    return NO_ERROR;
+
+  return refresh_size(h);
+}
+
+/*
+ *  sdb_reopen
+ *      fd:  file descriptor of a database file attached with a path
+ *
+ *  compress_db() and sdb_dense_expand() replace the database by renaming a
+ *  new file over it, which leaves other processes with the old file open.
+ *  If the path of fd now names a different file it is opened again and
+ *  moved onto fd with dup2(), so callers keep the same file descriptor, and
+ *  the mapping, sidecars and superblock are reloaded for the new file.  The
+ *  lock sidecar stays open so locks already held are kept.  If it is still
+ *  the same file the mmap engine picks up its current size instead, see
+ *  refresh_size(), the file is only ever cut short under a lock that
+ *  excludes ours.
+ *
+ *  returns:  NO_ERROR     fd refers to the file currently at its path
+ *            ERR_DB_FILE  the file could not be reopened
+ */
+int sdb_reopen(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+  struct stat cur, st;
+  int new_fd;
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  if (h->path == NULL)
+    return NO_ERROR;
+
+  if (stat(h->path, &cur) == -1 || fstat(fd, &st) == -1)
+    return ERR_DB_FILE;
+
+  // same file, but it may have changed size while we were not holding a
+  // lock on it
+  if (cur.st_dev == st.st_dev && cur.st_ino == st.st_ino)
+    return h->engine == SDB_ENGINE_MMAP ? refresh_size(h) : NO_ERROR;
+
+  new_fd = open(h->path, O_RDWR);
+  if (new_fd == -1)
+    return ERR_DB_FILE;
+
+  if (dup2(new_fd, fd) == -1) {
+    close(new_fd);
+    return ERR_DB_FILE;
+  }
+  close(new_fd);
+
+  if (h->map != NULL)
+    munmap(h->map, h->map_len);
+  h->map = NULL;
+  h->map_len = 0;
+  sdb_bm_close(fd);
+  sdb_wal_close(fd);
+  sdb_sum_close(fd);
+  h->layout = SDB_LAYOUT_SPARSE;
+  h->nslots = 0;
+
+  if (fstat(fd, &st) == -1)
+    return ERR_DB_FILE;
+
+  h->file_size = st.st_size;
+  if (h->engine == SDB_ENGINE_MMAP && st.st_size > 0 &&
+      map_file(h, st.st_size) != NO_ERROR)
+    h->engine = SDB_ENGINE_RW;
+
+  return sdb_sb_open(fd);
+}
+
+/*
+ *  open_lock
+ *      h:  handle of a database file attached with a path
+ *
+ *  Opens the lock sidecar of the database, see sdb_lock().  It is never
+ *  written, only its byte ranges are locked.
+ *
+ *  returns:  NO_ERROR     h->lock_fd is open
+ *            ERR_DB_FILE  the lock sidecar could not be opened
+ */
+static int open_lock(sdb_handle_t *h) {
+  char lock_path[PATH_MAX];
+  mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+
+  if (snprintf(lock_path, sizeof(lock_path), "%s%s", h->path,
+               SDB_LOCK_SUFFIX) >= (int)sizeof(lock_path))
+    return ERR_DB_FILE;
+
+  h->lock_fd = open(lock_path, O_RDWR | O_CREAT, mode);
+  return h->lock_fd == -1 ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  sdb_attach
+ *      fd:      file descriptor of an open database file
+ *      path:    name the file was opened with, sidecar files (like the
+ *               occupancy bitmap) are named after it.  NULL disables them
+ *      engine:  SDB_ENGINE_MMAP, SDB_ENGINE_RW or SDB_ENGINE_URING, or
+ *               SDB_ENGINE_REMOTE for a connection to a daemon (see
+ *               sdb_connect())
+ *
+ *  Attaches a database file to one of the storage engines.  With the mmap
+ *  engine the whole file is mapped MAP_SHARED so records are read and
+ *  written with plain memory copies instead of a syscall per record.  If the
+ *  file can not be mapped we quietly fall back to the read/write engine
+ *  since that one works on anything we can open.  SDB_ENGINE_URING is the
+ *  read/write engine plus an io_uring for batches (see sdb_uring_open()),
+ *  without io_uring it is just the read/write engine.
+ *
+ *  returns:  NO_ERROR     the file is attached
+ *            ERR_DB_FILE  there are no free handles, fstat() failed or we
+ *                         are out of memory
+ */
+int sdb_attach(int fd, const char *path, int engine) {
+  sdb_handle_t *h = NULL;
+  struct stat st;
+
+  if (!handles_ready) {
+    for (int i = 0; i < SDB_MAX_HANDLES; i++)
+      handles[i].fd = -1;
+    handles_ready = true;
+  }
+
+  sdb_detach(fd);
+  for (int i = 0; i < SDB_MAX_HANDLES; i++) {
+    if (handles[i].fd == -1) {
+      h = &handles[i];
+      break;
+    }
+  }
+
+  if (h == NULL || fstat(fd, &st) == -1)
+    return ERR_DB_FILE;
+
+  memset(h, 0, sizeof(*h));
+  h->fd = fd;
+  h->engine = engine;
+  h->file_size = st.st_size;
+  h->bm_fd = -1;
+  h->lock_fd = -1;
+
+  if (path != NULL && ((h->path = strdup(path)) == NULL ||
+                       open_lock(h) != NO_ERROR)) {
+    free(h->path);
+    h->path = NULL;
+    h->fd = -1;
+    return ERR_DB_FILE;
+  }
+
+  if (engine == SDB_ENGINE_MMAP && st.st_size > 0 &&
+      map_file(h, st.st_size) != NO_ERROR) {
+    h->engine = SDB_ENGINE_RW;
+  }
+
+  if (engine == SDB_ENGINE_URING) {
+    h->engine = SDB_ENGINE_RW;
+    sdb_uring_open(fd);
+  }
+
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_detach
+ *      fd:  file descriptor previously passed to sdb_attach()
+ *
+ *  Releases the mapping (if any), closes sidecar files and frees the handle.
+ *  This does not close the file descriptor, see close_db() in sdbsc.c for
+ *  that.  Dirty pages in
+ *  a MAP_SHARED mapping are owned by the page cache so unmapping does not
+ *  lose any writes.
+ */
+void sdb_detach(int fd) {
+  sdb_handle_t *h;
+
+  if (!handles_ready)
+    return;
+
+  for (int i = 0; i < SDB_MAX_HANDLES; i++) {
+    h = &handles[i];
+    if (h->fd != fd)
+      continue;
+
+    if (h->map != NULL)
+      munmap(h->map, h->map_len);
+
+    sdb_bm_close(fd);
+    sdb_wal_close(fd);
+    sdb_uring_close(fd);
+    sdb_name_close(fd);
+    sdb_col_close(fd);
+    sdb_sum_close(fd);
+    if (h->lock_fd != -1)
+      close(h->lock_fd);
+    free(h->path);
+    memset(h, 0, sizeof(*h));
+    h->fd = -1;
+  }
+}
+
+/*
+ *  sdb_handle
+ *      fd:  file descriptor of an open database file
+ *
+ *  Looks up the engine state of a database file.  Files that were not
+ *  opened with open_db() are attached on first use with the engine selected
+ *  on the command line so every database function works with any fd, they
+ *  just do not get any sidecar files.
+ *
+ *  returns:  pointer to the handle, or NULL if it could not be attached
+ */
+sdb_handle_t *sdb_handle(int fd) {
+  if (handles_ready) {
+    for (int i = 0; i < SDB_MAX_HANDLES; i++) {
+      if (handles[i].fd == fd)
+        return &handles[i];
+    }
+  }
+
+  if (sdb_attach(fd, NULL, sdb_opts.engine) != NO_ERROR)
+    return NULL;
+
+  return sdb_handle(fd);
+}
+
+/*
+ *  sdb_read_at
+ *      fd:      file descriptor of an open database file
+ *      buf:     where the bytes are copied
+ *      len:     number of bytes to read
+ *      offset:  file offset to read from
+ *
+ *  Like pread() a range that runs past the end of the file is cut short.
+ *  The pages read are checked against their checksums first, see
+ *  sdb_sum_check().  Inside a logged mutation the bytes read include the
+ *  writes logged so far, see sdb_wal_overlay().
+ *
+ *  returns:  <number>  bytes copied into buf, less than len at end of file
+ *            0         offset is at or past the end of the file
+ *            -1        database file I/O issue or a corrupt page
+ */
+ssize_t sdb_read_at(int fd, void *buf, size_t len, off_t offset) {
+  sdb_handle_t *h = sdb_handle(fd);
+  off_t end = offset + (off_t)len;
+  ssize_t bytes_read;
+
+  if (h == NULL || offset < 0)
+    return -1;
+
+  if (h->engine == SDB_ENGINE_RW) {
+    bytes_read = pread(fd, buf, len, offset);
+    if (bytes_read > 0 &&
+        sdb_sum_check(fd, buf, (size_t)bytes_read, offset) != NO_ERROR)
+      return -1;
+    if (bytes_read > 0 && sdb_wal_active(fd))
+      sdb_wal_overlay(fd, buf, bytes_read, offset);
+    return bytes_read;
+  }
+
+  if (end > h->file_size) {
+    if (refresh_size(h) != NO_ERROR)
+      return -1;
+    if (offset >= h->file_size)
+      return 0;
+    if (end > h->file_size)
+      len = (size_t)(h->file_size - offset);
+  }
+
+  if (sdb_sum_check(fd, h->map + offset, len, offset) != NO_ERROR)
+    return -1;
+  memcpy(buf, h->map + offset, len);
+  if (sdb_wal_active(fd))
+    sdb_wal_overlay(fd, buf, len, offset);
+  return (ssize_t)len;
+}
+
+/*
+ *  sdb_write_at
+ *      fd:      file descriptor of an open database file
+ *      buf:     the bytes to store
+ *      len:     number of bytes to write
+ *      offset:  file offset to write to
+ *
+ *  With the mmap engine a write past the end of the file first extends the
+ *  file with ftruncate(), which leaves a hole so the file stays sparse, and
+ *  then grows the mapping to cover the new range.  Inside a logged mutation
+ *  (see sdb_wal_begin()) the write only goes to the write-ahead log, it
+ *  reaches the file when the mutation commits.
+ *
+ *  returns:  NO_ERROR     the range was written
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_write_at(int fd, const void *buf, size_t len, off_t offset) {
+  sdb_handle_t *h = sdb_handle(fd);
+  off_t end = offset + (off_t)len;
+
+  if (h == NULL || offset < 0)
+    return ERR_DB_FILE;
+
+  if (sdb_wal_active(fd)) {
+    struct iovec iov = {(void *)buf, len};
+
+    return sdb_wal_log(fd, SDB_WAL_WRITE, offset, len, &iov, 1);
+  }
+
+  if (h->engine == SDB_ENGINE_RW) {
+    if (pwrite(fd, buf, len, offset) != (ssize_t)len)
+      return ERR_DB_FILE;
+    return NO_ERROR;
+  }
+
+  if (end > h->file_size && refresh_size(h) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  if (end > h->file_size) {
+    if (ftruncate(fd, end) == -1 || map_file(h, end) != NO_ERROR)
+      return ERR_DB_FILE;
+  }
+
+  memcpy(h->map + offset, buf, len);
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_write_sorted
+ *      fd:          file descriptor of an open database file
+ *      recs:        students to write, sorted by id with no duplicates
+ *      n:           number of students in recs
+ *      gaps_empty:  the caller knows every slot between two students in recs
+ *                   is empty, so it may be rewritten with zeros
+ *
+ *  Writes a batch of students with as few syscalls as possible.  With the
+ *  read/write engine students with consecutive ids go out in one pwritev(),
+ *  and when gaps_empty is set students separated by a short gap (less than
+ *  a page of slots) are merged into the same pwritev() with the gap written
+ *  as empty records.  That page is getting written anyway, so the gap does
+ *  not cost any extra storage.  With an io_uring all those pwritev() go
+ *  out together, see sdb_uring_queue().  With the mmap engine the file is
+ *  extended once to fit the highest id and the records are copied into the
+ *  mapping.
+ *  Inside a logged mutation each batch becomes one write-ahead log record
+ *  instead, whatever the engine.  A hashed file has no id order to
+ *  exploit, its students are written a bucket at a time instead, see
+ *  sdb_hash_write_batch().
+ *
+ *  returns:  NO_ERROR     every student was written
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_write_sorted(int fd, const student_t *recs, int n, bool gaps_empty) {
+  static const student_t zeros[SDB_SCAN_ALIGN / sizeof(student_t)];
+  const int per_page = SDB_SCAN_ALIGN / STUDENT_RECORD_SIZE;
+  sdb_handle_t *h = sdb_handle(fd);
+  struct iovec iov[IOV_MAX];
+  int i = 0, rc = NO_ERROR;
+
+  if (h == NULL || h->layout == SDB_LAYOUT_DENSE)
+    return ERR_DB_FILE;
+
+  if (n == 0)
+    return NO_ERROR;
+
+  // students of a hashed file go wherever their buckets are
+  if (h->layout == SDB_LAYOUT_HASH)
+    return sdb_hash_write_batch(fd, recs, n);
+
+  if (h->engine == SDB_ENGINE_MMAP && !sdb_wal_active(fd)) {
+    // one write at the highest id grows the file and the mapping once
+    if (sdb_write_slot(fd, recs[n - 1].id, &recs[n - 1]) != NO_ERROR)
+      return ERR_DB_FILE;
+    for (i = 0; i < n - 1; i++) {
+      if (sdb_write_slot(fd, recs[i].id, &recs[i]) != NO_ERROR)
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+  }
+
+  while (rc == NO_ERROR && i < n) {
+    int first = i, iovcnt = 0;
+    size_t len = 0;
+
+    if (recs[i].id < MIN_STD_ID) {
+      rc = ERR_DB_FILE;
+      break;
+    }
+
+    iov[iovcnt].iov_base = (void *)&recs[i];
+    iov[iovcnt++].iov_len = STUDENT_RECORD_SIZE;
+    len += STUDENT_RECORD_SIZE;
+
+    while (++i < n && iovcnt < IOV_MAX - 1) {
+      int gap = recs[i].id - recs[i - 1].id - 1;
+
+      if (gap > 0 && (!gaps_empty || gap >= per_page))
+        break;
+
+      if (gap > 0) {
+        iov[iovcnt].iov_base = (void *)zeros;
+        iov[iovcnt++].iov_len = (size_t)gap * STUDENT_RECORD_SIZE;
+        len += (size_t)gap * STUDENT_RECORD_SIZE;
+      }
+
+      // consecutive records are consecutive in memory too, grow the iovec
+      if (gap == 0 && (const char *)iov[iovcnt - 1].iov_base +
+                              iov[iovcnt - 1].iov_len ==
+                          (const char *)&recs[i]) {
+        iov[iovcnt - 1].iov_len += STUDENT_RECORD_SIZE;
+      } else {
+        iov[iovcnt].iov_base = (void *)&recs[i];
+        iov[iovcnt++].iov_len = STUDENT_RECORD_SIZE;
+      }
+      len += STUDENT_RECORD_SIZE;
+    }
+
+    if (sdb_wal_active(fd)) {
+      rc = sdb_wal_log(fd, SDB_WAL_WRITE,
+                       (off_t)recs[first].id * STUDENT_RECORD_SIZE, len, iov,
+                       iovcnt);
+    } else if (sdb_uring_ready(fd)) {
+      rc = sdb_uring_queue(fd, true, iov, iovcnt,
+                           (off_t)recs[first].id * STUDENT_RECORD_SIZE);
+    } else if (pwritev(fd, iov, iovcnt,
+                       (off_t)recs[first].id * STUDENT_RECORD_SIZE) !=
+               (ssize_t)len) {
+      rc = ERR_DB_FILE;
+    }
+  }
+
+  // queued writes point into recs, they must be done before we return
+  if (sdb_uring_wait(fd) != NO_ERROR)
+    rc = ERR_DB_FILE;
+
+  return rc < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  sorted_slot
+ *      h:   an attached handle
+ *      id:  student id
+ *
+ *  returns:  the slot of id, see sdb_read_slot()
+ *            0            a dense database does not have id
+ *            ERR_DB_FILE  database file I/O issue
+ */
+static int sorted_slot(sdb_handle_t *h, int id) {
+  return h->layout == SDB_LAYOUT_DENSE ? sdb_dense_slot(h->fd, id) : id;
+}
+
+/*
+ *  sdb_read_sorted
+ *      fd:   file descriptor of an open database file
+ *      ids:  student ids to read, sorted with no duplicates
+ *      n:    number of ids
+ *      out:  receives the raw slot of each id, out[i] for ids[i].  Slots
+ *            past the end of the file or missing from a dense database
+ *            come back as EMPTY_STUDENT_RECORD
+ *
+ *  Reads a batch of slots with as few syscalls as possible, the read side
+ *  of sdb_write_sorted().  With the read/write engine slots that are close
+ *  together (less than a page of slots apart) are fetched with one
+ *  preadv(), the slots in between land in a scratch buffer since their
+ *  page is read anyway.  Consecutive slots go straight into out with a
+ *  single iovec.  With an io_uring all the preadv() are in flight at once.
+ *  With the mmap engine of a file attached without a path, inside a
+ *  logged mutation or for a hashed file, every slot is simply copied with
+ *  sdb_read_slot().  The pages of each preadv() are checked against their
+ *  checksums before it is issued.
+ *
+ *  returns:  NO_ERROR     every slot was read
+ *            ERR_DB_FILE  database file I/O issue or a corrupt page
+ */
+int sdb_read_sorted(int fd, const int *ids, int n, student_t *out) {
+  static char scratch[SDB_SCAN_ALIGN];
+  const int per_page = SDB_SCAN_ALIGN / STUDENT_RECORD_SIZE;
+  sdb_handle_t *h = sdb_handle(fd);
+  struct iovec iov[IOV_MAX];
+  int i = 0, rc = NO_ERROR;
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  memset(out, 0, (size_t)n * sizeof(*out));
+
+  // a file other processes share is read like the file even with the mmap
+  // engine: a checksum per preadv() costs less than one per slot, and a
+  // lock free reader (see sdb_find.c) must not touch the mapping of a file
+  // that may be cut short under it, see sdb_peek_slot()
+  if ((h->engine != SDB_ENGINE_RW && h->path == NULL) ||
+      sdb_wal_active(fd) || h->layout == SDB_LAYOUT_HASH) {
+    for (i = 0; i < n; i++) {
+      if (sdb_read_slot(fd, ids[i], &out[i]) == -1)
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+  }
+
+  while (rc == NO_ERROR && i < n) {
+    int first, prev, iovcnt = 0;
+
+    first = sorted_slot(h, ids[i]);
+    if (first < 0) {
+      rc = ERR_DB_FILE;
+      break;
+    }
+    if (first == 0) {
+      i++;
+      continue;
+    }
+
+    iov[iovcnt].iov_base = &out[i];
+    iov[iovcnt++].iov_len = STUDENT_RECORD_SIZE;
+    prev = first;
+
+    while (++i < n && iovcnt < IOV_MAX - 1) {
+      int slot = sorted_slot(h, ids[i]);
+      int gap = slot - prev - 1;
+
+      if (slot < 0) {
+        rc = ERR_DB_FILE;
+        break;
+      }
+      if (slot == 0)
+        continue;
+      if (gap >= per_page)
+        break;
+
+      if (gap > 0) {
+        iov[iovcnt].iov_base = scratch;
+        iov[iovcnt++].iov_len = (size_t)gap * STUDENT_RECORD_SIZE;
+      }
+
+      // neighbouring slots of neighbouring ids, grow the iovec
+      if (gap == 0 && iov[iovcnt - 1].iov_base != scratch &&
+          (char *)iov[iovcnt - 1].iov_base + iov[iovcnt - 1].iov_len ==
+              (char *)&out[i]) {
+        iov[iovcnt - 1].iov_len += STUDENT_RECORD_SIZE;
+      } else {
+        iov[iovcnt].iov_base = &out[i];
+        iov[iovcnt++].iov_len = STUDENT_RECORD_SIZE;
+      }
+      prev = slot;
+    }
+
+    // a short read at the end of the file leaves the rest empty
+    if (rc != NO_ERROR)
+      break;
+    if (sdb_sum_check(fd, NULL,
+                      (size_t)(prev - first + 1) * STUDENT_RECORD_SIZE,
+                      (off_t)first * STUDENT_RECORD_SIZE) != NO_ERROR) {
+      rc = ERR_DB_FILE;
+      break;
+    }
+    if (sdb_uring_ready(fd)) {
+      rc = sdb_uring_queue(fd, false, iov, iovcnt,
+                           (off_t)first * STUDENT_RECORD_SIZE);
+    } else if (preadv(fd, iov, iovcnt, (off_t)first * STUDENT_RECORD_SIZE) ==
+               -1) {
+      rc = ERR_DB_FILE;
+    }
+  }
+
+  // queued reads land in out, they must be done before we return
+  if (sdb_uring_wait(fd) != NO_ERROR)
+    rc = ERR_DB_FILE;
+
+  return rc;
+}
+
+/*
+ *  sdb_read_slot
+ *      fd:  file descriptor of an open database file
+ *      id:  student id whose slot is read.  In a sparse database that is
+ *           slot id, in a dense one the slot is looked up in the id index
+ *           and in a hashed one it is found with sdb_hash_read()
+ *      *s:  where the 64 raw bytes of the slot are copied
+ *
+ *  returns:  STUDENT_RECORD_SIZE  the slot was copied into *s
+ *            <number>             a partial slot at the end of the file
+ *            0                    the slot is past the end of the file
+ *            -1                   database file I/O issue
+ */
+ssize_t sdb_read_slot(int fd, int id, student_t *s) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL)
+    return -1;
+
+  if (h->layout == SDB_LAYOUT_HASH)
+    return sdb_hash_read(fd, id, s);
+
+  if (h->layout == SDB_LAYOUT_DENSE) {
+    id = sdb_dense_slot(fd, id);
+    if (id <= 0)
+      return id == 0 ? 0 : -1;
+  }
+
+  return sdb_read_at(fd, s, STUDENT_RECORD_SIZE,
+                     (off_t)id * STUDENT_RECORD_SIZE);
+}
+
+/*
+ *  sdb_peek_slot
+ *      fd:  file descriptor of an open database file
+ *      id:  student id whose slot is read, see sdb_read_slot()
+ *      *s:  where the 64 raw bytes of the slot are copied
+ *
+ *  sdb_read_slot() for readers that hold no lock at all, see
+ *  get_student().  Without a lock sdb_reclaim_all() may cut the end off a
+ *  sparse file at any moment, and with the mmap engine touching a slot
+ *  past the new end is a SIGBUS rather than a short read, so sparse slots
+ *  are read with pread() here.  Dense and hashed files are never cut
+ *  short in place, they are replaced (see sdb_reopen()), and inside a
+ *  logged mutation the caller holds the lock already.
+ *
+ *  returns:  see sdb_read_slot()
+ */
+ssize_t sdb_peek_slot(int fd, int id, student_t *s) {
+  sdb_handle_t *h = sdb_handle(fd);
+  off_t offset = (off_t)id * STUDENT_RECORD_SIZE;
+  ssize_t bytes_read;
+
+  if (h == NULL)
+    return -1;
+
+  if (h->engine != SDB_ENGINE_MMAP || h->layout != SDB_LAYOUT_SPARSE ||
+      sdb_wal_active(fd))
+    return sdb_read_slot(fd, id, s);
+
+  bytes_read = pread(fd, s, STUDENT_RECORD_SIZE, offset);
+  if (bytes_read > 0 &&
+      sdb_sum_check(fd, s, (size_t)bytes_read, offset) != NO_ERROR)
+    return -1;
+
+  return bytes_read;
+}
+
+/*
+ *  sdb_write_slot
+ *      fd:  file descriptor of an open database file
+ *      id:  student id whose slot is written, see sdb_read_slot()
+ *      *s:  the 64 bytes to store in the slot
+ *
+ *  Slot 0 holds the superblock so it is never written as a student.  A
+ *  dense database only has slots for the ids in its index, call
+ *  sdb_dense_expand() before adding a new id to one.  A hashed database
+ *  finds or makes a slot for id, see sdb_hash_write().
+ *
+ *  returns:  NO_ERROR     the slot was written
+ *            ERR_DB_FILE  database file I/O issue or id is not a student id
+ */
+int sdb_write_slot(int fd, int id, const student_t *s) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || id < MIN_STD_ID)
+    return ERR_DB_FILE;
+
+  if (h->layout == SDB_LAYOUT_HASH)
+    return sdb_hash_write(fd, id, s);
+
+  if (h->layout == SDB_LAYOUT_DENSE) {
+    id = sdb_dense_slot(fd, id);
+    if (id <= 0)
+      return ERR_DB_FILE;
+  }
+
+  return sdb_write_at(fd, s, STUDENT_RECORD_SIZE,
+                      (off_t)id * STUDENT_RECORD_SIZE);
+}
+
+/*
+ *  sdb_write_field
+ *      fd:   file descriptor of an open database file
+ *      id:   student id whose slot is changed, see sdb_read_slot()
+ *      buf:  the new bytes of the field
+ *      len:  size of the field
+ *      at:   offset of the field inside student_t, see offsetof()
+ *
+ *  Overwrites one field of a student that is already in the database with
+ *  a single write, the rest of the slot is not read or written.  Inside a
+ *  mutation only those len bytes go to the write-ahead log.
+ *
+ *  returns:  NO_ERROR     the field was written
+ *            ERR_DB_FILE  database file I/O issue, or id has no slot (a
+ *                         dense or hashed database without id)
+ */
+int sdb_write_field(int fd, int id, const void *buf, size_t len,
+                    size_t at) {
+  sdb_handle_t *h = sdb_handle(fd);
+  off_t offset;
+
+  if (h == NULL || id < MIN_STD_ID || at + len > sizeof(student_t))
+    return ERR_DB_FILE;
+
+  if (h->layout == SDB_LAYOUT_HASH) {
+    offset = sdb_hash_offset(fd, id);
+  } else {
+    if (h->layout == SDB_LAYOUT_DENSE)
+      id = sdb_dense_slot(fd, id);
+    offset = (off_t)id * STUDENT_RECORD_SIZE;
+  }
+  if (offset <= 0)
+    return ERR_DB_FILE;
+
+  return sdb_write_at(fd, buf, len, offset + (off_t)at);
+}
+
+/*
+ *  sdb_punch
+ *      fd:      file descriptor of an open database file
+ *      offset:  start of the range to deallocate, filesystem block aligned
+ *      len:     length of the range, a multiple of the filesystem block size
+ *
+ *  Gives the blocks behind a range of empty slots back to the filesystem.
+ *  The range reads back as zeros (empty slots) afterwards and the file size
+ *  does not change.  Filesystems that can not punch holes just keep the
+ *  blocks, the slots are already empty so nothing is lost.  Like writes,
+ *  punches inside a logged mutation are deferred to its commit.
+ *
+ *  returns:  NO_ERROR     the range was deallocated, or punching holes is
+ *                         not supported
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_punch(int fd, off_t offset, off_t len) {
+  if (sdb_wal_active(fd))
+    return sdb_wal_log(fd, SDB_WAL_PUNCH, offset, len, NULL, 0);
+
+  if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) ==
+      -1) {
+    if (errno == EOPNOTSUPP || errno == ENOSYS)
+      return NO_ERROR;
+    return ERR_DB_FILE;
+  }
+
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_truncate
+ *      fd:    file descriptor of an open database file
+ *      size:  new size of the file
+ *
+ *  Cuts trailing empty slots off the database file.  The mmap engine keeps
+ *  its mapping, only the part of it up to size is used from now on.
+ *
+ *  returns:  NO_ERROR     the file is size bytes long
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_truncate(int fd, off_t size) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || ftruncate(fd, size) == -1)
+    return ERR_DB_FILE;
+
+  h->file_size = size;
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_sync
+ *      fd:  file descriptor of an open database file
+ *
+ *  Flushes everything written through the engine to stable storage.  For
+ *  the mmap engine that is msync() of the mapping, the read/write engine
+ *  just needs fdatasync().
+ *
+ *  returns:  NO_ERROR     the data is durable
+ *            ERR_DB_FILE  the flush failed
+ */
+int sdb_sync(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  // the daemon owns the file and syncs it according to its own --sync
+  if (h->engine == SDB_ENGINE_REMOTE)
+    return NO_ERROR;
+
+  if (h->engine == SDB_ENGINE_MMAP && h->map != NULL &&
+      msync(h->map, h->map_len, MS_SYNC) == -1)
+    return ERR_DB_FILE;
+
+  return fdatasync(fd) == -1 ? ERR_DB_FILE : NO_ERROR;
+}
@@ -0,0 +1,148 @@
+#define _GNU_SOURCE // F_OFD_SETLKW
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+/*
+ *  sdb_lock
+ *      fd:     file descriptor of an open database file
+ *      type:   F_RDLCK (shared), F_WRLCK (exclusive) or F_UNLCK
+ *      first:  first byte of the lock sidecar to lock, an id or SDB_LOCK_SB
+ *      count:  number of bytes to lock, 0 for everything from first on
+ *
+ *  Locks a range of the lock sidecar (see SDB_LOCK_SUFFIX in sdblib.h),
+ *  waiting for conflicting locks of other processes to go away.  Open file
+ *  description locks are used rather than classic POSIX ones, they belong
+ *  to the open lock sidecar instead of the process so closing some other
+ *  descriptor of the file does not silently drop them, and threads sharing
+ *  a handle share its locks.  Locking a range that is already locked with
+ *  this handle converts it to the new type, it never waits on itself.
+ *
+ *  Locks are always taken in the order whole database, ids, superblock, so
+ *  two processes never wait on each other.  The ids of a hashed database
+ *  are always locked all together.  While a group of mutations is open
+ *  (see sdb_sb_group_begin()) its caller already holds every id it
+ *  touches, locking or unlocking ids does nothing until the group ends.
+ *
+ *  returns:  NO_ERROR     the range is locked, or fd has no lock sidecar
+ *            ERR_DB_FILE  the lock could not be taken
+ */
+int sdb_lock(int fd, int type, int first, int count) {
+  sdb_handle_t *h = sdb_handle(fd);
+  struct flock fl = {0};
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  if (h->lock_fd == -1 || (h->group && first >= MIN_STD_ID))
+    return NO_ERROR;
+
+  // a bucket split moves students of other ids, so in a hashed file any
+  // range of ids stands for all of them, see sdb_hash_write()
+  if (h->layout == SDB_LAYOUT_HASH && first >= MIN_STD_ID) {
+    first = MIN_STD_ID;
+    count = 0;
+  }
+
+  fl.l_type = type;
+  fl.l_whence = SEEK_SET;
+  fl.l_start = first;
+  fl.l_len = count;
+
+  while (fcntl(h->lock_fd, F_OFD_SETLKW, &fl) == -1) {
+    if (errno != EINTR)
+      return ERR_DB_FILE;
+  }
+
+  if (first == SDB_LOCK_SB && count == 0)
+    h->lock_all = type == F_WRLCK;
+  if (first == SDB_LOCK_SB && count == 1)
+    h->lock_sb = type == F_WRLCK;
+
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_lock_ids
+ *      fd:     file descriptor of an open database file
+ *      type:   F_RDLCK (shared) or F_WRLCK (exclusive)
+ *      first:  first student id to lock
+ *      count:  number of ids to lock, 0 for every id from first on
+ *
+ *  Locks the slots of a range of student ids, shared to read them or
+ *  exclusive to change them.  Once the lock is held fd is checked against
+ *  the file currently at its path (see sdb_reopen()), a compress that ran
+ *  while we waited has replaced the file and the slots we locked belong to
+ *  the new one.  Release with sdb_lock(fd, F_UNLCK, first, count).
+ *
+ *  returns:  NO_ERROR     the ids are locked
+ *            ERR_DB_FILE  the lock could not be taken or the file reopened,
+ *                         nothing is left locked
+ */
+int sdb_lock_ids(int fd, int type, int first, int count) {
+  if (sdb_lock(fd, type, first, count) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  if (sdb_reopen(fd) != NO_ERROR) {
+    sdb_lock(fd, F_UNLCK, first, count);
+    return ERR_DB_FILE;
+  }
+
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_lock_add
+ *      fd:     file descriptor of an open database file
+ *      first:  first student id that will be added
+ *      count:  number of ids in the range
+ *
+ *  Exclusively locks a range of ids that students are going to be added
+ *  to.  A dense database has no room for new students, so it is expanded
+ *  first (see sdb_dense_expand()) with the whole database locked.  That
+ *  lock is dropped before the ids are locked, if another process compressed
+ *  the database again in between we go around once more.
+ *
+ *  returns:  NO_ERROR     the ids are locked and the database is sparse
+ *            ERR_DB_FILE  a lock could not be taken or the expand failed,
+ *                         nothing is left locked
+ */
+int sdb_lock_add(int fd, int first, int count) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  for (;;) {
+    if (h->layout == SDB_LAYOUT_DENSE) {
+      int rc;
+
+      if (sdb_lock(fd, F_WRLCK, SDB_LOCK_SB, 0) != NO_ERROR)
+        return ERR_DB_FILE;
+
+      rc = sdb_reopen(fd);
+      if (rc == NO_ERROR)
+        rc = sdb_dense_expand(fd);
+      sdb_lock(fd, F_UNLCK, SDB_LOCK_SB, 0);
+
+      if (rc != NO_ERROR)
+        return ERR_DB_FILE;
+    }
+
+    if (sdb_lock_ids(fd, F_WRLCK, first, count) != NO_ERROR)
+      return ERR_DB_FILE;
+
+    if (h->layout != SDB_LAYOUT_DENSE)
+      return NO_ERROR;
+
+    sdb_lock(fd, F_UNLCK, first, count);
+  }
+}
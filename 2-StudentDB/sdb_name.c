@@ -0,0 +1,588 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+#define ENT_SIZE sizeof(sdb_name_ent_t)
+
+// index entries read at a time while collecting matches
+#define NAME_CHUNK 256
+
+/*
+ *  names_attach
+ *      h:       handle of a database file opened with a path
+ *      create:  create the sidecar if it does not exist yet
+ *
+ *  Opens the last name index sidecar of the database.  Does nothing if
+ *  that already happened.  The sidecar is only created by the code that
+ *  is about to write it, see rebuild(), so a database that never had its
+ *  names looked up does not get one.
+ *
+ *  returns:  NO_ERROR        h->names is ready
+ *            SRCH_NOT_FOUND  there is no sidecar and create is false
+ *            ERR_DB_FILE     no path, the sidecar could not be opened or
+ *                            out of memory
+ */
+static int names_attach(sdb_handle_t *h, bool create) {
+  char path[PATH_MAX];
+  mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+  sdb_names_t *nm;
+
+  if (h->names != NULL)
+    return NO_ERROR;
+
+  if (h->path == NULL ||
+      snprintf(path, sizeof(path), "%s%s", h->path, SDB_NAME_SUFFIX) >=
+          (int)sizeof(path))
+    return ERR_DB_FILE;
+
+  nm = calloc(1, sizeof(*nm));
+  if (nm == NULL)
+    return ERR_DB_FILE;
+
+  nm->fd = open(path, O_RDWR | (create ? O_CREAT : 0), mode);
+  if (nm->fd == -1) {
+    free(nm);
+    return !create && errno == ENOENT ? SRCH_NOT_FOUND : ERR_DB_FILE;
+  }
+
+  h->names = nm;
+  return NO_ERROR;
+}
+
+/*
+ *  cmp_ent
+ *
+ *  qsort() comparator, orders index entries by last name and then id.
+ */
+static int cmp_ent(const void *a, const void *b) {
+  const sdb_name_ent_t *ea = a, *eb = b;
+  int c = strncmp(ea->lname, eb->lname, sizeof(ea->lname));
+
+  if (c != 0)
+    return c;
+
+  return (ea->id > eb->id) - (ea->id < eb->id);
+}
+
+/*
+ *  read_hdr
+ *      nm:    an attached name index
+ *      *hdr:  receives the sidecar header
+ *      *sb:   the superblock the index has to match
+ *
+ *  returns:  true if the index was written for this exact version of the
+ *            database, false if it is missing, stale or half written
+ */
+static bool read_hdr(sdb_names_t *nm, sdb_sidecar_t *hdr,
+                     const superblock_t *sb) {
+  return pread(nm->fd, hdr, sizeof(*hdr), 0) == sizeof(*hdr) &&
+         hdr->magic == SDB_NAME_MAGIC && hdr->uuid == sb->uuid &&
+         hdr->generation == sb->generation;
+}
+
+/*
+ *  log_len
+ *      nm:    an attached name index
+ *      *hdr:  its header, see read_hdr()
+ *
+ *  returns:  number of entries in the log after the sorted part, or -1 if
+ *            the size of the sidecar could not be read
+ */
+static int log_len(sdb_names_t *nm, const sdb_sidecar_t *hdr) {
+  struct stat st;
+  off_t sorted_end = sizeof(*hdr) + (off_t)hdr->count * ENT_SIZE;
+
+  if (fstat(nm->fd, &st) == -1 || st.st_size < sorted_end)
+    return -1;
+
+  return (int)((st.st_size - sorted_end) / ENT_SIZE);
+}
+
+/*
+ *  write_sorted
+ *      nm:    an attached name index
+ *      ents:  every live entry, sorted with cmp_ent()
+ *      n:     number of entries
+ *      *sb:   the superblock the index now matches
+ *
+ *  Replaces the whole index with ents and an empty log.  The header is
+ *  cleared first and only stamped with the generation of *sb once the
+ *  entries are written, so a crash part way leaves a stale index rather
+ *  than a wrong one.
+ *
+ *  returns:  NO_ERROR     the index was written
+ *            ERR_DB_FILE  the sidecar could not be written
+ */
+static int write_sorted(sdb_names_t *nm, const sdb_name_ent_t *ents, int n,
+                        const superblock_t *sb) {
+  sdb_sidecar_t hdr = {0};
+  size_t len = (size_t)n * ENT_SIZE;
+
+  if (pwrite(nm->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+      (n > 0 && pwrite(nm->fd, ents, len, sizeof(hdr)) != (ssize_t)len) ||
+      ftruncate(nm->fd, sizeof(hdr) + len) == -1)
+    return ERR_DB_FILE;
+
+  hdr.magic = SDB_NAME_MAGIC;
+  hdr.version = SDB_VERSION;
+  hdr.generation = sb->generation;
+  hdr.count = (unsigned int)n;
+  hdr.uuid = sb->uuid;
+
+  return pwrite(nm->fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) ? NO_ERROR
+                                                             : ERR_DB_FILE;
+}
+
+/*
+ *  merge
+ *      nm:     an attached name index whose header matched before the
+ *              running mutation
+ *      more:   entries to add to the log first, in order
+ *      nmore:  number of entries in more
+ *      *sb:    the superblock the merged index matches
+ *
+ *  Folds the log into the sorted part.  The sorted part, the log and more
+ *  are replayed in order and for every id only its last entry counts, if
+ *  that adds the student it goes into the new sorted part.
+ *
+ *  returns:  NO_ERROR     the index was merged
+ *            ERR_DB_FILE  the sidecar could not be read or written, or out
+ *                         of memory
+ */
+static int merge(sdb_names_t *nm, const sdb_name_ent_t *more, int nmore,
+                 const superblock_t *sb) {
+  sdb_sidecar_t hdr;
+  sdb_name_ent_t *ents;
+  int *last;
+  int n, kept = 0, rc;
+  size_t len;
+
+  if (pread(nm->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+      (n = log_len(nm, &hdr)) < 0)
+    return ERR_DB_FILE;
+  n += (int)hdr.count;
+
+  ents = malloc(((size_t)n + nmore) * ENT_SIZE);
+  last = calloc(MAX_STD_ID + 1, sizeof(*last));
+  len = (size_t)n * ENT_SIZE;
+  if (ents == NULL || last == NULL ||
+      (n > 0 && pread(nm->fd, ents, len, sizeof(hdr)) != (ssize_t)len)) {
+    free(ents);
+    free(last);
+    return ERR_DB_FILE;
+  }
+  memcpy(ents + n, more, (size_t)nmore * ENT_SIZE);
+  n += nmore;
+
+  // last[id] is one past the position of the latest entry for id
+  for (int i = 0; i < n; i++) {
+    if (ents[i].id >= MIN_STD_ID && ents[i].id <= MAX_STD_ID)
+      last[ents[i].id] = i + 1;
+  }
+  for (int i = 0; i < n; i++) {
+    if (ents[i].id >= MIN_STD_ID && ents[i].id <= MAX_STD_ID &&
+        last[ents[i].id] == i + 1 && ents[i].op == SDB_NAME_ADD)
+      ents[kept++] = ents[i];
+  }
+  free(last);
+
+  qsort(ents, kept, ENT_SIZE, cmp_ent);
+  rc = write_sorted(nm, ents, kept, sb);
+  free(ents);
+  return rc;
+}
+
+/*
+ *  rebuild
+ *      fd:   file descriptor of an open database file
+ *      nm:   its attached name index
+ *      *sb:  the current superblock
+ *
+ *  Builds the index from scratch with a full table scan, the first time
+ *  it is used and whenever it went stale.  The caller holds the superblock
+ *  lock so no student changes underneath the scan.
+ *
+ *  returns:  NO_ERROR     the index matches *sb
+ *            ERR_DB_FILE  database file I/O issue or out of memory
+ */
+static int rebuild(int fd, sdb_names_t *nm, const superblock_t *sb) {
+  sdb_name_ent_t *ents = NULL;
+  sdb_scan_t scan;
+  const student_t *rec;
+  int n = 0, cap = 0, rc;
+
+  rc = sdb_scan_open(&scan, fd);
+  while (rc == NO_ERROR && (rc = sdb_scan_next(&scan, &rec)) == 1) {
+    rc = NO_ERROR;
+    if (n == cap) {
+      sdb_name_ent_t *grown;
+
+      cap = cap == 0 ? NAME_CHUNK : cap * 2;
+      grown = realloc(ents, (size_t)cap * ENT_SIZE);
+      if (grown == NULL) {
+        rc = ERR_DB_FILE;
+        break;
+      }
+      ents = grown;
+    }
+
+    memset(&ents[n], 0, ENT_SIZE);
+    memcpy(ents[n].lname, rec->lname, sizeof(ents[n].lname));
+    ents[n].id = rec->id;
+    ents[n].op = SDB_NAME_ADD;
+    n++;
+  }
+  sdb_scan_close(&scan);
+
+  if (rc == NO_ERROR) {
+    qsort(ents, n, ENT_SIZE, cmp_ent);
+    rc = write_sorted(nm, ents, n, sb);
+  }
+
+  free(ents);
+  return rc < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  add_match
+ *      *out:   array of matches, grown as needed
+ *      *nout:  entries used in *out
+ *      *cap:   entries allocated for *out
+ *      e:      the entry to add
+ *
+ *  returns:  NO_ERROR     e was appended
+ *            ERR_DB_FILE  out of memory
+ */
+static int add_match(sdb_name_ent_t **out, int *nout, int *cap,
+                     const sdb_name_ent_t *e) {
+  if (*nout == *cap) {
+    int grown_cap = *cap == 0 ? NAME_CHUNK : *cap * 2;
+    sdb_name_ent_t *grown = realloc(*out, (size_t)grown_cap * ENT_SIZE);
+
+    if (grown == NULL)
+      return ERR_DB_FILE;
+    *out = grown;
+    *cap = grown_cap;
+  }
+
+  (*out)[(*nout)++] = *e;
+  return NO_ERROR;
+}
+
+/*
+ *  search
+ *      nm:      an attached name index that matches the database
+ *      key:     last name, or the start of one, NUL terminated
+ *      prefix:  match every last name starting with key
+ *      **out:   receives a malloc()'d array of the matches in name order
+ *      *nout:   receives the number of matches
+ *
+ *  Binary searches the sorted part for the first match, with one pread()
+ *  per probe, reads the matches that follow it and then applies the log.
+ *
+ *  returns:  NO_ERROR     *out holds the matches, NULL if there are none
+ *            ERR_DB_FILE  the sidecar could not be read or out of memory
+ */
+static int search(sdb_names_t *nm, const char *key, bool prefix,
+                  sdb_name_ent_t **out, int *nout) {
+  size_t keylen = prefix ? strlen(key) : sizeof(((student_t *)0)->lname);
+  sdb_name_ent_t chunk[NAME_CHUNK];
+  sdb_sidecar_t hdr;
+  int lo = 0, hi, nlog, cap = 0;
+  off_t base = sizeof(hdr);
+
+  *out = NULL;
+  *nout = 0;
+
+  if (pread(nm->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+      (nlog = log_len(nm, &hdr)) < 0)
+    return ERR_DB_FILE;
+
+  // first entry that does not sort before key
+  hi = (int)hdr.count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    sdb_name_ent_t e;
+
+    if (pread(nm->fd, &e, ENT_SIZE, base + (off_t)mid * ENT_SIZE) !=
+        ENT_SIZE)
+      goto fail;
+
+    if (strncmp(e.lname, key, keylen) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  // the matches follow it back to back
+  for (bool more = true; more && lo < (int)hdr.count;) {
+    int n = (int)hdr.count - lo < NAME_CHUNK ? (int)hdr.count - lo
+                                             : NAME_CHUNK;
+
+    if (pread(nm->fd, chunk, n * ENT_SIZE, base + (off_t)lo * ENT_SIZE) !=
+        (ssize_t)(n * ENT_SIZE))
+      goto fail;
+
+    for (int i = 0; i < n; i++) {
+      if (strncmp(chunk[i].lname, key, keylen) != 0) {
+        more = false;
+        break;
+      }
+      if (add_match(out, nout, &cap, &chunk[i]) != NO_ERROR)
+        goto fail;
+    }
+    lo += n;
+  }
+
+  // then the changes since the last merge, in the order they were made
+  base += (off_t)hdr.count * ENT_SIZE;
+  for (int pos = 0; pos < nlog; pos += NAME_CHUNK) {
+    int n = nlog - pos < NAME_CHUNK ? nlog - pos : NAME_CHUNK;
+
+    if (pread(nm->fd, chunk, n * ENT_SIZE, base + (off_t)pos * ENT_SIZE) !=
+        (ssize_t)(n * ENT_SIZE))
+      goto fail;
+
+    for (int i = 0; i < n; i++) {
+      if (chunk[i].op == SDB_NAME_DEL) {
+        for (int k = 0; k < *nout; k++) {
+          if ((*out)[k].id == chunk[i].id)
+            (*out)[k--] = (*out)[--*nout];
+        }
+      } else if (strncmp(chunk[i].lname, key, keylen) == 0 &&
+                 add_match(out, nout, &cap, &chunk[i]) != NO_ERROR) {
+        goto fail;
+      }
+    }
+  }
+
+  qsort(*out, *nout, ENT_SIZE, cmp_ent);
+  return NO_ERROR;
+
+fail:
+  free(*out);
+  *out = NULL;
+  *nout = 0;
+  return ERR_DB_FILE;
+}
+
+/*
+ *  sdb_name_begin
+ *      fd:   file descriptor of an open database file
+ *      *sb:  the superblock as it was before the mutation began
+ *
+ *  Called by sdb_sb_begin() with the superblock lock held.  If the index
+ *  matches the database the mutation records its name changes with
+ *  sdb_name_update() and sdb_sb_commit() applies them, otherwise the index
+ *  is left alone and stays stale until the next query rebuilds it.  A
+ *  missing index is not created, there is nothing to keep up to date.
+ */
+void sdb_name_begin(int fd, const superblock_t *sb) {
+  sdb_handle_t *h = sdb_handle(fd);
+  sdb_sidecar_t hdr;
+
+  if (h == NULL || h->path == NULL || names_attach(h, false) != NO_ERROR)
+    return;
+
+  // the index is only kept for ids up to MAX_STD_ID, see merge()
+  h->names->npending = 0;
+  h->names->fresh = h->layout != SDB_LAYOUT_HASH &&
+                    read_hdr(h->names, &hdr, sb);
+}
+
+/*
+ *  sdb_name_update
+ *      fd:    file descriptor of an open database file
+ *      *s:    student that was added or deleted by the running mutation
+ *      live:  true if s was added, false if it was deleted
+ *
+ *  Remembers a name change until sdb_name_commit().  If we run out of
+ *  memory the index is simply left to go stale.
+ */
+void sdb_name_update(int fd, const student_t *s, bool live) {
+  sdb_handle_t *h = sdb_handle(fd);
+  sdb_names_t *nm;
+  sdb_name_ent_t *e;
+
+  if (h == NULL || (nm = h->names) == NULL || !nm->fresh)
+    return;
+
+  if (nm->npending == nm->cap) {
+    int cap = nm->cap == 0 ? NAME_CHUNK : nm->cap * 2;
+    sdb_name_ent_t *grown = realloc(nm->pending, (size_t)cap * ENT_SIZE);
+
+    if (grown == NULL) {
+      nm->fresh = false;
+      return;
+    }
+    nm->pending = grown;
+    nm->cap = cap;
+  }
+
+  e = &nm->pending[nm->npending++];
+  memset(e, 0, ENT_SIZE);
+  memcpy(e->lname, s->lname, sizeof(e->lname));
+  e->lname[sizeof(e->lname) - 1] = '\0';
+  e->id = s->id;
+  e->op = live ? SDB_NAME_ADD : SDB_NAME_DEL;
+}
+
+/*
+ *  sdb_name_commit
+ *      fd:   file descriptor of an open database file
+ *      *sb:  superblock of the mutation being committed
+ *
+ *  Called by sdb_sb_commit().  Appends the name changes of the mutation to
+ *  the log of the index and stamps it with the new generation, folding the
+ *  log into the sorted part once it holds SDB_NAME_LOG_MAX entries.  The
+ *  header is cleared while the log is written, see write_sorted().  The
+ *  index is only a shortcut, so failing to write it does not fail the
+ *  mutation, the index just goes stale.
+ */
+void sdb_name_commit(int fd, const superblock_t *sb) {
+  sdb_handle_t *h = sdb_handle(fd);
+  sdb_names_t *nm;
+  sdb_sidecar_t hdr, cleared = {0};
+  struct stat st;
+  size_t len;
+  int nlog;
+
+  if (h == NULL || (nm = h->names) == NULL || !nm->fresh)
+    return;
+
+  nm->fresh = false;
+  len = (size_t)nm->npending * ENT_SIZE;
+
+  if (pread(nm->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+      (nlog = log_len(nm, &hdr)) < 0 || fstat(nm->fd, &st) == -1) {
+    nm->npending = 0;
+    return;
+  }
+
+  if (nlog + nm->npending >= SDB_NAME_LOG_MAX) {
+    merge(nm, nm->pending, nm->npending, sb);
+  } else if (pwrite(nm->fd, &cleared, sizeof(cleared), 0) ==
+                 sizeof(cleared) &&
+             (len == 0 ||
+              pwrite(nm->fd, nm->pending, len, st.st_size) == (ssize_t)len)) {
+    hdr.generation = sb->generation;
+    pwrite(nm->fd, &hdr, sizeof(hdr), 0);
+  }
+
+  nm->npending = 0;
+}
+
+/*
+ *  sdb_name_abort
+ *      fd:     file descriptor of an open database file
+ *      stale:  clear the header so the index gets rebuilt
+ *
+ *  Forgets the name changes of a mutation that was given up, see
+ *  sdb_sb_abort() and sdb_sb_commit().
+ */
+void sdb_name_abort(int fd, bool stale) {
+  sdb_handle_t *h = sdb_handle(fd);
+  sdb_sidecar_t cleared = {0};
+
+  if (h == NULL || h->names == NULL)
+    return;
+
+  h->names->npending = 0;
+  h->names->fresh = false;
+  if (stale)
+    pwrite(h->names->fd, &cleared, sizeof(cleared), 0);
+}
+
+/*
+ *  sdb_name_close
+ *      fd:  file descriptor of an open database file
+ *
+ *  Closes the name index sidecar, if it was opened.
+ */
+void sdb_name_close(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || h->names == NULL)
+    return;
+
+  close(h->names->fd);
+  free(h->names->pending);
+  free(h->names);
+  h->names = NULL;
+}
+
+/*
+ *  sdb_name_find
+ *      fd:      file descriptor of a database file opened with a path
+ *      name:    last name to look for
+ *      prefix:  find every last name that starts with name instead
+ *      **out:   receives a malloc()'d array of the matching index entries
+ *               in last name and id order, NULL if there are none
+ *      *nout:   receives the number of matches
+ *
+ *  Looks students up by last name in the index instead of scanning the
+ *  table.  Like get_student() no lock is taken if the superblock is clean
+ *  and at the same generation before and after the search (and the index
+ *  was written for that generation).  Otherwise the search is repeated
+ *  holding the superblock lock, rebuilding a stale or missing index first
+ *  (this is where the sidecar gets created).  The
+ *  entries only say where to look, the caller reads the students.  Hashed
+ *  databases have no index, their ids go past MAX_STD_ID.
+ *
+ *  returns:  NO_ERROR     *out holds the matches
+ *            ERR_DB_FILE  the index could not be used, database file I/O
+ *                         issue or out of memory
+ */
+int sdb_name_find(int fd, const char *name, bool prefix,
+                  sdb_name_ent_t **out, int *nout) {
+  sdb_handle_t *h = sdb_handle(fd);
+  char key[sizeof(((student_t *)0)->lname)] = {0};
+  superblock_t before, after;
+  sdb_sidecar_t hdr;
+  int rc;
+
+  *out = NULL;
+  *nout = 0;
+  if (h == NULL || h->layout == SDB_LAYOUT_HASH ||
+      (rc = names_attach(h, false)) == ERR_DB_FILE)
+    return ERR_DB_FILE;
+
+  // names are stored cut to fit student_t
+  strncpy(key, name, sizeof(key) - 1);
+
+  if (rc == NO_ERROR && sdb_sb_read(fd, &before) == NO_ERROR &&
+      before.state == SDB_STATE_CLEAN &&
+      read_hdr(h->names, &hdr, &before)) {
+    rc = search(h->names, key, prefix, out, nout);
+    if (rc == NO_ERROR && sdb_sb_read(fd, &after) == NO_ERROR &&
+        after.state == SDB_STATE_CLEAN &&
+        after.generation == before.generation)
+      return NO_ERROR;
+    free(*out);
+  }
+
+  if (sdb_lock(fd, F_WRLCK, SDB_LOCK_SB, 1) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  rc = names_attach(h, true);
+  if (rc == NO_ERROR)
+    rc = sdb_sb_read(fd, &before);
+  if (rc == NO_ERROR && !read_hdr(h->names, &hdr, &before))
+    rc = rebuild(fd, h->names, &before);
+  if (rc == NO_ERROR)
+    rc = search(h->names, key, prefix, out, nout);
+
+  sdb_lock(fd, F_UNLCK, SDB_LOCK_SB, 1);
+  return rc;
+}
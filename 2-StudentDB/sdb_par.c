@@ -0,0 +1,129 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+// one part of a parallel scan, handed to the thread that runs it
+//  scan:    the part of the file this thread visits
+//  index:   position of the part, parts are numbered in id order
+//  worker:  function that consumes the part
+//  arg:     passed through to worker
+//  rc:      what worker returned
+typedef struct par_part {
+  sdb_scan_t scan;
+  int index;
+  int (*worker)(sdb_scan_t *part, int index, void *arg);
+  void *arg;
+  int rc;
+} par_part_t;
+
+/*
+ *  run_part
+ *      p:  the par_part_t to run
+ *
+ *  Thread body, runs the worker over one part of the file.
+ */
+static void *run_part(void *p) {
+  par_part_t *part = p;
+
+  part->rc = part->worker(&part->scan, part->index, part->arg);
+  return NULL;
+}
+
+/*
+ *  sdb_par_scan
+ *      fd:      file descriptor of an open database file
+ *      jobs:    number of threads to use, at most SDB_MAX_JOBS
+ *      worker:  called once per part with a scan of that part only, its
+ *               index and arg.  Runs on its own thread
+ *      arg:     passed through to worker
+ *
+ *  Parallel version of a full table scan.  The slots of the file are cut
+ *  into jobs ranges of whole pages (a page is 64 slots, so two parts never
+ *  share a word of the occupancy bitmap either) and each range is scanned
+ *  by its own thread, see sdb_scan_range().  Part 0 runs on the calling
+ *  thread.  Parts are numbered in id order, so a worker that collects its
+ *  students per part lets the caller merge them back in id order just by
+ *  going through the parts in order (a hashed file only comes out in file
+ *  order, see sdb_scan_open()).  A small file is cut into fewer parts.
+ *
+ *  returns:  <parts>      number of parts the file was cut into, the worker
+ *                         ran once for each index below it
+ *            ERR_DB_FILE  database file I/O issue or out of memory, or a
+ *                         worker returned an error
+ */
+int sdb_par_scan(int fd, int jobs,
+                 int (*worker)(sdb_scan_t *part, int index, void *arg),
+                 void *arg) {
+  par_part_t parts[SDB_MAX_JOBS];
+  pthread_t threads[SDB_MAX_JOBS];
+  bool started[SDB_MAX_JOBS] = {false};
+  sdb_scan_t scan;
+  off_t pages, per, start, base;
+  int n, rc;
+
+  if (jobs < 1)
+    jobs = 1;
+  if (jobs > SDB_MAX_JOBS)
+    jobs = SDB_MAX_JOBS;
+
+  rc = sdb_scan_open(&scan, fd);
+  if (rc != NO_ERROR) {
+    sdb_scan_close(&scan);
+    return ERR_DB_FILE;
+  }
+
+  // the scan starts on the first slot, just past the superblock or the
+  // directory of a hashed file
+  start = scan.offset;
+  base = start - start % SDB_SCAN_ALIGN;
+  pages = (scan.file_end - base + SDB_SCAN_ALIGN - 1) / SDB_SCAN_ALIGN;
+  n = pages < jobs ? (int)pages : jobs;
+  if (n < 1)
+    n = 1;
+  per = (pages + n - 1) / n;
+
+  for (int i = 0; i < n; i++) {
+    off_t end = base + (off_t)(i + 1) * per * SDB_SCAN_ALIGN;
+
+    parts[i].index = i;
+    parts[i].worker = worker;
+    parts[i].arg = arg;
+    parts[i].rc = NO_ERROR;
+    if (sdb_scan_range(&parts[i].scan, &scan, start, end) != NO_ERROR) {
+      for (int k = 0; k <= i; k++)
+        sdb_scan_close(&parts[k].scan);
+      sdb_scan_close(&scan);
+      return ERR_DB_FILE;
+    }
+    start = end;
+  }
+
+  // if a thread cannot be started its part runs here instead
+  for (int i = 1; i < n; i++)
+    started[i] = pthread_create(&threads[i], NULL, run_part, &parts[i]) == 0;
+
+  run_part(&parts[0]);
+  for (int i = 1; i < n; i++) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    else
+      run_part(&parts[i]);
+  }
+
+  rc = n;
+  for (int i = 0; i < n; i++) {
+    if (parts[i].rc < 0)
+      rc = ERR_DB_FILE;
+    sdb_scan_close(&parts[i].scan);
+  }
+  sdb_scan_close(&scan);
+
+  return rc;
+}
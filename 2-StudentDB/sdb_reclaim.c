@@ -0,0 +1,233 @@
+#define _GNU_SOURCE // SEEK_DATA and SEEK_HOLE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+/*
+ *  fs_block
+ *      fd:  file descriptor of an open database file
+ *
+ *  returns:  the filesystem block size, the unit holes are punched in
+ */
+static off_t fs_block(int fd) {
+  struct stat st;
+
+  if (fstat(fd, &st) == -1 || st.st_blksize < STUDENT_RECORD_SIZE ||
+      st.st_blksize % STUDENT_RECORD_SIZE != 0)
+    return SDB_SCAN_ALIGN;
+
+  return st.st_blksize;
+}
+
+/*
+ *  slot_end
+ *      h:  handle of an open database file
+ *
+ *  returns:  the offset where the student slots end and something else
+ *            starts (the id index of a dense file), or -1 for a sparse file
+ *            where every slot past the superblock is a student slot
+ */
+static off_t slot_end(const sdb_handle_t *h) {
+  if (h->layout != SDB_LAYOUT_DENSE)
+    return -1;
+
+  return (off_t)(h->nslots + 1) * STUDENT_RECORD_SIZE;
+}
+
+/*
+ *  block_empty
+ *      fd:     file descriptor of an open database file
+ *      first:  first slot of the block
+ *      per:    number of slots in the block
+ *      buf:    scratch space for one block
+ *
+ *  Checks that none of the slots in a block holds a student.  A sparse
+ *  database with a fresh occupancy bitmap answers from the bitmap, anything
+ *  else reads the block and checks it with sdb_live_mask().
+ *
+ *  returns:  1            every slot in the block is empty
+ *            0            at least one slot holds a student
+ *            ERR_DB_FILE  database file I/O issue
+ */
+static int block_empty(int fd, int first, int per, student_t *buf) {
+  ssize_t bytes_read;
+  int n;
+
+  if (sdb_handle(fd)->layout == SDB_LAYOUT_SPARSE && sdb_bm_fresh(fd)) {
+    int next = sdb_bm_next(fd, first);
+
+    return next == 0 || next >= first + per;
+  }
+
+  bytes_read = sdb_read_at(fd, buf, (size_t)per * STUDENT_RECORD_SIZE,
+                           (off_t)first * STUDENT_RECORD_SIZE);
+  if (bytes_read == -1)
+    return ERR_DB_FILE;
+
+  n = (int)(bytes_read / STUDENT_RECORD_SIZE);
+  for (int i = 0; i < n; i += 64) {
+    if (sdb_live_mask(&buf[i], n - i < 64 ? n - i : 64) != 0)
+      return 0;
+  }
+
+  return 1;
+}
+
+/*
+ *  sdb_reclaim
+ *      fd:  file descriptor of an open database file
+ *      id:  student id that was just deleted
+ *
+ *  Called by del_student() after the slot of id was cleared.  If that
+ *  leaves every slot in the filesystem block holding it empty, the block is
+ *  punched out of the file (see sdb_punch()) so deleted students stop taking
+ *  up disk space without waiting for compress_db().  The first block is
+ *  never punched since it holds the superblock, neither is a block shared
+ *  with the id index of a dense file.  Buckets of a hashed file are reused
+ *  in place by later students, they are left alone.
+ *
+ *  returns:  NO_ERROR     the block was punched or is still in use
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_reclaim(int fd, int id) {
+  sdb_handle_t *h = sdb_handle(fd);
+  off_t blk, end;
+  student_t *buf;
+  int slot, per, first, rc;
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  if (h->layout == SDB_LAYOUT_HASH)
+    return NO_ERROR;
+
+  slot = h->layout == SDB_LAYOUT_DENSE ? sdb_dense_slot(fd, id) : id;
+  if (slot <= 0)
+    return slot < 0 ? ERR_DB_FILE : NO_ERROR;
+
+  blk = fs_block(fd);
+  per = (int)(blk / STUDENT_RECORD_SIZE);
+  first = slot - slot % per;
+  end = slot_end(h);
+  if (first == 0 ||
+      (end != -1 && (off_t)first * STUDENT_RECORD_SIZE + blk > end))
+    return NO_ERROR;
+
+  buf = malloc(blk);
+  if (buf == NULL)
+    return ERR_DB_FILE;
+
+  rc = block_empty(fd, first, per, buf);
+  free(buf);
+
+  if (rc != 1)
+    return rc < 0 ? ERR_DB_FILE : NO_ERROR;
+
+  return sdb_punch(fd, (off_t)first * STUDENT_RECORD_SIZE, blk);
+}
+
+/*
+ *  sdb_reclaim_all
+ *      fd:  file descriptor of an open database file
+ *
+ *  Online version of compress_db(), reclaims the space of deleted students
+ *  in place instead of copying the database.  Empty slots past the highest
+ *  id are cut off the end of a sparse file, then every allocated extent
+ *  (SEEK_DATA/SEEK_HOLE) is walked a filesystem block at a time and runs of
+ *  blocks with no students are punched out with one sdb_punch() call per
+ *  run.  Student ids and slots do not move, so the superblock and sidecars
+ *  stay valid.  A hashed file has nothing to reclaim, see sdb_reclaim().
+ *
+ *  returns:  NO_ERROR     the free space was reclaimed
+ *            ERR_DB_FILE  database file I/O issue or out of memory
+ */
+int sdb_reclaim_all(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+  superblock_t sb;
+  student_t *buf;
+  off_t blk, size, end, data, hole, run = -1;
+  int per, rc = NO_ERROR;
+
+  if (h == NULL || sdb_sb_read(fd, &sb) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  if (h->layout == SDB_LAYOUT_HASH)
+    return NO_ERROR;
+
+  // the file is changed outside the log, replay must not write over it
+  if (sdb_wal_checkpoint(fd) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  size = lseek(fd, 0, SEEK_END);
+  if (size == -1)
+    return ERR_DB_FILE;
+
+  end = slot_end(h);
+  if (end == -1) {
+    end = (off_t)(sb.max_id + 1) * STUDENT_RECORD_SIZE;
+    if (size > end) {
+      if (sdb_truncate(fd, end) != NO_ERROR)
+        return ERR_DB_FILE;
+      size = end;
+    }
+  }
+
+  blk = fs_block(fd);
+  per = (int)(blk / STUDENT_RECORD_SIZE);
+  // only whole blocks of student slots can be punched
+  end = end < size ? end : size;
+  end -= end % blk;
+
+  buf = malloc(blk);
+  if (buf == NULL)
+    return ERR_DB_FILE;
+
+  for (data = blk; rc == NO_ERROR && data < end; data = hole) {
+    data = lseek(fd, data, SEEK_DATA);
+    if (data == -1 && errno == EINVAL) {
+      data = blk;
+      hole = end;
+    } else if (data == -1) {
+      // ENXIO means there is no data left
+      if (errno != ENXIO)
+        rc = ERR_DB_FILE;
+      break;
+    } else if ((hole = lseek(fd, data, SEEK_HOLE)) == -1) {
+      rc = ERR_DB_FILE;
+      break;
+    }
+
+    data -= data % blk;
+    hole = hole < end ? hole : end;
+    for (off_t off = data; rc == NO_ERROR && off < hole; off += blk) {
+      int empty = block_empty(fd, (int)(off / STUDENT_RECORD_SIZE), per, buf);
+
+      if (empty < 0) {
+        rc = ERR_DB_FILE;
+      } else if (empty && run == -1) {
+        run = off;
+      } else if (!empty && run != -1) {
+        rc = sdb_punch(fd, run, off - run);
+        run = -1;
+      }
+    }
+
+    if (rc == NO_ERROR && run != -1) {
+      rc = sdb_punch(fd, run, hole - run);
+      run = -1;
+    }
+  }
+
+  free(buf);
+  return rc;
+}
@@ -0,0 +1,447 @@
+#define _GNU_SOURCE // SEEK_DATA and SEEK_HOLE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+/*
+ *  next_extent
+ *      scan:  an open scan that has consumed everything up to scan->offset
+ *
+ *  The database is a sparse file, most of it is holes that read back as
+ *  zeros and can never contain a student.  Ask the filesystem where the
+ *  next allocated extent at or after scan->offset starts (SEEK_DATA) and
+ *  where it ends (SEEK_HOLE) so the scan only visits real data.  Holes are
+ *  tracked per filesystem block so an extent always starts on a record
+ *  boundary.  Filesystems that do not support SEEK_DATA report the whole
+ *  file as one extent.
+ *
+ *  returns:  1            scan->offset..scan->data_end is the next extent
+ *            0            there is no data past scan->offset
+ *            ERR_DB_FILE  database file I/O issue
+ */
+static int next_extent(sdb_scan_t *scan) {
+  off_t data, hole;
+
+  if (scan->offset >= scan->file_end)
+    return 0;
+
+  data = lseek(scan->fd, scan->offset, SEEK_DATA);
+  if (data == -1) {
+    if (errno == ENXIO)
+      return 0;
+    if (errno != EINVAL)
+      return ERR_DB_FILE;
+    data = scan->offset;
+    hole = scan->file_end;
+  } else {
+    hole = lseek(scan->fd, data, SEEK_HOLE);
+    if (hole == -1)
+      return ERR_DB_FILE;
+  }
+
+  if (data >= scan->file_end)
+    return 0;
+
+  scan->offset = data - data % STUDENT_RECORD_SIZE;
+  scan->data_end = hole < scan->file_end ? hole : scan->file_end;
+  return 1;
+}
+
+/*
+ *  next_run
+ *      scan:  an open scan driven by the occupancy bitmap
+ *
+ *  With a bitmap we know exactly which slots hold students, so instead of
+ *  asking the filesystem for extents the scan jumps straight to the next
+ *  live id.  Live ids less than a page apart are grouped into one run so
+ *  the read/write engine still reads them with a single pread(), a run
+ *  starts on a page boundary and never gets longer than SDB_SCAN_BLOCK.
+ *
+ *  returns:  1  scan->offset..scan->data_end is the next run
+ *            0  there are no students past scan->offset
+ */
+static int next_run(sdb_scan_t *scan) {
+  const int per_page = SDB_SCAN_ALIGN / STUDENT_RECORD_SIZE;
+  const int max_run = SDB_SCAN_BLOCK / STUDENT_RECORD_SIZE;
+  int from = (int)(scan->offset / STUDENT_RECORD_SIZE);
+  int first, last, next, start;
+
+  first = sdb_bm_next(scan->fd, from);
+  if (first == 0)
+    return 0;
+
+  start = first - first % per_page;
+  if (start < from)
+    start = from;
+
+  last = first;
+  while ((next = sdb_bm_next(scan->fd, last + 1)) != 0 &&
+         next - last <= per_page && next - start < max_run)
+    last = next;
+
+  scan->offset = (off_t)start * STUDENT_RECORD_SIZE;
+  scan->data_end = (off_t)(last + 1) * STUDENT_RECORD_SIZE;
+  if (scan->data_end > scan->file_end)
+    scan->data_end = scan->file_end;
+
+  return scan->offset < scan->data_end ? 1 : 0;
+}
+
+/*
+ *  fill_block
+ *      scan:  an open scan
+ *
+ *  Moves the scan window to the next run of slots in the current extent,
+ *  starting a new extent if the current one is used up.  With the read/write
+ *  engine up to SDB_SCAN_BLOCK bytes are read into the scan buffer with a
+ *  single pread(), with the mmap engine the window is the whole extent inside
+ *  the mapping.  A trailing partial record (which a healthy database never
+ *  has) is ignored.  The window is checked against the page checksums, see
+ *  sdb_sum_check().
+ *
+ *  returns:  1            the window holds at least one more slot
+ *            0            end of the database file
+ *            ERR_DB_FILE  database file I/O issue or a corrupt page
+ */
+static int fill_block(sdb_scan_t *scan) {
+  ssize_t bytes_read;
+  size_t want;
+  int rc;
+
+  if (scan->offset >= scan->data_end) {
+    rc = scan->bm != NULL ? next_run(scan) : next_extent(scan);
+    if (rc <= 0)
+      return rc;
+  }
+
+  want = (size_t)(scan->data_end - scan->offset);
+  if (scan->mapped) {
+    scan->recs = (const student_t *)(scan->map + scan->offset);
+    bytes_read = (ssize_t)want;
+  } else {
+    if (want > SDB_SCAN_BLOCK)
+      want = SDB_SCAN_BLOCK;
+
+    bytes_read = pread(scan->fd, scan->block, want, scan->offset);
+    if (bytes_read == -1)
+      return ERR_DB_FILE;
+    if (bytes_read == 0)
+      return 0;
+    scan->recs = scan->block;
+  }
+
+  if (sdb_sum_check(scan->fd, scan->recs, (size_t)bytes_read, scan->offset) !=
+      NO_ERROR)
+    return ERR_DB_FILE;
+
+  scan->first_id = (int)(scan->offset / STUDENT_RECORD_SIZE);
+  scan->nrecs = (int)(bytes_read / STUDENT_RECORD_SIZE);
+  scan->pos = 0;
+  scan->offset += bytes_read;
+
+  return scan->nrecs > 0 ? 1 : 0;
+}
+
+/*
+ *  bm_bits
+ *      bm:  occupancy bitmap
+ *      id:  first id of the group
+ *      n:   number of ids in the group, at most 64
+ *
+ *  returns:  the n bitmap bits starting at id, id itself in bit 0
+ */
+static unsigned long long bm_bits(const unsigned long long *bm, int id,
+                                  int n) {
+  int word = id / 64, shift = id % 64;
+  unsigned long long bits = bm[word] >> shift;
+
+  if (shift != 0 && shift + n > 64 && word + 1 < SDB_BITMAP_WORDS)
+    bits |= bm[word + 1] << (64 - shift);
+
+  return n == 64 ? bits : bits & ((1ULL << n) - 1);
+}
+
+/*
+ *  dense_end
+ *      h:          handle of the file being scanned
+ *      file_size:  size of the file
+ *
+ *  returns:  where the student slots end, in a dense file the id index that
+ *            follows them must not be mistaken for students
+ */
+static off_t dense_end(const sdb_handle_t *h, off_t file_size) {
+  off_t end = (off_t)(h->nslots + 1) * STUDENT_RECORD_SIZE;
+
+  if (h->layout != SDB_LAYOUT_DENSE || end > file_size)
+    return file_size;
+
+  return end;
+}
+
+/*
+ *  sdb_scan_open
+ *      scan:  scan state to initialize, owned by the caller
+ *      fd:    file descriptor of an open database file
+ *
+ *  Starts a sequential scan of every student slot in the database, that is
+ *  everything after the superblock.  When the occupancy bitmap is available
+ *  the scan only visits live students (see next_run()), otherwise it visits
+ *  the allocated extents of the sparse file (see next_extent()).  A dense
+ *  file is just its slots, front to back, and a hashed one its buckets in
+ *  the order they were made, so its students do not come out by id.  The
+ *  kernel is told the file will be read front to back so it can read ahead
+ *  aggressively.  With the mmap engine the scan walks the mapping in place,
+ *  otherwise records are read SDB_SCAN_BLOCK bytes at a time into an
+ *  aligned buffer and walked in memory.
+ *
+ *  returns:  NO_ERROR     the scan is ready, call sdb_scan_next()
+ *            ERR_DB_FILE  database file issue or out of memory
+ */
+int sdb_scan_open(sdb_scan_t *scan, int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  memset(scan, 0, sizeof(*scan));
+  scan->fd = fd;
+  scan->offset = SDB_HEADER_SIZE;
+  scan->data_end = SDB_HEADER_SIZE;
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  // the directory of a hashed file sits in front of its buckets
+  if (h->layout == SDB_LAYOUT_HASH) {
+    scan->offset = SDB_HASH_DATA_OFF;
+    scan->data_end = SDB_HASH_DATA_OFF;
+  }
+
+  // the bitmap is indexed by id, which is only the slot in a sparse file
+  if (h->layout == SDB_LAYOUT_SPARSE && sdb_bm_fresh(fd))
+    scan->bm = h->bm;
+
+  if (h->engine == SDB_ENGINE_MMAP) {
+    // pick up growth from other processes, after this the scan sees the
+    // database as it was when the scan started
+    if (sdb_refresh(fd) != NO_ERROR)
+      return ERR_DB_FILE;
+
+    if (h->map != NULL) {
+      madvise(h->map, h->map_len, MADV_SEQUENTIAL);
+      scan->map = h->map;
+      scan->file_end = dense_end(h, h->file_size);
+    }
+    scan->mapped = true;
+    return NO_ERROR;
+  }
+
+  scan->file_end = lseek(fd, 0, SEEK_END);
+  if (scan->file_end == -1)
+    return ERR_DB_FILE;
+  scan->file_end = dense_end(h, scan->file_end);
+
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  if (posix_memalign((void **)&scan->block, SDB_SCAN_ALIGN, SDB_SCAN_BLOCK) !=
+      0) {
+    scan->block = NULL;
+    return ERR_DB_FILE;
+  }
+
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_scan_range
+ *      part:   scan state to initialize, owned by the caller
+ *      scan:   a scan of the whole file started with sdb_scan_open()
+ *      start:  file offset of the first slot to visit, a multiple of
+ *              SDB_SCAN_ALIGN or SDB_HEADER_SIZE
+ *      end:    file offset just past the last slot to visit
+ *
+ *  Starts a scan of the slots in start..end only, using the mapping, file
+ *  size and bitmap that sdb_scan_open() settled on for scan.  This is how a
+ *  full table scan is split between threads (see sdb_par_scan()), the parts
+ *  never refresh the mapping or reload the bitmap so they can run side by
+ *  side.  Each part has its own read buffer with the read/write engine.
+ *
+ *  returns:  NO_ERROR     the part is ready, call sdb_scan_next()
+ *            ERR_DB_FILE  out of memory
+ */
+int sdb_scan_range(sdb_scan_t *part, const sdb_scan_t *scan, off_t start,
+                   off_t end) {
+  *part = *scan;
+  part->block = NULL;
+  part->recs = NULL;
+  part->nrecs = 0;
+  part->pos = 0;
+  part->mask = 0;
+  part->offset = start;
+  part->data_end = start;
+  if (end < part->file_end)
+    part->file_end = end;
+
+  if (!part->mapped &&
+      posix_memalign((void **)&part->block, SDB_SCAN_ALIGN, SDB_SCAN_BLOCK) !=
+          0) {
+    part->block = NULL;
+    return ERR_DB_FILE;
+  }
+
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_scan_next
+ *      scan:  a scan started with sdb_scan_open()
+ *      s:     set to point at the next live student record
+ *
+ *  Advances to the next slot that is not empty (all zeros).  The window is
+ *  processed 64 slots at a time: a mask of the live slots in the group is
+ *  taken from the occupancy bitmap, or computed by the vectorized
+ *  sdb_live_mask() kernel, and the set bits are handed out in order.  The
+ *  record pointed to by *s lives in the scan buffer or the mapping and is
+ *  only valid until the next call, copy it if it needs to stick around.
+ *
+ *  returns:  1            *s points at a live record
+ *            0            there are no more records
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_scan_next(sdb_scan_t *scan, const student_t **s) {
+  int rc;
+
+  for (;;) {
+    if (scan->mask != 0) {
+      *s = &scan->recs[scan->mask_base + __builtin_ctzll(scan->mask)];
+      scan->mask &= scan->mask - 1;
+      return 1;
+    }
+
+    if (scan->pos < scan->nrecs) {
+      int n = scan->nrecs - scan->pos < 64 ? scan->nrecs - scan->pos : 64;
+
+      if (scan->bm != NULL)
+        scan->mask = bm_bits(scan->bm, scan->first_id + scan->pos, n);
+      else
+        scan->mask = sdb_live_mask(&scan->recs[scan->pos], n);
+      scan->mask_base = scan->pos;
+      scan->pos += n;
+      continue;
+    }
+
+    rc = fill_block(scan);
+    if (rc <= 0)
+      return rc;
+  }
+}
+
+/*
+ *  sdb_scan_group
+ *      scan:   a scan started with sdb_scan_open()
+ *      *recs:  set to point at the slots of the next group
+ *      *live:  set to the slots of the group that hold a student, bit i
+ *              for (*recs)[i]
+ *
+ *  Advances to the next group of up to 64 slots with at least one student
+ *  in it, for callers that process a whole group at once such as the GPA
+ *  kernels (see sdb_gpa_match()).  The slots are the same ones
+ *  sdb_scan_next() hands out, they are just not split into single records.
+ *  Like there, *recs is only valid until the next call.  Do not mix calls
+ *  to both on one scan.
+ *
+ *  returns:  <n>          number of slots in the group, 1 to 64
+ *            0            there are no more records
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_scan_group(sdb_scan_t *scan, const student_t **recs,
+                   unsigned long long *live) {
+  int rc;
+
+  for (;;) {
+    while (scan->pos < scan->nrecs) {
+      int n = scan->nrecs - scan->pos < 64 ? scan->nrecs - scan->pos : 64;
+
+      *recs = &scan->recs[scan->pos];
+      if (scan->bm != NULL)
+        *live = bm_bits(scan->bm, scan->first_id + scan->pos, n);
+      else
+        *live = sdb_live_mask(*recs, n);
+      scan->pos += n;
+
+      if (*live != 0)
+        return n;
+    }
+
+    rc = fill_block(scan);
+    if (rc <= 0)
+      return rc;
+  }
+}
+
+/*
+ *  sdb_scan_close
+ *      scan:  a scan started with sdb_scan_open()
+ *
+ *  Releases the block buffer.  Safe to call on a scan that failed to open.
+ */
+void sdb_scan_close(sdb_scan_t *scan) {
+  free(scan->block);
+  scan->block = NULL;
+  scan->recs = NULL;
+  scan->nrecs = 0;
+}
+
+/*
+ *  sdb_scan_prev
+ *      fd:  file descriptor of an open database file
+ *      id:  search for live students below this id
+ *
+ *  Finds the highest id below id that holds a student.  Used to keep the
+ *  superblock max_id exact when the student with the highest id is deleted.
+ *  The occupancy bitmap answers this directly, without one the file is read
+ *  backwards a page at a time.
+ *
+ *  returns:  <id>         the highest live id below id
+ *            0            there are no students below id
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_scan_prev(int fd, int id) {
+  student_t page[SDB_SCAN_ALIGN / sizeof(student_t)];
+  const int per_page = SDB_SCAN_ALIGN / sizeof(student_t);
+  int first;
+
+  if (sdb_bm_fresh(fd))
+    return sdb_bm_prev(fd, id);
+
+  if (sdb_handle(fd)->layout == SDB_LAYOUT_DENSE)
+    return sdb_dense_prev(fd, id);
+
+  if (sdb_handle(fd)->layout == SDB_LAYOUT_HASH)
+    return sdb_hash_prev(fd, id);
+
+  for (first = (id - 1) / per_page * per_page; first >= 0; first -= per_page) {
+    ssize_t bytes_read = sdb_read_at(fd, page, sizeof(page),
+                                     (off_t)first * STUDENT_RECORD_SIZE);
+    if (bytes_read == -1)
+      return ERR_DB_FILE;
+
+    for (int i = bytes_read / STUDENT_RECORD_SIZE - 1; i >= 0; i--) {
+      int slot = first + i;
+
+      if (slot >= id || slot < MIN_STD_ID)
+        continue;
+      if (memcmp(&page[i], &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0)
+        return slot;
+    }
+  }
+
+  return 0;
+}
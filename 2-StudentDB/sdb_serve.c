@@ -0,0 +1,659 @@
+#define _GNU_SOURCE // accept4
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+// set by the SIGINT and SIGTERM handler, stops sdb_serve()
+static volatile sig_atomic_t serve_stop = 0;
+
+// one request read by sdb_serve()
+//  sock:  client that sent it
+//  msg:   its header
+//  s:     the student that came with it, and the answer of SDB_OP_GET
+//  rc:    return code of the request once it ran
+//  done:  true once it ran, see run_req()
+typedef struct serve_req {
+  int sock;
+  sdb_msg_t msg;
+  student_t s;
+  int rc;
+  bool done;
+} serve_req_t;
+
+/*
+ *  on_stop
+ *
+ *  Signal handler, asks sdb_serve() to shut down cleanly.
+ */
+static void on_stop(int sig) {
+  (void)sig;
+  serve_stop = 1;
+}
+
+/*
+ *  sock_addr
+ *      path:  name of the database file
+ *      *sa:   receives the address of the daemon socket for path
+ *
+ *  returns:  NO_ERROR     *sa holds the address
+ *            ERR_DB_FILE  the socket name does not fit in sun_path
+ */
+static int sock_addr(const char *path, struct sockaddr_un *sa) {
+  memset(sa, 0, sizeof(*sa));
+  sa->sun_family = AF_UNIX;
+
+  if (snprintf(sa->sun_path, sizeof(sa->sun_path), "%s%s", path,
+               SDB_SOCK_SUFFIX) >= (int)sizeof(sa->sun_path))
+    return ERR_DB_FILE;
+
+  return NO_ERROR;
+}
+
+/*
+ *  send_all
+ *      sock:  connected socket
+ *      buf:   bytes to send
+ *      len:   number of bytes
+ *
+ *  returns:  NO_ERROR     everything was sent
+ *            ERR_DB_FILE  the peer went away or stopped reading, see
+ *                         SDB_SERVE_TIMEOUT
+ */
+static int send_all(int sock, const void *buf, size_t len) {
+  const char *p = buf;
+
+  while (len > 0) {
+    ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return ERR_DB_FILE;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+
+  return NO_ERROR;
+}
+
+/*
+ *  recv_all
+ *      sock:  connected socket
+ *      buf:   where the bytes are stored
+ *      len:   number of bytes to receive
+ *
+ *  returns:  NO_ERROR     len bytes were received
+ *            ERR_DB_FILE  the peer went away or sent a partial message,
+ *                         see SDB_SERVE_TIMEOUT
+ */
+static int recv_all(int sock, void *buf, size_t len) {
+  char *p = buf;
+
+  while (len > 0) {
+    ssize_t n = recv(sock, p, len, 0);
+
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return ERR_DB_FILE;
+    p += n;
+    len -= (size_t)n;
+  }
+
+  return NO_ERROR;
+}
+
+/*
+ *  send_msg
+ *      sock:   connected socket
+ *      op:     SDB_OP_* the message is about
+ *      rc:     return code of the request
+ *      recs:   students that follow the message header
+ *      n:      number of students in recs
+ *
+ *  returns:  NO_ERROR     the message was sent
+ *            ERR_DB_FILE  the peer went away
+ */
+static int send_msg(int sock, unsigned int op, int rc, const student_t *recs,
+                    unsigned int n) {
+  sdb_msg_t msg = {SDB_PROTO_MAGIC, op, rc, n};
+
+  if (send_all(sock, &msg, sizeof(msg)) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  return n == 0 ? NO_ERROR : send_all(sock, recs, n * sizeof(student_t));
+}
+
+/*
+ *  serve_print
+ *      fd:    database file
+ *      sock:  client that asked for SDB_OP_PRINT
+ *
+ *  Copies every student in id order under the same shared lock print_db()
+ *  uses, then drops the lock and sends them to the client SDB_SERVE_BATCH
+ *  at a time, so a client that is slow to read does not hold up writers.
+ *
+ *  returns:  NO_ERROR     the reply was sent
+ *            ERR_DB_FILE  the client went away
+ */
+static int serve_print(int fd, int sock) {
+  student_t *recs = NULL;
+  sdb_scan_t scan;
+  const student_t *rec;
+  unsigned int n = 0, cap = 0;
+  int rc;
+
+  if (sdb_lock_ids(fd, F_RDLCK, MIN_STD_ID, 0) != NO_ERROR)
+    return send_msg(sock, SDB_OP_PRINT, ERR_DB_FILE, NULL, 0);
+
+  rc = sdb_scan_open(&scan, fd);
+  while (rc == NO_ERROR && (rc = sdb_scan_next(&scan, &rec)) == 1) {
+    rc = NO_ERROR;
+    if (n == cap) {
+      unsigned int grown_cap = cap == 0 ? SDB_SERVE_BATCH : cap * 2;
+      student_t *grown = realloc(recs, (size_t)grown_cap * sizeof(*grown));
+
+      if (grown == NULL) {
+        rc = ERR_DB_FILE;
+        break;
+      }
+      recs = grown;
+      cap = grown_cap;
+    }
+    recs[n++] = *rec;
+  }
+  sdb_scan_close(&scan);
+  sdb_lock(fd, F_UNLCK, MIN_STD_ID, 0);
+
+  for (unsigned int i = 0; rc == NO_ERROR && i < n; i += SDB_SERVE_BATCH) {
+    unsigned int len = n - i < SDB_SERVE_BATCH ? n - i : SDB_SERVE_BATCH;
+
+    if (send_msg(sock, SDB_OP_PRINT, NO_ERROR, recs + i, len) != NO_ERROR) {
+      free(recs);
+      return ERR_DB_FILE;
+    }
+  }
+  free(recs);
+
+  return send_msg(sock, SDB_OP_PRINT, rc < 0 ? ERR_DB_FILE : NO_ERROR, NULL,
+                  0);
+}
+
+/*
+ *  recv_req
+ *      sock:  client with a request waiting
+ *      *req:  receives the request
+ *
+ *  Reads one request from a client.  The names of a student to add or
+ *  update are cut at their field size in case the client did not.
+ *
+ *  returns:  NO_ERROR     *req holds the request
+ *            ERR_DB_FILE  the client went away or sent garbage, the
+ *                         connection should be closed
+ */
+static int recv_req(int sock, serve_req_t *req) {
+  memset(req, 0, sizeof(*req));
+  req->sock = sock;
+
+  if (recv_all(sock, &req->msg, sizeof(req->msg)) != NO_ERROR ||
+      req->msg.magic != SDB_PROTO_MAGIC || req->msg.n > 1 ||
+      (req->msg.n == 1 &&
+       recv_all(sock, &req->s, sizeof(req->s)) != NO_ERROR))
+    return ERR_DB_FILE;
+
+  req->s.fname[sizeof(req->s.fname) - 1] = '\0';
+  req->s.lname[sizeof(req->s.lname) - 1] = '\0';
+  return NO_ERROR;
+}
+
+/*
+ *  is_mutation
+ *      req:  a request
+ *
+ *  returns:  true if the request changes the database
+ */
+static bool is_mutation(const serve_req_t *req) {
+  return req->msg.op == SDB_OP_ADD || req->msg.op == SDB_OP_DEL ||
+         req->msg.op == SDB_OP_UPDATE;
+}
+
+/*
+ *  run_req
+ *      fd:    database file
+ *      *req:  request to run, receives its return code
+ *
+ *  Runs a request against the database with the same functions the
+ *  command line uses.  Their console output goes nowhere, see
+ *  sdb_serve().  SDB_OP_PRINT runs when its reply is sent, see
+ *  serve_print().
+ */
+static void run_req(int fd, serve_req_t *req) {
+  student_t *s = &req->s;
+  superblock_t sb;
+  int gpa;
+
+  req->done = true;
+
+  // pick up a compress by another process, see sdb_reopen()
+  if (sdb_reopen(fd) != NO_ERROR) {
+    req->rc = ERR_DB_FILE;
+    return;
+  }
+
+  switch (req->msg.op) {
+  case SDB_OP_GET:
+    req->rc = get_student(fd, s->id, s);
+    break;
+
+  case SDB_OP_ADD:
+    req->rc = validate_range(fd, s->id, s->gpa) == NO_ERROR
+                  ? add_student(fd, s->id, s->fname, s->lname, s->gpa)
+                  : ERR_DB_OP;
+    break;
+
+  case SDB_OP_DEL:
+    req->rc = del_student(fd, s->id);
+    break;
+
+  case SDB_OP_UPDATE:
+    // a negative GPA or an empty last name is kept as it is
+    gpa = s->gpa < 0 ? -1 : s->gpa;
+    req->rc = validate_range(fd, s->id, gpa < 0 ? MIN_STD_GPA : gpa) ==
+                      NO_ERROR
+                  ? update_student(fd, s->id, gpa,
+                                   s->lname[0] == '\0' ? NULL : s->lname)
+                  : ERR_DB_OP;
+    break;
+
+  case SDB_OP_COUNT:
+    req->rc = sdb_sb_read(fd, &sb) == NO_ERROR ? sb.record_count
+                                              : ERR_DB_FILE;
+    break;
+
+  default:
+    req->rc = NO_ERROR;
+  }
+}
+
+/*
+ *  cmp_int
+ *
+ *  qsort() comparator for ints.
+ */
+static int cmp_int(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+
+  return (x > y) - (x < y);
+}
+
+/*
+ *  run_group
+ *      fd:    database file
+ *      reqs:  requests that arrived together
+ *      n:     number of requests
+ *
+ *  Group commit: runs the mutations among the requests as one, see
+ *  sdb_sb_group_begin(), so they share a single write-ahead log sync
+ *  instead of paying one each.  Their ids are locked first, in ascending
+ *  order, and held until the group is committed.  If the group fails every
+ *  mutation in it that had succeeded reports ERR_DB_FILE, none of them
+ *  reached the database.  Nothing is grouped with fewer than two
+ *  mutations, with --sync (that syncs the database after each one anyway)
+ *  or in a dense or hashed database, where adding a student can take the
+ *  whole database lock, the mutations then run one by one.
+ */
+static void run_group(int fd, serve_req_t *reqs, int n) {
+  sdb_handle_t *h = sdb_handle(fd);
+  int ids[SDB_SERVE_CLIENTS];
+  int nids = 0, locked = 0;
+
+  for (int i = 0; i < n; i++) {
+    if (is_mutation(&reqs[i]) && reqs[i].s.id >= MIN_STD_ID)
+      ids[nids++] = reqs[i].s.id;
+  }
+
+  if (nids < 2 || sdb_opts.sync || h == NULL || h->path == NULL)
+    return;
+
+  qsort(ids, nids, sizeof(*ids), cmp_int);
+  while (locked < nids) {
+    if (sdb_lock_ids(fd, F_WRLCK, ids[locked], 1) != NO_ERROR)
+      break;
+    // the same id twice is locked once
+    while (++locked < nids && ids[locked] == ids[locked - 1])
+      ;
+  }
+
+  if (locked == nids && h->layout == SDB_LAYOUT_SPARSE &&
+      sdb_sb_group_begin(fd) == NO_ERROR) {
+    for (int i = 0; i < n; i++) {
+      if (is_mutation(&reqs[i]))
+        run_req(fd, &reqs[i]);
+    }
+
+    if (sdb_sb_group_commit(fd) != NO_ERROR) {
+      for (int i = 0; i < n; i++) {
+        if (is_mutation(&reqs[i]) && reqs[i].rc == NO_ERROR)
+          reqs[i].rc = ERR_DB_FILE;
+      }
+    }
+  }
+
+  for (int i = 0; i < locked; i++)
+    sdb_lock(fd, F_UNLCK, ids[i], 1);
+}
+
+/*
+ *  send_reply
+ *      fd:    database file
+ *      *req:  request that was run, see run_req()
+ *
+ *  returns:  NO_ERROR     the answer was sent
+ *            ERR_DB_FILE  the client went away, the connection should be
+ *                         closed
+ */
+static int send_reply(int fd, const serve_req_t *req) {
+  switch (req->msg.op) {
+  case SDB_OP_GET:
+    return send_msg(req->sock, req->msg.op, req->rc, &req->s,
+                    req->rc == NO_ERROR ? 1 : 0);
+
+  case SDB_OP_ADD:
+  case SDB_OP_DEL:
+  case SDB_OP_UPDATE:
+  case SDB_OP_COUNT:
+    return send_msg(req->sock, req->msg.op, req->rc, NULL, 0);
+
+  case SDB_OP_PRINT:
+    return req->rc == NO_ERROR
+               ? serve_print(fd, req->sock)
+               : send_msg(req->sock, req->msg.op, req->rc, NULL, 0);
+
+  default:
+    return ERR_DB_FILE;
+  }
+}
+
+/*
+ *  serve_round
+ *      fd:     database file
+ *      fds:    poll() results, fds[0] is the listener
+ *      *nfds:  number of entries in fds, clients that are done are taken
+ *              out
+ *
+ *  Answers every client poll() found a request from.  All the requests
+ *  are read first, so the mutations among them can be committed as a
+ *  group (see run_group()), then the rest run and every client gets its
+ *  answer.
+ */
+static void serve_round(int fd, struct pollfd *fds, int *nfds) {
+  serve_req_t reqs[SDB_SERVE_CLIENTS];
+  int n = 0;
+
+  for (int i = *nfds - 1; i >= 1; i--) {
+    if (fds[i].revents == 0)
+      continue;
+
+    if (!(fds[i].revents & POLLIN) ||
+        recv_req(fds[i].fd, &reqs[n]) != NO_ERROR) {
+      close(fds[i].fd);
+      fds[i] = fds[--*nfds];
+    } else {
+      n++;
+    }
+  }
+
+  run_group(fd, reqs, n);
+
+  for (int i = 0; i < n; i++) {
+    if (!reqs[i].done)
+      run_req(fd, &reqs[i]);
+    if (send_reply(fd, &reqs[i]) == NO_ERROR)
+      continue;
+
+    close(reqs[i].sock);
+    for (int k = 1; k < *nfds; k++) {
+      if (fds[k].fd == reqs[i].sock) {
+        fds[k] = fds[--*nfds];
+        break;
+      }
+    }
+  }
+}
+
+/*
+ *  sdb_serve
+ *      fd:    database file opened with open_db()
+ *      path:  name of the database file, the socket is named after it
+ *
+ *  Runs sdbsc as a daemon (sdbsc --serve) so clients do not pay for process
+ *  startup, open_db() and a cold mapping on every lookup.  The database
+ *  stays open and mapped and requests (see sdb_msg_t) from up to
+ *  SDB_SERVE_CLIENTS connections at a time are answered as they arrive.
+ *  Mutations that arrive together are committed as a group, see
+ *  serve_round().  The daemon is just another process as far as the locks
+ *  are concerned, so command line sdbsc processes can keep using the
+ *  database next to it.  A socket left behind by a daemon that died is
+ *  replaced, one that still answers means a daemon is already running.
+ *  Clients get SDB_SERVE_TIMEOUT seconds to finish sending a request or
+ *  take in a reply, a client that stalls longer is disconnected so it
+ *  cannot hold up the others.  SIGINT or SIGTERM shuts the daemon down and
+ *  removes the socket.
+ *
+ *  returns:  NO_ERROR     the daemon was stopped by a signal
+ *            ERR_DB_FILE  the socket could not be set up
+ *
+ *  console:  M_SERVE_START once the daemon is listening
+ *            M_ERR_SERVE if the socket could not be set up
+ */
+int sdb_serve(int fd, const char *path) {
+  struct pollfd fds[SDB_SERVE_CLIENTS + 1];
+  struct sockaddr_un sa;
+  struct sigaction act;
+  struct timeval timeout = {SDB_SERVE_TIMEOUT, 0};
+  int nfds = 1, listener, devnull;
+
+  listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listener == -1 || sock_addr(path, &sa) != NO_ERROR) {
+    if (listener != -1)
+      close(listener);
+    printf(M_ERR_SERVE);
+    return ERR_DB_FILE;
+  }
+
+  // a socket nobody answers on is left over from a daemon that died
+  if (connect(listener, (struct sockaddr *)&sa, sizeof(sa)) == 0) {
+    close(listener);
+    printf(M_ERR_SERVE);
+    return ERR_DB_FILE;
+  }
+  close(listener);
+  unlink(sa.sun_path);
+
+  listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listener == -1 ||
+      bind(listener, (struct sockaddr *)&sa, sizeof(sa)) == -1 ||
+      listen(listener, SOMAXCONN) == -1) {
+    if (listener != -1)
+      close(listener);
+    printf(M_ERR_SERVE);
+    return ERR_DB_FILE;
+  }
+
+  // no SA_RESTART, poll() has to return so the loop sees serve_stop
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = on_stop;
+  sigaction(SIGINT, &act, NULL);
+  sigaction(SIGTERM, &act, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  printf(M_SERVE_START, path, sa.sun_path);
+  fflush(stdout);
+
+  // answers go over the socket, the messages the database functions print
+  // for the command line would only clutter wherever stdout points
+  devnull = open("/dev/null", O_WRONLY);
+  if (devnull != -1) {
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+  }
+
+  fds[0].fd = listener;
+  fds[0].events = POLLIN;
+  while (!serve_stop) {
+    if (poll(fds, nfds, -1) == -1)
+      continue;
+
+    serve_round(fd, fds, &nfds);
+
+    if (fds[0].revents & POLLIN) {
+      int client = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+
+      if (client != -1 &&
+          (nfds == SDB_SERVE_CLIENTS + 1 ||
+           setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                      sizeof(timeout)) == -1 ||
+           setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                      sizeof(timeout)) == -1)) {
+        close(client);
+      } else if (client != -1) {
+        fds[nfds].fd = client;
+        fds[nfds].events = POLLIN;
+        fds[nfds].revents = 0;
+        nfds++;
+      }
+    }
+  }
+
+  for (int i = 1; i < nfds; i++)
+    close(fds[i].fd);
+  close(listener);
+  unlink(sa.sun_path);
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_connect
+ *      path:  name of the database file served by the daemon
+ *
+ *  Connects to a sdbsc --serve daemon (sdbsc --client) and attaches the
+ *  socket with the SDB_ENGINE_REMOTE engine, the sdbsc.c database
+ *  functions then forward their work to the daemon (see sdb_remote()).
+ *
+ *  returns:  the connected socket, used like a database fd
+ *            ERR_DB_FILE  no daemon is serving path
+ *
+ *  console:  M_ERR_CONNECT if no daemon answered
+ */
+int sdb_connect(const char *path) {
+  struct sockaddr_un sa;
+  int sock;
+
+  sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock == -1 || sock_addr(path, &sa) != NO_ERROR ||
+      connect(sock, (struct sockaddr *)&sa, sizeof(sa)) == -1 ||
+      sdb_attach(sock, NULL, SDB_ENGINE_REMOTE) != NO_ERROR) {
+    if (sock != -1)
+      close(sock);
+    printf(M_ERR_CONNECT, path);
+    return ERR_DB_FILE;
+  }
+
+  return sock;
+}
+
+/*
+ *  sdb_remote
+ *      fd:  a database fd
+ *
+ *  returns:  true if fd is a connection to a daemon, see sdb_connect()
+ */
+bool sdb_remote(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  return h != NULL && h->engine == SDB_ENGINE_REMOTE;
+}
+
+/*
+ *  sdb_remote_call
+ *      fd:     connection to a daemon
+ *      op:     SDB_OP_* to run
+ *      req:    student sent with the request, NULL for none
+ *      resp:   receives the student sent back, NULL if none is expected
+ *
+ *  Sends one request to the daemon and waits for the answer.  For
+ *  SDB_OP_PRINT only the request is sent, the students are then read with
+ *  sdb_remote_next().
+ *
+ *  returns:  the rc of the answer, which is what the same operation would
+ *            return without the daemon (the count for SDB_OP_COUNT)
+ *            ERR_DB_FILE  the daemon went away
+ */
+int sdb_remote_call(int fd, unsigned int op, const student_t *req,
+                    student_t *resp) {
+  sdb_msg_t msg = {SDB_PROTO_MAGIC, op, NO_ERROR, req != NULL ? 1 : 0};
+
+  if (send_all(fd, &msg, sizeof(msg)) != NO_ERROR ||
+      (req != NULL && send_all(fd, req, sizeof(*req)) != NO_ERROR))
+    return ERR_DB_FILE;
+
+  if (op == SDB_OP_PRINT)
+    return NO_ERROR;
+
+  if (recv_all(fd, &msg, sizeof(msg)) != NO_ERROR ||
+      msg.magic != SDB_PROTO_MAGIC || msg.op != op || msg.n > 1)
+    return ERR_DB_FILE;
+
+  if (msg.n == 1) {
+    student_t s;
+
+    if (recv_all(fd, &s, sizeof(s)) != NO_ERROR)
+      return ERR_DB_FILE;
+    if (resp != NULL)
+      *resp = s;
+  }
+
+  return msg.rc;
+}
+
+/*
+ *  sdb_remote_next
+ *      fd:     connection to a daemon that was sent SDB_OP_PRINT
+ *      batch:  receives the next students in id order
+ *      max:    room in batch, at least SDB_SERVE_BATCH
+ *
+ *  returns:  <n>          number of students stored in batch
+ *            0            every student was received
+ *            ERR_DB_FILE  the daemon failed or went away
+ */
+int sdb_remote_next(int fd, student_t *batch, int max) {
+  sdb_msg_t msg;
+
+  if (recv_all(fd, &msg, sizeof(msg)) != NO_ERROR ||
+      msg.magic != SDB_PROTO_MAGIC || msg.op != SDB_OP_PRINT ||
+      msg.n > (unsigned int)max ||
+      recv_all(fd, batch, msg.n * sizeof(student_t)) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  if (msg.n == 0)
+    return msg.rc < 0 ? ERR_DB_FILE : 0;
+
+  return (int)msg.n;
+}
@@ -0,0 +1,581 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SDB_X86 1
+#endif
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+// the kernels below rely on a record being exactly one 64 byte cache line,
+// see the note on student_t in db.h
+_Static_assert(sizeof(student_t) == 64, "student_t must be 64 bytes");
+
+/*
+ *  live_mask_scalar
+ *      recs:  slots to check
+ *      n:     number of slots, at most 64
+ *
+ *  Portable version of sdb_live_mask(), ORs each record together as eight
+ *  64 bit words instead of calling memcmp() per slot.
+ */
+static unsigned long long live_mask_scalar(const student_t *recs, int n) {
+  unsigned long long mask = 0;
+
+  for (int i = 0; i < n; i++) {
+    unsigned long long w[8];
+
+    memcpy(w, &recs[i], sizeof(w));
+    if ((w[0] | w[1] | w[2] | w[3] | w[4] | w[5] | w[6] | w[7]) != 0)
+      mask |= 1ULL << i;
+  }
+
+  return mask;
+}
+
+#ifdef SDB_X86
+/*
+ *  live_mask_sse2
+ *
+ *  SSE2 version of sdb_live_mask(), every x86_64 cpu has it.  Each record is
+ *  four 16 byte lanes ORed together and compared against zero, movemask
+ *  turns the compare into a bit.
+ */
+static unsigned long long live_mask_sse2(const student_t *recs, int n) {
+  const __m128i zero = _mm_setzero_si128();
+  unsigned long long mask = 0;
+
+  for (int i = 0; i < n; i++) {
+    const __m128i *p = (const __m128i *)&recs[i];
+    __m128i v = _mm_or_si128(
+        _mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+        _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xffff)
+      mask |= 1ULL << i;
+  }
+
+  return mask;
+}
+
+/*
+ *  live_mask_avx2
+ *
+ *  AVX2 version of sdb_live_mask(), checks four records (four cache lines)
+ *  per iteration.  Each record is two 32 byte lanes ORed together, vptest
+ *  tells us if the result is all zero.
+ */
+__attribute__((target("avx2"))) static unsigned long long
+live_mask_avx2(const student_t *recs, int n) {
+  unsigned long long mask = 0;
+  int i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    const __m256i *p = (const __m256i *)&recs[i];
+    __m256i r0 =
+        _mm256_or_si256(_mm256_loadu_si256(p), _mm256_loadu_si256(p + 1));
+    __m256i r1 =
+        _mm256_or_si256(_mm256_loadu_si256(p + 2), _mm256_loadu_si256(p + 3));
+    __m256i r2 =
+        _mm256_or_si256(_mm256_loadu_si256(p + 4), _mm256_loadu_si256(p + 5));
+    __m256i r3 =
+        _mm256_or_si256(_mm256_loadu_si256(p + 6), _mm256_loadu_si256(p + 7));
+
+    mask |= (unsigned long long)!_mm256_testz_si256(r0, r0) << i;
+    mask |= (unsigned long long)!_mm256_testz_si256(r1, r1) << (i + 1);
+    mask |= (unsigned long long)!_mm256_testz_si256(r2, r2) << (i + 2);
+    mask |= (unsigned long long)!_mm256_testz_si256(r3, r3) << (i + 3);
+  }
+
+  for (; i < n; i++) {
+    const __m256i *p = (const __m256i *)&recs[i];
+    __m256i r =
+        _mm256_or_si256(_mm256_loadu_si256(p), _mm256_loadu_si256(p + 1));
+
+    mask |= (unsigned long long)!_mm256_testz_si256(r, r) << i;
+  }
+
+  return mask;
+}
+#endif
+
+/*
+ *  sdb_live_mask
+ *      recs:  slots to check, straight from a scan buffer or the mapping
+ *      n:     number of slots, at most 64
+ *
+ *  Checks a run of slots for all zero (empty or deleted) records.  The best
+ *  kernel for the cpu we are running on is picked the first time through:
+ *  AVX2, then SSE2, then a portable scalar loop.
+ *
+ *  returns:  a bitmask with bit i set if recs[i] holds a student
+ */
+unsigned long long sdb_live_mask(const student_t *recs, int n) {
+  static unsigned long long (*kernel)(const student_t *, int) = NULL;
+
+  if (kernel == NULL) {
+    kernel = live_mask_scalar;
+#ifdef SDB_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      kernel = live_mask_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+      kernel = live_mask_sse2;
+#endif
+  }
+
+  return kernel(recs, n);
+}
+
+/*
+ *  gpa_bucket
+ *      gpa:  a GPA as stored in student_t
+ *
+ *  returns:  the sdb_gpa_stats_t histogram bucket of gpa, GPAs outside of
+ *            MIN_STD_GPA to MAX_STD_GPA end up in the first or last one
+ */
+static inline int gpa_bucket(int gpa) {
+  int b = gpa / SDB_GPA_BUCKET;
+
+  if (b < 0)
+    return 0;
+  return b < SDB_GPA_BUCKETS ? b : SDB_GPA_BUCKETS - 1;
+}
+
+/*
+ *  gpa_match_scalar
+ *
+ *  Portable version of sdb_gpa_match(), one compare per slot.  Subtracting
+ *  lo first turns the range check into a single unsigned compare.
+ */
+static unsigned long long gpa_match_scalar(const student_t *recs, int n,
+                                           int lo, int hi) {
+  unsigned long long mask = 0;
+
+  for (int i = 0; i < n; i++) {
+    if ((unsigned int)(recs[i].gpa - lo) <= (unsigned int)(hi - lo))
+      mask |= 1ULL << i;
+  }
+
+  return mask;
+}
+
+/*
+ *  gpa_fold_scalar
+ *
+ *  Portable version of sdb_gpa_fold(), visits the live slots only.
+ */
+static void gpa_fold_scalar(const student_t *recs, unsigned long long live,
+                            sdb_gpa_stats_t *st) {
+  for (; live != 0; live &= live - 1) {
+    int gpa = recs[__builtin_ctzll(live)].gpa;
+
+    if (st->count == 0 || gpa < st->min)
+      st->min = gpa;
+    if (st->count == 0 || gpa > st->max)
+      st->max = gpa;
+    st->sum += gpa;
+    st->count++;
+    st->hist[gpa_bucket(gpa)]++;
+  }
+}
+
+#ifdef SDB_X86
+// offsets, in ints, of the gpa field of eight consecutive records
+#define GPA_STRIDE (int)(sizeof(student_t) / sizeof(int))
+#define GPA_LANES                                                              \
+  _mm256_setr_epi32(0, GPA_STRIDE, 2 * GPA_STRIDE, 3 * GPA_STRIDE,             \
+                    4 * GPA_STRIDE, 5 * GPA_STRIDE, 6 * GPA_STRIDE,            \
+                    7 * GPA_STRIDE)
+
+/*
+ *  gpa_match_avx2
+ *
+ *  AVX2 version of sdb_gpa_match().  One gather pulls the gpa field out of
+ *  eight records (one int per cache line) and two compares plus a movemask
+ *  turn them into eight bits of the result.
+ */
+__attribute__((target("avx2"))) static unsigned long long
+gpa_match_avx2(const student_t *recs, int n, int lo, int hi) {
+  const __m256i lanes = GPA_LANES;
+  const __m256i below = _mm256_set1_epi32(lo - 1);
+  const __m256i above = _mm256_set1_epi32(hi + 1);
+  unsigned long long mask = 0;
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i gpa = _mm256_i32gather_epi32(&recs[i].gpa, lanes, 4);
+    __m256i in = _mm256_and_si256(_mm256_cmpgt_epi32(gpa, below),
+                                  _mm256_cmpgt_epi32(above, gpa));
+
+    mask |= (unsigned long long)_mm256_movemask_ps(_mm256_castsi256_ps(in))
+            << i;
+  }
+
+  if (i < n)
+    mask |= gpa_match_scalar(&recs[i], n - i, lo, hi) << i;
+
+  return mask;
+}
+
+/*
+ *  gpa_fold_avx2
+ *
+ *  AVX2 version of sdb_gpa_fold().  Eight GPAs at a time are gathered,
+ *  empty slots are blended out using the live bits and the sum, min and
+ *  max are kept in vector registers that are only reduced at the end.  The
+ *  histogram stays scalar, eight buckets would conflict too often to be
+ *  worth a scatter.
+ */
+__attribute__((target("avx2"))) static void
+gpa_fold_avx2(const student_t *recs, int n, unsigned long long live,
+              sdb_gpa_stats_t *st) {
+  const __m256i lanes = GPA_LANES;
+  const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  __m256i sum = _mm256_setzero_si256();
+  __m256i vmin = _mm256_set1_epi32(0x7fffffff);
+  __m256i vmax = _mm256_set1_epi32(-0x7fffffff - 1);
+  int lane[8];
+  int i = 0, count;
+
+  for (; i + 8 <= n; i += 8) {
+    int bits = (int)((live >> i) & 0xff);
+    __m256i gpa, on;
+
+    if (bits == 0)
+      continue;
+
+    gpa = _mm256_i32gather_epi32(&recs[i].gpa, lanes, 4);
+    on = _mm256_and_si256(_mm256_set1_epi32(bits), bit);
+    on = _mm256_cmpeq_epi32(on, bit);
+
+    sum = _mm256_add_epi32(sum, _mm256_and_si256(gpa, on));
+    vmin = _mm256_min_epi32(vmin, _mm256_blendv_epi8(vmin, gpa, on));
+    vmax = _mm256_max_epi32(vmax, _mm256_blendv_epi8(vmax, gpa, on));
+
+    _mm256_storeu_si256((__m256i *)lane, gpa);
+    for (; bits != 0; bits &= bits - 1)
+      st->hist[gpa_bucket(lane[__builtin_ctz(bits)])]++;
+  }
+
+  // at most 64 GPAs of at most MAX_STD_GPA, the int lanes can not overflow
+  _mm256_storeu_si256((__m256i *)lane, sum);
+  for (int k = 0; k < 8; k++)
+    st->sum += lane[k];
+
+  count = __builtin_popcountll(i < 64 ? live & ((1ULL << i) - 1) : live);
+  if (count > 0) {
+    int lo[8], hi[8];
+    int min, max;
+
+    _mm256_storeu_si256((__m256i *)lo, vmin);
+    _mm256_storeu_si256((__m256i *)hi, vmax);
+    min = lo[0];
+    max = hi[0];
+    for (int k = 1; k < 8; k++) {
+      min = lo[k] < min ? lo[k] : min;
+      max = hi[k] > max ? hi[k] : max;
+    }
+
+    if (st->count == 0 || min < st->min)
+      st->min = min;
+    if (st->count == 0 || max > st->max)
+      st->max = max;
+    st->count += count;
+  }
+
+  if (i < n)
+    gpa_fold_scalar(&recs[i], live >> i, st);
+}
+#endif
+
+/*
+ *  sdb_gpa_match
+ *      recs:  slots of one scan group, see sdb_scan_group()
+ *      n:     number of slots, at most 64
+ *      live:  the slots that hold a student
+ *      lo:    lowest GPA to match
+ *      hi:    highest GPA to match
+ *
+ *  The filter of sdbsc -g.  Only the gpa field of each record is looked
+ *  at, with AVX2 eight records per instruction, falling back to a portable
+ *  scalar loop.
+ *
+ *  returns:  a bitmask with bit i set if recs[i] holds a student with a
+ *            GPA from lo to hi
+ */
+unsigned long long sdb_gpa_match(const student_t *recs, int n,
+                                 unsigned long long live, int lo, int hi) {
+  static unsigned long long (*kernel)(const student_t *, int, int,
+                                      int) = NULL;
+
+  if (kernel == NULL) {
+    kernel = gpa_match_scalar;
+#ifdef SDB_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      kernel = gpa_match_avx2;
+#endif
+  }
+
+  if (lo > hi)
+    return 0;
+
+  return kernel(recs, n, lo, hi) & live;
+}
+
+/*
+ *  sdb_gpa_fold
+ *      recs:  slots of one scan group, see sdb_scan_group()
+ *      n:     number of slots, at most 64
+ *      live:  the slots that hold a student
+ *      *st:   statistics to add the students of the group to
+ *
+ *  The aggregation of sdbsc -s, adds the count, sum, min, max and
+ *  histogram bucket of every live slot to *st.  Like sdb_gpa_match() only
+ *  the gpa field is read, with AVX2 when the cpu has it.
+ */
+void sdb_gpa_fold(const student_t *recs, int n, unsigned long long live,
+                  sdb_gpa_stats_t *st) {
+#ifdef SDB_X86
+  static int avx2 = -1;
+
+  if (avx2 == -1) {
+    __builtin_cpu_init();
+    avx2 = __builtin_cpu_supports("avx2") != 0;
+  }
+
+  if (avx2) {
+    gpa_fold_avx2(recs, n, live, st);
+    return;
+  }
+#endif
+
+  if (n < 64)
+    live &= (1ULL << n) - 1;
+  gpa_fold_scalar(recs, live, st);
+}
+
+/*
+ *  col_match_scalar
+ *
+ *  Portable version of sdb_col_match().  An empty entry (0) becomes -1 -
+ *  lo, which no unsigned range check passes.
+ */
+static unsigned long long col_match_scalar(const int *col, int n, int lo,
+                                           int hi) {
+  unsigned long long mask = 0;
+
+  for (int i = 0; i < n; i++) {
+    if (col[i] != 0 &&
+        (unsigned int)(col[i] - 1 - lo) <= (unsigned int)(hi - lo))
+      mask |= 1ULL << i;
+  }
+
+  return mask;
+}
+
+/*
+ *  col_fold_scalar
+ *
+ *  Portable version of sdb_col_fold().
+ */
+static void col_fold_scalar(const int *col, int n, sdb_gpa_stats_t *st) {
+  for (int i = 0; i < n; i++) {
+    int gpa = col[i] - 1;
+
+    if (col[i] == 0)
+      continue;
+
+    if (st->count == 0 || gpa < st->min)
+      st->min = gpa;
+    if (st->count == 0 || gpa > st->max)
+      st->max = gpa;
+    st->sum += gpa;
+    st->count++;
+    st->hist[gpa_bucket(gpa)]++;
+  }
+}
+
+#ifdef SDB_X86
+// entries folded by col_fold_avx2() before its int lanes are added up, small
+// enough that a lane can not overflow
+#define COL_FOLD_CHUNK 65536
+
+/*
+ *  col_match_avx2
+ *
+ *  AVX2 version of sdb_col_match(), compares eight contiguous entries per
+ *  iteration.
+ */
+__attribute__((target("avx2"))) static unsigned long long
+col_match_avx2(const int *col, int n, int lo, int hi) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i below = _mm256_set1_epi32(lo);
+  const __m256i above = _mm256_set1_epi32(hi + 2);
+  unsigned long long mask = 0;
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)&col[i]);
+    __m256i in = _mm256_and_si256(_mm256_cmpgt_epi32(v, below),
+                                  _mm256_cmpgt_epi32(above, v));
+
+    in = _mm256_and_si256(in, _mm256_cmpgt_epi32(v, zero));
+    mask |= (unsigned long long)_mm256_movemask_ps(_mm256_castsi256_ps(in))
+            << i;
+  }
+
+  if (i < n)
+    mask |= col_match_scalar(&col[i], n - i, lo, hi) << i;
+
+  return mask;
+}
+
+/*
+ *  col_fold_avx2
+ *
+ *  AVX2 version of sdb_col_fold(), everything stays in vector registers.
+ *  Besides the count, sum, min and max each lane counts how many GPAs are
+ *  at or above the start of every histogram bucket, the buckets are the
+ *  differences of those counts.
+ */
+__attribute__((target("avx2"))) static void
+col_fold_avx2(const int *col, int n, sdb_gpa_stats_t *st) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi32(1);
+  long long at_least[SDB_GPA_BUCKETS] = {0};
+  int lane[8];
+  int i = 0;
+
+  while (i + 8 <= n) {
+    __m256i count = zero, sum = zero;
+    __m256i vmin = _mm256_set1_epi32(0x7fffffff);
+    __m256i vmax = _mm256_set1_epi32(-0x7fffffff - 1);
+    __m256i ge[SDB_GPA_BUCKETS];
+    int end = n - i > COL_FOLD_CHUNK ? i + COL_FOLD_CHUNK : n;
+    int min = 0x7fffffff, max = -0x7fffffff - 1;
+    long long chunk = 0;
+
+    for (int b = 0; b < SDB_GPA_BUCKETS; b++)
+      ge[b] = zero;
+
+    for (; i + 8 <= end; i += 8) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)&col[i]);
+      __m256i live = _mm256_cmpgt_epi32(v, zero);
+      __m256i gpa = _mm256_sub_epi32(v, one);
+
+      // compare masks are -1 where true, subtracting them counts
+      count = _mm256_sub_epi32(count, live);
+      sum = _mm256_add_epi32(sum, _mm256_and_si256(gpa, live));
+      vmin = _mm256_min_epi32(vmin, _mm256_blendv_epi8(vmin, gpa, live));
+      vmax = _mm256_max_epi32(vmax, _mm256_blendv_epi8(vmax, gpa, live));
+      for (int b = 1; b < SDB_GPA_BUCKETS; b++) {
+        __m256i start = _mm256_set1_epi32(b * SDB_GPA_BUCKET - 1);
+
+        ge[b] = _mm256_sub_epi32(
+            ge[b], _mm256_and_si256(_mm256_cmpgt_epi32(gpa, start), live));
+      }
+    }
+
+    _mm256_storeu_si256((__m256i *)lane, count);
+    for (int k = 0; k < 8; k++)
+      chunk += lane[k];
+    if (chunk == 0)
+      continue;
+
+    _mm256_storeu_si256((__m256i *)lane, sum);
+    for (int k = 0; k < 8; k++)
+      st->sum += lane[k];
+
+    // lanes that saw no student still hold the starting values
+    _mm256_storeu_si256((__m256i *)lane, vmin);
+    for (int k = 0; k < 8; k++)
+      min = lane[k] < min ? lane[k] : min;
+    _mm256_storeu_si256((__m256i *)lane, vmax);
+    for (int k = 0; k < 8; k++)
+      max = lane[k] > max ? lane[k] : max;
+    if (st->count == 0 || min < st->min)
+      st->min = min;
+    if (st->count == 0 || max > st->max)
+      st->max = max;
+
+    at_least[0] += chunk;
+    for (int b = 1; b < SDB_GPA_BUCKETS; b++) {
+      _mm256_storeu_si256((__m256i *)lane, ge[b]);
+      for (int k = 0; k < 8; k++)
+        at_least[b] += lane[k];
+    }
+    st->count += chunk;
+  }
+
+  for (int b = 0; b < SDB_GPA_BUCKETS; b++) {
+    long long next = b + 1 < SDB_GPA_BUCKETS ? at_least[b + 1] : 0;
+
+    st->hist[b] += at_least[b] - next;
+  }
+
+  if (i < n)
+    col_fold_scalar(&col[i], n - i, st);
+}
+#endif
+
+/*
+ *  sdb_col_match
+ *      col:  entries of the GPA column, see sdb_col_load()
+ *      n:    number of entries, at most 64
+ *      lo:   lowest GPA to match
+ *      hi:   highest GPA to match
+ *
+ *  sdb_gpa_match() for the GPA column, the entries are contiguous so no
+ *  gather is needed.
+ *
+ *  returns:  a bitmask with bit i set if col[i] is a student with a GPA
+ *            from lo to hi
+ */
+unsigned long long sdb_col_match(const int *col, int n, int lo, int hi) {
+  static unsigned long long (*kernel)(const int *, int, int, int) = NULL;
+
+  if (kernel == NULL) {
+    kernel = col_match_scalar;
+#ifdef SDB_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      kernel = col_match_avx2;
+#endif
+  }
+
+  if (lo > hi)
+    return 0;
+
+  return kernel(col, n, lo, hi);
+}
+
+/*
+ *  sdb_col_fold
+ *      col:  entries of the GPA column, see sdb_col_load()
+ *      n:    number of entries, any number
+ *      *st:  statistics to add the students to
+ *
+ *  sdb_gpa_fold() for the GPA column.  With AVX2 even the histogram is
+ *  built in vector registers.
+ */
+void sdb_col_fold(const int *col, int n, sdb_gpa_stats_t *st) {
+  static void (*kernel)(const int *, int, sdb_gpa_stats_t *) = NULL;
+
+  if (kernel == NULL) {
+    kernel = col_fold_scalar;
+#ifdef SDB_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      kernel = col_fold_avx2;
+#endif
+  }
+
+  kernel(col, n, st);
+}
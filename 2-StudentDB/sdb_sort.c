@@ -0,0 +1,475 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+// a sorted run of students spilled to a temporary file
+//  f:    the run, read back from the start when it is merged
+//  buf:  students of the run read ahead while merging, see run_next()
+//  per:  room in buf
+//  pos:  next student of buf, n students are in it
+//  cur:  the first student of the run that was not merged yet
+typedef struct sort_run {
+  FILE *f;
+  student_t *buf;
+  int per;
+  int pos;
+  int n;
+  const student_t *cur;
+} sort_run_t;
+
+// everything print_sorted() is working on
+//  recs:    students collected for the next run, up to cap of them fit in
+//           the memory budget
+//  order:   pointers to recs, sorted with cmp_name() before a run is
+//           written so the 64 byte students do not have to be moved
+//  n:       students in recs
+//  runs:    runs spilled so far, nruns of them in room for runcap
+//  out:     formatted rows waiting to be written, len bytes of them
+//  found:   true once the header was printed
+typedef struct sort_state {
+  student_t *recs;
+  const student_t **order;
+  int n;
+  int cap;
+  sort_run_t *runs;
+  int nruns;
+  int runcap;
+  char *out;
+  size_t len;
+  bool found;
+} sort_state_t;
+
+/*
+ *  cmp_name
+ *      a, b:  two students
+ *
+ *  returns:  <0, 0 or >0 as a sorts before, with or after b by last name,
+ *            then first name and then id, so the order is total and the
+ *            output does not depend on where the runs were cut
+ */
+static int cmp_name(const student_t *a, const student_t *b) {
+  int c = strncmp(a->lname, b->lname, sizeof(a->lname));
+
+  if (c == 0)
+    c = strncmp(a->fname, b->fname, sizeof(a->fname));
+  if (c == 0)
+    c = (a->id > b->id) - (a->id < b->id);
+
+  return c;
+}
+
+/*
+ *  cmp_order
+ *
+ *  qsort() comparator for sort_state_t.order, see cmp_name().
+ */
+static int cmp_order(const void *a, const void *b) {
+  return cmp_name(*(const student_t *const *)a, *(const student_t *const *)b);
+}
+
+/*
+ *  emit
+ *      st:   the sort
+ *      rec:  the next student in name order
+ *
+ *  Prints rec like print_db() does, the header goes out before the first
+ *  row and rows are written a SDB_FMT_BUF buffer at a time.
+ */
+static void emit(sort_state_t *st, const student_t *rec) {
+  if (!st->found) {
+    printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+    fflush(stdout);
+    st->found = true;
+  }
+
+  if (SDB_FMT_BUF - st->len < SDB_FMT_ROW_MAX) {
+    sdb_write_all(STDOUT_FILENO, st->out, st->len);
+    st->len = 0;
+  }
+  st->len += sdb_fmt_row(st->out + st->len, rec);
+}
+
+/*
+ *  run_rewind
+ *      f:  a run that was just written
+ *
+ *  Gets a run ready to be read back with run_next(), which reads the file
+ *  descriptor of f directly.
+ *
+ *  returns:  NO_ERROR     the run can be read
+ *            ERR_DB_FILE  the temporary file could not be written
+ */
+static int run_rewind(FILE *f) {
+  if (fflush(f) != 0 || ferror(f) || lseek(fileno(f), 0, SEEK_SET) == -1)
+    return ERR_DB_FILE;
+
+  return NO_ERROR;
+}
+
+/*
+ *  add_run
+ *      st:  the sort
+ *      f:   a run that was just written
+ *
+ *  returns:  NO_ERROR     f is the last of st->runs
+ *            ERR_DB_FILE  f could not be rewound or out of memory, f was
+ *                         closed
+ */
+static int add_run(sort_state_t *st, FILE *f) {
+  if (run_rewind(f) != NO_ERROR)
+    goto fail;
+
+  if (st->nruns == st->runcap) {
+    int cap = st->runcap == 0 ? SDB_SORT_FANIN : st->runcap * 2;
+    sort_run_t *grown = realloc(st->runs, (size_t)cap * sizeof(*grown));
+
+    if (grown == NULL)
+      goto fail;
+    st->runs = grown;
+    st->runcap = cap;
+  }
+
+  memset(&st->runs[st->nruns], 0, sizeof(sort_run_t));
+  st->runs[st->nruns++].f = f;
+  return NO_ERROR;
+
+fail:
+  fclose(f);
+  return ERR_DB_FILE;
+}
+
+/*
+ *  spill
+ *      st:  the sort
+ *
+ *  Sorts the students collected so far and writes them to a new run in a
+ *  temporary file, which goes away by itself once it is closed.
+ *
+ *  returns:  NO_ERROR     recs is empty again
+ *            ERR_DB_FILE  the run could not be written
+ */
+static int spill(sort_state_t *st) {
+  FILE *f;
+
+  if (st->n == 0)
+    return NO_ERROR;
+
+  qsort(st->order, st->n, sizeof(*st->order), cmp_order);
+
+  f = tmpfile();
+  if (f == NULL)
+    return ERR_DB_FILE;
+
+  for (int i = 0; i < st->n; i++) {
+    if (fwrite(st->order[i], sizeof(student_t), 1, f) != 1) {
+      fclose(f);
+      return ERR_DB_FILE;
+    }
+  }
+
+  st->n = 0;
+  return add_run(st, f);
+}
+
+/*
+ *  collect
+ *      st:   the sort
+ *      rec:  a student of the database, in any order
+ *
+ *  returns:  NO_ERROR     rec was added to the run being collected
+ *            ERR_DB_FILE  a full run could not be spilled
+ */
+static int collect(sort_state_t *st, const student_t *rec) {
+  if (st->n == st->cap && spill(st) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  st->recs[st->n] = *rec;
+  st->order[st->n] = &st->recs[st->n];
+  st->n++;
+  return NO_ERROR;
+}
+
+/*
+ *  collect_local
+ *      st:  the sort
+ *      fd:  an open file descriptor to the database file
+ *
+ *  Feeds every student to collect() with a full table scan, under a shared
+ *  lock on every id like print_db().  The lock is dropped before merging,
+ *  the runs are a snapshot of the table.
+ *
+ *  returns:  NO_ERROR     every student was collected
+ *            ERR_DB_FILE  database or temporary file I/O issue
+ */
+static int collect_local(sort_state_t *st, int fd) {
+  sdb_scan_t scan;
+  const student_t *rec;
+  int rc;
+
+  if (sdb_lock_ids(fd, F_RDLCK, MIN_STD_ID, 0) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  rc = sdb_scan_open(&scan, fd);
+  while (rc == NO_ERROR && (rc = sdb_scan_next(&scan, &rec)) == 1)
+    rc = collect(st, rec);
+  sdb_scan_close(&scan);
+  sdb_lock(fd, F_UNLCK, MIN_STD_ID, 0);
+
+  return rc < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  collect_remote
+ *      st:  the sort
+ *      fd:  connection to a daemon, see sdb_connect()
+ *
+ *  The --client version of collect_local(), the daemon sends every
+ *  student like it does for print_remote().
+ *
+ *  returns:  NO_ERROR     every student was collected
+ *            ERR_DB_FILE  the daemon failed or went away, or a temporary
+ *                         file I/O issue
+ */
+static int collect_remote(sort_state_t *st, int fd) {
+  student_t *batch;
+  int n, rc = NO_ERROR;
+
+  batch = malloc(SDB_SERVE_BATCH * sizeof(student_t));
+  if (batch == NULL || sdb_remote_call(fd, SDB_OP_PRINT, NULL, NULL) !=
+                           NO_ERROR) {
+    free(batch);
+    return ERR_DB_FILE;
+  }
+
+  // keep reading to the end even after a failure, the connection is only
+  // usable again once the last batch was read
+  while ((n = sdb_remote_next(fd, batch, SDB_SERVE_BATCH)) > 0) {
+    for (int i = 0; rc == NO_ERROR && i < n; i++)
+      rc = collect(st, &batch[i]);
+  }
+
+  free(batch);
+  return n < 0 ? ERR_DB_FILE : rc;
+}
+
+/*
+ *  run_next
+ *      run:  a run being merged
+ *
+ *  Moves run->cur to the next student of the run, reading ahead run->per
+ *  students at a time.
+ *
+ *  returns:  1            run->cur is the next student
+ *            0            the run is used up
+ *            ERR_DB_FILE  the temporary file could not be read
+ */
+static int run_next(sort_run_t *run) {
+  if (run->pos == run->n) {
+    ssize_t got = read(fileno(run->f), run->buf,
+                       (size_t)run->per * sizeof(student_t));
+
+    if (got < 0)
+      return ERR_DB_FILE;
+    run->n = (int)(got / (ssize_t)sizeof(student_t));
+    run->pos = 0;
+    if (run->n == 0)
+      return 0;
+  }
+
+  run->cur = &run->buf[run->pos++];
+  return 1;
+}
+
+/*
+ *  sift_down
+ *      runs:  the runs being merged
+ *      heap:  indexes of the runs that are not used up, the run with the
+ *             smallest cur first
+ *      n:     entries in heap
+ *
+ *  Puts heap[0] back where it belongs after its cur changed.
+ */
+static void sift_down(const sort_run_t *runs, int *heap, int n) {
+  int top = heap[0], i = 0;
+
+  for (;;) {
+    int c = 2 * i + 1;
+
+    if (c >= n)
+      break;
+    if (c + 1 < n && cmp_name(runs[heap[c + 1]].cur, runs[heap[c]].cur) < 0)
+      c++;
+    if (cmp_name(runs[top].cur, runs[heap[c]].cur) <= 0)
+      break;
+    heap[i] = heap[c];
+    i = c;
+  }
+  heap[i] = top;
+}
+
+/*
+ *  merge_runs
+ *      st:   the sort
+ *      k:    merge the first k of st->runs, at most SDB_SORT_FANIN
+ *      dst:  a temporary file to write the merged run to, or NULL to
+ *            print it with emit()
+ *
+ *  k-way merge of sorted runs through a heap on their first students.
+ *  The memory budget is shared by the read ahead buffers of the k runs.
+ *  The k runs are closed whatever happens.
+ *
+ *  returns:  NO_ERROR     the runs were merged
+ *            ERR_DB_FILE  temporary file I/O issue or out of memory
+ */
+static int merge_runs(sort_state_t *st, int k, FILE *dst) {
+  sort_run_t *runs = st->runs;
+  int heap[SDB_SORT_FANIN];
+  int per, n = 0, rc = NO_ERROR;
+
+  per = (int)(sdb_opts.sort_mem / ((size_t)k * sizeof(student_t)));
+  for (int i = 0; i < k; i++) {
+    runs[i].per = per;
+    runs[i].buf = malloc((size_t)per * sizeof(student_t));
+    if (runs[i].buf == NULL) {
+      rc = ERR_DB_FILE;
+      continue;
+    }
+    if (rc == NO_ERROR && (rc = run_next(&runs[i])) == 1) {
+      int j;
+
+      // sift up, parents sort before their children
+      for (j = n++; j > 0 && cmp_name(runs[i].cur,
+                                      runs[heap[(j - 1) / 2]].cur) < 0;
+           j = (j - 1) / 2)
+        heap[j] = heap[(j - 1) / 2];
+      heap[j] = i;
+      rc = NO_ERROR;
+    }
+  }
+
+  while (rc == NO_ERROR && n > 0) {
+    sort_run_t *run = &runs[heap[0]];
+
+    if (dst == NULL)
+      emit(st, run->cur);
+    else if (fwrite(run->cur, sizeof(student_t), 1, dst) != 1)
+      rc = ERR_DB_FILE;
+
+    if (rc == NO_ERROR && (rc = run_next(run)) == 0)
+      heap[0] = heap[--n];
+    if (rc >= 0) {
+      rc = NO_ERROR;
+      sift_down(runs, heap, n);
+    }
+  }
+
+  for (int i = 0; i < k; i++) {
+    free(runs[i].buf);
+    fclose(runs[i].f);
+  }
+
+  // the runs left slide down to the front
+  st->nruns -= k;
+  memmove(runs, runs + k, (size_t)st->nruns * sizeof(*runs));
+  return rc;
+}
+
+/*
+ *  print_sorted
+ *      fd:  linux file descriptor, or a connection with --client
+ *
+ *  sdbsc -p --sort=lname, prints every student like print_db() but by last
+ *  name, then first name, then id.  The table does not have to fit in
+ *  memory: students are collected into runs of as many as fit in
+ *  sdb_opts.sort_mem (--sort-mem=N megabytes), each run is sorted through
+ *  an array of pointers and written to a temporary file, and the runs are
+ *  then merged SDB_SORT_FANIN at a time until one last merge prints them.
+ *  A table that fits in one run is sorted and printed without touching a
+ *  temporary file.
+ *
+ *  returns:  NO_ERROR     on success
+ *            ERR_DB_FILE  database or temporary file I/O issue, or out of
+ *                         memory
+ *
+ *  console:  the header and every student in name order
+ *            M_DB_EMPTY if there are no students
+ *            M_ERR_DB_READ on errors, part of the table may have been
+ *              printed
+ */
+int print_sorted(int fd) {
+  sort_state_t st = {0};
+  int rc;
+
+  st.cap = (int)(sdb_opts.sort_mem /
+                 (sizeof(student_t) + sizeof(const student_t *)));
+  st.recs = malloc((size_t)st.cap * sizeof(student_t));
+  st.order = malloc((size_t)st.cap * sizeof(const student_t *));
+  st.out = malloc(SDB_FMT_BUF);
+  if (st.recs == NULL || st.order == NULL || st.out == NULL) {
+    rc = ERR_DB_FILE;
+    goto done;
+  }
+
+  rc = sdb_remote(fd) ? collect_remote(&st, fd) : collect_local(&st, fd);
+  if (rc != NO_ERROR)
+    goto done;
+
+  if (st.nruns == 0) {
+    qsort(st.order, st.n, sizeof(*st.order), cmp_order);
+    for (int i = 0; i < st.n; i++)
+      emit(&st, st.order[i]);
+    goto done;
+  }
+
+  // the last run goes out too, the merge gets the whole memory budget
+  rc = spill(&st);
+  free(st.recs);
+  free(st.order);
+  st.recs = NULL;
+  st.order = NULL;
+
+  while (rc == NO_ERROR && st.nruns > SDB_SORT_FANIN) {
+    FILE *dst = tmpfile();
+
+    if (dst == NULL) {
+      rc = ERR_DB_FILE;
+      break;
+    }
+    rc = merge_runs(&st, SDB_SORT_FANIN, dst);
+    if (rc == NO_ERROR)
+      rc = add_run(&st, dst);
+    else
+      fclose(dst);
+  }
+
+  if (rc == NO_ERROR)
+    rc = merge_runs(&st, st.nruns, NULL);
+
+done:
+  if (st.len > 0)
+    sdb_write_all(STDOUT_FILENO, st.out, st.len);
+  for (int i = 0; i < st.nruns; i++)
+    fclose(st.runs[i].f);
+  free(st.runs);
+  free(st.recs);
+  free(st.order);
+  free(st.out);
+
+  if (rc != NO_ERROR) {
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
+
+  if (!st.found)
+    printf(M_DB_EMPTY);
+
+  return NO_ERROR;
+}
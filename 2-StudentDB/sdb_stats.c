@@ -0,0 +1,621 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+// widest bar of the sdbsc -s histogram
+#define HIST_BAR 40
+
+// students sdbsc -g reads from the database at a time, see range_col()
+#define RANGE_BATCH 1024
+
+/*
+ *  cmp_int
+ *
+ *  qsort() and bsearch() comparator for student ids.
+ */
+static int cmp_int(const void *a, const void *b) {
+  int ia = *(const int *)a, ib = *(const int *)b;
+
+  return (ia > ib) - (ia < ib);
+}
+
+/*
+ *  range_rows
+ *      fd:      an open file descriptor to the database file
+ *      lo, hi:  GPA range, see gpa_range()
+ *      *found:  set to true if any student was printed
+ *
+ *  gpa_range() without the GPA column.  The scan goes a group of 64 slots
+ *  at a time (see sdb_scan_group()) and sdb_gpa_match() picks the
+ *  matching slots by looking only at their gpa field, only those rows are
+ *  formatted.  The caller holds a shared lock on every id.
+ *
+ *  returns:  NO_ERROR     the matching rows were printed
+ *            ERR_DB_FILE  database file I/O issue or out of memory
+ */
+static int range_rows(int fd, int lo, int hi, bool *found) {
+  sdb_scan_t scan;
+  const student_t *recs;
+  unsigned long long live;
+  char *out;
+  size_t len = 0;
+  int rc;
+
+  out = malloc(SDB_FMT_BUF);
+  if (out == NULL)
+    return ERR_DB_FILE;
+
+  rc = sdb_scan_open(&scan, fd);
+  while (rc == NO_ERROR && (rc = sdb_scan_group(&scan, &recs, &live)) > 0) {
+    unsigned long long match = sdb_gpa_match(recs, rc, live, lo, hi);
+
+    rc = NO_ERROR;
+    if (match != 0 && !*found) {
+      printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+      fflush(stdout);
+      *found = true;
+    }
+
+    for (; match != 0; match &= match - 1) {
+      if (SDB_FMT_BUF - len < SDB_FMT_ROW_MAX) {
+        sdb_write_all(STDOUT_FILENO, out, len);
+        len = 0;
+      }
+      len += sdb_fmt_row(out + len, &recs[__builtin_ctzll(match)]);
+    }
+  }
+  sdb_scan_close(&scan);
+
+  if (len > 0)
+    sdb_write_all(STDOUT_FILENO, out, len);
+  free(out);
+
+  return rc < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  print_ids
+ *      fd:      an open file descriptor to the database file
+ *      ids:     ids of students to print, sorted
+ *      n:       number of ids, at most RANGE_BATCH
+ *      recs:    space for n students
+ *      out:     SDB_FMT_BUF bytes to format the rows in
+ *      *found:  set to true if any student was printed
+ *
+ *  Reads the students with sdb_read_sorted() and prints them like
+ *  print_db().  The caller holds a shared lock on every id.
+ *
+ *  returns:  NO_ERROR     the students were printed
+ *            ERR_DB_FILE  database file I/O issue
+ */
+static int print_ids(int fd, const int *ids, int n, student_t *recs,
+                     char *out, bool *found) {
+  size_t len = 0;
+
+  if (n == 0)
+    return NO_ERROR;
+  if (sdb_read_sorted(fd, ids, n, recs) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  if (!*found) {
+    printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+    fflush(stdout);
+    *found = true;
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (recs[i].id != ids[i])
+      continue;
+
+    if (SDB_FMT_BUF - len < SDB_FMT_ROW_MAX) {
+      sdb_write_all(STDOUT_FILENO, out, len);
+      len = 0;
+    }
+    len += sdb_fmt_row(out + len, &recs[i]);
+  }
+
+  if (len > 0)
+    sdb_write_all(STDOUT_FILENO, out, len);
+  return NO_ERROR;
+}
+
+/*
+ *  range_col
+ *      fd:      an open file descriptor to the database file
+ *      lo, hi:  GPA range, see gpa_range()
+ *      *found:  set to true if any student was printed
+ *
+ *  gpa_range() with the GPA column (see sdb_col_load()).  The filter runs
+ *  over 4 bytes per id with sdb_col_match() and only the students that
+ *  match are read from the database, RANGE_BATCH at a time in id
+ *  order.  The caller holds a shared lock on every id.
+ *
+ *  returns:  NO_ERROR     the matching rows were printed
+ *            ERR_DB_FILE  the column could not be used, nothing was
+ *                         printed
+ *            ERR_DB_OP    database file I/O issue, part of the table may
+ *                         have been printed
+ */
+static int range_col(int fd, int lo, int hi, bool *found) {
+  int ids[RANGE_BATCH];
+  student_t *recs;
+  char *out;
+  int *col;
+  int n, nids = 0, rc = NO_ERROR;
+
+  if (sdb_col_load(fd, &col, &n) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  recs = malloc(RANGE_BATCH * sizeof(*recs));
+  out = malloc(SDB_FMT_BUF);
+  if (recs == NULL || out == NULL) {
+    free(col);
+    free(recs);
+    free(out);
+    return ERR_DB_FILE;
+  }
+
+  for (int base = 0; rc == NO_ERROR && base < n; base += 64) {
+    unsigned long long match =
+        sdb_col_match(&col[base], n - base < 64 ? n - base : 64, lo, hi);
+
+    for (; rc == NO_ERROR && match != 0; match &= match - 1) {
+      ids[nids++] = base + __builtin_ctzll(match);
+      if (nids == RANGE_BATCH) {
+        rc = print_ids(fd, ids, nids, recs, out, found);
+        nids = 0;
+      }
+    }
+  }
+  if (rc == NO_ERROR)
+    rc = print_ids(fd, ids, nids, recs, out, found);
+
+  free(col);
+  free(recs);
+  free(out);
+  return rc == NO_ERROR ? NO_ERROR : ERR_DB_OP;
+}
+
+/*
+ *  gpa_range
+ *      fd:  an open file descriptor to the database file
+ *      lo:  lowest GPA to print, as a 3 digit int like -a takes it
+ *      hi:  highest GPA to print
+ *
+ *  sdbsc -g, prints every student with a GPA from lo to hi in id order,
+ *  the same table print_db() prints.  The GPA column picks the students
+ *  (see range_col()), if it can not be used the table is scanned instead
+ *  (see range_rows()).  Like print_db() the whole table is read under a
+ *  shared lock.
+ *
+ *  returns:  NO_ERROR     on success, even if no student matched
+ *            ERR_DB_FILE  database file I/O issue
+ *
+ *  console:  the header and a row per matching student, or M_GPA_NONE
+ *            M_ERR_DB_READ on database errors
+ */
+int gpa_range(int fd, int lo, int hi) {
+  bool found = false;
+  int rc;
+
+  if (sdb_lock_ids(fd, F_RDLCK, MIN_STD_ID, 0) != NO_ERROR) {
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
+
+  rc = range_col(fd, lo, hi, &found);
+  if (rc == ERR_DB_FILE)
+    rc = range_rows(fd, lo, hi, &found);
+  sdb_lock(fd, F_UNLCK, MIN_STD_ID, 0);
+
+  if (rc != NO_ERROR) {
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
+
+  if (!found)
+    printf(M_GPA_NONE, lo / 100.0, hi / 100.0);
+
+  return NO_ERROR;
+}
+
+/*
+ *  stats_part
+ *      part:   scan of one part of the database
+ *      index:  which part, selects the sdb_gpa_stats_t to fill
+ *      arg:    array of sdb_gpa_stats_t, one per part
+ *
+ *  sdb_par_scan() worker for gpa_stats(), folds the GPAs of one part.
+ *
+ *  returns:  NO_ERROR     every student of the part was counted
+ *            ERR_DB_FILE  database file I/O issue
+ */
+static int stats_part(sdb_scan_t *part, int index, void *arg) {
+  sdb_gpa_stats_t *st = &((sdb_gpa_stats_t *)arg)[index];
+  const student_t *recs;
+  unsigned long long live;
+  int n;
+
+  while ((n = sdb_scan_group(part, &recs, &live)) > 0)
+    sdb_gpa_fold(recs, n, live, st);
+
+  return n;
+}
+
+/*
+ *  stats_rows
+ *      fd:   an open file descriptor to the database file
+ *      *st:  receives the statistics of every student
+ *
+ *  gpa_stats() without the GPA column.  The GPAs are folded a scan group
+ *  at a time by sdb_gpa_fold(), split between sdb_opts.jobs threads with
+ *  -j N (see sdb_par_scan()), under a shared lock on every id.
+ *
+ *  returns:  NO_ERROR     *st holds the statistics
+ *            ERR_DB_FILE  database file I/O issue
+ */
+static int stats_rows(int fd, sdb_gpa_stats_t *st) {
+  sdb_gpa_stats_t parts[SDB_MAX_JOBS] = {0};
+  int n;
+
+  if (sdb_lock_ids(fd, F_RDLCK, MIN_STD_ID, 0) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  n = sdb_par_scan(fd, sdb_opts.jobs, stats_part, parts);
+  sdb_lock(fd, F_UNLCK, MIN_STD_ID, 0);
+  if (n < 0)
+    return ERR_DB_FILE;
+
+  for (int i = 0; i < n; i++) {
+    if (parts[i].count == 0)
+      continue;
+
+    if (st->count == 0 || parts[i].min < st->min)
+      st->min = parts[i].min;
+    if (st->count == 0 || parts[i].max > st->max)
+      st->max = parts[i].max;
+    st->count += parts[i].count;
+    st->sum += parts[i].sum;
+    for (int b = 0; b < SDB_GPA_BUCKETS; b++)
+      st->hist[b] += parts[i].hist[b];
+  }
+
+  return NO_ERROR;
+}
+
+/*
+ *  gpa_stats
+ *      fd:  an open file descriptor to the database file
+ *
+ *  sdbsc -s, prints the number of students, their lowest, highest and mean
+ *  GPA and a histogram of the GPAs.  Only the GPA column is read (see
+ *  sdb_col_load()) and folded by sdb_col_fold(), 4 bytes per id instead of
+ *  a 64 byte record.  If the column can not be used the table is scanned
+ *  instead, see stats_rows().
+ *
+ *  returns:  NO_ERROR     on success
+ *            ERR_DB_FILE  database file I/O issue
+ *
+ *  console:  the statistics, M_DB_EMPTY if there are no students
+ *            M_ERR_DB_READ on database errors
+ */
+int gpa_stats(int fd) {
+  sdb_gpa_stats_t st = {0};
+  long long widest = 0;
+  int *col;
+  int n;
+
+  if (sdb_col_load(fd, &col, &n) == NO_ERROR) {
+    sdb_col_fold(col, n, &st);
+    free(col);
+  } else if (stats_rows(fd, &st) != NO_ERROR) {
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
+
+  if (st.count == 0) {
+    printf(M_DB_EMPTY);
+    return NO_ERROR;
+  }
+
+  printf(M_STATS_COUNT, st.count);
+  printf(M_STATS_GPA, st.min / 100.0, st.max / 100.0,
+         (double)st.sum / st.count / 100.0);
+
+  for (int b = 0; b < SDB_GPA_BUCKETS; b++)
+    widest = st.hist[b] > widest ? st.hist[b] : widest;
+
+  for (int b = 0; b < SDB_GPA_BUCKETS; b++) {
+    int lo = b * SDB_GPA_BUCKET;
+    int hi = b == SDB_GPA_BUCKETS - 1 ? MAX_STD_GPA : lo + SDB_GPA_BUCKET - 1;
+    int bar = (int)(st.hist[b] * HIST_BAR / widest);
+
+    // a bucket with anybody in it always gets some bar
+    if (bar == 0 && st.hist[b] > 0)
+      bar = 1;
+    printf(M_STATS_HIST, lo / 100.0, hi / 100.0, st.hist[b]);
+    for (int k = 0; k < bar; k++)
+      putchar('#');
+    putchar('\n');
+  }
+
+  return NO_ERROR;
+}
+
+// one candidate of sdbsc -t, see top_push()
+typedef struct top_ent {
+  int gpa;
+  int id;
+} top_ent_t;
+
+// the K best students seen so far by sdbsc -t
+//  ents:    a heap with the candidate ranked last at ents[0]
+//  n:       entries used in ents
+//  k:       entries allocated for ents, the K of -t K
+//  lowest:  rank the lowest GPAs first instead of the highest
+typedef struct top_heap {
+  top_ent_t *ents;
+  int n;
+  int k;
+  bool lowest;
+} top_heap_t;
+
+/*
+ *  top_before
+ *      t:     the heap, says which way GPAs are ranked
+ *      a, b:  two candidates
+ *
+ *  returns:  true if a is ranked before b, by GPA and then by id
+ */
+static bool top_before(const top_heap_t *t, const top_ent_t *a,
+                       const top_ent_t *b) {
+  if (a->gpa != b->gpa)
+    return t->lowest ? a->gpa < b->gpa : a->gpa > b->gpa;
+
+  return a->id < b->id;
+}
+
+/*
+ *  top_push
+ *      t:     the heap
+ *      gpa:   GPA of a student
+ *      id:    its id
+ *
+ *  Offers a student to the heap.  Until K students were seen every one is
+ *  kept, after that it only replaces the candidate ranked last if it ranks
+ *  before it.  Either way the heap is fixed in log K steps.
+ */
+static void top_push(top_heap_t *t, int gpa, int id) {
+  top_ent_t e = {gpa, id};
+  int i;
+
+  if (t->n < t->k) {
+    // sift up, parents rank after their children
+    for (i = t->n++; i > 0 && top_before(t, &t->ents[(i - 1) / 2], &e);
+         i = (i - 1) / 2)
+      t->ents[i] = t->ents[(i - 1) / 2];
+    t->ents[i] = e;
+    return;
+  }
+
+  if (!top_before(t, &e, &t->ents[0]))
+    return;
+
+  // sift down from the root
+  for (i = 0;;) {
+    int c = 2 * i + 1;
+
+    if (c >= t->n)
+      break;
+    if (c + 1 < t->n && top_before(t, &t->ents[c], &t->ents[c + 1]))
+      c++;
+    if (!top_before(t, &e, &t->ents[c]))
+      break;
+    t->ents[i] = t->ents[c];
+    i = c;
+  }
+  t->ents[i] = e;
+}
+
+/*
+ *  top_range
+ *      t:    the heap
+ *      *lo:  receives the lowest GPA that can still make it in
+ *      *hi:  receives the highest GPA that can still make it in
+ *
+ *  Once the heap is full only GPAs at least as good as the one ranked last
+ *  can make it in, the GPA kernels skip every other student without
+ *  looking at it twice.
+ */
+static void top_range(const top_heap_t *t, int *lo, int *hi) {
+  *lo = MIN_STD_GPA;
+  *hi = MAX_STD_GPA;
+  if (t->n < t->k)
+    return;
+
+  if (t->lowest)
+    *hi = t->ents[0].gpa;
+  else
+    *lo = t->ents[0].gpa;
+}
+
+/*
+ *  top_col
+ *      fd:  an open file descriptor to the database file
+ *      t:   the heap to fill
+ *
+ *  Streams the GPA column (see sdb_col_load()) through the heap, 64 ids at
+ *  a time filtered by sdb_col_match().
+ *
+ *  returns:  NO_ERROR     every student was offered to the heap
+ *            ERR_DB_FILE  the column could not be used
+ */
+static int top_col(int fd, top_heap_t *t) {
+  int *col;
+  int n, lo, hi;
+
+  if (sdb_col_load(fd, &col, &n) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  for (int base = 0; base < n; base += 64) {
+    unsigned long long match;
+
+    top_range(t, &lo, &hi);
+    match = sdb_col_match(&col[base], n - base < 64 ? n - base : 64, lo, hi);
+    for (; match != 0; match &= match - 1) {
+      int id = base + __builtin_ctzll(match);
+
+      top_push(t, col[id] - 1, id);
+    }
+  }
+
+  free(col);
+  return NO_ERROR;
+}
+
+/*
+ *  top_rows
+ *      fd:  an open file descriptor to the database file
+ *      t:   the heap to fill
+ *
+ *  top_col() without the GPA column, streams the table a scan group at a
+ *  time filtered by sdb_gpa_match().
+ *
+ *  returns:  NO_ERROR     every student was offered to the heap
+ *            ERR_DB_FILE  database file I/O issue
+ */
+static int top_rows(int fd, top_heap_t *t) {
+  sdb_scan_t scan;
+  const student_t *recs;
+  unsigned long long live;
+  int rc, lo, hi;
+
+  rc = sdb_scan_open(&scan, fd);
+  while (rc == NO_ERROR && (rc = sdb_scan_group(&scan, &recs, &live)) > 0) {
+    unsigned long long match;
+
+    top_range(t, &lo, &hi);
+    match = sdb_gpa_match(recs, rc, live, lo, hi);
+    for (; match != 0; match &= match - 1) {
+      const student_t *s = &recs[__builtin_ctzll(match)];
+
+      top_push(t, s->gpa, s->id);
+    }
+    rc = NO_ERROR;
+  }
+  sdb_scan_close(&scan);
+
+  return rc < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  cmp_high, cmp_low
+ *
+ *  qsort() comparators, order top_ent_t by rank for sdbsc -t and
+ *  sdbsc -t --lowest.
+ */
+static int cmp_high(const void *a, const void *b) {
+  const top_heap_t t = {NULL, 0, 0, false};
+
+  return top_before(&t, a, b) ? -1 : top_before(&t, b, a);
+}
+
+static int cmp_low(const void *a, const void *b) {
+  const top_heap_t t = {NULL, 0, 0, true};
+
+  return top_before(&t, a, b) ? -1 : top_before(&t, b, a);
+}
+
+/*
+ *  gpa_top
+ *      fd:      an open file descriptor to the database file
+ *      k:       number of students to print
+ *      lowest:  print the lowest GPAs instead of the highest
+ *
+ *  sdbsc -t K, prints the K students with the highest GPA (or the lowest
+ *  with --lowest), best first and ties in id order.  One pass over the GPA
+ *  column (or the table, if the column can not be used) keeps the best K
+ *  in a heap, memory stays bounded by K no matter how big the database
+ *  is.  Only the K winners are read from the database and they are
+ *  printed like find_students() prints.  Like print_db() everything is
+ *  read under a shared lock.
+ *
+ *  returns:  NO_ERROR     on success
+ *            ERR_DB_FILE  database file I/O issue or out of memory
+ *
+ *  console:  the header and K rows, fewer if there are fewer students
+ *            M_DB_EMPTY if there are no students
+ *            M_ERR_DB_READ on database errors
+ */
+int gpa_top(int fd, int k, bool lowest) {
+  top_heap_t t = {NULL, 0, k < MAX_STD_ID ? k : MAX_STD_ID, lowest};
+  student_t *recs = NULL;
+  int *ids = NULL;
+  int rc;
+
+  t.ents = malloc((size_t)t.k * sizeof(*t.ents));
+  if (t.ents == NULL || sdb_lock_ids(fd, F_RDLCK, MIN_STD_ID, 0) != NO_ERROR) {
+    free(t.ents);
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
+
+  rc = top_col(fd, &t);
+  if (rc == ERR_DB_FILE)
+    rc = top_rows(fd, &t);
+
+  if (rc == NO_ERROR && t.n > 0) {
+    ids = malloc((size_t)t.n * sizeof(*ids));
+    recs = malloc((size_t)t.n * sizeof(*recs));
+    if (ids == NULL || recs == NULL) {
+      rc = ERR_DB_FILE;
+    } else {
+      // the winners are read in id order, then printed in rank order
+      for (int i = 0; i < t.n; i++)
+        ids[i] = t.ents[i].id;
+      qsort(ids, t.n, sizeof(*ids), cmp_int);
+      rc = sdb_read_sorted(fd, ids, t.n, recs);
+    }
+  }
+  sdb_lock(fd, F_UNLCK, MIN_STD_ID, 0);
+
+  if (rc != NO_ERROR) {
+    free(t.ents);
+    free(ids);
+    free(recs);
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
+
+  if (t.n == 0)
+    printf(M_DB_EMPTY);
+  else
+    printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+
+  qsort(t.ents, t.n, sizeof(*t.ents), lowest ? cmp_low : cmp_high);
+  for (int i = 0; i < t.n; i++) {
+    int *pos = bsearch(&t.ents[i].id, ids, t.n, sizeof(*ids), cmp_int);
+    student_t *s = &recs[pos - ids];
+
+    if (s->id != t.ents[i].id)
+      continue;
+
+    float calculated_gpa = s->gpa / 100.0;
+
+    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname,
+           calculated_gpa);
+  }
+
+  free(t.ents);
+  free(ids);
+  free(recs);
+  return NO_ERROR;
+}
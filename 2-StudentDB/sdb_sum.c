@@ -0,0 +1,667 @@
+#define _GNU_SOURCE // SEEK_DATA and SEEK_HOLE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+/*
+ *  sum_off
+ *      page:  page number in the database file
+ *
+ *  returns:  offset of the checksum of page in the sidecar
+ */
+static off_t sum_off(off_t page) {
+  return (off_t)sizeof(sdb_sidecar_t) + page * (off_t)sizeof(unsigned int);
+}
+
+/*
+ *  sum_attach
+ *      h:  handle of a database file opened with a path
+ *
+ *  Opens (creating if needed) the page checksum sidecar of the database.
+ *  Does nothing if that already happened.
+ *
+ *  returns:  NO_ERROR     h->sums is ready
+ *            ERR_DB_FILE  no path, the sidecar could not be opened or out
+ *                         of memory
+ */
+static int sum_attach(sdb_handle_t *h) {
+  static const char zeros[SDB_SUM_PAGE];
+  char path[PATH_MAX];
+  mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+  sdb_sums_t *sums;
+  struct stat st;
+
+  if (h->sums != NULL)
+    return NO_ERROR;
+
+  if (h->path == NULL || fstat(h->fd, &st) == -1 ||
+      snprintf(path, sizeof(path), "%s%s", h->path, SDB_SUM_SUFFIX) >=
+          (int)sizeof(path))
+    return ERR_DB_FILE;
+
+  sums = calloc(1, sizeof(*sums));
+  if (sums == NULL)
+    return ERR_DB_FILE;
+
+  sums->fd = open(path, O_RDWR | O_CREAT, mode);
+  if (sums->fd == -1) {
+    free(sums);
+    return ERR_DB_FILE;
+  }
+
+  sums->ino = st.st_ino;
+  sums->zero = sdb_crc32c(0, zeros, sizeof(zeros));
+  h->sums = sums;
+  return NO_ERROR;
+}
+
+/*
+ *  sum_fresh
+ *      sums:  attached page checksums
+ *      *sb:   the superblock the checksums have to match
+ *
+ *  returns:  true if the checksums were written for this exact version of
+ *            the database file, false if they are missing, stale or half
+ *            written
+ */
+static bool sum_fresh(sdb_sums_t *sums, const superblock_t *sb) {
+  sdb_sidecar_t hdr;
+
+  return pread(sums->fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+         hdr.magic == SDB_SUM_MAGIC && hdr.uuid == sb->uuid &&
+         hdr.generation == sb->generation && hdr.ino == sums->ino;
+}
+
+/*
+ *  sum_stamp
+ *      sums:  attached page checksums
+ *      *sb:   the superblock the checksums now match, NULL to mark them
+ *             stale
+ *
+ *  returns:  NO_ERROR     the header was written
+ *            ERR_DB_FILE  the sidecar could not be written
+ */
+static int sum_stamp(sdb_sums_t *sums, const superblock_t *sb) {
+  sdb_sidecar_t hdr = {0};
+
+  __atomic_store_n(&sums->seen, 0, __ATOMIC_RELAXED);
+  if (sb != NULL) {
+    hdr.magic = SDB_SUM_MAGIC;
+    hdr.version = SDB_VERSION;
+    hdr.generation = sb->generation;
+    hdr.uuid = sb->uuid;
+    hdr.ino = sums->ino;
+  }
+
+  return pwrite(sums->fd, &hdr, sizeof(hdr), 0) == sizeof(hdr)
+             ? NO_ERROR
+             : ERR_DB_FILE;
+}
+
+/*
+ *  read_sb
+ *      h:    an attached handle
+ *      *sb:  receives the superblock as it is in the file
+ *
+ *  Reads the superblock without going through sdb_read_at(), which checks
+ *  page 0 against the checksums that need the superblock.
+ *
+ *  returns:  NO_ERROR     *sb holds the superblock, all zeros if the file
+ *                         is too short to have one
+ *            ERR_DB_FILE  database file I/O issue
+ */
+static int read_sb(sdb_handle_t *h, superblock_t *sb) {
+  ssize_t got;
+
+  if (h->map != NULL && h->file_size >= (off_t)sizeof(*sb)) {
+    memcpy(sb, h->map, sizeof(*sb));
+    return NO_ERROR;
+  }
+
+  got = pread(h->fd, sb, sizeof(*sb), 0);
+  if (got == -1)
+    return ERR_DB_FILE;
+  if (got != sizeof(*sb))
+    memset(sb, 0, sizeof(*sb));
+
+  return NO_ERROR;
+}
+
+/*
+ *  get_pages
+ *      h:       an attached handle
+ *      buf:     room for n pages
+ *      first:   first page to get
+ *      n:       number of pages
+ *      mapped:  the caller holds a lock that keeps the file from being cut
+ *               short, so the mapping may be used
+ *
+ *  Finds the bytes of n pages of the database file as they are on disk,
+ *  write-ahead log or not.  With the mmap engine pages inside the mapping
+ *  are used where they are, anything else is read into buf and the part
+ *  past the end of the file is zeroed.  Lock free readers read into buf,
+ *  see sdb_peek_slot().
+ *
+ *  returns:  the n pages, either buf or a pointer into the mapping
+ *            NULL on a database file I/O issue
+ */
+static const char *get_pages(sdb_handle_t *h, char *buf, off_t first, int n,
+                             bool mapped) {
+  size_t len = (size_t)n * SDB_SUM_PAGE;
+  off_t offset = first * SDB_SUM_PAGE;
+  ssize_t got;
+
+  if (mapped && h->map != NULL && offset + (off_t)len <= h->file_size)
+    return h->map + offset;
+
+  got = pread(h->fd, buf, len, offset);
+  if (got == -1)
+    return NULL;
+
+  memset(buf + got, 0, len - (size_t)got);
+  return buf;
+}
+
+/*
+ *  read_sums
+ *      sums:   attached page checksums
+ *      ent:    receives the checksums of n pages
+ *      first:  first page
+ *      n:      number of pages, at most SDB_SUM_CHUNK
+ *
+ *  Entries past the end of the sidecar are 0, the checksum of a page of
+ *  zeros.
+ *
+ *  returns:  NO_ERROR     ent holds the checksums
+ *            ERR_DB_FILE  the sidecar could not be read
+ */
+static int read_sums(sdb_sums_t *sums, unsigned int *ent, off_t first,
+                     int n) {
+  size_t want = (size_t)n * sizeof(*ent);
+  ssize_t got = pread(sums->fd, ent, want, sum_off(first));
+
+  if (got == -1)
+    return ERR_DB_FILE;
+
+  memset((char *)ent + got, 0, want - (size_t)got);
+  return NO_ERROR;
+}
+
+/*
+ *  write_sums
+ *      h:      an attached handle with page checksums
+ *      first:  first page whose checksum is written
+ *      end:    page after the last one
+ *
+ *  Computes the checksums of a range of pages from the database file, up
+ *  to SDB_SUM_CHUNK pages per read, and stores them in the sidecar.
+ *
+ *  returns:  NO_ERROR     the checksums were written
+ *            ERR_DB_FILE  database or sidecar I/O issue, or out of memory
+ */
+static int write_sums(sdb_handle_t *h, off_t first, off_t end) {
+  unsigned int ent[SDB_SUM_CHUNK];
+  char *buf = malloc((size_t)SDB_SUM_CHUNK * SDB_SUM_PAGE);
+  int rc = buf != NULL ? NO_ERROR : ERR_DB_FILE;
+
+  for (off_t page = first; rc == NO_ERROR && page < end;) {
+    int n = end - page < SDB_SUM_CHUNK ? (int)(end - page) : SDB_SUM_CHUNK;
+    const char *pages = get_pages(h, buf, page, n, true);
+
+    if (pages == NULL) {
+      rc = ERR_DB_FILE;
+      break;
+    }
+
+    for (int i = 0; i < n; i++)
+      ent[i] = sdb_crc32c(0, pages + (size_t)i * SDB_SUM_PAGE,
+                          SDB_SUM_PAGE) ^
+               h->sums->zero;
+
+    if (pwrite(h->sums->fd, ent, (size_t)n * sizeof(*ent), sum_off(page)) !=
+        (ssize_t)((size_t)n * sizeof(*ent)))
+      rc = ERR_DB_FILE;
+    page += n;
+  }
+
+  free(buf);
+  return rc;
+}
+
+/*
+ *  rebuild
+ *      h:    an attached handle with page checksums
+ *      *sb:  the current superblock
+ *
+ *  Computes the checksum of every page of the database file, the first
+ *  time the file is opened and whenever the checksums went stale.  Holes
+ *  are skipped (SEEK_DATA), their entries stay holes in the sidecar which
+ *  read as the checksum of a page of zeros.
+ *
+ *  returns:  NO_ERROR     the checksums match *sb
+ *            ERR_DB_FILE  database or sidecar I/O issue, or out of memory
+ */
+static int rebuild(sdb_handle_t *h, const superblock_t *sb) {
+  off_t size = lseek(h->fd, 0, SEEK_END), pages, page = 0;
+  int rc = NO_ERROR;
+
+  if (size == -1 || sum_stamp(h->sums, NULL) != NO_ERROR ||
+      ftruncate(h->sums->fd, sum_off(0)) == -1)
+    return ERR_DB_FILE;
+
+  pages = (size + SDB_SUM_PAGE - 1) / SDB_SUM_PAGE;
+  while (rc == NO_ERROR && page < pages) {
+    off_t data = lseek(h->fd, page * SDB_SUM_PAGE, SEEK_DATA), hole;
+
+    if (data == -1 && errno == ENXIO)
+      break;
+    if (data == -1 && errno != EINVAL)
+      return ERR_DB_FILE;
+
+    // without SEEK_DATA the whole file is one extent
+    if (data == -1) {
+      data = 0;
+      hole = size;
+    } else if ((hole = lseek(h->fd, data, SEEK_HOLE)) == -1) {
+      return ERR_DB_FILE;
+    }
+
+    page = data / SDB_SUM_PAGE;
+    hole = (hole + SDB_SUM_PAGE - 1) / SDB_SUM_PAGE;
+    rc = write_sums(h, page, hole < pages ? hole : pages);
+    page = hole;
+  }
+
+  if (rc == NO_ERROR)
+    rc = sum_stamp(h->sums, sb);
+
+  return rc;
+}
+
+/*
+ *  sdb_sum_open
+ *      fd:   file descriptor of a database file that was just opened
+ *      *sb:  its clean superblock
+ *
+ *  Called by sdb_sb_open() with the superblock lock held.  Attaches the
+ *  page checksums and rebuilds them if they do not match the file.  The
+ *  checksums only protect the database, so if they can not be written
+ *  they are left stale and reads are not checked.
+ */
+void sdb_sum_open(int fd, const superblock_t *sb) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || h->path == NULL || h->engine == SDB_ENGINE_REMOTE ||
+      sum_attach(h) != NO_ERROR)
+    return;
+
+  if (!sum_fresh(h->sums, sb))
+    rebuild(h, sb);
+}
+
+/*
+ *  sdb_sum_begin
+ *      fd:   file descriptor of an open database file
+ *      *sb:  the superblock as it was before the mutation began
+ *
+ *  Called by sdb_sb_begin() with the superblock lock held.  If the
+ *  checksums match the database the mutation records the pages it writes
+ *  with sdb_sum_touch() and sdb_sb_commit() checksums them again once they
+ *  are in the file, otherwise the checksums stay stale until the next open
+ *  rebuilds them.
+ */
+void sdb_sum_begin(int fd, const superblock_t *sb) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || h->sums == NULL)
+    return;
+
+  h->sums->nruns = 0;
+  h->sums->fresh = sum_fresh(h->sums, sb);
+}
+
+/*
+ *  sdb_sum_touch
+ *      fd:      file descriptor of an open database file
+ *      offset:  database file offset the running mutation writes or punches
+ *      len:     number of bytes
+ *
+ *  Called by sdb_wal_log() for every write of a mutation.  Remembers the
+ *  pages written until sdb_sum_commit(), a write next to or inside the
+ *  previous one just extends it.  If we run out of memory the checksums
+ *  are simply left to go stale.
+ */
+void sdb_sum_touch(int fd, off_t offset, off_t len) {
+  sdb_handle_t *h = sdb_handle(fd);
+  sdb_sums_t *sums;
+  off_t first, last;
+
+  if (h == NULL || (sums = h->sums) == NULL || !sums->fresh || len <= 0)
+    return;
+
+  first = offset / SDB_SUM_PAGE;
+  last = (offset + len - 1) / SDB_SUM_PAGE;
+  if (sums->nruns > 0) {
+    sdb_sum_run_t *run = &sums->runs[sums->nruns - 1];
+
+    if (first <= run->last + 1 && last >= run->first - 1) {
+      run->first = first < run->first ? first : run->first;
+      run->last = last > run->last ? last : run->last;
+      return;
+    }
+  }
+
+  if (sums->nruns == sums->cap) {
+    int cap = sums->cap == 0 ? 64 : sums->cap * 2;
+    sdb_sum_run_t *grown = realloc(sums->runs, (size_t)cap * sizeof(*grown));
+
+    if (grown == NULL) {
+      sums->fresh = false;
+      return;
+    }
+    sums->runs = grown;
+    sums->cap = cap;
+  }
+
+  sums->runs[sums->nruns].first = first;
+  sums->runs[sums->nruns].last = last;
+  sums->nruns++;
+}
+
+/*
+ *  cmp_run
+ *      a, b:  sdb_sum_run_t entries
+ *
+ *  qsort() comparator, orders runs by their first page.
+ *
+ *  returns:  <0, 0 or >0 like strcmp()
+ */
+static int cmp_run(const void *a, const void *b) {
+  off_t x = ((const sdb_sum_run_t *)a)->first;
+  off_t y = ((const sdb_sum_run_t *)b)->first;
+
+  return (x > y) - (x < y);
+}
+
+/*
+ *  sdb_sum_commit
+ *      fd:   file descriptor of an open database file
+ *      *sb:  superblock of the mutation that was just committed
+ *
+ *  Called by sdb_sb_commit() once the mutation is in the database file,
+ *  still holding the superblock lock.  Checksums the pages the mutation
+ *  wrote again, from the file, and stamps the sidecar with the new
+ *  generation.  The header
+ *  is cleared while the entries are written so a crash part way leaves
+ *  stale checksums rather than wrong ones, and with --sync the entries are
+ *  on disk before the header says they are current.  Runs are sorted and
+ *  merged first, so a page written many times is checksummed once.
+ */
+void sdb_sum_commit(int fd, const superblock_t *sb) {
+  sdb_handle_t *h = sdb_handle(fd);
+  sdb_sums_t *sums;
+  int n = 0, rc;
+
+  if (h == NULL || (sums = h->sums) == NULL || !sums->fresh)
+    return;
+
+  sums->fresh = false;
+  qsort(sums->runs, sums->nruns, sizeof(*sums->runs), cmp_run);
+  for (int i = 0; i < sums->nruns; i++) {
+    if (n > 0 && sums->runs[i].first <= sums->runs[n - 1].last + 1) {
+      if (sums->runs[i].last > sums->runs[n - 1].last)
+        sums->runs[n - 1].last = sums->runs[i].last;
+    } else {
+      sums->runs[n++] = sums->runs[i];
+    }
+  }
+
+  rc = sum_stamp(sums, NULL);
+  for (int i = 0; rc == NO_ERROR && i < n; i++)
+    rc = write_sums(h, sums->runs[i].first, sums->runs[i].last + 1);
+
+  if (rc == NO_ERROR && sdb_opts.sync && fdatasync(sums->fd) == -1)
+    rc = ERR_DB_FILE;
+  if (rc == NO_ERROR)
+    sum_stamp(sums, sb);
+
+  sums->nruns = 0;
+}
+
+/*
+ *  sdb_sum_abort
+ *      fd:     file descriptor of an open database file
+ *      stale:  clear the header so the checksums get rebuilt
+ *
+ *  Forgets the pages of a mutation that was given up.  A mutation dropped
+ *  by sdb_sb_abort() never reached the file and leaves the sidecar as it
+ *  is, one whose commit failed (see sdb_sb_commit()) may have and marks
+ *  the checksums stale.
+ */
+void sdb_sum_abort(int fd, bool stale) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || h->sums == NULL)
+    return;
+
+  h->sums->nruns = 0;
+  h->sums->fresh = false;
+  if (stale)
+    sum_stamp(h->sums, NULL);
+}
+
+/*
+ *  sdb_sum_close
+ *      fd:  file descriptor of an open database file
+ *
+ *  Closes the page checksum sidecar, if it was opened.
+ */
+void sdb_sum_close(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || h->sums == NULL)
+    return;
+
+  close(h->sums->fd);
+  free(h->sums->runs);
+  free(h->sums);
+  h->sums = NULL;
+}
+
+/*
+ *  check_range
+ *      h:       an attached handle with page checksums
+ *      data:    the bytes of the range as read from the file, NULL to get
+ *               them here
+ *      len:     number of bytes in the range
+ *      offset:  database file offset of the range
+ *
+ *  Does the work of sdb_sum_check() once.  The sidecar header is only read
+ *  again when the generation moved on or a page does not match.
+ *
+ *  returns:  NO_ERROR     every page of the range matches, or the
+ *                         checksums are stale
+ *            ERR_DB_OP    a page does not match its checksum
+ *            ERR_DB_FILE  database or sidecar I/O issue
+ */
+static int check_range(sdb_handle_t *h, const char *data, size_t len,
+                       off_t offset) {
+  off_t first = offset / SDB_SUM_PAGE;
+  off_t end = (offset + (off_t)len - 1) / SDB_SUM_PAGE + 1;
+  unsigned int ent[SDB_SUM_CHUNK];
+  char page_buf[SDB_SUM_PAGE];
+  unsigned long long seen;
+  superblock_t sb;
+
+  if (read_sb(h, &sb) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  // the header only changes along with the generation, except when the
+  // database is replaced (see sum_attach()), which a mismatch rules out
+  seen = sb.generation + 1ULL;
+  if (__atomic_load_n(&h->sums->seen, __ATOMIC_RELAXED) != seen) {
+    if (!sum_fresh(h->sums, &sb))
+      return NO_ERROR;
+    __atomic_store_n(&h->sums->seen, seen, __ATOMIC_RELAXED);
+  }
+
+  for (off_t page = first; page < end;) {
+    int n = end - page < SDB_SUM_CHUNK ? (int)(end - page) : SDB_SUM_CHUNK;
+
+    if (read_sums(h->sums, ent, page, n) != NO_ERROR)
+      return ERR_DB_FILE;
+
+    for (int i = 0; i < n; i++, page++) {
+      off_t start = page * SDB_SUM_PAGE;
+      const char *bytes;
+
+      // pages the caller read in full are not read again
+      if (data != NULL && start >= offset &&
+          start + SDB_SUM_PAGE <= offset + (off_t)len)
+        bytes = data + (start - offset);
+      else if ((bytes = get_pages(h, page_buf, page, 1, false)) == NULL)
+        return ERR_DB_FILE;
+
+      if ((sdb_crc32c(0, bytes, SDB_SUM_PAGE) ^ h->sums->zero) != ent[i]) {
+        __atomic_store_n(&h->sums->seen, 0, __ATOMIC_RELAXED);
+        return sum_fresh(h->sums, &sb) ? ERR_DB_OP : NO_ERROR;
+      }
+    }
+  }
+
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_sum_check
+ *      fd:      file descriptor of an open database file
+ *      data:    the bytes just read from the range, before any write-ahead
+ *               log overlay, or NULL
+ *      len:     number of bytes read
+ *      offset:  database file offset they were read from
+ *
+ *  Verifies every page a read touched against its checksum, so a torn or
+ *  bit rotted page is reported instead of being handed out as students.
+ *  Pages only partly covered by data are read again in full.  Readers
+ *  that only lock the ids they read can see a page while another process
+ *  commits a write to a different slot of it, so a mismatch is checked
+ *  once more holding the superblock lock, which every commit holds until
+ *  its checksums are written.  A handle that already holds that lock (or
+ *  is inside a mutation) can not race a commit, its first answer stands.
+ *
+ *  returns:  NO_ERROR     the pages match, or there are no current
+ *                         checksums to compare against
+ *            ERR_DB_FILE  a page is corrupt, or database file I/O issue
+ */
+int sdb_sum_check(int fd, const void *data, size_t len, off_t offset) {
+  sdb_handle_t *h = sdb_handle(fd);
+  int rc;
+
+  if (h == NULL || h->sums == NULL || len == 0)
+    return NO_ERROR;
+
+  rc = check_range(h, data, len, offset);
+  if (rc != ERR_DB_OP || h->lock_sb || h->lock_all || sdb_wal_active(fd))
+    return rc == NO_ERROR ? NO_ERROR : ERR_DB_FILE;
+
+  if (sdb_lock(fd, F_RDLCK, SDB_LOCK_SB, 1) != NO_ERROR)
+    return ERR_DB_FILE;
+  rc = check_range(h, NULL, len, offset);
+  sdb_lock(fd, F_UNLCK, SDB_LOCK_SB, 1);
+
+  return rc == NO_ERROR ? NO_ERROR : ERR_DB_FILE;
+}
+
+/*
+ *  sdb_sum_ready
+ *      fd:  file descriptor of an open database file
+ *
+ *  returns:  true if the database has page checksums that match it
+ */
+bool sdb_sum_ready(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+  superblock_t sb;
+
+  return h != NULL && h->sums != NULL && read_sb(h, &sb) == NO_ERROR &&
+         sum_fresh(h->sums, &sb);
+}
+
+/*
+ *  sdb_sum_verify
+ *      fd:     file descriptor of a database with current checksums, see
+ *              sdb_sum_ready()
+ *      first:  first page to check
+ *      end:    page after the last one to check
+ *
+ *  Checks a range of pages against their checksums, SDB_SUM_CHUNK pages
+ *  per read.  A chunk that is all hole (SEEK_DATA) is not read, its
+ *  checksums just have to be those of zero pages.  Nothing but the stack
+ *  is used, so threads can check different ranges at the same time, see
+ *  fsck_db().
+ *
+ *  returns:  <page>       the first page from first on that does not match
+ *                         its checksum, end if they all match
+ *            ERR_DB_FILE  database or sidecar I/O issue, or out of memory
+ */
+off_t sdb_sum_verify(int fd, off_t first, off_t end) {
+  sdb_handle_t *h = sdb_handle(fd);
+  unsigned int ent[SDB_SUM_CHUNK];
+  char *buf;
+  off_t bad = end;
+
+  if (h == NULL || h->sums == NULL)
+    return ERR_DB_FILE;
+
+  buf = malloc((size_t)SDB_SUM_CHUNK * SDB_SUM_PAGE);
+  if (buf == NULL)
+    return ERR_DB_FILE;
+
+  for (off_t page = first; bad == end && page < end;) {
+    int n = end - page < SDB_SUM_CHUNK ? (int)(end - page) : SDB_SUM_CHUNK;
+    off_t data = lseek(h->fd, page * SDB_SUM_PAGE, SEEK_DATA);
+    const char *pages = NULL;
+
+    if (read_sums(h->sums, ent, page, n) != NO_ERROR) {
+      bad = ERR_DB_FILE;
+      break;
+    }
+
+    // ENXIO and data past the chunk mean it is all hole, EINVAL that the
+    // filesystem can not tell
+    if ((data == -1 && errno != ENXIO) ||
+        (data != -1 && data < (page + n) * SDB_SUM_PAGE)) {
+      pages = get_pages(h, buf, page, n, true);
+      if (pages == NULL) {
+        bad = ERR_DB_FILE;
+        break;
+      }
+    }
+
+    for (int i = 0; i < n; i++, page++) {
+      unsigned int sum = 0;
+
+      if (pages != NULL)
+        sum = sdb_crc32c(0, pages + (size_t)i * SDB_SUM_PAGE, SDB_SUM_PAGE) ^
+              h->sums->zero;
+      if (sum != ent[i]) {
+        bad = page;
+        break;
+      }
+    }
+  }
+
+  free(buf);
+  return bad;
+}
@@ -0,0 +1,486 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+/*
+ *  sdb_sb_read
+ *      fd:   file descriptor of an open database file
+ *      *sb:  where the superblock is copied
+ *
+ *  Reads the superblock from slot 0.  A file too short to hold one reads
+ *  back as an all zero superblock, same as a file that predates them.
+ *
+ *  returns:  NO_ERROR     *sb holds the superblock
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_sb_read(int fd, superblock_t *sb) {
+  ssize_t bytes_read = sdb_read_at(fd, sb, sizeof(*sb), 0);
+
+  if (bytes_read == -1)
+    return ERR_DB_FILE;
+
+  if (bytes_read != sizeof(*sb))
+    memset(sb, 0, sizeof(*sb));
+
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_sb_write
+ *      fd:   file descriptor of an open database file
+ *      *sb:  the superblock to store in slot 0
+ *
+ *  returns:  NO_ERROR     the superblock was written
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_sb_write(int fd, const superblock_t *sb) {
+  return sdb_write_at(fd, sb, sizeof(*sb), 0);
+}
+
+/*
+ *  new_uuid
+ *
+ *  returns:  a random, non zero id for a newly created superblock
+ */
+static unsigned long long new_uuid(void) {
+  unsigned long long uuid = 0;
+
+  if (getrandom(&uuid, sizeof(uuid), 0) != sizeof(uuid) || uuid == 0)
+    uuid = ((unsigned long long)time(NULL) << 32) ^ (unsigned)getpid() ^ 1;
+
+  return uuid;
+}
+
+/*
+ *  set_layout
+ *      fd:   file descriptor of an open database file
+ *      *sb:  superblock read from the file
+ *
+ *  Tells the storage engine how students are laid out in the file so slot
+ *  lookups (see sdb_read_slot()) and scans find them.  The layout of a file
+ *  never changes while it is open, files change layout by being replaced.
+ *
+ *  returns:  NO_ERROR     the handle has the layout of the file
+ *            ERR_DB_FILE  unknown layout, a dense file too short to hold
+ *                         the slots and index its superblock describes or
+ *                         a hashed one with an impossible directory
+ */
+static int set_layout(int fd, const superblock_t *sb) {
+  sdb_handle_t *h = sdb_handle(fd);
+  off_t need;
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  h->layout = SDB_LAYOUT_SPARSE;
+  h->nslots = 0;
+  if (sb->layout == SDB_LAYOUT_SPARSE)
+    return NO_ERROR;
+
+  // buckets past the end of a hashed file are holes, they read as empty
+  if (sb->layout == SDB_LAYOUT_HASH) {
+    if (sb->nslots < 1 || sb->nslots > 1 << SDB_HASH_MAX_DEPTH ||
+        sb->hash_depth < 0 || sb->hash_depth > SDB_HASH_MAX_DEPTH)
+      return ERR_DB_FILE;
+
+    h->layout = SDB_LAYOUT_HASH;
+    h->nslots = sb->nslots;
+    return NO_ERROR;
+  }
+
+  need = (off_t)(sb->nslots + 1) * STUDENT_RECORD_SIZE +
+         (off_t)sb->nslots * sizeof(unsigned int);
+  if (sb->layout != SDB_LAYOUT_DENSE || sb->nslots < 0 ||
+      sb->nslots > MAX_STD_ID || lseek(fd, 0, SEEK_END) < need)
+    return ERR_DB_FILE;
+
+  h->layout = SDB_LAYOUT_DENSE;
+  h->nslots = sb->nslots;
+  return NO_ERROR;
+}
+
+// what one part of the scan in sdb_sb_rebuild() found
+//  count:   number of students in the part
+//  max_id:  highest id in the part
+typedef struct rebuild_part {
+  int count;
+  int max_id;
+} rebuild_part_t;
+
+/*
+ *  rebuild_part
+ *      part:   scan of one part of the database
+ *      index:  which part, selects the rebuild_part_t to fill
+ *      arg:    array of rebuild_part_t, one per part
+ *
+ *  sdb_par_scan() worker for sdb_sb_rebuild(), counts the students of one
+ *  part and sets their bits in the occupancy bitmap.  Parts never share a
+ *  bitmap word so the updates do not race.
+ *
+ *  returns:  NO_ERROR     the part was counted
+ *            ERR_DB_FILE  database file I/O issue
+ */
+static int rebuild_part(sdb_scan_t *part, int index, void *arg) {
+  rebuild_part_t *out = &((rebuild_part_t *)arg)[index];
+  const student_t *rec;
+  int rc;
+
+  out->count = 0;
+  out->max_id = 0;
+  while ((rc = sdb_scan_next(part, &rec)) == 1) {
+    out->count++;
+    if (rec->id > out->max_id)
+      out->max_id = rec->id;
+    sdb_bm_update(part->fd, rec->id, true, NULL);
+  }
+
+  return rc;
+}
+
+/*
+ *  sdb_sb_rebuild
+ *      fd:   file descriptor of an open database file
+ *      *sb:  superblock to rebuild, the rebuilt copy is left here
+ *
+ *  Recomputes the record count, highest id and occupancy bitmap with a full
+ *  table scan, split between sdb_opts.jobs threads (see sdb_par_scan()),
+ *  and writes a clean, current version superblock.  This is how
+ *  headerless files are upgraded and how a superblock left dirty by a writer
+ *  that died part way through a mutation is repaired.  The uuid of an
+ *  existing superblock is kept, the generation always moves forward so
+ *  every sidecar written before the rebuild is seen as stale.  It skips
+ *  the next generation too, a mutation that failed after sdb_sb_begin()
+ *  may have stamped that one on the bitmap, see sdb_bm_update().  An empty new
+ *  file gets the hashed layout (see sdb_hash.c) if --hash was given.
+ *
+ *  returns:  NO_ERROR     the superblock was rebuilt
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_sb_rebuild(int fd, superblock_t *sb) {
+  rebuild_part_t parts[SDB_MAX_JOBS];
+  unsigned long long uuid = sb->uuid;
+  unsigned int generation = sb->generation;
+  int layout = sb->layout, nslots = sb->nslots, depth = sb->hash_depth;
+  int rc;
+
+  // only keep what we read if it really was one of our superblocks
+  if (sb->magic != SDB_MAGIC || uuid == 0) {
+    uuid = new_uuid();
+    generation = 0;
+  }
+  if (sb->magic != SDB_MAGIC ||
+      (layout != SDB_LAYOUT_DENSE && layout != SDB_LAYOUT_HASH)) {
+    layout = SDB_LAYOUT_SPARSE;
+    nslots = 0;
+    depth = 0;
+  }
+
+  // a brand new file is created hashed if asked to, see --hash.  One empty
+  // bucket behind a one entry directory, all of it holes
+  if (sb->magic != SDB_MAGIC && sdb_opts.hash &&
+      lseek(fd, 0, SEEK_END) == 0) {
+    layout = SDB_LAYOUT_HASH;
+    nslots = 1;
+  }
+
+  memset(sb, 0, sizeof(*sb));
+  sb->magic = SDB_MAGIC;
+  sb->version = SDB_VERSION;
+  sb->state = SDB_STATE_CLEAN;
+  sb->generation = generation + 2;
+  sb->uuid = uuid;
+  sb->layout = layout;
+  sb->nslots = nslots;
+  sb->hash_depth = depth;
+
+  if (set_layout(fd, sb) != NO_ERROR || sdb_bm_reset(fd) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  rc = sdb_par_scan(fd, sdb_opts.jobs, rebuild_part, parts);
+  if (rc < 0)
+    return ERR_DB_FILE;
+
+  // parts are in id order except in a hashed file, so look at all of them
+  for (int i = 0; i < rc; i++) {
+    sb->record_count += parts[i].count;
+    if (parts[i].max_id > sb->max_id)
+      sb->max_id = parts[i].max_id;
+  }
+
+  if (sdb_bm_save(fd, sb) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  return sdb_sb_write(fd, sb);
+}
+
+/*
+ *  sb_load
+ *      fd:  file descriptor of a database file that was just opened
+ *
+ *  Does the work of sdb_sb_open() with the superblock already locked.
+ */
+static int sb_load(int fd) {
+  superblock_t sb;
+  int rc;
+  static const superblock_t empty_sb = {0};
+
+  // committed mutations that did not make it into the file come first
+  if (sdb_wal_open(fd) != NO_ERROR || sdb_sb_read(fd, &sb) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  if (memcmp(&sb, &empty_sb, sizeof(sb)) == 0) {
+    rc = sdb_sb_rebuild(fd, &sb);
+  } else if (sb.magic != SDB_MAGIC || sb.version > SDB_VERSION ||
+             set_layout(fd, &sb) != NO_ERROR) {
+    return ERR_DB_FILE;
+  } else if (sb.state != SDB_STATE_CLEAN || sb.uuid == 0) {
+    rc = sdb_sb_rebuild(fd, &sb);
+  } else {
+    rc = sdb_bm_open(fd, &sb);
+    if (rc == SRCH_NOT_FOUND)
+      rc = sdb_sb_rebuild(fd, &sb);
+  }
+
+  // page checksums go last, they are stamped with the final superblock
+  if (rc == NO_ERROR)
+    sdb_sum_open(fd, &sb);
+
+  return rc;
+}
+
+/*
+ *  sdb_sb_open
+ *      fd:  file descriptor of a database file that was just opened
+ *
+ *  Makes sure the file has a usable superblock.  Files without one (new or
+ *  created by an older sdbsc) get one built for them, a dirty superblock
+ *  is repaired, and files that are not student databases or come from a
+ *  newer format version are rejected.  The occupancy bitmap is loaded too
+ *  and rebuilt along with the superblock if it is missing or stale.  The
+ *  superblock lock is held throughout so a repair or log replay never runs
+ *  next to another process's mutation.
+ *
+ *  returns:  NO_ERROR     the superblock is valid and clean
+ *            ERR_DB_FILE  database file I/O issue or unsupported file
+ */
+int sdb_sb_open(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+  int rc;
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  // the whole database lock already covers the superblock
+  if (h->lock_all)
+    return sb_load(fd);
+
+  if (sdb_lock(fd, F_WRLCK, SDB_LOCK_SB, 1) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  rc = sb_load(fd);
+  sdb_lock(fd, F_UNLCK, SDB_LOCK_SB, 1);
+  return rc;
+}
+
+/*
+ *  sdb_sb_begin
+ *      fd:   file descriptor of an open database file
+ *      *sb:  receives the current superblock
+ *
+ *  Starts a mutation by marking the superblock dirty and moving it to the
+ *  next generation.  The caller changes the student slots, updates the
+ *  sidecars and the counters in *sb and then calls sdb_sb_commit().  If the
+ *  process dies in between, the next open sees the dirty flag and rebuilds
+ *  the counters, so they never silently drift from the data.  With a
+ *  write-ahead log every write from here to sdb_sb_commit() is logged and
+ *  only reaches the file once the whole mutation is durable in the log.
+ *  The superblock lock is taken here and held until sdb_sb_commit(), the
+ *  counters are shared by every writer so mutations commit one at a time.
+ *  Inside a group (see sdb_sb_group_begin()) *sb is just the superblock
+ *  the previous mutation of the group left.
+ *
+ *  returns:  NO_ERROR     *sb holds the superblock, now marked dirty
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_sb_begin(int fd, superblock_t *sb) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  // inside a group the mutation carries on where the last one stopped
+  if (h != NULL && h->group) {
+    *sb = h->group_sb;
+    return NO_ERROR;
+  }
+
+  if (sdb_lock(fd, F_WRLCK, SDB_LOCK_SB, 1) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  if (sdb_sb_read(fd, sb) != NO_ERROR) {
+    sdb_lock(fd, F_UNLCK, SDB_LOCK_SB, 1);
+    return ERR_DB_FILE;
+  }
+
+  // catch the in memory bitmap up with mutations of other processes, it is
+  // updated and saved as part of this one
+  sdb_bm_fresh(fd);
+  sdb_name_begin(fd, sb);
+  sdb_col_begin(fd, sb);
+  sdb_sum_begin(fd, sb);
+
+  sb->state = SDB_STATE_DIRTY;
+  sb->generation++;
+  if (sdb_wal_begin(fd, sb) != NO_ERROR || sdb_sb_write(fd, sb) != NO_ERROR) {
+    sdb_lock(fd, F_UNLCK, SDB_LOCK_SB, 1);
+    return ERR_DB_FILE;
+  }
+
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_sb_commit
+ *      fd:   file descriptor of an open database file
+ *      *sb:  superblock from sdb_sb_begin() with updated counters
+ *
+ *  Finishes a mutation by writing the new counters and marking the
+ *  superblock clean again, then commits the mutation to the write-ahead
+ *  log, see sdb_wal_commit().  Once it is committed the last name index,
+ *  the GPA column and the page checksums are brought up to date (see
+ *  sdb_name_commit(), sdb_col_commit() and sdb_sum_commit()), if the
+ *  commit fails they are marked stale instead.  The superblock lock is
+ *  released either way.  Inside a group *sb is only kept for the next
+ *  mutation, the group is committed by sdb_sb_group_commit().
+ *
+ *  returns:  NO_ERROR     the superblock was written
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_sb_commit(int fd, superblock_t *sb) {
+  sdb_handle_t *h = sdb_handle(fd);
+  superblock_t cur;
+  int rc = NO_ERROR;
+
+  if (h != NULL && h->group) {
+    h->group_sb = *sb;
+    return NO_ERROR;
+  }
+
+  // bucket splits of a hashed file grow it during the mutation, they
+  // leave the new size in the superblock of the file, see sdb_hash_write()
+  if (h != NULL && h->layout == SDB_LAYOUT_HASH &&
+      (rc = sdb_sb_read(fd, &cur)) == NO_ERROR) {
+    sb->nslots = cur.nslots;
+    sb->hash_depth = cur.hash_depth;
+    h->nslots = cur.nslots;
+  }
+
+  sb->state = SDB_STATE_CLEAN;
+  if (rc == NO_ERROR)
+    rc = sdb_sb_write(fd, sb);
+  if (rc == NO_ERROR)
+    rc = sdb_wal_commit(fd);
+
+  // the sidecars only move to the new generation with a mutation that
+  // committed, after a failed one they are marked stale for the next open
+  if (rc == NO_ERROR) {
+    sdb_name_commit(fd, sb);
+    sdb_col_commit(fd, sb);
+    sdb_sum_commit(fd, sb);
+  } else {
+    sdb_name_abort(fd, true);
+    sdb_col_abort(fd, true);
+    sdb_sum_abort(fd, true);
+  }
+
+  sdb_lock(fd, F_UNLCK, SDB_LOCK_SB, 1);
+  return rc;
+}
+
+/*
+ *  sdb_sb_abort
+ *      fd:  file descriptor of an open database file
+ *
+ *  Gives up on a mutation started with sdb_sb_begin() that failed part way
+ *  through.  With a write-ahead log nothing was written to the database
+ *  yet and the mutation is simply dropped, without one the superblock is
+ *  left dirty and gets rebuilt by the next open.  Either way the superblock
+ *  lock is released, which matters to a process that keeps the database
+ *  open after the failure such as sdbsc --serve.  Inside a group the
+ *  whole group is given up once it ends, see sdb_sb_group_commit().
+ */
+void sdb_sb_abort(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h != NULL && h->group) {
+    h->group_err = true;
+    return;
+  }
+
+  sdb_wal_abort(fd);
+  sdb_name_abort(fd, false);
+  sdb_col_abort(fd, false);
+  sdb_sum_abort(fd, false);
+  sdb_lock(fd, F_UNLCK, SDB_LOCK_SB, 1);
+}
+
+/*
+ *  sdb_sb_group_begin
+ *      fd:  file descriptor of an open sparse database file with a path
+ *
+ *  Starts a group commit: the mutations until sdb_sb_group_commit() are
+ *  made as one, so they share one write-ahead log sync (see
+ *  sdb_wal_commit()) and one update of every sidecar.  sdb_sb_begin() and
+ *  sdb_sb_commit() of the mutations in the group only hand the superblock
+ *  on, and sdb_sb_abort() dooms the whole group.  The caller must hold the
+ *  ids of every mutation of the group before calling this, the superblock
+ *  lock is taken here so the lock order stays whole database, ids,
+ *  superblock.  sdbsc --serve groups the requests that arrive together.
+ *
+ *  returns:  NO_ERROR     the group is open
+ *            ERR_DB_FILE  database file I/O issue
+ */
+int sdb_sb_group_begin(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || h->group || sdb_sb_begin(fd, &h->group_sb) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  h->group = true;
+  h->group_err = false;
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_sb_group_commit
+ *      fd:  file descriptor of an open database file
+ *
+ *  Ends a group started with sdb_sb_group_begin().  If every mutation of
+ *  the group went through they are committed together with
+ *  sdb_sb_commit(), otherwise all of them are given up with
+ *  sdb_sb_abort().
+ *
+ *  returns:  NO_ERROR     every mutation of the group is committed
+ *            ERR_DB_FILE  none of them is, a mutation failed or the commit
+ *                         did
+ */
+int sdb_sb_group_commit(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || !h->group)
+    return ERR_DB_FILE;
+
+  h->group = false;
+  if (h->group_err) {
+    sdb_sb_abort(fd);
+    return ERR_DB_FILE;
+  }
+
+  return sdb_sb_commit(fd, &h->group_sb);
+}
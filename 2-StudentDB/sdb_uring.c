@@ -0,0 +1,324 @@
+#define _GNU_SOURCE // IOV_MAX
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+// iovecs the queued requests of a ring can use together, one request can
+// have up to IOV_MAX of them
+#define URING_IOVS (8 * IOV_MAX)
+
+// one queued read or write, kept to check its completion
+//  start, end:  byte range of the database file it touches
+//  want:        bytes it transfers
+//  write:       true for a write
+typedef struct uring_op {
+  off_t start;
+  off_t end;
+  size_t want;
+  bool write;
+} uring_op_t;
+
+// an io_uring instance shared with the kernel, see sdb_uring_open()
+//  ring_fd:   the io_uring file descriptor
+//  sq, cq:    mappings of the submission and completion rings
+//  sq_len:    bytes mapped at sq
+//  cq_len:    bytes mapped at cq, 0 if the kernel maps both rings at sq
+//  sqes:      mapping of the submission queue entries
+//  sq_*:      head, tail, mask and index array of the submission ring
+//  cq_*:      head, tail and mask of the completion ring, and its entries
+//  ops:       what every queued entry does, indexed by user_data
+//  nops:      entries queued since the last sdb_uring_wait()
+//  iov:       copies of the iovecs of the queued entries
+//  niov:      iovecs used in iov
+struct sdb_uring {
+  int ring_fd;
+  void *sq;
+  size_t sq_len;
+  void *cq;
+  size_t cq_len;
+  struct io_uring_sqe *sqes;
+  unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned int *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+  uring_op_t ops[SDB_URING_DEPTH];
+  int nops;
+  struct iovec iov[URING_IOVS];
+  int niov;
+};
+
+/*
+ *  ring_free
+ *      r:  a ring, possibly only partly set up
+ *
+ *  Unmaps the rings and closes the io_uring descriptor.
+ */
+static void ring_free(sdb_uring_t *r) {
+  if (r->sqes != NULL && r->sqes != MAP_FAILED)
+    munmap(r->sqes, SDB_URING_DEPTH * sizeof(struct io_uring_sqe));
+  if (r->cq_len > 0 && r->cq != NULL && r->cq != MAP_FAILED)
+    munmap(r->cq, r->cq_len);
+  if (r->sq != NULL && r->sq != MAP_FAILED)
+    munmap(r->sq, r->sq_len);
+  if (r->ring_fd != -1)
+    close(r->ring_fd);
+  free(r);
+}
+
+/*
+ *  sdb_uring_open
+ *      fd:  file descriptor of an open database file
+ *
+ *  Gives the handle of fd an io_uring (see sdbsc --io=uring) so batches of
+ *  reads and writes can be in flight together instead of going out one
+ *  syscall at a time.  liburing is not needed, the ring is set up with the
+ *  raw io_uring_setup() and mmap() calls.  Kernels without io_uring, or
+ *  with it disabled, make this fail and the handle simply keeps using the
+ *  read/write engine.
+ *
+ *  returns:  NO_ERROR     the handle has a ring
+ *            ERR_DB_FILE  io_uring is not available
+ */
+int sdb_uring_open(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+  struct io_uring_params p;
+  sdb_uring_t *r;
+  char *sq, *cq;
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+  if (h->ring != NULL)
+    return NO_ERROR;
+
+  r = calloc(1, sizeof(*r));
+  if (r == NULL)
+    return ERR_DB_FILE;
+
+  memset(&p, 0, sizeof(p));
+  r->ring_fd = (int)syscall(SYS_io_uring_setup, SDB_URING_DEPTH, &p);
+  if (r->ring_fd == -1) {
+    ring_free(r);
+    return ERR_DB_FILE;
+  }
+
+  r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (r->cq_len > r->sq_len)
+      r->sq_len = r->cq_len;
+    r->cq_len = 0;
+  }
+
+  r->sq = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_SQ_RING);
+  if (r->sq == MAP_FAILED) {
+    ring_free(r);
+    return ERR_DB_FILE;
+  }
+
+  r->cq = r->sq;
+  if (r->cq_len > 0) {
+    r->cq = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_CQ_RING);
+    if (r->cq == MAP_FAILED) {
+      ring_free(r);
+      return ERR_DB_FILE;
+    }
+  }
+
+  r->sqes = mmap(NULL, SDB_URING_DEPTH * sizeof(struct io_uring_sqe),
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 r->ring_fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED) {
+    ring_free(r);
+    return ERR_DB_FILE;
+  }
+
+  sq = r->sq;
+  cq = r->cq;
+  r->sq_head = (unsigned int *)(sq + p.sq_off.head);
+  r->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+  r->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+  r->sq_array = (unsigned int *)(sq + p.sq_off.array);
+  r->cq_head = (unsigned int *)(cq + p.cq_off.head);
+  r->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+  r->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  h->ring = r;
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_uring_close
+ *      fd:  file descriptor of an open database file
+ *
+ *  Waits for anything still queued and frees the ring of the handle, if it
+ *  has one.
+ */
+void sdb_uring_close(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || h->ring == NULL)
+    return;
+
+  sdb_uring_wait(fd);
+  ring_free(h->ring);
+  h->ring = NULL;
+}
+
+/*
+ *  sdb_uring_ready
+ *      fd:  file descriptor of an open database file
+ *
+ *  returns:  true if reads and writes of fd can go through
+ *            sdb_uring_queue(), false if they have to be issued directly
+ */
+bool sdb_uring_ready(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  return h != NULL && h->ring != NULL && h->engine == SDB_ENGINE_RW &&
+         !sdb_wal_active(fd);
+}
+
+/*
+ *  sdb_uring_queue
+ *      fd:      file descriptor of a database file with a ring
+ *      write:   true to write the iovecs, false to read into them
+ *      iov:     the buffers, copied so the caller may reuse the array
+ *      iovcnt:  number of iovecs, at most IOV_MAX
+ *      offset:  file offset of the first byte
+ *
+ *  Queues a preadv() or pwritev() on the ring of fd without waiting for
+ *  it.  The buffers themselves have to stay untouched until
+ *  sdb_uring_wait().  Queued requests may complete in any order, so when a
+ *  new one overlaps a queued write (or is a write overlapping anything
+ *  queued), everything queued so far is waited for first.  The same
+ *  happens when the ring is full.
+ *
+ *  returns:  NO_ERROR     the request is queued
+ *            ERR_DB_FILE  fd has no ring, or an earlier request failed
+ */
+int sdb_uring_queue(int fd, bool write, const struct iovec *iov, int iovcnt,
+                    off_t offset) {
+  sdb_handle_t *h = sdb_handle(fd);
+  struct io_uring_sqe *sqe;
+  sdb_uring_t *r;
+  unsigned int tail, index;
+  size_t want = 0;
+
+  if (h == NULL || h->ring == NULL || iovcnt < 1 || iovcnt > IOV_MAX)
+    return ERR_DB_FILE;
+  r = h->ring;
+
+  for (int i = 0; i < iovcnt; i++)
+    want += iov[i].iov_len;
+
+  if (r->nops == SDB_URING_DEPTH || r->niov + iovcnt > URING_IOVS) {
+    if (sdb_uring_wait(fd) != NO_ERROR)
+      return ERR_DB_FILE;
+  }
+
+  for (int i = 0; i < r->nops; i++) {
+    if (offset < r->ops[i].end && r->ops[i].start < offset + (off_t)want &&
+        (write || r->ops[i].write)) {
+      if (sdb_uring_wait(fd) != NO_ERROR)
+        return ERR_DB_FILE;
+      break;
+    }
+  }
+
+  memcpy(&r->iov[r->niov], iov, iovcnt * sizeof(*iov));
+
+  tail = *r->sq_tail;
+  index = tail & *r->sq_mask;
+  sqe = &r->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long long)(uintptr_t)&r->iov[r->niov];
+  sqe->len = (unsigned int)iovcnt;
+  sqe->off = (unsigned long long)offset;
+  sqe->user_data = (unsigned long long)r->nops;
+  r->sq_array[index] = index;
+
+  // the kernel must see the entry before it sees the new tail
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  r->ops[r->nops].start = offset;
+  r->ops[r->nops].end = offset + (off_t)want;
+  r->ops[r->nops].want = want;
+  r->ops[r->nops].write = write;
+  r->nops++;
+  r->niov += iovcnt;
+
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_uring_wait
+ *      fd:  file descriptor of a database file
+ *
+ *  Submits everything queued with sdb_uring_queue() in one io_uring_enter()
+ *  and waits until all of it completed.  A read that comes up short ran
+ *  into the end of the file, just like a short pread(), a short write is
+ *  an error.  Does nothing if fd has no ring or nothing is queued.  If the
+ *  ring itself fails the handle drops it and goes on without one.
+ *
+ *  returns:  NO_ERROR     every queued request completed
+ *            ERR_DB_FILE  a request failed
+ */
+int sdb_uring_wait(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+  sdb_uring_t *r;
+  int submitted = 0, done = 0, rc = NO_ERROR;
+
+  if (h == NULL || h->ring == NULL)
+    return NO_ERROR;
+  r = h->ring;
+
+  while (done < r->nops) {
+    unsigned int head, tail;
+    int ret;
+
+    ret = (int)syscall(SYS_io_uring_enter, r->ring_fd, r->nops - submitted,
+                       r->nops - done, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (ret == -1 && errno != EINTR) {
+      ring_free(r);
+      h->ring = NULL;
+      return ERR_DB_FILE;
+    }
+    if (ret > 0)
+      submitted += ret;
+
+    head = *r->cq_head;
+    tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+      uring_op_t *op = &r->ops[cqe->user_data];
+
+      if (cqe->res < 0 || (op->write && (size_t)cqe->res != op->want))
+        rc = ERR_DB_FILE;
+      done++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  r->nops = 0;
+  r->niov = 0;
+  return rc;
+}
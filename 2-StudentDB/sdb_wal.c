@@ -0,0 +1,529 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblib.h"
+
+#define REC_SIZE sizeof(sdb_wal_rec_t)
+#define BOOT_ID_FILE "/proc/sys/kernel/random/boot_id"
+
+/*
+ *  pad8
+ *      len:  length of the data of a record
+ *
+ *  returns:  len rounded up to a multiple of 8, records stay 8 byte aligned
+ */
+static size_t pad8(size_t len) { return (len + 7) & ~(size_t)7; }
+
+/*
+ *  rec_crc
+ *      rec:   record header, its crc field is ignored
+ *      data:  the data following the header, NULL if there is none
+ *
+ *  returns:  CRC32C of the header (with crc set to 0) and the data
+ */
+static unsigned int rec_crc(const sdb_wal_rec_t *rec, const void *data) {
+  sdb_wal_rec_t hdr = *rec;
+  unsigned int crc;
+
+  hdr.crc = 0;
+  crc = sdb_crc32c(0, &hdr, sizeof(hdr));
+  if (rec->type == SDB_WAL_WRITE)
+    crc = sdb_crc32c(crc, data, rec->len);
+
+  return crc;
+}
+
+/*
+ *  boot_id
+ *
+ *  returns:  a 64 bit hash of the id the kernel gave the running boot, 0 if
+ *            it cannot be read
+ */
+static unsigned long long boot_id(void) {
+  char id[36];
+  int fd = open(BOOT_ID_FILE, O_RDONLY);
+  ssize_t n = fd == -1 ? -1 : read(fd, id, sizeof(id));
+
+  if (fd != -1)
+    close(fd);
+  if (n != sizeof(id))
+    return 0;
+
+  return (unsigned long long)sdb_crc32c(0, id, sizeof(id) / 2) << 32 |
+         sdb_crc32c(0, id + sizeof(id) / 2, sizeof(id) / 2);
+}
+
+/*
+ *  write_header
+ *      wal:  write-ahead log with an empty file
+ *
+ *  The header is stamped with the running boot, see boot_id(), so the
+ *  next open can tell whether the machine went down since.
+ *
+ *  returns:  NO_ERROR     the log file starts with its sidecar header
+ *            ERR_DB_FILE  the log could not be written
+ */
+static int write_header(sdb_wal_t *wal) {
+  sdb_sidecar_t hdr = {0};
+
+  hdr.magic = SDB_WAL_MAGIC;
+  hdr.version = SDB_VERSION;
+  hdr.uuid = boot_id();
+
+  if (ftruncate(wal->fd, 0) == -1 ||
+      write(wal->fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+    return ERR_DB_FILE;
+
+  return NO_ERROR;
+}
+
+/*
+ *  apply
+ *      fd:    file descriptor of the database the records belong to
+ *      recs:  the records of one mutation, without its commit record
+ *      len:   bytes in recs
+ *
+ *  Carries out logged writes and punches on the database, in log order.
+ *  The log must not be active so they go straight to the file.  With an
+ *  io_uring the writes between two punches are in flight together, see
+ *  sdb_uring_queue().
+ *
+ *  returns:  NO_ERROR     every record was applied
+ *            ERR_DB_FILE  database file I/O issue
+ */
+static int apply(int fd, const char *recs, size_t len) {
+  bool batch = sdb_uring_ready(fd);
+  size_t pos = 0;
+  int rc = NO_ERROR;
+
+  while (rc == NO_ERROR && pos < len) {
+    sdb_wal_rec_t rec;
+    const char *data = recs + pos + REC_SIZE;
+
+    memcpy(&rec, recs + pos, REC_SIZE);
+    if (rec.type == SDB_WAL_WRITE && batch) {
+      struct iovec iov = {(void *)data, rec.len};
+
+      rc = sdb_uring_queue(fd, true, &iov, 1, rec.offset);
+    } else if (rec.type == SDB_WAL_WRITE) {
+      rc = sdb_write_at(fd, data, rec.len, rec.offset);
+    } else if (rec.type == SDB_WAL_PUNCH) {
+      // the punch must not overtake a queued write to the same block
+      rc = sdb_uring_wait(fd);
+      if (rc == NO_ERROR)
+        rc = sdb_punch(fd, rec.offset, rec.len);
+    }
+
+    pos += REC_SIZE + (rec.type == SDB_WAL_WRITE ? pad8(rec.len) : 0);
+  }
+
+  if (sdb_uring_wait(fd) != NO_ERROR)
+    rc = ERR_DB_FILE;
+
+  return rc;
+}
+
+/*
+ *  needs_replay
+ *      fd:        file descriptor of the database
+ *      commit:    commit record of a mutation found in the log
+ *      rebooted:  true if the machine went down since the log was emptied
+ *
+ *  A mutation has to be replayed if it belongs to this database (same
+ *  uuid) and may be missing from it.  Applying a mutation writes its pages
+ *  and its superblock without ordering them, so after a power loss a clean
+ *  superblock of the mutation's generation says nothing about its pages,
+ *  and every mutation in the log is replayed.  The records are physical
+ *  redo, applying them again in log order is harmless.  Without a reboot
+ *  the applied pages are in the page cache, and only a mutation the
+ *  superblock has not reached is replayed: its generation is newer, or it
+ *  is the same generation but still dirty because the writer died while
+ *  applying it.  Mutations logged for a database that has since been
+ *  replaced are never replayed.
+ *
+ *  returns:  true if the mutation has to be applied again
+ */
+static bool needs_replay(int fd, const sdb_wal_rec_t *commit, bool rebooted) {
+  superblock_t sb;
+
+  if (sdb_sb_read(fd, &sb) != NO_ERROR || sb.magic != SDB_MAGIC ||
+      sb.uuid != commit->uuid)
+    return false;
+
+  return rebooted || commit->generation > sb.generation ||
+         (commit->generation == sb.generation &&
+          sb.state != SDB_STATE_CLEAN);
+}
+
+/*
+ *  replay
+ *      fd:        file descriptor of the database
+ *      log:       the whole log file
+ *      len:       size of the log file
+ *      rebooted:  true if the machine went down since the log was emptied
+ *      *applied:  set to true if any mutation was applied
+ *
+ *  Walks the log from the start, applying every complete mutation that
+ *  needs_replay().  The walk stops at the first record that is cut short
+ *  or fails its checksum, that is the tail a writer was appending when it
+ *  died, and records after the last commit are ignored.
+ *
+ *  returns:  NO_ERROR     the database has every committed mutation
+ *            ERR_DB_FILE  database file I/O issue
+ */
+static int replay(int fd, const char *log, size_t len, bool rebooted,
+                  bool *applied) {
+  size_t pos = sizeof(sdb_sidecar_t), start = pos;
+
+  while (pos + REC_SIZE <= len) {
+    sdb_wal_rec_t rec;
+    size_t data_len;
+
+    memcpy(&rec, log + pos, REC_SIZE);
+    if (rec.magic != SDB_WAL_REC_MAGIC)
+      break;
+
+    data_len = rec.type == SDB_WAL_WRITE ? pad8(rec.len) : 0;
+    if (data_len > len - pos - REC_SIZE ||
+        rec_crc(&rec, log + pos + REC_SIZE) != rec.crc)
+      break;
+
+    if (rec.type == SDB_WAL_COMMIT) {
+      if (needs_replay(fd, &rec, rebooted)) {
+        if (apply(fd, log + start, pos - start) != NO_ERROR)
+          return ERR_DB_FILE;
+        *applied = true;
+      }
+      start = pos + REC_SIZE;
+    }
+
+    pos += REC_SIZE + data_len;
+  }
+
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_wal_open
+ *      fd:  file descriptor of a database file opened with a path
+ *
+ *  Opens (creating if needed) the write-ahead log of the database and
+ *  replays the mutations that were committed to it but did not make it
+ *  into the database, see replay().  If anything was replayed, the machine
+ *  went down since the log was emptied or the log is due for it, the
+ *  database is checkpointed.  Has to run before the
+ *  superblock is looked at since replay may change it.  Databases attached
+ *  without a path do not use a log.
+ *
+ *  returns:  NO_ERROR     the log is open and the database is up to date
+ *            ERR_DB_FILE  the log could not be opened or replayed
+ */
+int sdb_wal_open(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+  char wal_path[PATH_MAX];
+  mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+  sdb_sidecar_t hdr;
+  struct stat st;
+  char *log;
+  bool applied = false, rebooted;
+  int rc;
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  if (h->path == NULL || h->wal != NULL)
+    return NO_ERROR;
+
+  if (snprintf(wal_path, sizeof(wal_path), "%s%s", h->path, SDB_WAL_SUFFIX) >=
+      (int)sizeof(wal_path))
+    return ERR_DB_FILE;
+
+  h->wal = calloc(1, sizeof(*h->wal));
+  if (h->wal == NULL)
+    return ERR_DB_FILE;
+
+  h->wal->fd = open(wal_path, O_RDWR | O_CREAT | O_APPEND, mode);
+  if (h->wal->fd == -1 || fstat(h->wal->fd, &st) == -1) {
+    sdb_wal_close(fd);
+    return ERR_DB_FILE;
+  }
+
+  if (pread(h->wal->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+      hdr.magic != SDB_WAL_MAGIC)
+    return write_header(h->wal);
+
+  if (st.st_size == sizeof(hdr))
+    return NO_ERROR;
+
+  log = malloc(st.st_size);
+  if (log == NULL)
+    return ERR_DB_FILE;
+
+  if (pread(h->wal->fd, log, st.st_size, 0) != st.st_size) {
+    free(log);
+    return ERR_DB_FILE;
+  }
+
+  // a log from an unknown boot is treated like one from before a reboot
+  rebooted = hdr.uuid == 0 || hdr.uuid != boot_id();
+  rc = replay(fd, log, st.st_size, rebooted, &applied);
+  free(log);
+
+  if (rc == NO_ERROR &&
+      (applied || rebooted || st.st_size > SDB_WAL_CHECKPOINT))
+    rc = sdb_wal_checkpoint(fd);
+
+  return rc;
+}
+
+/*
+ *  sdb_wal_begin
+ *      fd:   file descriptor of an open database file
+ *      *sb:  superblock the mutation will produce (see sdb_sb_begin())
+ *
+ *  Starts logging a mutation.  Until sdb_wal_commit() writes to the
+ *  database are only collected in memory, reads see them though, see
+ *  sdb_wal_overlay().
+ *
+ *  returns:  NO_ERROR  the mutation is being logged, or there is no log
+ */
+int sdb_wal_begin(int fd, const superblock_t *sb) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || h->wal == NULL)
+    return NO_ERROR;
+
+  h->wal->active = true;
+  h->wal->uuid = sb->uuid;
+  h->wal->generation = sb->generation;
+  h->wal->len = 0;
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_wal_active
+ *      fd:  file descriptor of an open database file
+ *
+ *  returns:  true if writes to the database are being logged right now
+ */
+bool sdb_wal_active(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  return h != NULL && h->wal != NULL && h->wal->active;
+}
+
+/*
+ *  sdb_wal_log
+ *      fd:      file descriptor of an open database file
+ *      type:    SDB_WAL_WRITE or SDB_WAL_PUNCH
+ *      offset:  database file offset the record applies to
+ *      len:     bytes written or punched
+ *      iov:     the data of a SDB_WAL_WRITE, gathered from iovcnt buffers
+ *      iovcnt:  number of buffers in iov, 0 for SDB_WAL_PUNCH
+ *
+ *  Adds a record to the mutation being logged.  Nothing is written to the
+ *  log file until the mutation commits.
+ *
+ *  returns:  NO_ERROR     the record was added
+ *            ERR_DB_FILE  out of memory
+ */
+int sdb_wal_log(int fd, int type, off_t offset, off_t len,
+                const struct iovec *iov, int iovcnt) {
+  sdb_wal_t *wal = sdb_handle(fd)->wal;
+  sdb_wal_rec_t rec = {0};
+  size_t need = REC_SIZE + (type == SDB_WAL_WRITE ? pad8(len) : 0);
+  char *data;
+
+  sdb_sum_touch(fd, offset, len);
+  if (wal->len + need > wal->cap) {
+    size_t cap = wal->cap == 0 ? SDB_SCAN_BLOCK : wal->cap;
+    char *grown;
+
+    while (cap < wal->len + need)
+      cap *= 2;
+    grown = realloc(wal->buf, cap);
+    if (grown == NULL)
+      return ERR_DB_FILE;
+    wal->buf = grown;
+    wal->cap = cap;
+  }
+
+  data = wal->buf + wal->len + REC_SIZE;
+  for (int i = 0; i < iovcnt; i++) {
+    memcpy(data, iov[i].iov_base, iov[i].iov_len);
+    data += iov[i].iov_len;
+  }
+  memset(data, 0, need - REC_SIZE - (type == SDB_WAL_WRITE ? len : 0));
+
+  rec.magic = SDB_WAL_REC_MAGIC;
+  rec.type = type;
+  rec.offset = offset;
+  rec.len = len;
+  rec.uuid = wal->uuid;
+  rec.generation = wal->generation;
+  rec.crc = rec_crc(&rec, wal->buf + wal->len + REC_SIZE);
+  memcpy(wal->buf + wal->len, &rec, REC_SIZE);
+
+  wal->len += need;
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_wal_overlay
+ *      fd:      file descriptor of an open database file
+ *      buf:     bytes just read from the database
+ *      len:     number of bytes in buf
+ *      offset:  database file offset buf was read from
+ *
+ *  Patches the logged but not yet applied writes of the current mutation
+ *  into buf, so code running inside a mutation reads its own writes.
+ */
+void sdb_wal_overlay(int fd, void *buf, size_t len, off_t offset) {
+  sdb_wal_t *wal = sdb_handle(fd)->wal;
+  off_t end = offset + (off_t)len;
+  size_t pos = 0;
+
+  while (pos < wal->len) {
+    sdb_wal_rec_t rec;
+    off_t from, to;
+
+    memcpy(&rec, wal->buf + pos, REC_SIZE);
+    from = (off_t)rec.offset > offset ? (off_t)rec.offset : offset;
+    to = (off_t)(rec.offset + rec.len) < end ? (off_t)(rec.offset + rec.len)
+                                             : end;
+
+    if (from < to && rec.type == SDB_WAL_WRITE)
+      memcpy((char *)buf + (from - offset),
+             wal->buf + pos + REC_SIZE + (from - (off_t)rec.offset),
+             to - from);
+    else if (from < to && rec.type == SDB_WAL_PUNCH)
+      memset((char *)buf + (from - offset), 0, to - from);
+
+    pos += REC_SIZE + (rec.type == SDB_WAL_WRITE ? pad8(rec.len) : 0);
+  }
+}
+
+/*
+ *  sdb_wal_commit
+ *      fd:  file descriptor of an open database file
+ *
+ *  Commits the mutation being logged.  Its records and a commit record are
+ *  appended to the log with a single write() and made durable with a
+ *  single fdatasync(), so a mutation costs one sync no matter how many
+ *  students it touches: a whole bulk load, or the group of adds, deletes
+ *  and updates sdbsc --serve received together (see
+ *  sdb_sb_group_begin()).  Only then are the records applied to the
+ *  database.  A crash before the sync
+ *  loses the whole mutation, a crash after it is repaired by
+ *  sdb_wal_open().
+ *
+ *  returns:  NO_ERROR     the mutation is durable and applied, or there is
+ *                         no log
+ *            ERR_DB_FILE  the log or the database could not be written
+ */
+int sdb_wal_commit(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+  sdb_wal_t *wal;
+  struct stat st;
+  size_t len;
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  wal = h->wal;
+  if (wal == NULL || !wal->active)
+    return NO_ERROR;
+
+  if (sdb_wal_log(fd, SDB_WAL_COMMIT, 0, 0, NULL, 0) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  // from here on the records go to the database instead of the log
+  wal->active = false;
+  len = wal->len;
+  wal->len = 0;
+
+  if (write(wal->fd, wal->buf, len) != (ssize_t)len ||
+      fdatasync(wal->fd) == -1)
+    return ERR_DB_FILE;
+
+  if (apply(fd, wal->buf, len - REC_SIZE) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  if (fstat(wal->fd, &st) == 0 && st.st_size > SDB_WAL_CHECKPOINT)
+    return sdb_wal_checkpoint(fd);
+
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_wal_abort
+ *      fd:  file descriptor of an open database file
+ *
+ *  Throws away the mutation being logged.  None of its writes reached the
+ *  database or the log yet, so the database stays as it was before
+ *  sdb_wal_begin().
+ */
+void sdb_wal_abort(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || h->wal == NULL)
+    return;
+
+  h->wal->active = false;
+  h->wal->len = 0;
+}
+
+/*
+ *  sdb_wal_checkpoint
+ *      fd:  file descriptor of an open database file
+ *
+ *  Makes everything applied to the database so far durable and empties the
+ *  log, the mutations in it are no longer needed for recovery.
+ *
+ *  returns:  NO_ERROR     the log is empty, or there is no log
+ *            ERR_DB_FILE  the database could not be synced
+ */
+int sdb_wal_checkpoint(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL)
+    return ERR_DB_FILE;
+
+  if (h->wal == NULL)
+    return NO_ERROR;
+
+  if (sdb_sync(fd) != NO_ERROR || write_header(h->wal) != NO_ERROR ||
+      fdatasync(h->wal->fd) == -1)
+    return ERR_DB_FILE;
+
+  return NO_ERROR;
+}
+
+/*
+ *  sdb_wal_close
+ *      fd:  file descriptor of an open database file
+ *
+ *  Closes the log.  A mutation that was never committed is dropped, it
+ *  did not touch the database.
+ */
+void sdb_wal_close(int fd) {
+  sdb_handle_t *h = sdb_handle(fd);
+
+  if (h == NULL || h->wal == NULL)
+    return;
+
+  if (h->wal->fd != -1)
+    close(h->wal->fd);
+  free(h->wal->buf);
+  free(h->wal);
+  h->wal = NULL;
+}
@@ -0,0 +1,627 @@
+#ifndef __SDB_LIB_H__
+#define __SDB_LIB_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "db.h" // get student record type
+
+// storage engines that can sit behind the sdbsc.c database functions.  The
+// memory mapped engine is the default, the read/write engine is the original
+// one syscall per record implementation and is kept around as a fallback
+#define SDB_ENGINE_MMAP 0
+#define SDB_ENGINE_RW 1
+
+// a database opened through a running sdbsc --serve daemon (sdbsc --client)
+// is attached with this engine.  fd is then the socket to the daemon and the
+// sdbsc.c database functions send requests instead of touching the file
+#define SDB_ENGINE_REMOTE 2
+
+// the read/write engine with batches of reads and writes submitted through
+// an io_uring (sdbsc --io=uring), see sdb_uring.c.  Handles end up with
+// engine SDB_ENGINE_RW and a ring, or without one if the kernel has no
+// io_uring
+#define SDB_ENGINE_URING 3
+
+// requests in flight on an io_uring at most
+#define SDB_URING_DEPTH 64
+
+// maximum number of database files that can be attached to an engine at
+// the same time.  sdbsc only ever has the database and the temporary
+// compression file open so this is plenty
+#define SDB_MAX_HANDLES 8
+
+// full table scans read the database this many bytes at a time when the
+// read/write engine is used.  Buffers are aligned to SDB_SCAN_ALIGN so the
+// reads line up with pages (and would work with O_DIRECT)
+#define SDB_SCAN_BLOCK (1024 * 1024) // 1M
+#define SDB_SCAN_ALIGN 4096
+
+// print_db() formats rows itself (see sdb_fmt_row()) into a buffer of
+// SDB_FMT_BUF bytes that is written out with write().  A formatted row is
+// never longer than SDB_FMT_ROW_MAX bytes
+#define SDB_FMT_BUF (64 * 1024)
+#define SDB_FMT_ROW_MAX 128
+
+// sdbsc --export=FMT streams every student out in one of these formats,
+// see export_db(), and --import=FMT reads them back, see import_db():
+//  SDB_FORMAT_CSV:    id,first_name,last_name,gpa lines like sdbsc -B takes
+//  SDB_FORMAT_JSONL:  one {"id":..,"fname":..,"lname":..,"gpa":..} per line
+//  SDB_FORMAT_RAW:    a sdb_raw_hdr_t, then the student_t slots as they are
+// exports are written SDB_EXPORT_BUF bytes at a time and a CSV or JSONL line
+// is never longer than SDB_FMT_REC_MAX.  Imports are added SDB_IMPORT_BATCH
+// students (one superblock mutation) at a time
+#define SDB_FORMAT_CSV 0
+#define SDB_FORMAT_JSONL 1
+#define SDB_FORMAT_RAW 2
+#define SDB_FMT_REC_MAX 512
+#define SDB_EXPORT_BUF (1024 * 1024)
+#define SDB_IMPORT_BATCH 65536
+#define SDB_RAW_MAGIC 0x58424453 // "SDBX"
+#define SDB_RAW_VERSION 1
+
+// most threads a parallel full table scan (sdbsc -j N) is split into, see
+// sdb_par_scan()
+#define SDB_MAX_JOBS 64
+
+// sdbsc -p --sort=lname sorts in at most sdb_opts.sort_mem bytes (64M unless
+// --sort-mem=N says otherwise), spilling sorted runs to temporary files and
+// merging up to SDB_SORT_FANIN of them at a time, see print_sorted()
+#define SDB_SORT_ID 0
+#define SDB_SORT_LNAME 1
+#define SDB_SORT_MEM (64 * 1024 * 1024)
+#define SDB_SORT_MEM_MAX 4096 // in M
+#define SDB_SORT_FANIN 64
+
+// sdbsc -s counts GPAs in buckets SDB_GPA_BUCKET wide (0.00-0.49, 0.50-0.99
+// and so on), the last bucket also holds MAX_STD_GPA
+#define SDB_GPA_BUCKET 50
+#define SDB_GPA_BUCKETS (MAX_STD_GPA / SDB_GPA_BUCKET)
+
+// the occupancy bitmap lives next to the database in a sidecar file named
+// after it, for example student.db.bm.  It holds one bit per possible
+// student id, about 12.5K for MAX_STD_ID 100000
+#define SDB_BITMAP_SUFFIX ".bm"
+#define SDB_BITMAP_MAGIC 0x504d4253 // "SBMP"
+#define SDB_BITMAP_WORDS (MAX_STD_ID / 64 + 1)
+
+// the last name index lives in a sidecar too, for example student.db.ln.
+// After the header come sdb_name_ent_t entries sorted by last name and id
+// (count of them), then a log of the changes since the last merge that is
+// folded into the sorted part once it reaches SDB_NAME_LOG_MAX entries
+#define SDB_NAME_SUFFIX ".ln"
+#define SDB_NAME_MAGIC 0x4d414e53 // "SNAM"
+#define SDB_NAME_LOG_MAX 4096
+
+// the GPA column lives in a sidecar too, for example student.db.col.  After
+// the header comes one int per id, id 0 first, holding the GPA of that
+// student plus one.  0 is an empty slot, so holes in the file are empty
+#define SDB_COL_SUFFIX ".col"
+#define SDB_COL_MAGIC 0x4c4f4353 // "SCOL"
+
+// every SDB_SUM_PAGE bytes of the database file have a CRC32C in a sidecar
+// too, for example student.db.sum.  After the header comes one unsigned
+// int per page, page 0 first, holding the CRC32C of the page (zero padded
+// past the end of the file) xor the CRC32C of an all zero page.  So 0
+// stands for a page of zeros, and holes in the database need no entries
+// in the sidecar.  Pages are checked and their entries read SDB_SUM_CHUNK
+// at a time
+#define SDB_SUM_SUFFIX ".sum"
+#define SDB_SUM_MAGIC 0x4d555353 // "SSUM"
+#define SDB_SUM_PAGE SDB_SCAN_ALIGN
+#define SDB_SUM_CHUNK (SDB_SCAN_BLOCK / SDB_SUM_PAGE)
+
+// what an entry of the name index log records
+#define SDB_NAME_ADD 1
+#define SDB_NAME_DEL 2
+
+// a hashed database (see SDB_LAYOUT_HASH in db.h) keeps its extendible hash
+// directory, one bucket number per entry, on the page after the superblock.
+// Then comes one local depth byte per bucket and then the buckets, each
+// SDB_HASH_BUCKET bytes of student slots.  Both regions are sized for
+// SDB_HASH_MAX_DEPTH and stay holes in the file until they are used
+#define SDB_HASH_MAX_DEPTH 24
+#define SDB_HASH_BUCKET SDB_SCAN_ALIGN
+#define SDB_HASH_DIR_OFF ((off_t)SDB_SCAN_ALIGN)
+#define SDB_HASH_DEPTH_OFF                                                     \
+  (SDB_HASH_DIR_OFF + ((off_t)sizeof(unsigned int) << SDB_HASH_MAX_DEPTH))
+#define SDB_HASH_DATA_OFF                                                      \
+  (SDB_HASH_DEPTH_OFF + ((off_t)1 << SDB_HASH_MAX_DEPTH))
+
+// a dense database is turned back into a sparse one (see sdb_dense_expand())
+// by writing a copy next to it with this suffix and renaming it into place
+#define SDB_EXPAND_SUFFIX ".expand"
+
+// processes sharing a database coordinate with fcntl() record locks on a
+// sidecar named after it, for example student.db.lock.  Byte id of the lock
+// file stands for the slot of student id and byte 0 for the superblock, so
+// writers to different ids do not wait on each other.  Locking from byte 0
+// to the end of the file locks the whole database, which is how compress
+// and other operations that replace or restructure the file keep everyone
+// else out (see sdb_lock.c)
+#define SDB_LOCK_SUFFIX ".lock"
+#define SDB_LOCK_SB 0
+
+// sdbsc --serve listens on a UNIX domain socket named after the database,
+// for example student.db.sock, see sdb_serve.c.  At most SDB_SERVE_CLIENTS
+// connections are served at a time.  A client that stops reading or
+// sends part of a message for SDB_SERVE_TIMEOUT seconds is dropped
+#define SDB_SOCK_SUFFIX ".sock"
+#define SDB_SERVE_CLIENTS 64
+#define SDB_SERVE_TIMEOUT 2
+
+// every message between sdbsc --client and the daemon is a sdb_msg_t
+// followed by n student records.  Requests:
+//  SDB_OP_GET:    n = 1, the id of the student to find
+//  SDB_OP_ADD:    n = 1, the student to add
+//  SDB_OP_DEL:    n = 1, the id of the student to delete
+//  SDB_OP_COUNT:  n = 0
+//  SDB_OP_PRINT:  n = 0
+//  SDB_OP_UPDATE: n = 1, the id of the student to change, its new gpa (or
+//                 -1 to keep it) and new lname (or "" to keep it)
+// every request is answered with one message that has the op of the
+// request and its return code in rc, for SDB_OP_COUNT the record count and
+// for SDB_OP_GET the student in n = 1.  SDB_OP_PRINT is answered with any
+// number of messages of up to SDB_SERVE_BATCH students in id order, the
+// last one has n = 0
+#define SDB_PROTO_MAGIC 0x50424453 // "SDBP"
+#define SDB_OP_GET 1
+#define SDB_OP_ADD 2
+#define SDB_OP_DEL 3
+#define SDB_OP_COUNT 4
+#define SDB_OP_PRINT 5
+#define SDB_OP_UPDATE 6
+#define SDB_SERVE_BATCH 1024
+
+// header of a sdbsc --export=raw file, rec_size is STUDENT_RECORD_SIZE of
+// the sdbsc that wrote it
+typedef struct sdb_raw_hdr {
+  unsigned int magic;
+  unsigned int version;
+  unsigned int rec_size;
+  unsigned int reserved;
+} sdb_raw_hdr_t;
+
+typedef struct sdb_msg {
+  unsigned int magic;
+  unsigned int op;
+  int rc;
+  unsigned int n;
+} sdb_msg_t;
+
+// every sidecar file starts with this 64 byte header.  A sidecar is only
+// trusted when its uuid and generation match the superblock of the database
+// (see db.h), otherwise it is stale and gets rebuilt from the database
+//  count:  entries in sidecars that hold a list, see sdb_name.c
+//  ino:    inode of the database file in sidecars about its bytes rather
+//          than its students, see sdb_sum.c.  A compress replaces the file
+//          but keeps uuid and generation
+// the write-ahead log keeps the boot it was emptied in in uuid instead, see
+// sdb_wal.c
+typedef struct sdb_sidecar {
+  unsigned int magic;
+  unsigned int version;
+  unsigned int generation;
+  unsigned int count;
+  unsigned long long uuid;
+  unsigned long long ino;
+  char reserved[32];
+} sdb_sidecar_t;
+
+// mutations are made crash safe by a write-ahead log next to the database,
+// for example student.db.wal.  The writes of a mutation are appended to the
+// log as records and made durable with one fdatasync() per mutation, or per
+// group of them (see sdb_sb_group_begin()), before any of them touch the
+// database.  Once the log grows past
+// SDB_WAL_CHECKPOINT bytes the database is synced and the log emptied
+#define SDB_WAL_SUFFIX ".wal"
+#define SDB_WAL_MAGIC 0x4c415753     // "SWAL"
+#define SDB_WAL_REC_MAGIC 0x43455257 // "WREC"
+#define SDB_WAL_CHECKPOINT (4 * 1024 * 1024)
+
+// write-ahead log record types
+//  SDB_WAL_WRITE:   len bytes of data follow, written at offset
+//  SDB_WAL_PUNCH:   the len bytes at offset are punched, see sdb_punch()
+//  SDB_WAL_COMMIT:  the records before it (back to the previous commit) are
+//                   one complete mutation
+#define SDB_WAL_WRITE 1
+#define SDB_WAL_PUNCH 2
+#define SDB_WAL_COMMIT 3
+
+// header of every write-ahead log record.  uuid and generation identify the
+// superblock the mutation produces, so replay can tell mutations that were
+// already applied (or belong to a database that was since replaced) from
+// ones that were not.  crc is the CRC32C of the header, with crc set to 0,
+// followed by the data.  Data is padded to a multiple of 8 bytes
+typedef struct sdb_wal_rec {
+  unsigned int magic;
+  unsigned int type;
+  unsigned long long offset;
+  unsigned long long len;
+  unsigned long long uuid;
+  unsigned int generation;
+  unsigned int crc;
+  char reserved[8];
+} sdb_wal_rec_t;
+
+// write-ahead log of an open database
+//  fd:          the open log file, opened O_APPEND
+//  active:      true between sdb_wal_begin() and sdb_wal_commit()
+//  uuid:        superblock uuid of the mutation being logged
+//  generation:  superblock generation of the mutation being logged
+//  buf:         records of the mutation being logged, not in the file yet
+//  len:         bytes used in buf
+//  cap:         bytes allocated for buf
+typedef struct sdb_wal {
+  int fd;
+  bool active;
+  unsigned long long uuid;
+  unsigned int generation;
+  char *buf;
+  size_t len;
+  size_t cap;
+} sdb_wal_t;
+
+// one entry of the last name index
+//  lname:  last name of the student, as stored in student_t
+//  id:     student id
+//  op:     SDB_NAME_ADD, or SDB_NAME_DEL for a delete in the log
+typedef struct sdb_name_ent {
+  char lname[32];
+  int id;
+  int op;
+} sdb_name_ent_t;
+
+// last name index of an open database, see sdb_name.c
+//  fd:        the open index sidecar
+//  fresh:     the index matched the database when the running mutation
+//             began, so the mutation keeps it up to date
+//  pending:   name changes of the running mutation, applied on commit
+//  npending:  entries used in pending
+//  cap:       entries allocated for pending
+typedef struct sdb_names {
+  int fd;
+  bool fresh;
+  sdb_name_ent_t *pending;
+  int npending;
+  int cap;
+} sdb_names_t;
+
+// one change to the GPA column, see sdb_col_update()
+//  id:     student id
+//  value:  the new column entry, GPA plus one or 0 for a delete
+typedef struct sdb_col_ent {
+  int id;
+  int value;
+} sdb_col_ent_t;
+
+// GPA column of an open database, see sdb_col.c
+//  fd:        the open column sidecar
+//  fresh:     the column matched the database when the running mutation
+//             began, so the mutation keeps it up to date
+//  pending:   column changes of the running mutation, applied on commit
+//  npending:  entries used in pending
+//  cap:       entries allocated for pending
+typedef struct sdb_col {
+  int fd;
+  bool fresh;
+  sdb_col_ent_t *pending;
+  int npending;
+  int cap;
+} sdb_col_t;
+
+// pages written by a mutation, first to last, see sdb_sum_touch()
+typedef struct sdb_sum_run {
+  off_t first;
+  off_t last;
+} sdb_sum_run_t;
+
+// page checksums of an open database, see sdb_sum.c
+//  fd:     the open checksum sidecar
+//  ino:    inode of the database file the handle has open
+//  zero:   CRC32C of an all zero page
+//  fresh:  the checksums matched the database when the running mutation
+//          began, so the mutation keeps them up to date
+//  seen:   generation + 1 of the last superblock the sidecar header was
+//          found to match, 0 if none, accessed with __atomic builtins
+//  runs:   pages written by the running mutation, nruns of them
+//  cap:    entries allocated for runs
+typedef struct sdb_sums {
+  int fd;
+  unsigned long long ino;
+  unsigned int zero;
+  bool fresh;
+  unsigned long long seen;
+  sdb_sum_run_t *runs;
+  int nruns;
+  int cap;
+} sdb_sums_t;
+
+// GPA statistics of a set of students, see sdb_gpa_fold()
+//  count:     number of students
+//  sum:       sum of their GPAs
+//  min, max:  lowest and highest GPA, only meaningful if count > 0
+//  hist:      students per GPA bucket, see SDB_GPA_BUCKET
+typedef struct sdb_gpa_stats {
+  long long count;
+  long long sum;
+  int min;
+  int max;
+  long long hist[SDB_GPA_BUCKETS];
+} sdb_gpa_stats_t;
+
+// io_uring of a handle, private to sdb_uring.c
+typedef struct sdb_uring sdb_uring_t;
+
+// options that modify how an operation runs rather than selecting one.  They
+// can appear anywhere on the command line and are stripped from argv before
+// the operation is parsed, see parse_opts() in sdbsc.c
+//  engine:  storage engine used for files opened with open_db()
+//  sync:    flush every mutation to stable storage before reporting success
+//  online:  compress the database in place, see compress_db_online()
+//  jobs:    threads used by full table scans, see sdb_par_scan()
+//  serve:   run as a daemon, see sdb_serve()
+//  client:  send the operation to a running daemon, see sdb_connect()
+//  prefix:  -n matches last names starting with the name, see find_name()
+//  lowest:  -t ranks the lowest GPAs first, see gpa_top()
+//  hash:    a database created by this run uses the hashed layout, see
+//           sdb_sb_rebuild()
+//  sort:      SDB_SORT_ID or SDB_SORT_LNAME, the order -p prints in
+//  sort_mem:  bytes print_sorted() may hold in memory
+typedef struct sdb_opts {
+  int engine;
+  bool sync;
+  bool online;
+  int jobs;
+  bool serve;
+  bool client;
+  bool prefix;
+  bool lowest;
+  bool hash;
+  int sort;
+  size_t sort_mem;
+} sdb_opts_t;
+
+extern sdb_opts_t sdb_opts;
+
+// bookkeeping for a database file attached to a storage engine
+//  fd:         the file descriptor returned from open_db()
+//  engine:     SDB_ENGINE_MMAP, SDB_ENGINE_RW or SDB_ENGINE_REMOTE
+//  map:        base of the shared mapping, NULL if nothing is mapped yet
+//  map_len:    number of bytes mapped, always a multiple of the page size
+//  file_size:  size of the database file as of the last time we looked
+//  path:       name the file was opened with, NULL if sidecars are not used
+//  layout:     SDB_LAYOUT_SPARSE, SDB_LAYOUT_DENSE or SDB_LAYOUT_HASH, from
+//              the superblock
+//  nslots:     number of student slots in a dense file
+//  bm_fd:      open occupancy bitmap sidecar, -1 if there is none
+//  bm:         in memory copy of the bitmap, SDB_BITMAP_WORDS long
+//  bm_gen:     superblock generation the in memory bitmap reflects
+//  bm_uuid:    superblock uuid the in memory bitmap reflects
+//  wal:        write-ahead log, NULL if mutations are written directly
+//  lock_fd:    open lock sidecar, -1 if the file is not shared
+//  lock_all:   true while this handle holds the whole database lock
+//  lock_sb:    true while this handle holds the superblock lock
+//  ring:       io_uring for batched I/O, NULL to issue every call directly
+//  names:      last name index, NULL until a mutation or query needs it
+//  col:        GPA column, NULL until a mutation or query needs it
+//  sums:       page checksums, NULL if the file has no path
+//  group:      true between sdb_sb_group_begin() and sdb_sb_group_commit()
+//  group_err:  a mutation of the group failed, the whole group is dropped
+//  group_sb:   superblock of the group as its mutations left it
+typedef struct sdb_handle {
+  int fd;
+  int engine;
+  char *map;
+  size_t map_len;
+  off_t file_size;
+  char *path;
+  int layout;
+  int nslots;
+  int bm_fd;
+  unsigned long long *bm;
+  unsigned int bm_gen;
+  unsigned long long bm_uuid;
+  sdb_wal_t *wal;
+  int lock_fd;
+  bool lock_all;
+  bool lock_sb;
+  sdb_uring_t *ring;
+  sdb_names_t *names;
+  sdb_col_t *col;
+  sdb_sums_t *sums;
+  bool group;
+  bool group_err;
+  superblock_t group_sb;
+} sdb_handle_t;
+
+// state of a sequential scan over every slot in the database, see
+// sdb_scan_open() in sdb_scan.c
+//  fd:        file descriptor being scanned
+//  mapped:    true if recs points into the engine mapping
+//  map:       base of the engine mapping (mmap engine only)
+//  bm:        occupancy bitmap driving the scan, NULL to check every slot
+//  block:     aligned SDB_SCAN_BLOCK buffer (read/write engine only)
+//  recs:      the slots currently being walked
+//  nrecs:     number of slots in recs
+//  pos:       index in recs of the next group of slots to look at
+//  mask:      live slots of the current group not handed out yet
+//  mask_base: index in recs of bit 0 of mask
+//  first_id:  id of the slot at recs[0]
+//  offset:    file offset of the next block to read
+//  data_end:  end of the allocated extent offset is in
+//  file_end:  size of the file when the scan started
+typedef struct sdb_scan {
+  int fd;
+  bool mapped;
+  const char *map;
+  const unsigned long long *bm;
+  student_t *block;
+  const student_t *recs;
+  int nrecs;
+  int pos;
+  unsigned long long mask;
+  int mask_base;
+  int first_id;
+  off_t offset;
+  off_t data_end;
+  off_t file_end;
+} sdb_scan_t;
+
+// storage engine prototypes for sdb_io.c - see documentation for each
+// function to see what they do
+int sdb_attach(int fd, const char *path, int engine);
+void sdb_detach(int fd);
+sdb_handle_t *sdb_handle(int fd);
+ssize_t sdb_read_at(int fd, void *buf, size_t len, off_t offset);
+int sdb_write_at(int fd, const void *buf, size_t len, off_t offset);
+ssize_t sdb_read_slot(int fd, int id, student_t *s);
+ssize_t sdb_peek_slot(int fd, int id, student_t *s);
+int sdb_read_sorted(int fd, const int *ids, int n, student_t *out);
+int sdb_write_slot(int fd, int id, const student_t *s);
+int sdb_write_sorted(int fd, const student_t *recs, int n, bool gaps_empty);
+int sdb_write_field(int fd, int id, const void *buf, size_t len,
+                    size_t at);
+int sdb_punch(int fd, off_t offset, off_t len);
+int sdb_truncate(int fd, off_t size);
+int sdb_sync(int fd);
+int sdb_refresh(int fd);
+int sdb_reopen(int fd);
+
+// full table scan prototypes for sdb_scan.c
+int sdb_scan_open(sdb_scan_t *scan, int fd);
+int sdb_scan_next(sdb_scan_t *scan, const student_t **s);
+int sdb_scan_group(sdb_scan_t *scan, const student_t **recs,
+                   unsigned long long *live);
+void sdb_scan_close(sdb_scan_t *scan);
+int sdb_scan_range(sdb_scan_t *part, const sdb_scan_t *scan, off_t start,
+                   off_t end);
+int sdb_scan_prev(int fd, int id);
+
+// parallel scan prototypes for sdb_par.c
+int sdb_par_scan(int fd, int jobs,
+                 int (*worker)(sdb_scan_t *part, int index, void *arg),
+                 void *arg);
+
+// empty slot detection and GPA kernel prototypes for sdb_simd.c
+unsigned long long sdb_live_mask(const student_t *recs, int n);
+unsigned long long sdb_gpa_match(const student_t *recs, int n,
+                                 unsigned long long live, int lo, int hi);
+void sdb_gpa_fold(const student_t *recs, int n, unsigned long long live,
+                  sdb_gpa_stats_t *st);
+unsigned long long sdb_col_match(const int *col, int n, int lo, int hi);
+void sdb_col_fold(const int *col, int n, sdb_gpa_stats_t *st);
+
+// last name index prototypes for sdb_name.c
+void sdb_name_begin(int fd, const superblock_t *sb);
+void sdb_name_update(int fd, const student_t *s, bool live);
+void sdb_name_commit(int fd, const superblock_t *sb);
+void sdb_name_abort(int fd, bool stale);
+void sdb_name_close(int fd);
+int sdb_name_find(int fd, const char *name, bool prefix,
+                  sdb_name_ent_t **out, int *nout);
+
+// GPA column prototypes for sdb_col.c
+void sdb_col_begin(int fd, const superblock_t *sb);
+void sdb_col_update(int fd, const student_t *s, bool live);
+void sdb_col_commit(int fd, const superblock_t *sb);
+void sdb_col_abort(int fd, bool stale);
+void sdb_col_close(int fd);
+int sdb_col_load(int fd, int **col, int *n);
+
+// page checksum prototypes for sdb_sum.c
+void sdb_sum_open(int fd, const superblock_t *sb);
+void sdb_sum_begin(int fd, const superblock_t *sb);
+void sdb_sum_touch(int fd, off_t offset, off_t len);
+void sdb_sum_commit(int fd, const superblock_t *sb);
+void sdb_sum_abort(int fd, bool stale);
+void sdb_sum_close(int fd);
+int sdb_sum_check(int fd, const void *data, size_t len, off_t offset);
+bool sdb_sum_ready(int fd);
+off_t sdb_sum_verify(int fd, off_t first, off_t end);
+
+// io_uring prototypes for sdb_uring.c
+int sdb_uring_open(int fd);
+void sdb_uring_close(int fd);
+bool sdb_uring_ready(int fd);
+int sdb_uring_queue(int fd, bool write, const struct iovec *iov, int iovcnt,
+                    off_t offset);
+int sdb_uring_wait(int fd);
+
+// daemon and client prototypes for sdb_serve.c
+int sdb_serve(int fd, const char *path);
+int sdb_connect(const char *path);
+bool sdb_remote(int fd);
+int sdb_remote_call(int fd, unsigned int op, const student_t *req,
+                    student_t *resp);
+int sdb_remote_next(int fd, student_t *batch, int max);
+
+// output formatting prototypes for sdb_fmt.c
+size_t sdb_fmt_row(char *out, const student_t *s);
+size_t sdb_fmt_csv(char *out, const student_t *s);
+size_t sdb_fmt_jsonl(char *out, const student_t *s);
+int sdb_write_all(int fd, const char *buf, size_t len);
+
+// checksum prototypes for sdb_crc.c
+unsigned int sdb_crc32c(unsigned int crc, const void *buf, size_t len);
+
+// write-ahead log prototypes for sdb_wal.c
+int sdb_wal_open(int fd);
+int sdb_wal_begin(int fd, const superblock_t *sb);
+bool sdb_wal_active(int fd);
+int sdb_wal_log(int fd, int type, off_t offset, off_t len,
+                const struct iovec *iov, int iovcnt);
+void sdb_wal_overlay(int fd, void *buf, size_t len, off_t offset);
+int sdb_wal_commit(int fd);
+void sdb_wal_abort(int fd);
+int sdb_wal_checkpoint(int fd);
+void sdb_wal_close(int fd);
+
+// record lock prototypes for sdb_lock.c
+int sdb_lock(int fd, int type, int first, int count);
+int sdb_lock_ids(int fd, int type, int first, int count);
+int sdb_lock_add(int fd, int first, int count);
+
+// superblock prototypes for sdb_super.c
+int sdb_sb_read(int fd, superblock_t *sb);
+int sdb_sb_write(int fd, const superblock_t *sb);
+int sdb_sb_rebuild(int fd, superblock_t *sb);
+int sdb_sb_open(int fd);
+int sdb_sb_begin(int fd, superblock_t *sb);
+int sdb_sb_commit(int fd, superblock_t *sb);
+void sdb_sb_abort(int fd);
+int sdb_sb_group_begin(int fd);
+int sdb_sb_group_commit(int fd);
+
+// dense layout prototypes for sdb_dense.c
+int sdb_dense_slot(int fd, int id);
+int sdb_dense_prev(int fd, int id);
+int sdb_dense_write(int src_fd, int dst_fd);
+int sdb_dense_expand(int fd);
+
+// hashed layout prototypes for sdb_hash.c
+ssize_t sdb_hash_read(int fd, int id, student_t *s);
+off_t sdb_hash_offset(int fd, int id);
+int sdb_hash_write(int fd, int id, const student_t *s);
+int sdb_hash_write_batch(int fd, const student_t *recs, int n);
+int sdb_hash_prev(int fd, int id);
+int sdb_id_max(int fd);
+
+// space reclaim prototypes for sdb_reclaim.c
+int sdb_reclaim(int fd, int id);
+int sdb_reclaim_all(int fd);
+
+// occupancy bitmap prototypes for sdb_bitmap.c
+int sdb_bm_open(int fd, const superblock_t *sb);
+int sdb_bm_reset(int fd);
+int sdb_bm_save(int fd, const superblock_t *sb);
+int sdb_bm_update(int fd, int id, bool live, const superblock_t *sb);
+bool sdb_bm_fresh(int fd);
+int sdb_bm_test(int fd, int id);
+int sdb_bm_next(int fd, int id);
+int sdb_bm_prev(int fd, int id);
+int sdb_bm_count(int fd);
+void sdb_bm_close(int fd);
+
+#endif
@@ -1,4 +1,6 @@
 #include <fcntl.h> //c library for system call file routines
+#include <limits.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,12 +11,23 @@
 // database include files
 #include "db.h"
 #include "sdbsc.h"
+#include "sdblib.h"
+
+// modifiers from the command line, see parse_opts()
+sdb_opts_t sdb_opts = {SDB_ENGINE_MMAP, false, false, 1,
+                       false, false, false, false, false,
+                       SDB_SORT_ID, SDB_SORT_MEM};
 
 /*
  *  open_db
  *      dbFile:  name of the database file
  *      should_truncate:  indicates if opening the file also empties it
  *
+ *  The file is attached to the storage engine selected on the command line
+ *  (see sdb_opts) so the rest of the database functions can access records
+ *  through it.  The superblock in slot 0 is checked and, for new files or
+ *  files written by older versions of sdbsc, created.
+ *
  *  returns:  File descriptor on success, or ERR_DB_FILE on failure
  *
  *  console:  Does not produce any console I/O on success
@@ -29,9 +42,7 @@ int open_db(char *dbFile, bool should_truncate) {
   // open the file if it exists for Read and Write,
   // create it if it does not exist
   int flags = O_RDWR | O_CREAT;
-
-  if (should_truncate)
-    flags += O_TRUNC;
+  int rc;
 
   // Now open file
   int fd = open(dbFile, flags, mode);
@@ -42,34 +53,84 @@ int open_db(char *dbFile, bool should_truncate) {
     return ERR_DB_FILE;
   }
 
+  rc = sdb_attach(fd, dbFile, sdb_opts.engine);
+
+  // other processes may be using the file, even reading it without a lock
+  // (see get_student()), and cutting a mapped file short under them is a
+  // SIGBUS.  So like compress_db() an empty file is renamed over it while
+  // holding the whole database lock, they notice the new file once they
+  // get their locks and sdb_reopen() moves fd onto it here
+  if (rc == NO_ERROR && should_truncate) {
+    rc = sdb_lock(fd, F_WRLCK, SDB_LOCK_SB, 0);
+    if (rc == NO_ERROR) {
+      int tmp_fd = open(TMP_DB_FILE, flags | O_TRUNC, mode);
+
+      if (tmp_fd == -1 || close(tmp_fd) == -1 ||
+          rename(TMP_DB_FILE, dbFile) == -1)
+        rc = ERR_DB_FILE;
+    }
+  }
+
+  if (rc == NO_ERROR)
+    rc = should_truncate ? sdb_reopen(fd) : sdb_sb_open(fd);
+
+  if (should_truncate)
+    sdb_lock(fd, F_UNLCK, SDB_LOCK_SB, 0);
+
+  if (rc != NO_ERROR) {
+    printf(M_ERR_DB_OPEN);
+    sdb_detach(fd);
+    close(fd);
+    return ERR_DB_FILE;
+  }
+
   return fd;
 }
 
 /*
- *  get_student
+ *  close_db
+ *      fd:  file descriptor returned from open_db()
+ *
+ *  Detaches the file from the storage engine and closes it.  If --sync was
+ *  given everything written is flushed to stable storage first.
+ *
+ *  returns:  NO_ERROR     on success
+ *            ERR_DB_FILE  the final flush or close failed
+ *
+ *  console:  Does not produce any console I/O
+ */
+int close_db(int fd) {
+  int rc = NO_ERROR;
+
+  if (sdb_opts.sync && sdb_sync(fd) != NO_ERROR)
+    rc = ERR_DB_FILE;
+
+  sdb_detach(fd);
+  if (close(fd) == -1)
+    rc = ERR_DB_FILE;
+
+  return rc;
+}
+
+/*
+ *  read_student
  *      fd:  linux file descriptor
- *      id:  the student id we are looking forname of the
+ *      id:  the student id we are looking for
  *      *s:  a pointer where the located (if found) student data will be
  *           copied
  *
+ *  Reads the slot of id in a way that is safe without any locking (see
+ *  sdb_peek_slot()), see get_student().
+ *
  *  returns:  NO_ERROR       student located and copied into *s
  *            ERR_DB_FILE    database file I/O issue
  *            SRCH_NOT_FOUND student was not located in the database
- *
- *  console:  Does not produce any console I/O used by other functions
  */
-int get_student(int fd, int id, student_t *s) {
+static int read_student(int fd, int id, student_t *s) {
   student_t buffer;
-  off_t position;
   ssize_t bytes_read;
 
-  position = id * STUDENT_RECORD_SIZE;
-
-  if (lseek(fd, position, SEEK_SET) == -1) {
-    return ERR_DB_FILE;
-  }
-
-  bytes_read = read(fd, &buffer, STUDENT_RECORD_SIZE);
+  bytes_read = sdb_peek_slot(fd, id, &buffer);
   if (bytes_read == -1) {
     return ERR_DB_FILE;
   }
@@ -87,6 +148,118 @@ int get_student(int fd, int id, student_t *s) {
   return NO_ERROR;
 }
 
+/*
+ *  get_student
+ *      fd:  linux file descriptor
+ *      id:  the student id we are looking forname of the
+ *      *s:  a pointer where the located (if found) student data will be
+ *           copied
+ *
+ *  Readers normally take no lock at all.  Every mutation moves the
+ *  superblock to a new generation and marks it dirty until it is done, so
+ *  if the superblock is clean and at the same generation before and after
+ *  the slot is read, nothing changed underneath the read.  Only if that
+ *  check fails is the slot read again under a shared lock, which waits
+ *  for the writer of that id to finish.  With --client the daemon looks
+ *  the student up instead.
+ *
+ *  returns:  NO_ERROR       student located and copied into *s
+ *            ERR_DB_FILE    database file I/O issue
+ *            SRCH_NOT_FOUND student was not located in the database
+ *
+ *  console:  Does not produce any console I/O used by other functions
+ */
+int get_student(int fd, int id, student_t *s) {
+  superblock_t before, after;
+  int rc;
+
+  if (id < MIN_STD_ID || id > sdb_id_max(fd))
+    return SRCH_NOT_FOUND;
+
+  if (sdb_remote(fd)) {
+    student_t key = {0};
+
+    key.id = id;
+    return sdb_remote_call(fd, SDB_OP_GET, &key, s);
+  }
+
+  if (sdb_sb_read(fd, &before) == NO_ERROR &&
+      before.state == SDB_STATE_CLEAN) {
+    // past the highest id there is nothing to read, or maybe even no file
+    rc = id > before.max_id ? SRCH_NOT_FOUND : read_student(fd, id, s);
+    if (sdb_sb_read(fd, &after) == NO_ERROR &&
+        after.state == SDB_STATE_CLEAN &&
+        after.generation == before.generation)
+      return rc;
+  }
+
+  if (sdb_lock_ids(fd, F_RDLCK, id, 1) != NO_ERROR)
+    return ERR_DB_FILE;
+
+  rc = read_student(fd, id, s);
+  sdb_lock(fd, F_UNLCK, id, 1);
+  return rc;
+}
+
+/*
+ *  add_locked
+ *
+ *  Does the work of add_student() once the slot of id is locked.
+ */
+static int add_locked(int fd, int id, char *fname, char *lname, int gpa) {
+  student_t new_student = {0};
+  student_t existing_student;
+  superblock_t sb;
+  ssize_t bytes_read;
+  int exists;
+
+  exists = sdb_bm_test(fd, id);
+  if (exists == -1) {
+    bytes_read = sdb_read_slot(fd, id, &existing_student);
+    if (bytes_read == -1) {
+      printf(M_ERR_DB_READ);
+      return ERR_DB_FILE;
+    }
+
+    exists = bytes_read == STUDENT_RECORD_SIZE &&
+             memcmp(&existing_student, &EMPTY_STUDENT_RECORD,
+                    STUDENT_RECORD_SIZE) != 0;
+  }
+
+  if (exists) {
+    printf(M_ERR_DB_ADD_DUP, id);
+    return ERR_DB_OP;
+  }
+
+  new_student.id = id;
+  strncpy(new_student.fname, fname, sizeof(new_student.fname) - 1);
+  strncpy(new_student.lname, lname, sizeof(new_student.lname) - 1);
+  new_student.gpa = gpa;
+
+  if (sdb_sb_begin(fd, &sb) != NO_ERROR ||
+      sdb_write_slot(fd, id, &new_student) != NO_ERROR ||
+      sdb_bm_update(fd, id, true, &sb) != NO_ERROR) {
+    sdb_sb_abort(fd);
+    printf(M_ERR_DB_WRITE);
+    return ERR_DB_FILE;
+  }
+  sdb_name_update(fd, &new_student, true);
+  sdb_col_update(fd, &new_student, true);
+
+  sb.record_count++;
+  if (id > sb.max_id)
+    sb.max_id = id;
+
+  if (sdb_sb_commit(fd, &sb) != NO_ERROR ||
+      (sdb_opts.sync && sdb_sync(fd) != NO_ERROR)) {
+    printf(M_ERR_DB_WRITE);
+    return ERR_DB_FILE;
+  }
+
+  printf(M_STD_ADDED, id);
+  return NO_ERROR;
+}
+
 /*
  *  add_student
  *      fd:     linux file descriptor
@@ -98,7 +271,13 @@ int get_student(int fd, int id, student_t *s) {
  *  Adds a new student to the database.  After calculating the index for the
  *  student, check if there is another student already at that location.  A good
  *  way is to use something like memcmp() to ensure that the location for this
- *  student contains all zero byes indicating the space is empty.
+ *  student contains all zero byes indicating the space is empty.  When the
+ *  occupancy bitmap is available it answers that question instead, without
+ *  reading the slot at all.  The record count and highest id in the
+ *  superblock and the bitmap are updated along with the slot.  The slot
+ *  is locked exclusively from the check until the student is written, so
+ *  two processes adding the same id cannot both see it empty.  With
+ *  --client the daemon adds the student and we print what it did.
  *
  *  returns:  NO_ERROR       student added to database
  *            ERR_DB_FILE    database file I/O issue
@@ -113,48 +292,87 @@ int get_student(int fd, int id, student_t *s) {
  *
  */
 int add_student(int fd, int id, char *fname, char *lname, int gpa) {
-  student_t new_student = {0};
-  student_t existing_student;
-  off_t position;
-  ssize_t bytes_read, bytes_written;
-
-  position = id * STUDENT_RECORD_SIZE;
+  int rc;
 
-  if (lseek(fd, position, SEEK_SET) == -1) {
-    printf(M_ERR_DB_READ);
-    return ERR_DB_FILE;
+  if (sdb_remote(fd)) {
+    student_t new_student = {0};
+
+    new_student.id = id;
+    strncpy(new_student.fname, fname, sizeof(new_student.fname) - 1);
+    strncpy(new_student.lname, lname, sizeof(new_student.lname) - 1);
+    new_student.gpa = gpa;
+
+    rc = sdb_remote_call(fd, SDB_OP_ADD, &new_student, NULL);
+    if (rc == NO_ERROR)
+      printf(M_STD_ADDED, id);
+    else if (rc == ERR_DB_OP)
+      printf(M_ERR_DB_ADD_DUP, id);
+    else
+      printf(M_ERR_DB_WRITE);
+    return rc;
   }
 
-  bytes_read = read(fd, &existing_student, STUDENT_RECORD_SIZE);
-  if (bytes_read == -1) {
-    printf(M_ERR_DB_READ);
+  // a compressed (dense) database has no free slots, so sdb_lock_add()
+  // expands it first, see sdb_dense_expand()
+  if (sdb_lock_add(fd, id, 1) != NO_ERROR) {
+    printf(M_ERR_DB_WRITE);
     return ERR_DB_FILE;
   }
 
-  if (bytes_read == STUDENT_RECORD_SIZE &&
-      memcmp(&existing_student, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) !=
-          0) {
-    printf(M_ERR_DB_ADD_DUP, id);
+  rc = add_locked(fd, id, fname, lname, gpa);
+  sdb_lock(fd, F_UNLCK, id, 1);
+  return rc;
+}
+
+/*
+ *  del_locked
+ *
+ *  Does the work of del_student() once the slot of id is locked.
+ */
+static int del_locked(int fd, int id) {
+  student_t student;
+  superblock_t sb;
+  int rc;
+
+  rc = read_student(fd, id, &student);
+  if (rc == SRCH_NOT_FOUND) {
+    printf(M_STD_NOT_FND_MSG, id);
     return ERR_DB_OP;
+  } else if (rc != NO_ERROR) {
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
   }
 
-  new_student.id = id;
-  strncpy(new_student.fname, fname, sizeof(new_student.fname) - 1);
-  strncpy(new_student.lname, lname, sizeof(new_student.lname) - 1);
-  new_student.gpa = gpa;
-
-  if (lseek(fd, position, SEEK_SET) == -1) {
+  // the slot is cleared first, then its block is given back to the
+  // filesystem if no other student lives there, see sdb_reclaim()
+  if (sdb_sb_begin(fd, &sb) != NO_ERROR ||
+      sdb_write_slot(fd, id, &EMPTY_STUDENT_RECORD) != NO_ERROR ||
+      sdb_bm_update(fd, id, false, &sb) != NO_ERROR ||
+      sdb_reclaim(fd, id) != NO_ERROR) {
+    sdb_sb_abort(fd);
     printf(M_ERR_DB_WRITE);
     return ERR_DB_FILE;
   }
+  sdb_name_update(fd, &student, false);
+  sdb_col_update(fd, &student, false);
+
+  sb.record_count--;
+  if (id == sb.max_id) {
+    sb.max_id = sdb_scan_prev(fd, id);
+    if (sb.max_id < 0) {
+      sdb_sb_abort(fd);
+      printf(M_ERR_DB_READ);
+      return ERR_DB_FILE;
+    }
+  }
 
-  bytes_written = write(fd, &new_student, STUDENT_RECORD_SIZE);
-  if (bytes_written != STUDENT_RECORD_SIZE) {
+  if (sdb_sb_commit(fd, &sb) != NO_ERROR ||
+      (sdb_opts.sync && sdb_sync(fd) != NO_ERROR)) {
     printf(M_ERR_DB_WRITE);
     return ERR_DB_FILE;
   }
 
-  printf(M_STD_ADDED, id);
+  printf(M_STD_DEL_MSG, id);
   return NO_ERROR;
 }
 
@@ -166,7 +384,10 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa) {
  *  Removes a student to the database.  Use the get_student() function to
  *  locate the student to be deleted. If there is a student at that location
  *  write an empty student record - see EMPTY_STUDENT_RECORD from db.h at
- *  that location.
+ *  that location.  The superblock counters and the occupancy bitmap are
+ *  updated to match, if this was the highest id the next highest live id
+ *  becomes the new max_id.  The slot is locked exclusively throughout.
+ *  With --client the daemon deletes the student.
  *
  *  returns:  NO_ERROR       student deleted from database
  *            ERR_DB_FILE    database file I/O issue
@@ -181,13 +402,49 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa) {
  *
  */
 int del_student(int fd, int id) {
-  student_t student;
   int rc;
-  off_t position;
 
-  position = id * STUDENT_RECORD_SIZE;
+  if (id < MIN_STD_ID || id > sdb_id_max(fd)) {
+    printf(M_STD_NOT_FND_MSG, id);
+    return ERR_DB_OP;
+  }
+
+  if (sdb_remote(fd)) {
+    student_t key = {0};
 
-  rc = get_student(fd, id, &student);
+    key.id = id;
+    rc = sdb_remote_call(fd, SDB_OP_DEL, &key, NULL);
+    if (rc == NO_ERROR)
+      printf(M_STD_DEL_MSG, id);
+    else if (rc == ERR_DB_OP)
+      printf(M_STD_NOT_FND_MSG, id);
+    else
+      printf(M_ERR_DB_WRITE);
+    return rc;
+  }
+
+  if (sdb_lock_ids(fd, F_WRLCK, id, 1) != NO_ERROR) {
+    printf(M_ERR_DB_WRITE);
+    return ERR_DB_FILE;
+  }
+
+  rc = del_locked(fd, id);
+  sdb_lock(fd, F_UNLCK, id, 1);
+  return rc;
+}
+
+/*
+ *  update_locked
+ *
+ *  Does the work of update_student() once the slot of id is locked.
+ */
+static int update_locked(int fd, int id, int gpa, const char *lname) {
+  student_t old, s;
+  superblock_t sb;
+  size_t first = sizeof(s), end = 0;
+  int rc;
+
+  rc = read_student(fd, id, &old);
   if (rc == SRCH_NOT_FOUND) {
     printf(M_STD_NOT_FND_MSG, id);
     return ERR_DB_OP;
@@ -196,32 +453,122 @@ int del_student(int fd, int id) {
     return ERR_DB_FILE;
   }
 
-  if (lseek(fd, position, SEEK_SET) == -1) {
-    printf(M_ERR_DB_READ);
+  // lname and gpa are next to each other, so changing both is still one
+  // write from the start of lname to the end of gpa
+  s = old;
+  if (lname != NULL) {
+    memset(s.lname, 0, sizeof(s.lname));
+    strncpy(s.lname, lname, sizeof(s.lname) - 1);
+    first = offsetof(student_t, lname);
+    end = first + sizeof(s.lname);
+  }
+  if (gpa >= 0) {
+    s.gpa = gpa;
+    if (offsetof(student_t, gpa) < first)
+      first = offsetof(student_t, gpa);
+    end = offsetof(student_t, gpa) + sizeof(s.gpa);
+  }
+
+  if (memcmp(&old, &s, sizeof(s)) == 0) {
+    printf(M_STD_UPDATED, id);
+    return NO_ERROR;
+  }
+
+  if (sdb_sb_begin(fd, &sb) != NO_ERROR ||
+      sdb_write_field(fd, id, (const char *)&s + first, end - first,
+                      first) != NO_ERROR) {
+    sdb_sb_abort(fd);
+    printf(M_ERR_DB_WRITE);
     return ERR_DB_FILE;
   }
+  if (strcmp(old.lname, s.lname) != 0) {
+    sdb_name_update(fd, &old, false);
+    sdb_name_update(fd, &s, true);
+  }
+  if (old.gpa != s.gpa)
+    sdb_col_update(fd, &s, true);
 
-  if (write(fd, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) !=
-      STUDENT_RECORD_SIZE) {
+  if (sdb_sb_commit(fd, &sb) != NO_ERROR ||
+      (sdb_opts.sync && sdb_sync(fd) != NO_ERROR)) {
     printf(M_ERR_DB_WRITE);
     return ERR_DB_FILE;
   }
 
-  printf(M_STD_DEL_MSG, id);
+  printf(M_STD_UPDATED, id);
   return NO_ERROR;
 }
 
+/*
+ *  update_student
+ *      fd:     linux file descriptor
+ *      id:     student id to be updated
+ *      gpa:    the new GPA, or -1 to keep the current one
+ *      lname:  the new last name, or NULL to keep the current one
+ *
+ *  Changes the GPA and/or last name of a student that is already in the
+ *  database without deleting and adding it again, so there is no moment
+ *  where the student does not exist.  Only the bytes of the changed fields
+ *  are written, with one write at their offset inside the slot (see
+ *  sdb_write_field()), and the last name index and GPA column are told
+ *  about the change.  The record count and highest id do not change.  The
+ *  slot is locked exclusively throughout.  With --client the daemon
+ *  updates the student.
+ *
+ *  returns:  NO_ERROR       student updated
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      database operation logically failed (aka student
+ *                           not in database)
+ *
+ *  console:  M_STD_UPDATED      on success
+ *            M_STD_NOT_FND_MSG  student not in database, cant be updated
+ *            M_ERR_DB_READ      error reading or seeking the database file
+ *            M_ERR_DB_WRITE     error writing to db file
+ */
+int update_student(int fd, int id, int gpa, const char *lname) {
+  int rc;
+
+  if (id < MIN_STD_ID || id > sdb_id_max(fd)) {
+    printf(M_STD_NOT_FND_MSG, id);
+    return ERR_DB_OP;
+  }
+
+  if (sdb_remote(fd)) {
+    student_t req = {0};
+
+    // an empty last name and a negative GPA tell the daemon to keep them
+    req.id = id;
+    req.gpa = gpa;
+    if (lname != NULL)
+      strncpy(req.lname, lname, sizeof(req.lname) - 1);
+    rc = sdb_remote_call(fd, SDB_OP_UPDATE, &req, NULL);
+    if (rc == NO_ERROR)
+      printf(M_STD_UPDATED, id);
+    else if (rc == ERR_DB_OP)
+      printf(M_STD_NOT_FND_MSG, id);
+    else
+      printf(M_ERR_DB_WRITE);
+    return rc;
+  }
+
+  if (sdb_lock_ids(fd, F_WRLCK, id, 1) != NO_ERROR) {
+    printf(M_ERR_DB_WRITE);
+    return ERR_DB_FILE;
+  }
+
+  rc = update_locked(fd, id, gpa, lname);
+  sdb_lock(fd, F_UNLCK, id, 1);
+  return rc;
+}
+
 /*
  *  count_db_records
  *      fd:     linux file descriptor
  *
- *  Counts the number of records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Create a counter variable and initialize it
- *  to zero, every time a non-zero record is read increment the counter.
+ *  Counts the number of records in the database.  add_student() and
+ *  del_student() keep a live record count in the superblock (slot 0, see
+ *  db.h) so this is a single read no matter how big the database is.  The
+ *  count is only rebuilt with a full table scan when open_db() finds the
+ *  superblock missing or dirty.  With --client the daemon reads the count.
  *
  *  returns:  <number>       returns the number of records in db on success
  *            ERR_DB_FILE    database file I/O issue
@@ -236,22 +583,17 @@ int del_student(int fd, int id) {
  *
  */
 int count_db_records(int fd) {
-  ssize_t bytes_read;
-  student_t buffer;
-  int count = 0;
-
-  if (lseek(fd, 0, SEEK_SET) == -1) {
-    printf(M_ERR_DB_READ);
-    return ERR_DB_FILE;
-  }
+  superblock_t sb;
+  int count;
 
-  while ((bytes_read = read(fd, &buffer, STUDENT_RECORD_SIZE)) > 0) {
-    if (memcmp(&buffer, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
-      count++;
-    }
+  if (sdb_remote(fd)) {
+    count = sdb_remote_call(fd, SDB_OP_COUNT, NULL, NULL);
+  } else {
+    count = sdb_sb_read(fd, &sb) == NO_ERROR ? (int)sb.record_count
+                                              : ERR_DB_FILE;
   }
 
-  if (bytes_read == -1) {
+  if (count < 0) {
     printf(M_ERR_DB_READ);
     return ERR_DB_FILE;
   }
@@ -265,16 +607,145 @@ int count_db_records(int fd) {
   return count;
 }
 
+// rows formatted by one part of print_parallel(), see print_part()
+//  text:  the rows, not NUL terminated
+//  len:   bytes used in text
+//  cap:   bytes allocated for text
+typedef struct print_buf {
+  char *text;
+  size_t len;
+  size_t cap;
+} print_buf_t;
+
+/*
+ *  print_part
+ *      part:   scan of one part of the database
+ *      index:  which part, selects the print_buf_t to fill
+ *      arg:    array of print_buf_t, one per part
+ *
+ *  sdb_par_scan() worker, formats the students of one part with
+ *  sdb_fmt_row() just like print_db() does.
+ *
+ *  returns:  NO_ERROR     every student of the part is in the buffer
+ *            ERR_DB_FILE  database file I/O issue or out of memory
+ */
+static int print_part(sdb_scan_t *part, int index, void *arg) {
+  print_buf_t *buf = &((print_buf_t *)arg)[index];
+  const student_t *rec;
+  int rc;
+
+  while ((rc = sdb_scan_next(part, &rec)) == 1) {
+    if (buf->cap - buf->len < SDB_FMT_ROW_MAX) {
+      size_t cap = buf->cap == 0 ? SDB_SCAN_BLOCK : buf->cap * 2;
+      char *grown = realloc(buf->text, cap);
+
+      if (grown == NULL)
+        return ERR_DB_FILE;
+      buf->text = grown;
+      buf->cap = cap;
+    }
+    buf->len += sdb_fmt_row(buf->text + buf->len, rec);
+  }
+
+  return rc;
+}
+
+/*
+ *  print_parallel
+ *      fd:              linux file descriptor
+ *      *found_records:  set to true if any student was printed
+ *
+ *  The -j N version of print_db().  sdb_par_scan() splits the database into
+ *  up to N ranges of ids that are formatted by separate threads, then the
+ *  ranges are written out in order, so the output is byte for byte the
+ *  same as a single threaded print.
+ *
+ *  returns:  NO_ERROR     the table was printed
+ *            ERR_DB_FILE  database file I/O issue or out of memory, nothing
+ *                         was printed
+ */
+static int print_parallel(int fd, bool *found_records) {
+  print_buf_t bufs[SDB_MAX_JOBS] = {0};
+  int parts;
+
+  *found_records = false;
+  parts = sdb_par_scan(fd, sdb_opts.jobs, print_part, bufs);
+
+  for (int i = 0; parts > 0 && i < parts; i++) {
+    if (bufs[i].len == 0)
+      continue;
+
+    if (!*found_records) {
+      printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+      fflush(stdout);
+      *found_records = true;
+    }
+    sdb_write_all(STDOUT_FILENO, bufs[i].text, bufs[i].len);
+  }
+
+  for (int i = 0; i < SDB_MAX_JOBS; i++)
+    free(bufs[i].text);
+
+  return parts < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  print_remote
+ *      fd:              connection to a daemon, see sdb_connect()
+ *      *found_records:  set to true if any student was printed
+ *
+ *  The --client version of print_db().  The daemon sends the students in
+ *  id order, SDB_SERVE_BATCH at a time, and they are formatted here.
+ *
+ *  returns:  NO_ERROR     the table was printed
+ *            ERR_DB_FILE  the daemon failed or went away, part of the table
+ *                         may have been printed
+ */
+static int print_remote(int fd, bool *found_records) {
+  student_t *batch;
+  char *out;
+  int n;
+
+  *found_records = false;
+  batch = malloc(SDB_SERVE_BATCH * sizeof(student_t));
+  out = malloc(SDB_SERVE_BATCH * SDB_FMT_ROW_MAX);
+  if (batch == NULL || out == NULL ||
+      sdb_remote_call(fd, SDB_OP_PRINT, NULL, NULL) != NO_ERROR) {
+    free(batch);
+    free(out);
+    return ERR_DB_FILE;
+  }
+
+  while ((n = sdb_remote_next(fd, batch, SDB_SERVE_BATCH)) > 0) {
+    size_t len = 0;
+
+    if (!*found_records) {
+      printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+      fflush(stdout);
+      *found_records = true;
+    }
+    for (int i = 0; i < n; i++)
+      len += sdb_fmt_row(out + len, &batch[i]);
+    sdb_write_all(STDOUT_FILENO, out, len);
+  }
+
+  free(batch);
+  free(out);
+  return n < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
 /*
  *  print_db
  *      fd:     linux file descriptor
  *
- *  Prints all records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Be careful as the database might be empty.
+ *  Prints all records in the database.  The database is walked front to
+ *  back with a full table scan (see sdb_scan_open()) that skips empty or
+ *  previously deleted slots, or with -j N by N threads (see
+ *  print_parallel()), or by the daemon with --client (see
+ *  print_remote()).  Be careful as the database might be empty.
+ *  Rows are formatted by sdb_fmt_row() into a SDB_FMT_BUF buffer and
+ *  written with write() rather than printed one at a time, the output is
+ *  the same as printing each row with printf() as described below.
  *  on the first real row encountered print the header for the required output:
  *
  *     printf(STUDENT_PRINT_HDR_STRING, "ID",
@@ -285,10 +756,8 @@ int count_db_records(int fd) {
  *     printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname,
  *                    student.lname, calculated_gpa_from_student);
  *
- *  The code above assumes you are reading student records into a local
- *  variable named student that is of type student_t. Also dont forget that
- *  the GPA in the student structure is an int, to convert it into a real
- *  gpa divide by 100.0 and store in a float variable.
+ *  Dont forget that the GPA in the student structure is an int, to convert
+ *  it into a real gpa divide by 100.0 and store in a float variable.
  *
  *  returns:  NO_ERROR       on success
  *            ERR_DB_FILE    database file I/O issue
@@ -299,34 +768,75 @@ int count_db_records(int fd) {
  *
  */
 int print_db(int fd) {
-  ssize_t bytes_read;
-  student_t buffer;
+  sdb_scan_t scan;
+  const student_t *rec;
+  char *out;
+  size_t len = 0;
+  int rc;
   bool header_printed = false;
   bool found_records = false;
 
-  if (lseek(fd, 0, SEEK_SET) == -1) {
+  if (sdb_remote(fd)) {
+    if (print_remote(fd, &found_records) != NO_ERROR) {
+      printf(M_ERR_DB_READ);
+      return ERR_DB_FILE;
+    }
+    if (!found_records)
+      printf(M_DB_EMPTY);
+    return NO_ERROR;
+  }
+
+  // a shared lock on every id gives a consistent table, writers wait
+  if (sdb_lock_ids(fd, F_RDLCK, MIN_STD_ID, 0) != NO_ERROR) {
     printf(M_ERR_DB_READ);
     return ERR_DB_FILE;
   }
 
-  while ((bytes_read = read(fd, &buffer, STUDENT_RECORD_SIZE)) > 0) {
-    if (memcmp(&buffer, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
-      if (!header_printed) {
-        printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME",
-               "GPA");
-        header_printed = true;
-      }
+  if (sdb_opts.jobs > 1) {
+    rc = print_parallel(fd, &found_records);
+    sdb_lock(fd, F_UNLCK, MIN_STD_ID, 0);
+    if (rc < 0) {
+      printf(M_ERR_DB_READ);
+      return ERR_DB_FILE;
+    }
+    if (!found_records)
+      printf(M_DB_EMPTY);
+    return NO_ERROR;
+  }
 
-      float calculated_gpa = buffer.gpa / 100.0;
+  out = malloc(SDB_FMT_BUF);
+  if (out == NULL) {
+    sdb_lock(fd, F_UNLCK, MIN_STD_ID, 0);
+    printf(M_ERR_DB_READ);
+    return ERR_DB_FILE;
+  }
 
-      printf(STUDENT_PRINT_FMT_STRING, buffer.id, buffer.fname, buffer.lname,
-             calculated_gpa);
+  rc = sdb_scan_open(&scan, fd);
+  while (rc == NO_ERROR && (rc = sdb_scan_next(&scan, &rec)) == 1) {
+    if (!header_printed) {
+      printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+      fflush(stdout);
+      header_printed = true;
+    }
 
-      found_records = true;
+    // rows bypass stdio, see sdb_fmt_row()
+    if (SDB_FMT_BUF - len < SDB_FMT_ROW_MAX) {
+      sdb_write_all(STDOUT_FILENO, out, len);
+      len = 0;
     }
+    len += sdb_fmt_row(out + len, rec);
+
+    found_records = true;
+    rc = NO_ERROR;
   }
+  sdb_scan_close(&scan);
+  sdb_lock(fd, F_UNLCK, MIN_STD_ID, 0);
 
-  if (bytes_read == -1) {
+  if (len > 0)
+    sdb_write_all(STDOUT_FILENO, out, len);
+  free(out);
+
+  if (rc < 0) {
     printf(M_ERR_DB_READ);
     return ERR_DB_FILE;
   }
@@ -409,7 +919,8 @@ void print_student(student_t *s) {
  *  it is very likely you will need to close it to overwrite it with the
  *  compressed version of the file.  To ensure the caller can work with the
  *  compressed file after you create it, it is a good design to return the fd
- *  of the new compressed file from this function
+ *  of the new compressed file from this function.  A hashed database (see
+ *  sdb_hash.c) reuses the slots of deleted students and is left as it is
  *
  *  returns:  <number>       returns the fd of the compressed database file
  *            ERR_DB_FILE    database file I/O issue
@@ -427,55 +938,67 @@ void print_student(student_t *s) {
  *
  */
 int compress_db(int fd) {
-  student_t buffer;
-  ssize_t bytes_read;
   int tmp_fd;
-  off_t write_pos = 0;
 
-  tmp_fd = open_db(TMP_DB_FILE, true);
-  if (tmp_fd < 0) {
+  // the whole database lock keeps every other process out until the
+  // compressed copy has replaced the file, close_db() releases it.  They
+  // notice the new file once they get their locks, see sdb_lock_ids()
+  if (sdb_lock(fd, F_WRLCK, SDB_LOCK_SB, 0) != NO_ERROR ||
+      sdb_reopen(fd) != NO_ERROR) {
     printf(M_ERR_DB_OPEN);
     return ERR_DB_FILE;
   }
 
-  if (lseek(fd, 0, SEEK_SET) == -1) {
-    printf(M_ERR_DB_READ);
-    close(tmp_fd);
-    return ERR_DB_FILE;
+  // a hashed file has no gaps between students to squeeze out
+  if (sdb_handle(fd)->layout == SDB_LAYOUT_HASH) {
+    printf(M_DB_COMPRESSED_OK);
+    return fd;
   }
 
-  while ((bytes_read = read(fd, &buffer, STUDENT_RECORD_SIZE)) > 0) {
-    if (memcmp(&buffer, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
-      write_pos = (buffer.id) * STUDENT_RECORD_SIZE;
-
-      if (lseek(tmp_fd, write_pos, SEEK_SET) == -1) {
-        printf(M_ERR_DB_WRITE);
-        close(tmp_fd);
-        return ERR_DB_FILE;
-      }
+  // the copy keeps the uuid, so the logged mutations of the old layout
+  // must never be replayed into it
+  if (sdb_wal_checkpoint(fd) != NO_ERROR) {
+    printf(M_ERR_DB_WRITE);
+    return ERR_DB_FILE;
+  }
 
-      ssize_t bytes_written = write(tmp_fd, &buffer, STUDENT_RECORD_SIZE);
-      if (bytes_written != STUDENT_RECORD_SIZE) {
-        printf(M_ERR_DB_WRITE);
-        close(tmp_fd);
-        return ERR_DB_FILE;
-      }
-    }
+  // the temporary file is attached without a path so it does not get
+  // sidecar files of its own.  It is written in the dense layout (see db.h)
+  // with the same uuid and generation as the database, so the sidecars of
+  // DB_FILE stay valid for the compressed copy
+  tmp_fd = open(TMP_DB_FILE, O_RDWR | O_CREAT | O_TRUNC,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+  if (tmp_fd == -1) {
+    printf(M_ERR_DB_OPEN);
+    return ERR_DB_FILE;
   }
 
-  if (bytes_read == -1) {
-    printf(M_ERR_DB_READ);
+  if (sdb_attach(tmp_fd, NULL, sdb_opts.engine) != NO_ERROR) {
+    printf(M_ERR_DB_OPEN);
     close(tmp_fd);
     return ERR_DB_FILE;
   }
 
-  close(fd);
-  close(tmp_fd);
+  if (sdb_dense_write(fd, tmp_fd) != NO_ERROR) {
+    printf(M_ERR_DB_WRITE);
+    close_db(tmp_fd);
+    return ERR_DB_FILE;
+  }
+
+  // the compressed copy must be on disk before it replaces the database
+  if (sdb_sync(tmp_fd) != NO_ERROR) {
+    printf(M_ERR_DB_WRITE);
+    close_db(tmp_fd);
+    return ERR_DB_FILE;
+  }
 
+  close_db(tmp_fd);
   if (rename(TMP_DB_FILE, DB_FILE) == -1) {
     printf(M_ERR_DB_CREATE);
+    close_db(fd);
     return ERR_DB_FILE;
   }
+  close_db(fd);
 
   fd = open_db(DB_FILE, false);
   if (fd < 0) {
@@ -487,14 +1010,56 @@ int compress_db(int fd) {
   return fd;
 }
 
+/*
+ *  compress_db_online
+ *      fd:  pointer to an open file descriptor to the database file
+ *
+ *  Reclaims the storage of deleted students without copying the database
+ *  (sdbsc -x --online).  Empty slots past the highest student id are cut
+ *  off the end of the file and every filesystem block that only holds
+ *  empty slots is punched out of it, see sdb_reclaim_all().  Students keep
+ *  their slots, so unlike compress_db() the file is not replaced and fd
+ *  stays valid.  The whole database is locked while this runs.
+ *
+ *  returns:  NO_ERROR     the database was compressed
+ *            ERR_DB_FILE  database file I/O issue
+ *
+ *  console:  M_DB_COMPRESSED_OK  on success
+ *            M_ERR_DB_WRITE      if the file could not be changed
+ *
+ */
+int compress_db_online(int fd) {
+  int rc;
+
+  if (sdb_lock(fd, F_WRLCK, SDB_LOCK_SB, 0) != NO_ERROR) {
+    printf(M_ERR_DB_WRITE);
+    return ERR_DB_FILE;
+  }
+
+  rc = sdb_reopen(fd);
+  if (rc == NO_ERROR)
+    rc = sdb_reclaim_all(fd);
+  sdb_lock(fd, F_UNLCK, SDB_LOCK_SB, 0);
+
+  if (rc != NO_ERROR || (sdb_opts.sync && sdb_sync(fd) != NO_ERROR)) {
+    printf(M_ERR_DB_WRITE);
+    return ERR_DB_FILE;
+  }
+
+  printf(M_DB_COMPRESSED_OK);
+  return NO_ERROR;
+}
+
 /*
  *  validate_range
+ *      fd:  the database the student is for
  *      id:  proposed student id
  *      gpa: proposed gpa
  *
  *  This function validates that the id and gpa are in the allowable ranges
  *  as per the specifications.  It checks if the values are within the
- *  inclusive range using constents in db.h
+ *  inclusive range using constents in db.h, a hashed database takes ids
+ *  past MAX_STD_ID (see sdb_id_max())
  *
  *  returns:    NO_ERROR       on success, both ID and GPA are in range
  *              EXIT_FAIL_ARGS if either ID or GPA is out of range
@@ -502,8 +1067,8 @@ int compress_db(int fd) {
  *  console:  This function does not produce any output
  *
  */
-int validate_range(int id, int gpa) {
-  if ((id < MIN_STD_ID) || (id > MAX_STD_ID))
+int validate_range(int fd, int id, int gpa) {
+  if ((id < MIN_STD_ID) || (id > sdb_id_max(fd)))
     return EXIT_FAIL_ARGS;
 
   if ((gpa < MIN_STD_GPA) || (gpa > MAX_STD_GPA))
@@ -524,31 +1089,190 @@ int validate_range(int id, int gpa) {
  *
  */
 void usage(char *exename) {
-  printf("usage: %s -[h|a|c|d|f|p|z] options.  Where:\n", exename);
+  printf("usage: %s -[h|a|B|c|d|f|F|g|n|p|s|t|u|U|z] options.  Where:\n",
+         exename);
   printf("\t-h:  prints help\n");
   printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
+  printf("\t-B [file.csv|-]:  adds every id,first_name,last_name,gpa line of "
+         "the file (or stdin)\n");
+  printf("\t--export=csv|jsonl|raw [file|-]:  writes every student to the "
+         "file (or stdout), raw is a snapshot of the 64 byte records\n");
+  printf("\t--import=csv|jsonl|raw [file|-]:  adds every student of a "
+         "--export file (or stdin)\n");
   printf("\t-c:  counts the records in the database\n");
   printf("\t-d id:  deletes a student\n");
-  printf("\t-f id:  finds and prints a student in the database\n");
-  printf("\t-p:  prints all records in the student database\n");
-  printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
+  printf("\t-f id [id ...]:  finds and prints students in the database\n");
+  printf("\t-F [ids.txt|-]:  finds every student id listed one per line in "
+         "the file (or stdin)\n");
+  printf("\t-g lo hi:  prints students with a GPA from lo to hi (as 3 digit "
+         "ints)\n");
+  printf("\t-n last_name [--prefix]:  finds students by last name, "
+         "--prefix matches every last name starting with it\n");
+  printf("\t-p [--sort=lname] [--sort-mem=N]:  prints all records in the "
+         "student database, --sort=lname orders them by last name and first "
+         "name using at most N megabytes (default %d)\n",
+         SDB_SORT_MEM / (1024 * 1024));
+  printf("\t-s:  prints GPA statistics and a histogram\n");
+  printf("\t-t K [--lowest]:  prints the K students with the highest GPA, "
+         "--lowest prints the lowest instead\n");
+  printf("\t-u id [--gpa N] [--lname X]:  changes the GPA (as 3 digit int) "
+         "and/or last name of a student in place\n");
+  printf("\t-U [updates.csv|-]:  applies every id,gpa or id,gpa,last_name "
+         "line of the file (or stdin)\n");
+  printf("\t--fsck [-j N]:  checks every page of the db file against its "
+         "checksum and reports the students on corrupt pages\n");
+  printf("\t-x [--online]:  compress the database file [EXTRA CREDIT], "
+         "--online reclaims space in place\n");
   printf("\t-z:  zero db file (remove all records)\n");
+  printf("modifiers, these can be combined with any of the above:\n");
+  printf("\t--io=mmap|rw|uring:  storage engine, mmap (default) maps the db "
+         "file, rw uses read/write calls, uring is rw with batches submitted "
+         "through io_uring\n");
+  printf("\t--sync:  flush changes to disk before reporting success\n");
+  printf("\t--hash:  a new (or -z) db file stores students in hashed "
+         "buckets, ids up to %d\n",
+         INT_MAX);
+  printf("\t-j N:  scan the database with N threads (1 to %d)\n",
+         SDB_MAX_JOBS);
+  printf("\t--client:  send -a, -c, -d, -f, -F, -p and -u to a running "
+         "sdbsc --serve\n");
+  printf("daemon:\n");
+  printf("\t--serve:  keep the database open and answer --client requests "
+         "until interrupted\n");
+}
+
+/*
+ *  parse_opts
+ *      argc:  pointer to the argument count from main()
+ *      argv:  the argument vector from main()
+ *
+ *  Looks for modifiers (see usage()) anywhere on the command line, records
+ *  them in sdb_opts and removes them from argv so the positional arguments
+ *  of each operation end up where main() expects them.
+ *
+ *  returns:  NO_ERROR        all modifiers were understood
+ *            EXIT_FAIL_ARGS  a modifier had an invalid value
+ *
+ *  console:  This function does not produce any output
+ *
+ */
+int parse_opts(int *argc, char *argv[]) {
+  int kept = 1;
+
+  for (int i = 1; i < *argc; i++) {
+    if (strcmp(argv[i], "--io=mmap") == 0) {
+      sdb_opts.engine = SDB_ENGINE_MMAP;
+    } else if (strcmp(argv[i], "--io=rw") == 0) {
+      sdb_opts.engine = SDB_ENGINE_RW;
+    } else if (strcmp(argv[i], "--io=uring") == 0) {
+      sdb_opts.engine = SDB_ENGINE_URING;
+    } else if (strncmp(argv[i], "--io=", 5) == 0) {
+      return EXIT_FAIL_ARGS;
+    } else if (strcmp(argv[i], "--sync") == 0) {
+      sdb_opts.sync = true;
+    } else if (strcmp(argv[i], "--online") == 0) {
+      sdb_opts.online = true;
+    } else if (strcmp(argv[i], "--serve") == 0) {
+      sdb_opts.serve = true;
+    } else if (strcmp(argv[i], "--client") == 0) {
+      sdb_opts.client = true;
+    } else if (strcmp(argv[i], "--prefix") == 0) {
+      sdb_opts.prefix = true;
+    } else if (strcmp(argv[i], "--lowest") == 0) {
+      sdb_opts.lowest = true;
+    } else if (strcmp(argv[i], "--hash") == 0) {
+      sdb_opts.hash = true;
+    } else if (strcmp(argv[i], "--sort=id") == 0) {
+      sdb_opts.sort = SDB_SORT_ID;
+    } else if (strcmp(argv[i], "--sort=lname") == 0) {
+      sdb_opts.sort = SDB_SORT_LNAME;
+    } else if (strncmp(argv[i], "--sort=", 7) == 0) {
+      return EXIT_FAIL_ARGS;
+    } else if (strncmp(argv[i], "--sort-mem=", 11) == 0) {
+      char *end;
+      long mem = strtol(argv[i] + 11, &end, 10);
+
+      if (*end != '\0' || mem < 1 || mem > SDB_SORT_MEM_MAX)
+        return EXIT_FAIL_ARGS;
+      sdb_opts.sort_mem = (size_t)mem * 1024 * 1024;
+    } else if (strcmp(argv[i], "-j") == 0) {
+      char *end;
+      long jobs;
+
+      if (i + 1 == *argc)
+        return EXIT_FAIL_ARGS;
+      jobs = strtol(argv[++i], &end, 10);
+      if (*end != '\0' || jobs < 1 || jobs > SDB_MAX_JOBS)
+        return EXIT_FAIL_ARGS;
+      sdb_opts.jobs = (int)jobs;
+    } else {
+      argv[kept++] = argv[i];
+    }
+  }
+
+  argv[kept] = NULL;
+  *argc = kept;
+  return NO_ERROR;
+}
+
+/*
+ *  parse_format
+ *      name:  the FMT of --export=FMT or --import=FMT
+ *
+ *  returns:  SDB_FORMAT_CSV, SDB_FORMAT_JSONL or SDB_FORMAT_RAW
+ *            -1  name is not a format
+ *
+ *  console:  This function does not produce any output
+ *
+ */
+int parse_format(const char *name) {
+  if (strcmp(name, "csv") == 0)
+    return SDB_FORMAT_CSV;
+  if (strcmp(name, "jsonl") == 0)
+    return SDB_FORMAT_JSONL;
+  if (strcmp(name, "raw") == 0)
+    return SDB_FORMAT_RAW;
+  return -1;
 }
 
 // Welcome to main()
 int main(int argc, char *argv[]) {
-  char opt;      // user selected option
-  int fd;        // file descriptor of database files
-  int rc;        // return code from various operations
-  int exit_code; // exit code to shell
-  int id;        // userid from argv[2]
-  int gpa;       // gpa from argv[5]
+  char opt;           // user selected option
+  int fd;             // file descriptor of database files
+  int rc;             // return code from various operations
+  int exit_code;      // exit code to shell
+  int id;             // userid from argv[2]
+  int gpa;            // gpa from argv[5]
+  int lo, hi;         // gpa range from argv[2] and argv[3]
+  char *lname = NULL; // new last name from -u
+  int format = -1;    // SDB_FORMAT_* of --export= and --import=
 
   // space for a student structure which we will get back from
   // some of the functions we will be writing such as get_student(),
   // and print_student().
   student_t student = {0};
 
+  // pull the modifiers out first so the checks below only see the operation
+  // and its arguments
+  if (parse_opts(&argc, argv) != NO_ERROR) {
+    usage(argv[0]);
+    exit(EXIT_FAIL_ARGS);
+  }
+
+  // the daemon takes no operation, it serves until it is interrupted
+  if (sdb_opts.serve) {
+    if (argc != 1 || sdb_opts.client) {
+      usage(argv[0]);
+      exit(EXIT_FAIL_ARGS);
+    }
+    fd = open_db(DB_FILE, false);
+    if (fd < 0)
+      exit(EXIT_FAIL_DB);
+    rc = sdb_serve(fd, DB_FILE);
+    close_db(fd);
+    exit(rc == NO_ERROR ? EXIT_OK : EXIT_FAIL_DB);
+  }
+
   // This function must have at least one arg, and the arg must start
   // with a dash
   if ((argc < 2) || (*argv[1] != '-')) {
@@ -560,6 +1284,21 @@ int main(int argc, char *argv[]) {
   //-h -a -c -d -f -p -x -z
   opt = (char)*(argv[1] + 1); // get the option flag
 
+  // --export=FMT and --import=FMT are operations too, 'e' and 'i' below
+  if (strncmp(argv[1], "--export=", 9) == 0 ||
+      strncmp(argv[1], "--import=", 9) == 0) {
+    format = parse_format(argv[1] + 9);
+    if (format < 0) {
+      usage(argv[0]);
+      exit(EXIT_FAIL_ARGS);
+    }
+    opt = argv[1][2];
+  }
+
+  // --fsck is an operation too, 'k' below
+  if (strcmp(argv[1], "--fsck") == 0)
+    opt = 'k';
+
   // handle the help flag and then exit normally
   if (opt == 'h') {
     usage(argv[0]);
@@ -568,8 +1307,12 @@ int main(int argc, char *argv[]) {
 
   // now lets open the file and continue if there is no error
   // note we are not truncating the file using the second
-  // parameter
-  fd = open_db(DB_FILE, false);
+  // parameter.  With --client the operations the daemon knows go through
+  // it, compress, zero and bulk load always work on the file directly
+  if (sdb_opts.client && opt != '\0' && strchr("acdfFpu", opt) != NULL)
+    fd = sdb_connect(DB_FILE);
+  else
+    fd = open_db(DB_FILE, false);
   if (fd < 0) {
     exit(EXIT_FAIL_DB);
   }
@@ -596,7 +1339,7 @@ int main(int argc, char *argv[]) {
     id = atoi(argv[2]);
     gpa = atoi(argv[5]);
 
-    exit_code = validate_range(id, gpa);
+    exit_code = validate_range(fd, id, gpa);
     if (exit_code == EXIT_FAIL_ARGS) {
       printf(M_ERR_STD_RNG);
       break;
@@ -608,6 +1351,102 @@ int main(int argc, char *argv[]) {
 
     break;
 
+  case 'B':
+    //   arv[0] arv[1]        arv[2]
+    // prog_name     -B  [file.csv|-]
+    //-------------------------------
+    // example:  prog_name -B students.csv
+    //           prog_name -B < students.csv
+    if (argc > 3) {
+      usage(argv[0]);
+      exit_code = EXIT_FAIL_ARGS;
+      break;
+    }
+
+    if (argc == 3 && strcmp(argv[2], "-") != 0) {
+      FILE *in = fopen(argv[2], "r");
+
+      if (in == NULL) {
+        printf(M_ERR_BULK_OPEN, argv[2]);
+        exit_code = EXIT_FAIL_ARGS;
+        break;
+      }
+      rc = bulk_load(fd, in);
+      fclose(in);
+    } else {
+      rc = bulk_load(fd, stdin);
+    }
+
+    if (rc < 0)
+      exit_code = EXIT_FAIL_DB;
+    break;
+
+  case 'e':
+    //   arv[0]        arv[1]    arv[2]
+    // prog_name  --export=FMT  [file|-]
+    //----------------------------------
+    // example:  prog_name --export=csv students.csv
+    //           prog_name --export=raw > students.raw
+    if (format < 0 || argc > 3) {
+      usage(argv[0]);
+      exit_code = EXIT_FAIL_ARGS;
+      break;
+    }
+
+    if (argc == 3 && strcmp(argv[2], "-") != 0) {
+      int out = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC,
+                     S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+
+      if (out == -1) {
+        printf(M_ERR_EXPORT_OPEN, argv[2]);
+        exit_code = EXIT_FAIL_ARGS;
+        break;
+      }
+      rc = export_db(fd, out, format);
+      if (close(out) == -1 && rc == NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        rc = ERR_DB_FILE;
+      }
+    } else {
+      // anything already printed has to go out before the students
+      fflush(stdout);
+      rc = export_db(fd, STDOUT_FILENO, format);
+    }
+
+    if (rc < 0)
+      exit_code = EXIT_FAIL_DB;
+    break;
+
+  case 'i':
+    //   arv[0]        arv[1]    arv[2]
+    // prog_name  --import=FMT  [file|-]
+    //----------------------------------
+    // example:  prog_name --import=csv students.csv
+    //           prog_name --import=raw < students.raw
+    if (format < 0 || argc > 3) {
+      usage(argv[0]);
+      exit_code = EXIT_FAIL_ARGS;
+      break;
+    }
+
+    if (argc == 3 && strcmp(argv[2], "-") != 0) {
+      FILE *in = fopen(argv[2], "r");
+
+      if (in == NULL) {
+        printf(M_ERR_IMPORT_OPEN, argv[2]);
+        exit_code = EXIT_FAIL_ARGS;
+        break;
+      }
+      rc = import_db(fd, in, format);
+      fclose(in);
+    } else {
+      rc = import_db(fd, stdin, format);
+    }
+
+    if (rc < 0)
+      exit_code = EXIT_FAIL_DB;
+    break;
+
   case 'c':
     //    arv[0] arv[1]
     // prog_name     -c
@@ -636,15 +1475,35 @@ int main(int argc, char *argv[]) {
     break;
 
   case 'f':
-    //    arv[0] arv[1]  arv[2]
-    // prog_name     -f      id
+    //    arv[0] arv[1]  arv[2]  ...
+    // prog_name     -f      id  [id ...]
     //-------------------------
     // example:  prog_name -f 100
-    if (argc != 3) {
+    //           prog_name -f 100 7 42
+    if (argc < 3) {
       usage(argv[0]);
       exit_code = EXIT_FAIL_ARGS;
       break;
     }
+
+    // several ids are looked up together, see find_students()
+    if (argc > 3) {
+      int *ids = malloc((size_t)(argc - 2) * sizeof(*ids));
+
+      if (ids == NULL) {
+        printf(M_ERR_DB_READ);
+        exit_code = EXIT_FAIL_DB;
+        break;
+      }
+      for (int i = 2; i < argc; i++)
+        ids[i - 2] = atoi(argv[i]);
+      rc = find_students(fd, ids, argc - 2);
+      free(ids);
+      if (rc < 0)
+        exit_code = EXIT_FAIL_DB;
+      break;
+    }
+
     id = atoi(argv[2]);
     rc = get_student(fd, id, &student);
 
@@ -663,16 +1522,206 @@ int main(int argc, char *argv[]) {
     }
     break;
 
+  case 'F':
+    //   arv[0] arv[1]        arv[2]
+    // prog_name     -F  [ids.txt|-]
+    //-----------------------------
+    // example:  prog_name -F class_list.txt
+    //           prog_name -F < class_list.txt
+    if (argc > 3) {
+      usage(argv[0]);
+      exit_code = EXIT_FAIL_ARGS;
+      break;
+    }
+
+    if (argc == 3 && strcmp(argv[2], "-") != 0) {
+      FILE *in = fopen(argv[2], "r");
+
+      if (in == NULL) {
+        printf(M_ERR_FIND_OPEN, argv[2]);
+        exit_code = EXIT_FAIL_ARGS;
+        break;
+      }
+      rc = find_file(fd, in);
+      fclose(in);
+    } else {
+      rc = find_file(fd, stdin);
+    }
+
+    if (rc < 0)
+      exit_code = EXIT_FAIL_DB;
+    break;
+
+  case 'g':
+    //    arv[0] arv[1]  arv[2]  arv[3]
+    // prog_name     -g      lo      hi
+    //-------------------------------
+    // example:  prog_name -g 300 400
+    if (argc != 4) {
+      usage(argv[0]);
+      exit_code = EXIT_FAIL_ARGS;
+      break;
+    }
+
+    lo = atoi(argv[2]);
+    hi = atoi(argv[3]);
+    if (lo < MIN_STD_GPA || hi > MAX_STD_GPA || lo > hi) {
+      usage(argv[0]);
+      exit_code = EXIT_FAIL_ARGS;
+      break;
+    }
+
+    rc = gpa_range(fd, lo, hi);
+    if (rc < 0)
+      exit_code = EXIT_FAIL_DB;
+    break;
+
+  case 'n':
+    //    arv[0] arv[1]     arv[2]
+    // prog_name     -n  last_name  [--prefix]
+    //-----------------------------
+    // example:  prog_name -n Smith
+    //           prog_name -n Sm --prefix
+    if (argc != 3) {
+      usage(argv[0]);
+      exit_code = EXIT_FAIL_ARGS;
+      break;
+    }
+
+    rc = find_name(fd, argv[2], sdb_opts.prefix);
+    if (rc < 0)
+      exit_code = EXIT_FAIL_DB;
+    break;
+
   case 'p':
     //    arv[0] arv[1]
-    // prog_name     -p
+    // prog_name     -p  [--sort=lname]
     //-----------------
     // example:  prog_name -p
-    rc = print_db(fd);
+    //           prog_name -p --sort=lname --sort-mem=16
+    if (sdb_opts.sort == SDB_SORT_LNAME)
+      rc = print_sorted(fd);
+    else
+      rc = print_db(fd);
     if (rc < 0)
       exit_code = EXIT_FAIL_DB;
     break;
 
+  case 's':
+    //    arv[0] arv[1]
+    // prog_name     -s
+    //-----------------
+    // example:  prog_name -s
+    rc = gpa_stats(fd);
+    if (rc < 0)
+      exit_code = EXIT_FAIL_DB;
+    break;
+
+  case 't':
+    //    arv[0] arv[1]  arv[2]
+    // prog_name     -t       K  [--lowest]
+    //-----------------------
+    // example:  prog_name -t 50
+    //           prog_name -t 10 --lowest
+    if (argc != 3 || atoi(argv[2]) < 1) {
+      usage(argv[0]);
+      exit_code = EXIT_FAIL_ARGS;
+      break;
+    }
+
+    rc = gpa_top(fd, atoi(argv[2]), sdb_opts.lowest);
+    if (rc < 0)
+      exit_code = EXIT_FAIL_DB;
+    break;
+
+  case 'u':
+    //    arv[0] arv[1]  arv[2]        arv[3...]
+    // prog_name     -u      id  [--gpa N] [--lname X]
+    //-------------------------------------------------
+    // example:  prog_name -u 100 --gpa 355
+    //           prog_name -u 100 --gpa 355 --lname Smith
+    if (argc != 5 && argc != 7) {
+      usage(argv[0]);
+      exit_code = EXIT_FAIL_ARGS;
+      break;
+    }
+
+    id = atoi(argv[2]);
+    gpa = -1;
+    for (int i = 3; i < argc; i += 2) {
+      if (strcmp(argv[i], "--gpa") == 0 && gpa == -1 &&
+          atoi(argv[i + 1]) >= 0) {
+        gpa = atoi(argv[i + 1]);
+      } else if (strcmp(argv[i], "--lname") == 0 && lname == NULL &&
+                 *argv[i + 1] != '\0') {
+        lname = argv[i + 1];
+      } else {
+        exit_code = EXIT_FAIL_ARGS;
+      }
+    }
+    if (exit_code == EXIT_FAIL_ARGS) {
+      usage(argv[0]);
+      break;
+    }
+
+    exit_code = validate_range(fd, id, gpa == -1 ? MIN_STD_GPA : gpa);
+    if (exit_code == EXIT_FAIL_ARGS) {
+      printf(M_ERR_STD_RNG);
+      break;
+    }
+
+    rc = update_student(fd, id, gpa, lname);
+    if (rc < 0)
+      exit_code = EXIT_FAIL_DB;
+    break;
+
+  case 'U':
+    //   arv[0] arv[1]           arv[2]
+    // prog_name     -U  [updates.csv|-]
+    //----------------------------------
+    // example:  prog_name -U grades.csv
+    //           prog_name -U < grades.csv
+    if (argc > 3) {
+      usage(argv[0]);
+      exit_code = EXIT_FAIL_ARGS;
+      break;
+    }
+
+    if (argc == 3 && strcmp(argv[2], "-") != 0) {
+      FILE *in = fopen(argv[2], "r");
+
+      if (in == NULL) {
+        printf(M_ERR_UPDATE_OPEN, argv[2]);
+        exit_code = EXIT_FAIL_ARGS;
+        break;
+      }
+      rc = bulk_update(fd, in);
+      fclose(in);
+    } else {
+      rc = bulk_update(fd, stdin);
+    }
+
+    if (rc < 0)
+      exit_code = EXIT_FAIL_DB;
+    break;
+
+  case 'k':
+    //   arv[0]  arv[1]
+    // prog_name --fsck
+    //-----------------
+    // example:  prog_name --fsck -j 4
+    //
+    // -k lands here too, only the long form is an operation
+    if (argc != 2 || strcmp(argv[1], "--fsck") != 0) {
+      usage(argv[0]);
+      exit_code = EXIT_FAIL_ARGS;
+      break;
+    }
+
+    if (fsck_db(fd) != NO_ERROR)
+      exit_code = EXIT_FAIL_DB;
+    break;
+
   case 'x':
     //    arv[0] arv[1]
     // prog_name     -x
@@ -680,7 +1729,14 @@ int main(int argc, char *argv[]) {
     // example:  prog_name -x
 
     // remember compress_db returns a fd of the compressed database.
-    // we close it after this switch statement
+    // we close it after this switch statement.  Online compression works
+    // in place and keeps fd
+    if (sdb_opts.online) {
+      if (compress_db_online(fd) < 0)
+        exit_code = EXIT_FAIL_DB;
+      break;
+    }
+
     fd = compress_db(fd);
     if (fd < 0)
       exit_code = EXIT_FAIL_DB;
@@ -693,7 +1749,7 @@ int main(int argc, char *argv[]) {
     // example:  prog_name -x
     // HINT:  close the db file, we already have fd
     //       and reopen db indicating truncate=true
-    close(fd);
+    close_db(fd);
     fd = open_db(DB_FILE, true);
     if (fd < 0) {
       exit_code = EXIT_FAIL_DB;
@@ -709,6 +1765,7 @@ int main(int argc, char *argv[]) {
 
   // dont forget to close the file before exiting, and setting the
   // proper exit code - see the header file for expected values
-  close(fd);
+  if (close_db(fd) != NO_ERROR && exit_code == EXIT_OK)
+    exit_code = EXIT_FAIL_DB;
   exit(exit_code);
 }
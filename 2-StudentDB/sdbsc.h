@@ -1,18 +1,48 @@
 #ifndef __SDB_H__
+#define __SDB_H__
 
 #include "db.h" //get student record type
 
 //prototypes for functions go below for this assignment
 int open_db(char *dbFile, bool should_truncate);
+int close_db(int fd);
 int add_student(int fd, int id, char *fname, char *lname, int gpa);
 int get_student(int fd, int id, student_t *s);
 int del_student(int fd, int id);
+int update_student(int fd, int id, int gpa, const char *lname);
 int compress_db(int fd);
+int compress_db_online(int fd);
 void print_student(student_t *s);
-int validate_range(int id, int gpa);
+int validate_range(int fd, int id, int gpa);
 int count_db_records(int fd);
 int print_db(int fd);
 void usage(char *);
+int parse_opts(int *argc, char *argv[]);
+int parse_format(const char *name);
+
+//prototypes for bulk loading and updating, see sdb_bulk.c
+int bulk_load(int fd, FILE *in);
+int bulk_update(int fd, FILE *in);
+int import_db(int fd, FILE *in, int format);
+
+//prototypes for exporting, see sdb_export.c
+int export_db(int fd, int out, int format);
+
+//prototypes for checking page checksums, see sdb_fsck.c
+int fsck_db(int fd);
+
+//prototypes for looking up many ids at once, see sdb_find.c
+int find_students(int fd, const int *ids, int n);
+int find_file(int fd, FILE *in);
+int find_name(int fd, const char *name, bool prefix);
+
+//prototypes for GPA queries, see sdb_stats.c
+int gpa_range(int fd, int lo, int hi);
+int gpa_stats(int fd);
+int gpa_top(int fd, int k, bool lowest);
+
+//prototypes for printing in name order, see sdb_sort.c
+int print_sorted(int fd);
 
 //error codes to be returned from individual functions
 // NO_ERROR is returned if there are no errors
@@ -44,15 +74,48 @@ void usage(char *);
 #define M_ERR_DB_WRITE    "Error writing DB file, exiting!\n"
 #define M_ERR_DB_ADD_DUP  "Cant add student with ID=%d, already exists in db.\n"
 #define M_ERR_STD_PRINT   "Cant print student. Student is NULL or ID is zero\n"
+#define M_ERR_BULK_OPEN   "Error opening bulk load file %s, exiting!\n"
+#define M_ERR_BULK_READ   "Error reading bulk load input, nothing was added!\n"
+#define M_BULK_BAD_LINE   "Skipping line %d, expected id,first_name,last_name,gpa.\n"
+#define M_BULK_BAD_RANGE  "Skipping line %d, either ID or GPA out of allowable range!\n"
+#define M_BULK_DUP_INPUT  "Skipping line %d, ID=%d already appears earlier in the input.\n"
+#define M_ERR_UPDATE_OPEN "Error opening update file %s, exiting!\n"
+#define M_ERR_UPDATE_READ "Error reading update input, nothing was updated!\n"
+#define M_UPDATE_BAD_LINE "Skipping line %d, expected id,gpa or id,gpa,last_name.\n"
+#define M_IMPORT_BAD_JSON "Skipping line %d, expected a JSON object with id, fname, lname and gpa.\n"
+#define M_ERR_IMPORT_OPEN "Error opening import file %s, exiting!\n"
+#define M_ERR_IMPORT_READ "Error reading import input, exiting!\n"
+#define M_ERR_IMPORT_RAW  "Import input is not a sdbsc --export=raw file, nothing was imported!\n"
+#define M_ERR_EXPORT_OPEN "Error opening export file %s, exiting!\n"
+#define M_ERR_FIND_OPEN   "Error opening id list %s, exiting!\n"
+#define M_ERR_FIND_READ   "Error reading id list, exiting!\n"
+#define M_FIND_BAD_LINE   "Skipping line %d, expected a student id.\n"
+#define M_ERR_SERVE       "Error starting server, is sdbsc --serve already running?\n"
+#define M_NAME_NOT_FND    "No student with last name %s was found in database.\n"
+#define M_ERR_CONNECT     "Error connecting to sdbsc --serve for %s, exiting!\n"
+#define M_ERR_FSCK_NO_SUMS "Database has no current page checksums, open it with a writable sdbsc first!\n"
 
 #define M_STD_ADDED       "Student %d added to database.\n"
 #define M_STD_DEL_MSG     "Student %d was deleted from database.\n"
 #define M_STD_NOT_FND_MSG "Student %d was not found in database.\n"
+#define M_STD_UPDATED     "Student %d was updated in database.\n"
 #define M_DB_COMPRESSED_OK "Database successfully compressed!\n"
 #define M_DB_ZERO_OK      "All database records removed!\n"
 #define M_DB_EMPTY        "Database contains no student records.\n"
 #define M_DB_RECORD_CNT   "Database contains %d student record(s).\n"
 #define M_NOT_IMPL        "The requested operation is not implemented yet!\n"
+#define M_GPA_NONE        "No student with a GPA from %.2f to %.2f was found in database.\n"
+#define M_STATS_COUNT     "Students:  %lld\n"
+#define M_STATS_GPA       "GPA min %.2f, max %.2f, mean %.2f\n"
+#define M_STATS_HIST      "  %.2f-%.2f %8lld  "
+#define M_SERVE_START     "Serving %s on %s.\n"
+#define M_BULK_SUMMARY    "Bulk load: %d line(s) read, %d student(s) added, %d duplicate(s), %d invalid.\n"
+#define M_UPDATE_SUMMARY  "Bulk update: %d line(s) read, %d student(s) updated, %d not found, %d duplicate(s), %d invalid.\n"
+#define M_FSCK_BAD_IDS    "Corrupt page(s) %lld-%lld: student ids %d to %d.\n"
+#define M_FSCK_BAD_META   "Corrupt page(s) %lld-%lld: %s.\n"
+#define M_FSCK_BAD_BUCKETS "Corrupt page(s) %lld-%lld: hash buckets %d to %d.\n"
+#define M_FSCK_SUMMARY    "Fsck: %lld page(s) checked with %d thread(s), %lld corrupt.\n"
+#define M_IMPORT_SUMMARY  "Import: %d record(s) read, %d student(s) added, %d duplicate(s), %d invalid.\n"
 
 //useful format strings for print students
 //For example to print the header in the required output:
@@ -2,10 +2,9 @@
 
 # The setup function runs before every test
 setup_file() {
-  # Delete the student.db file if it exists
-  if [ -f "student.db" ]; then
-    rm "student.db"
-  fi
+  # Delete the student.db file and its sidecars (student.db.bm,
+  # student.db.wal, ...) if they exist, so no run depends on the last one
+  rm -f student.db student.db.*
 }
 
 @test "Check if database is empty to start" {
@@ -181,9 +180,10 @@ setup_file() {
   run du -h ./student.db
   [ "$status" -eq 0 ]
   #note du -h puts a tab between the 2 fields need to match on that
-  [ "$output" = "12K$(echo -e '\t')./student.db" ] || {
+  #deleting 64 emptied its block, so the block was given back
+  [ "$output" = "8.0K$(echo -e '\t')./student.db" ] || {
     echo "Failed Output:  $output"
-    echo "12K     ./student.db"
+    echo "8.0K     ./student.db"
     return 1
   }
 }
@@ -197,13 +197,13 @@ setup_file() {
   }
 }
 
-@test "One block should be gone" {
+@test "Compressed db should be down to 1 block" {
   run du -h ./student.db
   [ "$status" -eq 0 ]
   #note du -h puts a tab between the 2 fields need to match on that
-  [ "$output" = "8.0K$(echo -e '\t')./student.db" ] || {
+  [ "$output" = "4.0K$(echo -e '\t')./student.db" ] || {
     echo "Failed Output:  $output"
-    echo "8.0K     ./student.db"
+    echo "4.0K     ./student.db"
     return 1
   }
 }
@@ -236,3 +236,212 @@ setup_file() {
     return 1
   }
 }
+
+@test "Bulk load students from stdin" {
+  run bash -c "printf 'id,first,last,gpa\n200,ann,lee,310\n201,bob,kim,295\n3,dup,doe,100\n' | ./sdbsc -B"
+  [ "$status" -eq 1 ]
+  [ "${lines[0]}" = "Cant add student with ID=3, already exists in db." ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+  [ "${lines[1]}" = "Bulk load: 3 line(s) read, 2 student(s) added, 1 duplicate(s), 0 invalid." ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}
+
+@test "Compress db online" {
+  run ./sdbsc -d 201
+  [ "$status" -eq 0 ]
+  run ./sdbsc -x --online
+  [ "$status" -eq 0 ]
+  [ "${lines[0]}" = "Database successfully compressed!" ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+  run stat -c %s ./student.db
+  [ "$output" = "12864" ] || {
+    echo "Failed Output:  $output"
+    echo "12864"
+    return 1
+  }
+}
+
+@test "Parallel print matches serial print" {
+  run bash -c "./sdbsc -p > serial.out && ./sdbsc -p -j 4 | diff serial.out -"
+  rm -f serial.out
+  [ "$status" -eq 0 ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}
+
+@test "Client mode matches local print" {
+  ./sdbsc --serve > /dev/null &
+  server=$!
+  while [ ! -S student.db.sock ]; do sleep 0.1; done
+  run bash -c "./sdbsc -p > local.out && ./sdbsc -p --client | diff local.out -"
+  kill $server
+  wait $server
+  rm -f local.out
+  [ "$status" -eq 0 ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}
+
+@test "Client mutations that arrive together all commit" {
+  run bash -c "d=\$(mktemp -d) && cp sdbsc \$d && cd \$d && { ./sdbsc --serve > /dev/null & } && while [ ! -S student.db.sock ]; do sleep 0.1; done && for i in \$(seq 1 40); do ./sdbsc --client -a \$i first one 300 > /dev/null & done; wait \$(jobs -p | tail -n +2); for i in \$(seq 1 20); do ./sdbsc --client -d \$i > /dev/null & done; wait \$(jobs -p | tail -n +2); ./sdbsc --client -c; kill %1; wait %1; ./sdbsc -c && ./sdbsc -p | tail -1 | cut -d' ' -f1 && ./sdbsc --fsck; rc=\$?; cd / && rm -rf \$d; exit \$rc"
+  [ "$status" -eq 0 ]
+  [ "${lines[0]}" = "Database contains 20 student record(s)." ]
+  [ "${lines[1]}" = "Database contains 20 student record(s)." ]
+  [ "${lines[2]}" = "40" ]
+  [ "${lines[3]}" = "Fsck: 1 page(s) checked with 1 thread(s), 0 corrupt." ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}
+
+@test "Find many students in request order" {
+  run bash -c "printf '3\n999\n1\n3\n' | ./sdbsc -F -"
+  [ "$status" -eq 1 ]
+  [ "${lines[0]}" = "ID     FIRST NAME               LAST_NAME                        GPA" ]
+  [ "${lines[1]%% *}" = "3" ]
+  [ "${lines[2]}" = "Student 999 was not found in database." ]
+  [ "${lines[3]%% *}" = "1" ]
+  [ "${lines[4]%% *}" = "3" ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}
+
+@test "io_uring engine reads what it wrote" {
+  run bash -c "printf '500,ann,lee,310\n501,bob,lee,290\n' | ./sdbsc --io=uring -B - && ./sdbsc --io=uring -f 501 500 | diff - <(./sdbsc --io=rw -f 501 500)"
+  [ "$status" -eq 0 ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}
+
+@test "Find students by last name and prefix" {
+  run bash -c "./sdbsc -a 502 cal leeds 300 && ./sdbsc -n lee && ./sdbsc -n lee --prefix"
+  [ "$status" -eq 0 ]
+  [ "${lines[2]%% *}" = "200" ]
+  [ "${lines[4]%% *}" = "501" ]
+  [ "${lines[5]:0:3}" = "ID " ]
+  [ "${lines[9]%% *}" = "502" ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}
+
+@test "GPA range and statistics" {
+  run bash -c "./sdbsc -g 290 310 | tail -n +2 | cut -d' ' -f1 | sort -n | tr '\n' ' ' && echo && ./sdbsc -s | head -2"
+  [ "$status" -eq 0 ]
+  [ "${lines[0]}" = "200 500 501 502 " ]
+  [ "${lines[1]%% *}" = "Students:" ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}
+
+@test "GPA column stays in sync with deletes" {
+  run bash -c "./sdbsc -s > /dev/null && ./sdbsc -d 502 && ./sdbsc -s > col.out && rm -f student.db.col && ./sdbsc -s | diff col.out - && ./sdbsc -g 290 310 | tail -n +2 | wc -l"
+  rm -f col.out
+  [ "$status" -eq 0 ]
+  [ "${lines[1]}" = "3" ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}
+
+@test "Top K students by GPA" {
+  run bash -c "./sdbsc -t 2 && ./sdbsc -t 1 --lowest"
+  [ "$status" -eq 0 ]
+  [ "${lines[1]%% *}" = "200" ]
+  [ "${lines[2]%% *}" = "500" ]
+  [ "${lines[4]%% *}" = "63" ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}
+
+@test "Hashed layout takes large ids" {
+  run bash -c "d=\$(mktemp -d) && cp sdbsc \$d && cd \$d && ./sdbsc -z --hash > /dev/null && ./sdbsc -a 123456789 big id 350 && ./sdbsc -a 7 small id 300 > /dev/null && ./sdbsc -f 123456789 | tail -1 | cut -d' ' -f1 && ./sdbsc -d 7 && ./sdbsc -c; rc=\$?; rm -rf \$d; exit \$rc"
+  [ "$status" -eq 0 ]
+  [ "${lines[0]}" = "Student 123456789 added to database." ]
+  [ "${lines[1]}" = "123456789" ]
+  [ "${lines[2]}" = "Student 7 was deleted from database." ]
+  [ "${lines[3]}" = "Database contains 1 student record(s)." ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}
+
+@test "Update a GPA and last name in place" {
+  run bash -c "./sdbsc -u 200 --gpa 123 && ./sdbsc -f 200 | tail -1 && printf '500,,Renamed\n' | ./sdbsc -U - && ./sdbsc -n Renamed | tail -1"
+  [ "$status" -eq 0 ]
+  [ "${lines[0]}" = "Student 200 was updated in database." ]
+  [ "${lines[1]%% *}" = "200" ]
+  [ "${lines[1]##* }" = "1.23" ]
+  [ "${lines[3]%% *}" = "500" ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}
+
+@test "Print sorted by last name" {
+  run bash -c "./sdbsc -p --sort=lname --sort-mem=1 | tail -n +2 > sorted.out && ./sdbsc -p | tail -n +2 | LC_ALL=C sort -b -k3,3 -k2,2 -k1,1n | diff sorted.out - && wc -l < sorted.out"
+  rm -f sorted.out
+  [ "$status" -eq 0 ]
+  [ "${lines[0]}" -gt 1 ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}
+
+@test "Export and import round trip" {
+  run bash -c "./sdbsc -c | cut -d' ' -f3 && ./sdbsc -p > before.out && ./sdbsc --export=jsonl students.jsonl && ./sdbsc --export=raw > students.raw && ./sdbsc -z > /dev/null && ./sdbsc --import=jsonl students.jsonl | tail -1 && ./sdbsc -p | diff before.out - && ./sdbsc -z > /dev/null && ./sdbsc --import=raw < students.raw > /dev/null && ./sdbsc --export=csv | head -1"
+  rm -f before.out students.jsonl students.raw
+  [ "$status" -eq 0 ]
+  [ "${lines[1]%%,*}" = "Import: ${lines[0]} record(s) read" ]
+  [ "${lines[2]%%,*}" = "1" ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}
+
+@test "Fsck finds a corrupt page" {
+  run bash -c "d=\$(mktemp -d) && cp sdbsc \$d && cd \$d && ./sdbsc -a 1 first one 300 > /dev/null && ./sdbsc -a 100 second one 310 > /dev/null && ./sdbsc --fsck -j 2 && printf 'X' | dd of=student.db bs=1 seek=6408 conv=notrunc 2> /dev/null && { ./sdbsc -f 100 || echo failed; } && ./sdbsc --fsck -j 2; rc=\$?; rm -rf \$d; exit \$rc"
+  [ "$status" -eq 1 ]
+  [ "${lines[0]}" = "Fsck: 2 page(s) checked with 2 thread(s), 0 corrupt." ]
+  [ "${lines[1]}" = "Error reading DB file, exiting!" ]
+  [ "${lines[2]}" = "failed" ]
+  [ "${lines[3]}" = "Corrupt page(s) 1-1: student ids 64 to 127." ]
+  [ "${lines[4]}" = "Fsck: 2 page(s) checked with 2 thread(s), 1 corrupt." ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}
+
+@test "Open replays a committed log record" {
+  run bash -c "d=\$(mktemp -d) && cp sdbsc \$d && cd \$d && ./sdbsc -a 1 first one 300 > /dev/null && mkdir before && cp student.db* before && ./sdbsc -a 2 second two 310 > /dev/null && cp student.db.wal before && cp before/* . && ./sdbsc -f 2 | tail -1 | cut -d' ' -f1 && ./sdbsc -c && ./sdbsc --fsck; rc=\$?; rm -rf \$d; exit \$rc"
+  [ "$status" -eq 0 ]
+  [ "${lines[0]}" = "2" ]
+  [ "${lines[1]}" = "Database contains 2 student record(s)." ]
+  [ "${lines[2]}" = "Fsck: 1 page(s) checked with 1 thread(s), 0 corrupt." ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}
+
+@test "Failed log write leaves a readable database" {
+  run bash -c "d=\$(mktemp -d) && cp sdbsc \$d && cd \$d && for i in 1 2 3; do ./sdbsc -a \$i first one 300 > /dev/null; done && (ulimit -f 1; trap '' XFSZ; ./sdbsc -a 4 second two 310) ; ./sdbsc -p | tail -1 | cut -d' ' -f1 && ./sdbsc --fsck; rc=\$?; rm -rf \$d; exit \$rc"
+  [ "$status" -eq 0 ]
+  [ "${lines[0]}" = "Error writing DB file, exiting!" ]
+  [ "${lines[1]}" = "3" ]
+  [ "${lines[2]}" = "Fsck: 1 page(s) checked with 1 thread(s), 0 corrupt." ] || {
+    echo "Failed Output:  $output"
+    return 1
+  }
+}